@@ -93,6 +93,7 @@ void ImageWeightedMean<dataType>::process()
         for (int j=0; j<int(_output_image_sptr->get_raw_nifti_sptr()->nvox); j++)
             // Add in the weighted contribution of the jth voxel of the ith image
             (*_output_image_sptr)(j) += (*_input_image_sptrs[i])(j) * normalised_weights[i];
+    _output_image_sptr->mark_modified();
 
     // Once the processing is done, set the need_to_update flag to false
     _need_to_update = false;
@@ -42,6 +42,8 @@ limitations under the License.
 #include <iomanip>
 #include <cmath>
 #include <numeric>
+#include <limits>
+#include <algorithm>
 
 // Remove NiftyReg's definition of isnan
 #undef isnan
@@ -69,6 +71,7 @@ NiftiImageData<dataType>::NiftiImageData(const NiftiImageData<dataType>& to_copy
 template<class dataType>
 NiftiImageData<dataType>& NiftiImageData<dataType>::operator=(const NiftiImageData<dataType>& to_copy)
 {
+    this->mark_modified();
     *this = dynamic_cast<const ImageData&>(to_copy);
     return *this;
 }
@@ -82,6 +85,7 @@ NiftiImageData<dataType>::NiftiImageData(const ImageData& to_copy)
 template<class dataType>
 NiftiImageData<dataType>& NiftiImageData<dataType>::operator=(const ImageData& to_copy)
 {
+    this->mark_modified();
     // Check for self-assignment
     if (this != &to_copy) {
         // Try to cast to NiftiImageData.
@@ -489,6 +493,7 @@ unsigned NiftiImageData<dataType>::get_nan_count() const
 template<class dataType>
 void NiftiImageData<dataType>::fill(const float v)
 {
+    this->mark_modified();
     if(!this->is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::fill(): Image not initialised.");
 
@@ -499,6 +504,7 @@ void NiftiImageData<dataType>::fill(const float v)
 template<class dataType>
 void NiftiImageData<dataType>::fill(const dataType *v)
 {
+    this->mark_modified();
     if(!this->is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::fill(): Image not initialised.");
 
@@ -510,6 +516,7 @@ void NiftiImageData<dataType>::fill(const dataType *v)
 template<class dataType>
 void NiftiImageData<dataType>::fill(const NiftiImageData &im)
 {
+    this->mark_modified();
     if(!im.is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::fill(): Argument image not initialised.");
 
@@ -602,6 +609,7 @@ void NiftiImageData<dataType>::check_dimensions(const NiftiImageDataType image_t
 template<class dataType>
 void NiftiImageData<dataType>::maths(const NiftiImageData<dataType>& c, const MathsType type)
 {
+    this->mark_modified();
     if (!this->is_initialised() || !c.is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::maths_image: at least one image is not initialised.");
     if (!NiftiImageData<dataType>::do_nifti_image_metadata_match(*this, c, true))
@@ -624,6 +632,7 @@ void NiftiImageData<dataType>::maths(const NiftiImageData<dataType>& c, const Ma
 template<class dataType>
 void NiftiImageData<dataType>::maths(const float val, const MathsType type)
 {
+    this->mark_modified();
     if (!this->is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::maths_image_val: image is not initialised.");
     if (type != add && type != sub && type != mul && type != div)
@@ -692,6 +701,7 @@ void NiftiImageData<dataType>::copy_nifti_image(std::shared_ptr<nifti_image> &ou
 template<class dataType>
 void NiftiImageData<dataType>::normalise_zero_and_one()
 {
+    this->mark_modified();
     dataType max = this->get_max();
     dataType min = this->get_min();
     // im = (im-min) / (max-min)
@@ -702,6 +712,7 @@ void NiftiImageData<dataType>::normalise_zero_and_one()
 template<class dataType>
 void NiftiImageData<dataType>::standardise()
 {
+    this->mark_modified();
     dataType mean = this->get_mean();
     dataType std  = this->get_standard_deviation();
     for (size_t i=0; i<this->get_num_voxels(); ++i)
@@ -745,6 +756,7 @@ void NiftiImageData<dataType>::print_headers(const std::vector<const NiftiImageD
 template<class dataType>
 void NiftiImageData<dataType>::crop(const int min_index[7], const int max_index[7])
 {
+    this->mark_modified();
     if(!this->is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::crop: Image not initialised.");
 
@@ -865,6 +877,7 @@ void NiftiImageData<dataType>::crop(const int min_index[7], const int max_index[
 template<class dataType>
 void NiftiImageData<dataType>::pad(const int min_index[7], const int max_index[7], const dataType val)
 {
+    this->mark_modified();
     if(!this->is_initialised())
         throw std::runtime_error("NiftiImageData<dataType>::crop: Image not initialised.");
 
@@ -1427,6 +1440,7 @@ std::string NiftiImageData<dataType>::get_nifti_element(const std::vector<const
 template<class dataType>
 void NiftiImageData<dataType>::set_voxel_spacing(const float new_spacing[3], const int interpolation_order)
 {
+    this->mark_modified();
 #ifndef NDEBUG
     std::cout << "\nResampling image from voxel sizes of (" << _nifti_image->dx << ", " << _nifti_image->dy << ", " << _nifti_image->dz << ") to "
                  "(" << new_spacing[0] << ", " << new_spacing[1] << ", " << new_spacing[2] << ")\n";
@@ -1540,32 +1554,22 @@ void NiftiImageData<dataType>::set_voxel_spacing(const float new_spacing[3], con
     def->data = static_cast<void *>(calloc(def->nvox,size_t(def->nbyper)));
     // Fill the deformation field with an identity transformation
     reg_getDeformationFromDisplacement(def);
-    // Allocate and compute the Jacobian matrices
-    mat33 *jacobian = static_cast<mat33 *>(malloc(size_t(def->nx * def->ny * def->nz) * sizeof(mat33)));
-    for(size_t i=0;i<size_t(def->nx*def->ny*def->nz);++i)
-        reg_mat33_eye(&jacobian[i]);
-
-    if((newImg->pixdim[1]>oldImg->pixdim[1] ||
-            newImg->pixdim[2]>oldImg->pixdim[2] ||
-            newImg->pixdim[3]>oldImg->pixdim[3]) && interpolation_order != 0) {
-        reg_resampleImage_PSF(oldImg,
-                              newImg,
-                              def,
-                              NULL,
-                              interpolation_order,
-                              0.f,
-                              jacobian,
-                              0);
+    // If downsampling, smooth first to avoid aliasing. The Gaussian's FWHM is chosen such that
+    // convolving it with the old voxel size gives the new one.
+    if(interpolation_order != 0) {
+        std::array<float,3> sigma = {0.f, 0.f, 0.f};
+        for (int i=0; i<3; ++i)
+            if (oldImg->dim[i+1] > 1 && newImg->pixdim[i+1] > oldImg->pixdim[i+1])
+                sigma[i] = std::sqrt(newImg->pixdim[i+1]*newImg->pixdim[i+1] - oldImg->pixdim[i+1]*oldImg->pixdim[i+1]) / 2.35482f;
+        if (sigma[0] > 0.f || sigma[1] > 0.f || sigma[2] > 0.f)
+            old.kernel_convolution(sigma, GAUSSIAN_KERNEL);
     }
-    else{
-        reg_resampleImage(oldImg,
-                          newImg,
-                          def,
-                          NULL,
-                          interpolation_order,
-                          0.f);
-    }
-    free(jacobian);
+    reg_resampleImage(oldImg,
+                      newImg,
+                      def,
+                      NULL,
+                      interpolation_order,
+                      0.f);
     nifti_image_free(def);
 
     // Store the data and update geom info
@@ -1573,17 +1577,179 @@ void NiftiImageData<dataType>::set_voxel_spacing(const float new_spacing[3], con
     set_up_geom_info();
 }
 
+/// Get the 1D kernel for a given sigma (in voxels). Kernel widths are as per NiftyReg. Empty if radius is 0.
+static std::vector<float> get_convolution_kernel(const float sigma, const NREG_CONV_KERNEL_TYPE conv_type)
+{
+    int radius;
+    switch (conv_type) {
+    case MEAN_KERNEL:
+    case LINEAR_KERNEL:
+        radius = int(sigma);
+        break;
+    case GAUSSIAN_KERNEL:
+        radius = int(sigma*3.f);
+        break;
+    case CUBIC_SPLINE_KERNEL:
+        radius = int(sigma*2.f);
+        break;
+    default:
+        throw std::runtime_error("NiftiImageData<dataType>::kernel_convolution: Unknown kernel type.");
+    }
+
+    std::vector<float> kernel;
+    if (radius <= 0)
+        return kernel;
+
+    kernel.resize(size_t(2*radius+1));
+    float sum = 0.f;
+    for (int i=-radius; i<=radius; ++i) {
+        const float rel = std::abs(float(i)) / sigma;
+        float value = 1.f;
+        if (conv_type == GAUSSIAN_KERNEL)
+            value = std::exp(-0.5f*rel*rel);
+        else if (conv_type == LINEAR_KERNEL)
+            value = std::max(1.f - std::abs(float(i))/float(radius), 0.f);
+        else if (conv_type == CUBIC_SPLINE_KERNEL) {
+            if (rel < 1.f)
+                value = 2.f/3.f - rel*rel + 0.5f*rel*rel*rel;
+            else if (rel < 2.f)
+                value = -(rel-2.f)*(rel-2.f)*(rel-2.f)/6.f;
+            else
+                value = 0.f;
+        }
+        kernel[size_t(i+radius)] = value;
+        sum += value;
+    }
+    for (size_t i=0; i<kernel.size(); ++i)
+        kernel[i] /= sum;
+    return kernel;
+}
+
+/// Convolve a block of lines (stored as [n][width]) along n.
+/// If normalise, weights falling outside of the line are ignored and the rest renormalised.
+static void convolve_line_block(float * const out, const float * const in, const int n, const int width,
+                                const std::vector<float> &kernel, const bool normalise)
+{
+    const int radius = int(kernel.size()) / 2;
+    for (int i=0; i<n; ++i) {
+        const int k_min = std::max(-radius, -i);
+        const int k_max = std::min(radius, n-1-i);
+        float * const out_i = out + size_t(i)*size_t(width);
+        std::fill(out_i, out_i+width, 0.f);
+        float weight_sum = 0.f;
+        for (int k=k_min; k<=k_max; ++k) {
+            const float w = kernel[size_t(k+radius)];
+            const float * const in_k = in + size_t(i+k)*size_t(width);
+            for (int b=0; b<width; ++b)
+                out_i[b] += w * in_k[b];
+            weight_sum += w;
+        }
+        if (normalise && (k_min != -radius || k_max != radius) && weight_sum > 0.f)
+            for (int b=0; b<width; ++b)
+                out_i[b] /= weight_sum;
+    }
+}
+
+/// Convolve all volumes along a given axis, in place.
+static void convolve_along_axis(float * const data, const int dims[3], const size_t num_vols, const int axis,
+                                const std::vector<float> &kernel, const bool normalise)
+{
+    const size_t nx = size_t(dims[0]);
+    const size_t ny = size_t(dims[1]);
+    const size_t nz = size_t(dims[2]);
+    const int n = dims[axis];
+
+    // Lines along x are contiguous. Along y and z, neighbouring lines are filtered together
+    // in tiles, so that memory is read in contiguous runs of tile_width values.
+    const size_t tile_width = axis == 0 ? 1 : std::min(nx, size_t(32));
+    const size_t num_tiles = axis == 0 ? 1 : (nx + tile_width - 1) / tile_width;
+    const size_t step      = axis == 0 ? 1     : axis == 1 ? nx    : nx*ny;
+    const size_t num_lines = axis == 0 ? ny*nz : axis == 1 ? nz    : ny;
+    const size_t line_step = axis == 0 ? nx    : axis == 1 ? nx*ny : nx;
+    const long long num_items = (long long)(num_vols * num_lines * num_tiles);
+
+#pragma omp parallel
+    {
+        std::vector<float> in(size_t(n)*tile_width), out(size_t(n)*tile_width);
+#pragma omp for schedule(static)
+        for (long long item=0; item<num_items; ++item) {
+            const size_t tile = size_t(item) % num_tiles;
+            const size_t line = (size_t(item) / num_tiles) % num_lines;
+            const size_t vol  = size_t(item) / (num_tiles * num_lines);
+            const size_t x0 = tile*tile_width;
+            const int width = int(std::min(tile_width, nx - x0));
+            float * const base = data + vol*nx*ny*nz + line*line_step + x0;
+
+            for (int i=0; i<n; ++i)
+                std::copy(base + size_t(i)*step, base + size_t(i)*step + width, in.begin() + size_t(i*width));
+            convolve_line_block(out.data(), in.data(), n, width, kernel, normalise);
+            for (int i=0; i<n; ++i)
+                std::copy(out.begin() + size_t(i*width), out.begin() + size_t((i+1)*width), base + size_t(i)*step);
+        }
+    }
+}
+
+/// Separable convolution of all volumes, in place. NaNs are ignored (as per NiftyReg).
+static void separable_convolution(float * const data, const int dims[3], const size_t num_vols, const std::vector<float> kernels[3])
+{
+    const long long num_vox = (long long)(size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]) * num_vols);
+
+    bool contains_nans = false;
+#pragma omp parallel for reduction(||:contains_nans)
+    for (long long i=0; i<num_vox; ++i)
+        if (std::isnan(data[i]))
+            contains_nans = true;
+
+    if (!contains_nans) {
+        for (int axis=0; axis<3; ++axis)
+            if (!kernels[axis].empty())
+                convolve_along_axis(data, dims, num_vols, axis, kernels[axis], true);
+        return;
+    }
+
+    // Convolve the image (with NaNs set to 0) and the density of valid voxels, then divide
+    std::vector<float> density(size_t(num_vox), 1.f);
+    for (long long i=0; i<num_vox; ++i)
+        if (std::isnan(data[i])) {
+            data[i] = 0.f;
+            density[size_t(i)] = 0.f;
+        }
+    for (int axis=0; axis<3; ++axis)
+        if (!kernels[axis].empty()) {
+            convolve_along_axis(data,           dims, num_vols, axis, kernels[axis], false);
+            convolve_along_axis(density.data(), dims, num_vols, axis, kernels[axis], false);
+        }
+#pragma omp parallel for
+    for (long long i=0; i<num_vox; ++i)
+        data[i] = density[size_t(i)] > 0.f ? data[i] / density[size_t(i)] : std::numeric_limits<float>::quiet_NaN();
+}
+
 template<class dataType>
 void NiftiImageData<dataType>::kernel_convolution(const float sigma, NREG_CONV_KERNEL_TYPE conv_type)
 {
+    kernel_convolution(std::array<float,3>{sigma, sigma, sigma}, conv_type);
+}
+
+template<class dataType>
+void NiftiImageData<dataType>::kernel_convolution(const std::array<float,3> &sigma, NREG_CONV_KERNEL_TYPE conv_type)
+{
+    this->mark_modified();
     // Check image has been initialised
     if(!this->is_initialised())
-        throw std::runtime_error("NiftiImageData<dataType>::set_voxel_spacing: Image not initialised.");
+        throw std::runtime_error("NiftiImageData<dataType>::kernel_convolution: Image not initialised.");
+
+    const int dims[3] = { _nifti_image->nx, _nifti_image->ny, _nifti_image->nz };
+    std::vector<float> kernels[3];
+    for (int i=0; i<3; ++i) {
+        if (dims[i] <= 1)
+            continue;
+        // As per NiftyReg, positive sigma is in mm, negative in voxels
+        const float sigma_vox = sigma[i] > 0.f ? sigma[i] / _nifti_image->pixdim[i+1] : std::abs(sigma[i]);
+        kernels[i] = get_convolution_kernel(sigma_vox, conv_type);
+    }
 
-    float *sigma_t=new float[_nifti_image->nt];
-    for(int i=0; i<_nifti_image->nt; ++i) sigma_t[i]=sigma; //-0.7355f?
-    reg_tools_kernelConvolution(_nifti_image.get(),sigma_t,conv_type);
-    delete[] sigma_t;
+    const size_t num_vols = size_t(_nifti_image->nvox) / (size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]));
+    separable_convolution(_data, dims, num_vols, kernels);
 }
 
 enum FlipOrMirror {
@@ -1753,6 +1919,7 @@ void NiftiImageData<dataType>::axpby(
     const void* ptr_a, const DataContainer& a_x,
     const void* ptr_b, const DataContainer& a_y)
 {
+    this->mark_modified();
     const float a = *static_cast<const float*>(ptr_a);
     const float b = *static_cast<const float*>(ptr_b);
     const NiftiImageData<dataType>& x = dynamic_cast<const NiftiImageData<dataType>&>(a_x);
@@ -1774,6 +1941,7 @@ void NiftiImageData<dataType>::xapyb(
     const DataContainer& a_x, const void* ptr_a,
     const DataContainer& a_y, const void* ptr_b)
 {
+    this->mark_modified();
 	NiftiImageData<dataType>::axpby(ptr_a, a_x, ptr_b, a_y);
 }
 
@@ -1782,6 +1950,7 @@ void NiftiImageData<dataType>::xapyb(
     const DataContainer& a_x, const DataContainer& a_a,
     const DataContainer& a_y, const DataContainer& a_b)
 {
+    this->mark_modified();
     try{
         auto& a = dynamic_cast<const NiftiImageData<dataType>&>(a_a);
         auto& b = dynamic_cast<const NiftiImageData<dataType>&>(a_b);
@@ -1819,6 +1988,7 @@ template<class dataType>
 void NiftiImageData<dataType>::multiply
     (const DataContainer& a_x, const DataContainer& a_y)
 {
+    this->mark_modified();
     const NiftiImageData<dataType>& x = dynamic_cast<const NiftiImageData<dataType>&>(a_x);
     const NiftiImageData<dataType>& y = dynamic_cast<const NiftiImageData<dataType>&>(a_y);
 
@@ -1837,6 +2007,7 @@ template<class dataType>
 void NiftiImageData<dataType>::divide
     (const DataContainer& a_x, const DataContainer& a_y)
 {
+    this->mark_modified();
     const NiftiImageData<dataType>& x = dynamic_cast<const NiftiImageData<dataType>&>(a_x);
     const NiftiImageData<dataType>& y = dynamic_cast<const NiftiImageData<dataType>&>(a_y);
 
@@ -1858,6 +2029,7 @@ template<class dataType>
 void NiftiImageData<dataType>::maximum
 (const DataContainer& a_x, const DataContainer& a_y)
 {
+    this->mark_modified();
 	const NiftiImageData<dataType>& x = dynamic_cast<const NiftiImageData<dataType>&>(a_x);
 	const NiftiImageData<dataType>& y = dynamic_cast<const NiftiImageData<dataType>&>(a_y);
 
@@ -1876,6 +2048,7 @@ template<class dataType>
 void NiftiImageData<dataType>::minimum
 (const DataContainer& a_x, const DataContainer& a_y)
 {
+    this->mark_modified();
 	const NiftiImageData<dataType>& x = dynamic_cast<const NiftiImageData<dataType>&>(a_x);
 	const NiftiImageData<dataType>& y = dynamic_cast<const NiftiImageData<dataType>&>(a_y);
 
@@ -29,6 +29,7 @@ limitations under the License.
 
 #include "sirf/Reg/NiftiImageData3DDeformation.h"
 #include "sirf/Reg/Transformation.h"
+#include "sirf/Reg/AffineTransformation.h"
 #include "sirf/Reg/NiftiImageData3DDisplacement.h"
 #include <_reg_globalTrans.h>
 #include <sstream>
@@ -98,10 +99,27 @@ NiftiImageData3DDeformation<dataType> NiftiImageData3DDeformation<dataType>::com
     if (transformations.size() == 0)
         throw std::runtime_error("NiftiImageData3DDeformation::compose_single_deformation no transformations given.");
 
-    NiftiImageData3DDeformation def = transformations.at(0)->get_as_deformation_field(ref);
+    // Consecutive affine transformations are multiplied together, which is exact
+    // and saves converting each of them to a deformation field and composing.
+    std::vector<std::shared_ptr<const Transformation<dataType> > > collapsed_affines;
+    std::vector<const Transformation<dataType>*> vec;
+    for (unsigned i=0; i<transformations.size(); ++i) {
+        const AffineTransformation<dataType> *affine_ptr =
+                dynamic_cast<const AffineTransformation<dataType>*>(transformations.at(i));
+        const AffineTransformation<dataType> *prev_affine_ptr = vec.empty() ? nullptr :
+                dynamic_cast<const AffineTransformation<dataType>*>(vec.back());
+        if (affine_ptr && prev_affine_ptr) {
+            collapsed_affines.push_back(std::make_shared<const AffineTransformation<dataType> >(*affine_ptr * *prev_affine_ptr));
+            vec.back() = collapsed_affines.back().get();
+        }
+        else
+            vec.push_back(transformations.at(i));
+    }
+
+    NiftiImageData3DDeformation def = vec.at(0)->get_as_deformation_field(ref);
 
-    for (unsigned i=1; i<transformations.size(); ++i) {
-        NiftiImageData3DDeformation temp = transformations.at(i)->get_as_deformation_field(ref, false);
+    for (unsigned i=1; i<vec.size(); ++i) {
+        NiftiImageData3DDeformation temp = vec.at(i)->get_as_deformation_field(ref, false);
         reg_defField_compose(temp.get_raw_nifti_sptr().get(),def.get_raw_nifti_sptr().get(),nullptr);
     }
     return def;
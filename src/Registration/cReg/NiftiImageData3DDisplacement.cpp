@@ -158,6 +158,7 @@ NiftiImageData3DDisplacement<dataType>::get_inverse_impl_vtk(const std::shared_p
             for (idx[2]=0; idx[2]<dims[3]; ++idx[2])
                 for (idx[4]=0; idx[4]<dims[5]; ++idx[4])// t is 3, skip to 4 for tensor component
                     (*output_ptr)(idx) = inverse_image->GetScalarComponentAsFloat(idx[0],idx[1],idx[2],idx[4]);
+    output_ptr->mark_modified();
 
     return output_ptr;
 #endif
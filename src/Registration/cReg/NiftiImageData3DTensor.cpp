@@ -213,6 +213,7 @@ tensor_component_maths(
         else if (maths_type == NiftiImageData<dataType>::add)
             (*this)(i+tensor_index_offset) += (*nii_scalar_im_sptr)(i);
     }
+    this->mark_modified();
 }
 
 template<class dataType>
@@ -34,6 +34,9 @@ limitations under the License.
 #include "sirf/Reg/NiftiImageData3DDeformation.h"
 #include "sirf/Reg/NiftiImageData3DDisplacement.h"
 #include <_reg_aladin_sym.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace sirf;
 
@@ -46,71 +49,111 @@ void NiftyAladinSym<dataType>::process()
     // Convert the input images from ImageData to NiftiImageData3D
     this->set_up_inputs();
 
-    // Annoyingly NiftyReg doesn't mark ref and floating images as const, so need to copy (could do a naughty cast, but not going to do that!)
-    NiftiImageData3D<dataType> ref = *this->_reference_image_nifti_sptr;
-    NiftiImageData3D<dataType> flo = *this->_floating_images_nifti.at(0);
+    const int num_flo_ims = int(this->get_num_floating_images());
+    _TMs_fwd.resize(num_flo_ims);
+    _TMs_inv.resize(num_flo_ims);
+
+    std::cout << "\n\nStarting registration of " << num_flo_ims << " floating image(s)...\n\n";
+
+    // Exceptions can't leave an OpenMP region, so store the messages and rethrow afterwards
+    std::vector<std::string> errors(num_flo_ims);
+#ifdef _OPENMP
+    // NiftyReg parallelises each registration itself. With several floating images,
+    // the registrations run in parallel instead, and NiftyReg's own regions are not nested.
+    const int max_active_levels = omp_get_max_active_levels();
+    if (num_flo_ims > 1)
+        omp_set_max_active_levels(1);
+#endif
+#pragma omp parallel for schedule(dynamic) if (num_flo_ims > 1)
+    for (int i=0; i<num_flo_ims; ++i) {
+        try {
+            register_floating_image(unsigned(i));
+        }
+        catch (const std::exception &e) {
+            errors[i] = e.what();
+        }
+    }
+#ifdef _OPENMP
+    omp_set_max_active_levels(max_active_levels);
+#endif
+    this->check_errors(errors);
+
+    for (int i=0; i<num_flo_ims; ++i) {
+        std::cout << "\nPrinting forwards tranformation matrix (floating image " << i << "):\n";
+        _TMs_fwd.at(i)->print();
+        std::cout << "\nPrinting inverse tranformation matrix (floating image " << i << "):\n";
+        _TMs_inv.at(i)->print();
+
+        // Output different dependent on whether image was set as object or via filename
+        if (this->_reference_image_sptr) {
+            // The output should be a clone of the reference image, with data filled in from the nifti image
+            this->_warped_images.at(i) = this->_reference_image_sptr->clone();
+            this->_warped_images.at(i)->fill(*this->_warped_images_nifti.at(i));
+        }
+        else
+            this->_warped_images.at(i) = this->_warped_images_nifti.at(i);
+    }
 
-    // Create the registration object
-    _registration_sptr = std::make_shared<reg_aladin_sym<dataType> >();
-    _registration_sptr->SetInputReference(ref.get_raw_nifti_sptr().get());
-    _registration_sptr->SetInputFloating(flo.get_raw_nifti_sptr().get());
+    std::cout << "\n\nRegistration finished!\n\n";
+}
 
-    // By default, use a padding value of 0
-    _registration_sptr->SetWarpedPaddingValue(0.f);
+template<class dataType>
+void NiftyAladinSym<dataType>::register_floating_image(const unsigned idx)
+{
+    // Annoyingly NiftyReg doesn't mark ref and floating images as const, so need to copy (could do a naughty cast, but not going to do that!)
+    // NiftyReg also corrects the headers of its inputs when it initialises, so each registration gets its own copies of the reference and the masks.
+    NiftiImageData3D<dataType> ref = *this->_reference_image_nifti_sptr;
+    NiftiImageData3D<dataType> flo = *this->_floating_images_nifti.at(idx);
 
-    // Set masks (if present). Again, need to copy to get rid of const
     NiftiImageData3D<dataType> ref_mask, flo_mask;
+    NiftiImageData3D<dataType> *ref_mask_ptr = nullptr, *flo_mask_ptr = nullptr;
     if (this->_reference_mask_nifti_sptr && this->_reference_mask_nifti_sptr->is_initialised()) {
         ref_mask = *this->_reference_mask_nifti_sptr;
-        _registration_sptr->SetInputMask(ref_mask.get_raw_nifti_sptr().get());
+        ref_mask_ptr = &ref_mask;
     }
     if (this->_floating_mask_nifti_sptr && this->_floating_mask_nifti_sptr->is_initialised()) {
         flo_mask = *this->_floating_mask_nifti_sptr;
-        _registration_sptr->SetInputFloatingMask(flo_mask.get_raw_nifti_sptr().get());
+        flo_mask_ptr = &flo_mask;
     }
 
+    // Create the registration object
+    std::shared_ptr<reg_aladin_sym<dataType> > registration_sptr = std::make_shared<reg_aladin_sym<dataType> >();
+    registration_sptr->SetInputReference(ref.get_raw_nifti_sptr().get());
+    registration_sptr->SetInputFloating(flo.get_raw_nifti_sptr().get());
+
+    // By default, use a padding value of 0
+    registration_sptr->SetWarpedPaddingValue(0.f);
+
+    // Set masks (if present)
+    if (ref_mask_ptr)
+        registration_sptr->SetInputMask(ref_mask_ptr->get_raw_nifti_sptr().get());
+    if (flo_mask_ptr)
+        registration_sptr->SetInputFloatingMask(flo_mask_ptr->get_raw_nifti_sptr().get());
+
     // Parse parameter file
-    this->parse_parameter_file();
+    this->parse_parameter_file(registration_sptr);
 
     // Set any extra parameters
-    this->set_parameters();
-
-    std::cout << "\n\nStarting registration...\n\n";
+    this->set_parameters(registration_sptr);
 
     // Run
-    _registration_sptr->Run();
+    registration_sptr->Run();
 
     // Get the output
-    nifti_image *warped_im = _registration_sptr->GetFinalWarpedImage();
-    this->_warped_images_nifti.at(0) = std::make_shared<NiftiImageData3D<dataType> >(*warped_im);
+    nifti_image *warped_im = registration_sptr->GetFinalWarpedImage();
+    this->_warped_images_nifti.at(idx) = std::make_shared<NiftiImageData3D<dataType> >(*warped_im);
     nifti_image_free(warped_im);
 
     // For some reason, dt & pixdim[4] are sometimes set to 1
-    if (this->_floating_images_nifti.at(0)->get_raw_nifti_sptr()->dt < 1.e-7F &&
+    if (this->_floating_images_nifti.at(idx)->get_raw_nifti_sptr()->dt < 1.e-7F &&
             this->_reference_image_nifti_sptr->get_raw_nifti_sptr()->dt < 1.e-7F)
-        this->_warped_images_nifti.at(0)->get_raw_nifti_sptr()->pixdim[4] = this->_warped_images_nifti.at(0)->get_raw_nifti_sptr()->dt = 0.F;
+        this->_warped_images_nifti.at(idx)->get_raw_nifti_sptr()->pixdim[4] = this->_warped_images_nifti.at(idx)->get_raw_nifti_sptr()->dt = 0.F;
 
     // Get the forward and inverse transformation matrices
-    this->_TM_forward_sptr = std::make_shared<AffineTransformation<float> >(*this->_registration_sptr->GetTransformationMatrix());
-    this->_TM_inverse_sptr = std::make_shared<AffineTransformation<float> >(nifti_mat44_inverse(*_registration_sptr->GetTransformationMatrix()));
-
-    std::cout << "\nPrinting forwards tranformation matrix:\n";
-    _TM_forward_sptr->print();
-    std::cout << "\nPrinting inverse tranformation matrix:\n";
-    std::dynamic_pointer_cast<const AffineTransformation<float> >(_TM_inverse_sptr)->print();
-
-    this->_def_fwd_images.at(0) = std::make_shared<NiftiImageData3DDeformation<dataType> >(_TM_forward_sptr->get_as_deformation_field(ref));
+    _TMs_fwd.at(idx) = std::make_shared<AffineTransformation<float> >(*registration_sptr->GetTransformationMatrix());
+    _TMs_inv.at(idx) = std::make_shared<AffineTransformation<float> >(nifti_mat44_inverse(*registration_sptr->GetTransformationMatrix()));
 
-    // Output different dependent on whether image was set as object or via filename
-    if (this->_reference_image_sptr) {
-        // The output should be a clone of the reference image, with data filled in from the nifti image
-        this->_warped_images.at(0) = this->_reference_image_sptr->clone();
-        this->_warped_images.at(0)->fill(*this->_warped_images_nifti.at(0));
-    }
-    else
-        this->_warped_images.at(0) = this->_warped_images_nifti.at(0);
-
-    std::cout << "\n\nRegistration finished!\n\n";
+    this->_def_fwd_images.at(idx) = std::make_shared<NiftiImageData3DDeformation<dataType> >(_TMs_fwd.at(idx)->get_as_deformation_field(ref));
 }
 
 template<class dataType>
@@ -118,11 +161,11 @@ const std::shared_ptr<const Transformation<dataType> >
 NiftyAladinSym<dataType>::
 get_deformation_field_inverse_sptr(const unsigned idx) const
 {
-    if (idx>0)
+    if (idx>=_TMs_inv.size())
         throw std::runtime_error("NiftyAladinSym::get_deformation_field_inverse_sptr: idx out of range");
 
     return std::make_shared<NiftiImageData3DDeformation<dataType> >(
-                _TM_inverse_sptr->get_as_deformation_field(*this->_floating_images_nifti.at(0)));
+                _TMs_inv.at(idx)->get_as_deformation_field(*this->_floating_images_nifti.at(idx)));
 }
 
 template<class dataType>
@@ -157,14 +200,14 @@ void NiftyAladinSym<dataType>::print_all_wrapped_methods()
 }
 
 template<class dataType>
-void NiftyAladinSym<dataType>::parse_parameter_file()
+void NiftyAladinSym<dataType>::parse_parameter_file(const std::shared_ptr<reg_aladin_sym<dataType> > &registration_sptr) const
 {
     if (this->_parameter_filename.empty())
         return;
 
     Parser<reg_aladin_sym<dataType> > parser;
 
-    parser.set_object   (    _registration_sptr     );
+    parser.set_object   (     registration_sptr     );
     parser.set_filename ( this->_parameter_filename );
 
     parser.add_key("SetInterpolationToCubic",&reg_aladin_sym<dataType>::SetInterpolationToCubic);
@@ -198,7 +241,7 @@ void NiftyAladinSym<dataType>::parse_parameter_file()
 }
 
 template<class dataType>
-void NiftyAladinSym<dataType>::set_parameters()
+void NiftyAladinSym<dataType>::set_parameters(const std::shared_ptr<reg_aladin_sym<dataType> > &registration_sptr) const
 {
     for (size_t i=0; i<this->_extra_params.size(); i+=3) {
 
@@ -206,32 +249,32 @@ void NiftyAladinSym<dataType>::set_parameters()
         std::string arg1 = this->_extra_params[i+1];
         // std::string arg2 = this->_extra_params[i+2]; No aladin methods need 2 args (but f3d does)
 
-        if      (strcmp(par.c_str(),"SetInterpolationToCubic")== 0) _registration_sptr->SetInterpolationToCubic();
-        else if (strcmp(par.c_str(),"SetInterpolationToNearestNeighbor")== 0) _registration_sptr->SetInterpolationToNearestNeighbor();
-        else if (strcmp(par.c_str(),"SetInterpolationToTrilinear")== 0) _registration_sptr->SetInterpolationToTrilinear();
-        else if (strcmp(par.c_str(),"SetAlignCentre")== 0) _registration_sptr->SetAlignCentre(bool(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetInputTransform")== 0) _registration_sptr->SetInputTransform(arg1.c_str());
-        else if (strcmp(par.c_str(),"SetPerformAffine")== 0) _registration_sptr->SetPerformAffine(bool(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetPerformRigid")== 0) _registration_sptr->SetPerformRigid(bool(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetVerbose")== 0) _registration_sptr->SetVerbose(bool(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetBlockPercentage")== 0) _registration_sptr->SetBlockPercentage(stoi(arg1));
-        else if (strcmp(par.c_str(),"SetInterpolation")== 0) _registration_sptr->SetInterpolation(stoi(arg1));
-        else if (strcmp(par.c_str(),"SetBlockStepSize")== 0) _registration_sptr->SetBlockStepSize(stoi(arg1));
-        else if (strcmp(par.c_str(),"setCaptureRangeVox")== 0) _registration_sptr->setCaptureRangeVox(stoi(arg1));
-        else if (strcmp(par.c_str(),"setPlatformCode")== 0) _registration_sptr->setPlatformCode(stoi(arg1));
-        else if (strcmp(par.c_str(),"SetLevelsToPerform")== 0) _registration_sptr->SetLevelsToPerform(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetMaxIterations")== 0) _registration_sptr->SetMaxIterations(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetNumberOfLevels")== 0) _registration_sptr->SetNumberOfLevels(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"setGpuIdx")== 0) _registration_sptr->setGpuIdx(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetFloatingSigma")== 0) _registration_sptr->SetFloatingSigma(stof(arg1));
-        else if (strcmp(par.c_str(),"SetInlierLts")== 0) _registration_sptr->SetInlierLts(stof(arg1));
-        else if (strcmp(par.c_str(),"SetReferenceSigma")== 0) _registration_sptr->SetReferenceSigma(stof(arg1));
-        else if (strcmp(par.c_str(),"SetFloatingLowerThreshold")== 0) _registration_sptr->SetFloatingLowerThreshold(stof(arg1));
-        else if (strcmp(par.c_str(),"SetFloatingUpperThreshold")== 0) _registration_sptr->SetFloatingUpperThreshold(stof(arg1));
-        else if (strcmp(par.c_str(),"SetReferenceLowerThreshold")== 0) _registration_sptr->SetReferenceLowerThreshold(stof(arg1));
-        else if (strcmp(par.c_str(),"SetReferenceUpperThreshold")== 0) _registration_sptr->SetReferenceUpperThreshold(stof(arg1));
-        else if (strcmp(par.c_str(),"SetWarpedPaddingValue")== 0) _registration_sptr->SetWarpedPaddingValue(stof(arg1));
-        else if (strcmp(par.c_str(),"SetAlignCentreMass")== 0) _registration_sptr->SetAlignCentreMass(stoi(arg1));
+        if      (strcmp(par.c_str(),"SetInterpolationToCubic")== 0) registration_sptr->SetInterpolationToCubic();
+        else if (strcmp(par.c_str(),"SetInterpolationToNearestNeighbor")== 0) registration_sptr->SetInterpolationToNearestNeighbor();
+        else if (strcmp(par.c_str(),"SetInterpolationToTrilinear")== 0) registration_sptr->SetInterpolationToTrilinear();
+        else if (strcmp(par.c_str(),"SetAlignCentre")== 0) registration_sptr->SetAlignCentre(bool(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetInputTransform")== 0) registration_sptr->SetInputTransform(arg1.c_str());
+        else if (strcmp(par.c_str(),"SetPerformAffine")== 0) registration_sptr->SetPerformAffine(bool(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetPerformRigid")== 0) registration_sptr->SetPerformRigid(bool(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetVerbose")== 0) registration_sptr->SetVerbose(bool(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetBlockPercentage")== 0) registration_sptr->SetBlockPercentage(stoi(arg1));
+        else if (strcmp(par.c_str(),"SetInterpolation")== 0) registration_sptr->SetInterpolation(stoi(arg1));
+        else if (strcmp(par.c_str(),"SetBlockStepSize")== 0) registration_sptr->SetBlockStepSize(stoi(arg1));
+        else if (strcmp(par.c_str(),"setCaptureRangeVox")== 0) registration_sptr->setCaptureRangeVox(stoi(arg1));
+        else if (strcmp(par.c_str(),"setPlatformCode")== 0) registration_sptr->setPlatformCode(stoi(arg1));
+        else if (strcmp(par.c_str(),"SetLevelsToPerform")== 0) registration_sptr->SetLevelsToPerform(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetMaxIterations")== 0) registration_sptr->SetMaxIterations(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetNumberOfLevels")== 0) registration_sptr->SetNumberOfLevels(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"setGpuIdx")== 0) registration_sptr->setGpuIdx(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetFloatingSigma")== 0) registration_sptr->SetFloatingSigma(stof(arg1));
+        else if (strcmp(par.c_str(),"SetInlierLts")== 0) registration_sptr->SetInlierLts(stof(arg1));
+        else if (strcmp(par.c_str(),"SetReferenceSigma")== 0) registration_sptr->SetReferenceSigma(stof(arg1));
+        else if (strcmp(par.c_str(),"SetFloatingLowerThreshold")== 0) registration_sptr->SetFloatingLowerThreshold(stof(arg1));
+        else if (strcmp(par.c_str(),"SetFloatingUpperThreshold")== 0) registration_sptr->SetFloatingUpperThreshold(stof(arg1));
+        else if (strcmp(par.c_str(),"SetReferenceLowerThreshold")== 0) registration_sptr->SetReferenceLowerThreshold(stof(arg1));
+        else if (strcmp(par.c_str(),"SetReferenceUpperThreshold")== 0) registration_sptr->SetReferenceUpperThreshold(stof(arg1));
+        else if (strcmp(par.c_str(),"SetWarpedPaddingValue")== 0) registration_sptr->SetWarpedPaddingValue(stof(arg1));
+        else if (strcmp(par.c_str(),"SetAlignCentreMass")== 0) registration_sptr->SetAlignCentreMass(stoi(arg1));
         else
             throw std::runtime_error("\nUnknown argument: " + par);
     }
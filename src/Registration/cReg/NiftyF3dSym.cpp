@@ -33,6 +33,9 @@ limitations under the License.
 #include "sirf/Reg/NiftiImageData3D.h"
 #include "sirf/Reg/NiftiImageData3DDisplacement.h"
 #include <_reg_f3d_sym.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace sirf;
 
@@ -45,54 +48,104 @@ void NiftyF3dSym<dataType>::process()
     // Convert the input images from ImageData to NiftiImageData3D
     this->set_up_inputs();
 
+    const int num_flo_ims = int(this->get_num_floating_images());
+    std::cout << "\n\nStarting registration of " << num_flo_ims << " floating image(s)...\n\n";
+
+    // Exceptions can't leave an OpenMP region, so store the messages and rethrow afterwards
+    std::vector<std::string> errors(num_flo_ims);
+#ifdef _OPENMP
+    // NiftyReg parallelises each registration itself. With several floating images,
+    // the registrations run in parallel instead, and NiftyReg's own regions are not nested.
+    const int max_active_levels = omp_get_max_active_levels();
+    if (num_flo_ims > 1)
+        omp_set_max_active_levels(1);
+#endif
+#pragma omp parallel for schedule(dynamic) if (num_flo_ims > 1)
+    for (int i=0; i<num_flo_ims; ++i) {
+        try {
+            register_floating_image(unsigned(i));
+        }
+        catch (const std::exception &e) {
+            errors[i] = e.what();
+        }
+    }
+#ifdef _OPENMP
+    omp_set_max_active_levels(max_active_levels);
+#endif
+    this->check_errors(errors);
+
+    // Output different dependent on whether image was set as object or via filename
+    for (int i=0; i<num_flo_ims; ++i) {
+        if (this->_reference_image_sptr) {
+            // The output should be a clone of the reference image, with data filled in from the nifti image
+            this->_warped_images.at(i) = this->_reference_image_sptr->clone();
+            this->_warped_images.at(i)->fill(*this->_warped_images_nifti.at(i));
+        }
+        else
+            this->_warped_images.at(i) = this->_warped_images_nifti.at(i);
+    }
+
+    std::cout << "\n\nRegistration finished!\n\n";
+}
+
+template<class dataType>
+void NiftyF3dSym<dataType>::register_floating_image(const unsigned idx)
+{
     // Annoyingly NiftyReg doesn't mark ref and floating images as const, so need to copy (could do a naughty cast, but not going to do that!)
+    // NiftyReg also corrects the headers of its inputs when it initialises, so each registration gets its own copies of the reference and the masks.
     NiftiImageData3D<dataType> ref = *this->_reference_image_nifti_sptr;
-    NiftiImageData3D<dataType> flo = *this->_floating_images_nifti.at(0);
+    NiftiImageData3D<dataType> flo = *this->_floating_images_nifti.at(idx);
+
+    NiftiImageData3D<dataType> ref_mask, flo_mask;
+    NiftiImageData3D<dataType> *ref_mask_ptr = nullptr, *flo_mask_ptr = nullptr;
+    if (this->_reference_mask_nifti_sptr && this->_reference_mask_nifti_sptr->is_initialised()) {
+        ref_mask = *this->_reference_mask_nifti_sptr;
+        ref_mask_ptr = &ref_mask;
+    }
+    if (this->_floating_mask_nifti_sptr && this->_floating_mask_nifti_sptr->is_initialised()) {
+        flo_mask = *this->_floating_mask_nifti_sptr;
+        flo_mask_ptr = &flo_mask;
+    }
 
     // Create the registration object
+    std::shared_ptr<reg_f3d<dataType> > registration_sptr;
     if (_use_symmetric)
-        _registration_sptr = std::make_shared<reg_f3d_sym<dataType> >(_reference_time_point, _floating_time_point);
+        registration_sptr = std::make_shared<reg_f3d_sym<dataType> >(_reference_time_point, _floating_time_point);
     else
-        _registration_sptr = std::make_shared<reg_f3d<dataType> >(_reference_time_point, _floating_time_point);
+        registration_sptr = std::make_shared<reg_f3d<dataType> >(_reference_time_point, _floating_time_point);
 
     // Set reference and floating images
-    _registration_sptr->SetReferenceImage(ref.get_raw_nifti_sptr().get());
-    _registration_sptr->SetFloatingImage(flo.get_raw_nifti_sptr().get());
+    registration_sptr->SetReferenceImage(ref.get_raw_nifti_sptr().get());
+    registration_sptr->SetFloatingImage(flo.get_raw_nifti_sptr().get());
 
     // By default, use a padding value of 0
-    _registration_sptr->SetWarpedPaddingValue(0.f);
+    registration_sptr->SetWarpedPaddingValue(0.f);
 
     // If there is an initial transformation matrix, set it
+    mat44 init_tm;
     if (_initial_transformation_sptr) {
-        mat44 init_tm = _initial_transformation_sptr->get_as_mat44();
-        _registration_sptr->SetAffineTransformation(&init_tm);
+        init_tm = _initial_transformation_sptr->get_as_mat44();
+        registration_sptr->SetAffineTransformation(&init_tm);
     }
 
-    // Set masks (if present). Again, need to copy to get rid of const
-    NiftiImageData3D<dataType> ref_mask, flo_mask;
-    if (this->_reference_mask_nifti_sptr && this->_reference_mask_nifti_sptr->is_initialised()) {
-        ref_mask = *this->_reference_mask_nifti_sptr;
-        _registration_sptr->SetReferenceMask(ref_mask.get_raw_nifti_sptr().get());
-    }
-    if (this->_floating_mask_nifti_sptr && this->_floating_mask_nifti_sptr->is_initialised()) {
-        flo_mask = *this->_floating_mask_sptr;
-        _registration_sptr->SetFloatingMask(flo_mask.get_raw_nifti_sptr().get());
-    }
+    // Set masks (if present)
+    if (ref_mask_ptr)
+        registration_sptr->SetReferenceMask(ref_mask_ptr->get_raw_nifti_sptr().get());
+    if (flo_mask_ptr)
+        registration_sptr->SetFloatingMask(flo_mask_ptr->get_raw_nifti_sptr().get());
 
     // Parse parameter file
-    this->parse_parameter_file();
+    this->parse_parameter_file(registration_sptr);
 
     // Set any extra parameters
-    this->set_parameters();
-
-    std::cout << "\n\nStarting registration...\n\n";
+    this->set_parameters(registration_sptr);
 
     // Run
-    _registration_sptr->Run();
+    registration_sptr->Run();
 
     // Get the warped image
-    nifti_image **warped_im = _registration_sptr->GetWarpedImage();
-    this->_warped_images_nifti.at(0) = std::make_shared<NiftiImageData3D<dataType> >(*warped_im[0]);
+    nifti_image **warped_im = registration_sptr->GetWarpedImage();
+    this->_warped_images_nifti.at(idx) = std::make_shared<NiftiImageData3D<dataType> >(*warped_im[0]);
     // Free the images created
     if(warped_im[0]!=NULL)
         nifti_image_free(warped_im[0]);
@@ -104,30 +157,19 @@ void NiftyF3dSym<dataType>::process()
     warped_im=NULL;
 
     // For some reason, dt & pixdim[4] are sometimes set to 1
-    if (this->_floating_images_nifti.at(0)->get_raw_nifti_sptr()->dt < 1.e-7F &&
+    if (this->_floating_images_nifti.at(idx)->get_raw_nifti_sptr()->dt < 1.e-7F &&
             this->_reference_image_nifti_sptr->get_raw_nifti_sptr()->dt < 1.e-7F)
-        this->_warped_images_nifti.at(0)->get_raw_nifti_sptr()->pixdim[4] = this->_warped_images_nifti.at(0)->get_raw_nifti_sptr()->dt = 0.F;
+        this->_warped_images_nifti.at(idx)->get_raw_nifti_sptr()->pixdim[4] = this->_warped_images_nifti.at(idx)->get_raw_nifti_sptr()->dt = 0.F;
 
     // Get the CPP images
-    nifti_image * cpp_fwd_ptr = _registration_sptr->GetControlPointPositionImage();
+    nifti_image * cpp_fwd_ptr = registration_sptr->GetControlPointPositionImage();
     NiftiImageData3DTensor<dataType> cpp_forward(*cpp_fwd_ptr);
     nifti_image_free(cpp_fwd_ptr);
 
     // Get deformation fields from cpp
     std::shared_ptr<NiftiImageData3DDeformation<dataType> > def_fwd_sptr = std::make_shared<NiftiImageData3DDeformation<dataType> >();
     def_fwd_sptr->create_from_cpp(cpp_forward, ref);
-    this->_def_fwd_images.at(0) = def_fwd_sptr;
-
-    // Output different dependent on whether image was set as object or via filename
-    if (this->_reference_image_sptr) {
-        // The output should be a clone of the reference image, with data filled in from the nifti image
-        this->_warped_images.at(0) = this->_reference_image_sptr->clone();
-        this->_warped_images.at(0)->fill(*this->_warped_images_nifti.at(0));
-    }
-    else
-        this->_warped_images.at(0) = this->_warped_images_nifti.at(0);
-
-    std::cout << "\n\nRegistration finished!\n\n";
+    this->_def_fwd_images.at(idx) = def_fwd_sptr;
 }
 
 template<class dataType>
@@ -135,18 +177,18 @@ const std::shared_ptr<const Transformation<dataType> >
 NiftyF3dSym<dataType>::
 get_deformation_field_inverse_sptr(const unsigned idx) const
 {
-    if (idx>0)
-        throw std::runtime_error("NiftyF3dSym::get_displacement_field_inverse_sptr: idx out of range");
+    if (idx>=this->_def_fwd_images.size())
+        throw std::runtime_error("NiftyF3dSym::get_deformation_field_inverse_sptr: idx out of range");
 
     std::shared_ptr<NiftiImageData3DDeformation<dataType> > def_inv_sptr;
-    std::shared_ptr<Transformation<dataType> > trans_fwd = this->_def_fwd_images.at(0);
+    std::shared_ptr<Transformation<dataType> > trans_fwd = this->_def_fwd_images.at(idx);
     const NiftiImageData3DDeformation<dataType> &def_fwd =
             *std::dynamic_pointer_cast<NiftiImageData3DDeformation<dataType> >(trans_fwd);
 
     // Get inverse deformation.
     // NiftyReg can only do inverse for 3D images.
     if (def_fwd.get_raw_nifti_sptr()->nu == 3)
-        def_inv_sptr = def_fwd.get_inverse(this->_floating_images_nifti.at(0));
+        def_inv_sptr = def_fwd.get_inverse(this->_floating_images_nifti.at(idx));
     else {
 #ifdef SIRF_VTK
         // if not 3d but VTK is present, use that.
@@ -202,13 +244,13 @@ void NiftyF3dSym<dataType>::check_parameters() const
 }
 
 template<class dataType>
-void NiftyF3dSym<dataType>::parse_parameter_file()
+void NiftyF3dSym<dataType>::parse_parameter_file(const std::shared_ptr<reg_f3d<dataType> > &registration_sptr) const
 {
     if (this->_parameter_filename.empty())
         return;
 
     Parser<reg_f3d<dataType> > parser;
-    parser.set_object   (    _registration_sptr     );
+    parser.set_object   (     registration_sptr     );
     parser.set_filename ( this->_parameter_filename );
 
     parser.add_key("SetCompositionStepNumber",&reg_f3d<dataType>::SetCompositionStepNumber);
@@ -238,7 +280,7 @@ void NiftyF3dSym<dataType>::parse_parameter_file()
     parser.parse();
 }
 template<class dataType>
-void NiftyF3dSym<dataType>::set_parameters()
+void NiftyF3dSym<dataType>::set_parameters(const std::shared_ptr<reg_f3d<dataType> > &registration_sptr) const
 {
     for (size_t i=0; i<this->_extra_params.size(); i+=3) {
 
@@ -246,29 +288,29 @@ void NiftyF3dSym<dataType>::set_parameters()
         std::string arg1 = this->_extra_params[i+1];
         std::string arg2 = this->_extra_params[i+2];
 
-        if      (strcmp(par.c_str(),"SetCompositionStepNumber")== 0) _registration_sptr->SetCompositionStepNumber(stoi(arg1));
-        else if (strcmp(par.c_str(),"SetInverseConsistencyWeight")== 0) _registration_sptr->SetInverseConsistencyWeight(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetJacobianLogWeight")== 0) _registration_sptr->SetJacobianLogWeight(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetLinearEnergyWeight")== 0) _registration_sptr->SetLinearEnergyWeight(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetWarpedPaddingValue")== 0) _registration_sptr->SetWarpedPaddingValue(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetBendingEnergyWeight")== 0) _registration_sptr->SetBendingEnergyWeight(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetFloatingSmoothingSigma")== 0) _registration_sptr->SetFloatingSmoothingSigma(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetGradientSmoothingSigma")== 0) _registration_sptr->SetGradientSmoothingSigma(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetReferenceSmoothingSigma")== 0) _registration_sptr->SetReferenceSmoothingSigma(dataType(stod(arg1)));
-        else if (strcmp(par.c_str(),"SetLNCCKernelType")== 0) _registration_sptr->SetLNCCKernelType(stoi(arg1));
-        else if (strcmp(par.c_str(),"SetLevelNumber")== 0) _registration_sptr->SetLevelNumber(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetLevelToPerform")== 0) _registration_sptr->SetLevelToPerform(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetMaximalIterationNumber")== 0) _registration_sptr->SetMaximalIterationNumber(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetPerturbationNumber")== 0) _registration_sptr->SetPerturbationNumber(unsigned(stoi(arg1)));
-        else if (strcmp(par.c_str(),"SetSSDWeight")== 0) _registration_sptr->SetSSDWeight(stoi(arg1), stoi(arg2));
-        else if (strcmp(par.c_str(),"SetLNCCWeight")== 0) _registration_sptr->SetLNCCWeight(stoi(arg1), stod(arg2));
-        else if (strcmp(par.c_str(),"SetNMIWeight")== 0) _registration_sptr->SetNMIWeight(stoi(arg1), stod(arg2));
-        else if (strcmp(par.c_str(),"SetKLDWeight")== 0) _registration_sptr->SetKLDWeight(stoi(arg1), unsigned(stoi(arg2)));
-        else if (strcmp(par.c_str(),"SetFloatingThresholdUp")== 0) _registration_sptr->SetFloatingThresholdUp(unsigned(stoi(arg1)), dataType(stod(arg2)));
-        else if (strcmp(par.c_str(),"SetFloatingThresholdLow")== 0) _registration_sptr->SetFloatingThresholdLow(unsigned(stoi(arg1)), dataType(stod(arg2)));
-        else if (strcmp(par.c_str(),"SetReferenceThresholdUp")== 0) _registration_sptr->SetReferenceThresholdUp(unsigned(stoi(arg1)), dataType(stod(arg2)));
-        else if (strcmp(par.c_str(),"SetReferenceThresholdLow")== 0) _registration_sptr->SetReferenceThresholdLow(unsigned(stoi(arg1)), dataType(stod(arg2)));
-        else if (strcmp(par.c_str(),"SetSpacing")== 0) _registration_sptr->SetSpacing(unsigned(stoi(arg1)), dataType(stod(arg2)));
+        if      (strcmp(par.c_str(),"SetCompositionStepNumber")== 0) registration_sptr->SetCompositionStepNumber(stoi(arg1));
+        else if (strcmp(par.c_str(),"SetInverseConsistencyWeight")== 0) registration_sptr->SetInverseConsistencyWeight(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetJacobianLogWeight")== 0) registration_sptr->SetJacobianLogWeight(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetLinearEnergyWeight")== 0) registration_sptr->SetLinearEnergyWeight(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetWarpedPaddingValue")== 0) registration_sptr->SetWarpedPaddingValue(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetBendingEnergyWeight")== 0) registration_sptr->SetBendingEnergyWeight(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetFloatingSmoothingSigma")== 0) registration_sptr->SetFloatingSmoothingSigma(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetGradientSmoothingSigma")== 0) registration_sptr->SetGradientSmoothingSigma(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetReferenceSmoothingSigma")== 0) registration_sptr->SetReferenceSmoothingSigma(dataType(stod(arg1)));
+        else if (strcmp(par.c_str(),"SetLNCCKernelType")== 0) registration_sptr->SetLNCCKernelType(stoi(arg1));
+        else if (strcmp(par.c_str(),"SetLevelNumber")== 0) registration_sptr->SetLevelNumber(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetLevelToPerform")== 0) registration_sptr->SetLevelToPerform(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetMaximalIterationNumber")== 0) registration_sptr->SetMaximalIterationNumber(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetPerturbationNumber")== 0) registration_sptr->SetPerturbationNumber(unsigned(stoi(arg1)));
+        else if (strcmp(par.c_str(),"SetSSDWeight")== 0) registration_sptr->SetSSDWeight(stoi(arg1), stoi(arg2));
+        else if (strcmp(par.c_str(),"SetLNCCWeight")== 0) registration_sptr->SetLNCCWeight(stoi(arg1), stod(arg2));
+        else if (strcmp(par.c_str(),"SetNMIWeight")== 0) registration_sptr->SetNMIWeight(stoi(arg1), stod(arg2));
+        else if (strcmp(par.c_str(),"SetKLDWeight")== 0) registration_sptr->SetKLDWeight(stoi(arg1), unsigned(stoi(arg2)));
+        else if (strcmp(par.c_str(),"SetFloatingThresholdUp")== 0) registration_sptr->SetFloatingThresholdUp(unsigned(stoi(arg1)), dataType(stod(arg2)));
+        else if (strcmp(par.c_str(),"SetFloatingThresholdLow")== 0) registration_sptr->SetFloatingThresholdLow(unsigned(stoi(arg1)), dataType(stod(arg2)));
+        else if (strcmp(par.c_str(),"SetReferenceThresholdUp")== 0) registration_sptr->SetReferenceThresholdUp(unsigned(stoi(arg1)), dataType(stod(arg2)));
+        else if (strcmp(par.c_str(),"SetReferenceThresholdLow")== 0) registration_sptr->SetReferenceThresholdLow(unsigned(stoi(arg1)), dataType(stod(arg2)));
+        else if (strcmp(par.c_str(),"SetSpacing")== 0) registration_sptr->SetSpacing(unsigned(stoi(arg1)), dataType(stod(arg2)));
 
         else
             throw std::runtime_error("\nUnknown argument: " + par);
@@ -29,6 +29,7 @@ limitations under the License.
 
 #include "sirf/Reg/NiftyRegistration.h"
 #include "sirf/Reg/NiftiImageData3D.h"
+#include <stdexcept>
 
 using namespace sirf;
 
@@ -51,9 +52,8 @@ void NiftyRegistration<dataType>::set_parameter(const std::string &par, const st
 template<class dataType>
 void NiftyRegistration<dataType>::set_up_inputs()
 {
-    if (this->_floating_images.size()+this->_floating_image_filenames.size() != 1)
-        throw std::runtime_error("NiftyReg only accepts one floating image.");
-    this->_floating_images_nifti.resize(1);
+    const size_t num_flo_ims = this->_floating_images.size() + this->_floating_image_filenames.size();
+    this->_floating_images_nifti.resize(num_flo_ims);
 
     // For reference and floating image.
     // If filename has been set, read the image.
@@ -66,12 +66,19 @@ void NiftyRegistration<dataType>::set_up_inputs()
     else
         NiftiBasedRegistration<dataType>::convert_to_NiftiImageData_if_not_already(this->_reference_image_nifti_sptr, this->_reference_image_sptr);
 
-    // If image has been read via filename, read it.
-    if (this->_floating_image_filenames.size() == 1)
-        this->_floating_images_nifti.at(0) = std::make_shared<const NiftiImageData3D<dataType> >(this->_floating_image_filenames.at(0));
-    // Else, convert it
+    // If images have been set via filename, read them.
+    if (!this->_floating_image_filenames.empty())
+        for (size_t i=0; i<num_flo_ims; ++i)
+            this->_floating_images_nifti.at(i) = std::make_shared<const NiftiImageData3D<dataType> >(this->_floating_image_filenames.at(i));
+    // Else, convert them
     else
-        NiftiBasedRegistration<dataType>::convert_to_NiftiImageData_if_not_already(this->_floating_images_nifti.at(0), this->_floating_images.at(0));
+        for (size_t i=0; i<num_flo_ims; ++i)
+            NiftiBasedRegistration<dataType>::convert_to_NiftiImageData_if_not_already(this->_floating_images_nifti.at(i), this->_floating_images.at(i));
+
+    // Outputs: one per floating image
+    this->_warped_images.resize(num_flo_ims);
+    this->_warped_images_nifti.resize(num_flo_ims);
+    this->_def_fwd_images.resize(num_flo_ims);
 
     // Reference and floating masks (if supplied)
     if (this->_reference_mask_sptr)
@@ -80,6 +87,14 @@ void NiftyRegistration<dataType>::set_up_inputs()
         NiftiBasedRegistration<dataType>::convert_to_NiftiImageData_if_not_already(this->_floating_mask_nifti_sptr, this->_floating_mask_sptr);
 }
 
+template<class dataType>
+void NiftyRegistration<dataType>::check_errors(const std::vector<std::string> &errors)
+{
+    for (size_t i=0; i<errors.size(); ++i)
+        if (!errors[i].empty())
+            throw std::runtime_error("Registration of floating image " + std::to_string(i) + " failed: " + errors[i]);
+}
+
 namespace sirf {
 template class NiftyRegistration<float>;
 }
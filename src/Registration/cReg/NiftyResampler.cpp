@@ -28,6 +28,7 @@ limitations under the License.
 */
 
 #include "sirf/common/deprecate.h"
+#include "sirf/common/Profiler.h"
 #include "sirf/Reg/NiftyResampler.h"
 #include "sirf/Reg/NiftiImageData3DTensor.h"
 #include "sirf/Reg/NiftiImageData3DDeformation.h"
@@ -37,10 +38,25 @@ limitations under the License.
 #include <_reg_globalTrans.h>
 #include <_reg_tools.h>
 #include <memory>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace sirf;
 using namespace detail;
 
+/// Size of the voxel values of an image (only computed if profiling is on)
+static uint64_t image_bytes(const ImageData &image)
+{
+    if (!Profiler::enabled())
+        return 0;
+    const VoxelisedGeometricalInfo3D::Size size = image.get_geom_info_sptr()->get_size();
+    return uint64_t(size[0]) * size[1] * size[2] * (image.is_complex() ? 8 : 4);
+}
+
 template<class dataType>
 static void convert_ImageData_to_ComplexNiftiImageData(ComplexNiftiImageData<dataType> &output, const std::shared_ptr<const ImageData> input_sptr)
 {
@@ -116,13 +132,50 @@ void NiftyResampler<dataType>::set_up()
         this->_transformations.push_back(std::make_shared<AffineTransformation<float> >());
     }
 
+    // Dense deformation and interpolation points are only computed when needed
+    this->_deformation_sptr.reset();
+    this->_forward_memo.clear();
+    this->_interpolation_points.clear();
+
+    // If all transformations are affine, multiply the matrices instead of composing deformation fields
+    this->_affine_sptr.reset();
+    std::vector<const AffineTransformation<float>*> affines;
+    for (size_t i=0; i<this->_transformations.size(); ++i) {
+        const AffineTransformation<float> *affine_ptr =
+                dynamic_cast<const AffineTransformation<float>*>(this->_transformations[i].get());
+        if (!affine_ptr)
+            break;
+        affines.push_back(affine_ptr);
+    }
+    if (affines.size() == this->_transformations.size()) {
+        // Transformations are applied in the order they were added, i.e., Tn(...T1(T0(x)))
+        this->_affine_sptr = std::make_shared<AffineTransformation<float> >(*affines.at(0));
+        for (size_t i=1; i<affines.size(); ++i)
+            this->_affine_sptr = std::make_shared<AffineTransformation<float> >(*affines.at(i) * *this->_affine_sptr);
+    }
+
+    this->_need_to_set_up = false;
+}
+
+template<class dataType>
+void NiftyResampler<dataType>::set_up_deformation()
+{
+    if (this->_deformation_sptr)
+        return;
+
     // If there are multiple transformations, compose them into single transformation.
     // Use the reference regardless of forward/adjoint.
     this->_deformation_sptr = std::make_shared<NiftiImageData3DDeformation<dataType> >(
             NiftiImageData3DDeformation<dataType>::compose_single_deformation(
                 this->_transformations,*this->_reference_image_niftis.real()));
+}
 
-    this->_need_to_set_up = false;
+template<class dataType>
+bool NiftyResampler<dataType>::use_affine_kernel() const
+{
+    return this->_affine_sptr &&
+            (this->_interpolation_type == Resampler<dataType>::NEARESTNEIGHBOUR ||
+             this->_interpolation_type == Resampler<dataType>::LINEAR);
 }
 
 template<class dataType>
@@ -135,8 +188,13 @@ void NiftyResampler<dataType>::set_up_forward()
     // Call base level
     set_up();
 
-    // Setup output image
-    set_up_output_image(_output_image_forward_niftis, _reference_image_niftis, _floating_image_niftis);
+    // Affine transformations with nearest neighbour or linear interpolation don't need a deformation field
+    if (!use_affine_kernel()) {
+        set_up_deformation();
+
+        // Setup output image
+        set_up_output_image(_output_image_forward_niftis, _reference_image_niftis, _floating_image_niftis);
+    }
 
     this->_need_to_set_up_forward = false;
 }
@@ -151,6 +209,14 @@ void NiftyResampler<dataType>::set_up_adjoint()
     // Call base level
     set_up();
 
+    // Affine transformations with nearest neighbour or linear interpolation don't need NiftyMoMo
+    if (use_affine_kernel()) {
+        this->_need_to_set_up_adjoint = false;
+        return;
+    }
+
+    set_up_deformation();
+
     // SINC currently not supported in NiftyMoMo
     if (this->_interpolation_type == Resampler<dataType>::SINC)
         throw std::runtime_error("NiftyMoMo does not currently support SINC interpolation");
@@ -228,24 +294,30 @@ static void check_images_match(
 }
 
 template<class dataType>
-static void set_post_resample_outputs(std::shared_ptr<ImageData> &output_to_return_sptr, std::shared_ptr<ImageData> &output_as_member_sptr, const ComplexNiftiImageData<dataType> resampled_niftis)
+static void fill_output_from_niftis(const std::shared_ptr<ImageData> &output_sptr, const ComplexNiftiImageData<dataType> &resampled_niftis)
 {
     // If output is only real, set that
-    if (!output_to_return_sptr->is_complex())
-        output_to_return_sptr->fill(*resampled_niftis.real());
+    if (!output_sptr->is_complex())
+        output_sptr->fill(*resampled_niftis.real());
     // Else, set the complex bit
     else {
-        NumberType::Type output_num_type = (*output_to_return_sptr->begin()).get_typeID();
+        NumberType::Type output_num_type = (*output_sptr->begin()).get_typeID();
         if (output_num_type != NumberType::CXFLOAT)
             throw std::runtime_error("NiftyResampler: Only complex type currently supported is complex float");
-        ImageData::Iterator &it_out = output_to_return_sptr->begin();
+        ImageData::Iterator &it_out = output_sptr->begin();
         auto &it_real = resampled_niftis.real()->begin();
         auto &it_imag = resampled_niftis.imag()->begin();
-        for (; it_out!=output_to_return_sptr->end(); ++it_real, ++it_imag, ++it_out) {
+        for (; it_out!=output_sptr->end(); ++it_real, ++it_imag, ++it_out) {
             complex_float_t cmplx_flt(*it_real,*it_imag);
             *it_out = NumRef((void *)&cmplx_flt, output_num_type);
         }
     }
+}
+
+template<class dataType>
+static void set_post_resample_outputs(std::shared_ptr<ImageData> &output_to_return_sptr, std::shared_ptr<ImageData> &output_as_member_sptr, const ComplexNiftiImageData<dataType> resampled_niftis)
+{
+    fill_output_from_niftis(output_to_return_sptr, resampled_niftis);
 
     // Copy the output so that backwards compatibility of get_output() is preserved.
     output_as_member_sptr = output_to_return_sptr;
@@ -258,6 +330,7 @@ std::shared_ptr<ImageData> NiftyResampler<dataType>::forward(const std::shared_p
     set_up_forward();
 
     std::shared_ptr<ImageData> output_sptr = this->_reference_image_sptr->clone();
+    Profiler::count_allocation("NiftyResampler::forward", image_bytes(*output_sptr));
     forward(output_sptr, input_sptr);
 
     return output_sptr;
@@ -266,9 +339,49 @@ std::shared_ptr<ImageData> NiftyResampler<dataType>::forward(const std::shared_p
 template<class dataType>
 void NiftyResampler<dataType>::forward(std::shared_ptr<ImageData> output_sptr, const std::shared_ptr<const ImageData> input_sptr)
 {
+    ScopedTimer timer("NiftyResampler::forward");
+    Profiler::count_bytes("NiftyResampler::forward", image_bytes(*input_sptr) + image_bytes(*output_sptr));
+
     // Call the set up
     set_up_forward();
 
+    // If the input has not changed since the last call, reuse the result
+    const std::vector<uint64_t> args = forward_memo_arguments();
+    const std::shared_ptr<const ImageData> memo_sptr = _forward_memo.find(*input_sptr, args);
+    if (memo_sptr) {
+        output_sptr->fill(*memo_sptr);
+        output_sptr->mark_modified();
+        this->_output_image_sptr = output_sptr;
+        return;
+    }
+
+    resample_forward(output_sptr, input_sptr);
+    output_sptr->mark_modified();
+
+    if (_forward_memo.enabled())
+        _forward_memo.store(*input_sptr, std::shared_ptr<const ImageData>(output_sptr->clone()), args);
+}
+
+template<class dataType>
+std::vector<uint64_t> NiftyResampler<dataType>::forward_memo_arguments() const
+{
+    // The transformations and interpolation type are fixed by set_up(), which clears the memo
+    uint32_t padding_bits;
+    std::memcpy(&padding_bits, &this->_padding_value, sizeof(padding_bits));
+    return std::vector<uint64_t>{ uint64_t(this->_transformations.size()), uint64_t(padding_bits) };
+}
+
+template<class dataType>
+void NiftyResampler<dataType>::resample_forward(std::shared_ptr<ImageData> output_sptr, const std::shared_ptr<const ImageData> input_sptr)
+{
+    // Affine with nearest neighbour or linear interpolation, compute the positions on the fly
+    if (use_affine_kernel()) {
+        forward(std::vector<std::shared_ptr<ImageData> >(1, output_sptr),
+                std::vector<std::shared_ptr<const ImageData> >(1, input_sptr));
+        this->_output_image_sptr = output_sptr;
+        return;
+    }
+
     // Get the input image as NiftiImageData
     ComplexNiftiImageData<dataType> input_niftis, output_niftis;
     convert_ImageData_to_ComplexNiftiImageData(input_niftis, input_sptr);
@@ -309,9 +422,20 @@ std::shared_ptr<ImageData> NiftyResampler<dataType>::adjoint(const std::shared_p
 template<class dataType>
 void NiftyResampler<dataType>::adjoint(std::shared_ptr<ImageData> output_sptr, const std::shared_ptr<const ImageData> input_sptr)
 {
+    ScopedTimer timer("NiftyResampler::adjoint");
+    Profiler::count_bytes("NiftyResampler::adjoint", image_bytes(*input_sptr) + image_bytes(*output_sptr));
+
     // Call the set up
     set_up_adjoint();
 
+    // Affine with nearest neighbour or linear interpolation, compute the positions on the fly
+    if (use_affine_kernel()) {
+        adjoint(std::vector<std::shared_ptr<ImageData> >(1, output_sptr),
+                std::vector<std::shared_ptr<const ImageData> >(1, input_sptr));
+        this->_output_image_sptr = output_sptr;
+        return;
+    }
+
     // Get the input image as NiftiImageData
     ComplexNiftiImageData<dataType> input_niftis, output_niftis;
     convert_ImageData_to_ComplexNiftiImageData(input_niftis, input_sptr);
@@ -339,6 +463,508 @@ void NiftyResampler<dataType>::adjoint(std::shared_ptr<ImageData> output_sptr, c
     set_post_resample_outputs(output_sptr, this->_output_image_sptr, _output_image_adjoint_niftis);
 }
 
+/*!
+\ingroup Registration
+\brief Data buffers of the real (and imaginary) parts of an image used for batched resampling.
+
+If the image is a (real) NiftiImageData, its own buffer is used. Otherwise, it is
+converted to NiftiImageData (and outputs are copied back once resampled).
+*/
+template<class dataType>
+struct ResampleBuffers
+{
+    /// Only used if the image needs converting
+    ComplexNiftiImageData<dataType> niftis;
+    /// Data of the real and (optionally) imaginary parts
+    std::vector<dataType*> data;
+    /// True if the image needed converting
+    bool converted = false;
+};
+
+template<class dataType>
+static void check_buffer_matches(const NiftiImageData<dataType> &im, const ComplexNiftiImageData<dataType> &expected, const std::string &explanation)
+{
+    if (!NiftiImageData<dataType>::do_nifti_image_metadata_match(im, *expected.real(), false))
+        throw std::runtime_error(explanation);
+}
+
+template<class dataType>
+static void get_input_buffers(ResampleBuffers<dataType> &buffers,
+                              const std::shared_ptr<const ImageData> &input_sptr,
+                              const ComplexNiftiImageData<dataType> &expected,
+                              const std::string &explanation)
+{
+    std::shared_ptr<const NiftiImageData<dataType> > nifti_sptr =
+            std::dynamic_pointer_cast<const NiftiImageData<dataType> >(input_sptr);
+    if (nifti_sptr) {
+        check_buffer_matches(*nifti_sptr, expected, explanation);
+        // Only read from, so no need to copy
+        buffers.data.push_back(const_cast<dataType*>(static_cast<const dataType*>(nifti_sptr->get_raw_nifti_sptr()->data)));
+        return;
+    }
+    convert_ImageData_to_ComplexNiftiImageData(buffers.niftis, input_sptr);
+    check_buffer_matches(*buffers.niftis.real(), expected, explanation);
+    buffers.converted = true;
+    for (unsigned i=0; i<buffers.niftis.size(); ++i)
+        buffers.data.push_back(static_cast<dataType*>(buffers.niftis.at(i)->get_raw_nifti_sptr()->data));
+}
+
+template<class dataType>
+static void get_output_buffers(ResampleBuffers<dataType> &buffers,
+                               const std::shared_ptr<ImageData> &output_sptr,
+                               const ComplexNiftiImageData<dataType> &im_for_shape,
+                               const ComplexNiftiImageData<dataType> &im_for_metadata,
+                               const std::string &explanation)
+{
+    std::shared_ptr<NiftiImageData<dataType> > nifti_sptr =
+            std::dynamic_pointer_cast<NiftiImageData<dataType> >(output_sptr);
+    if (nifti_sptr) {
+        check_buffer_matches(*nifti_sptr, im_for_shape, explanation);
+        buffers.data.push_back(static_cast<dataType*>(nifti_sptr->get_raw_nifti_sptr()->data));
+        return;
+    }
+    if (output_sptr->is_complex() != im_for_shape.is_complex())
+        throw std::runtime_error(explanation);
+    set_up_output_image(buffers.niftis, im_for_shape, im_for_metadata);
+    buffers.converted = true;
+    for (unsigned i=0; i<buffers.niftis.size(); ++i)
+        buffers.data.push_back(static_cast<dataType*>(buffers.niftis.at(i)->get_raw_nifti_sptr()->data));
+}
+
+static inline int nifty_round(const float a)
+{
+    // Same rounding as NiftyReg's reg_round
+    return a > 0.f ? int(a+0.5f) : int(a-0.5f);
+}
+
+/// Set the stencil of an interpolation point from its (voxel) position in the floating image
+template<class InterpolationPoint>
+static inline void set_interpolation_point(InterpolationPoint &p, const double pos[3], const bool is_nn, const bool is_2d)
+{
+    p.valid = true;
+    for (int d=0; d<3; ++d) {
+        p.pre[d] = 0;
+        p.rel[d] = 0;
+    }
+    for (int d=0; d<(is_2d ? 2 : 3); ++d) {
+        if (is_nn)
+            p.pre[d] = nifty_round(float(pos[d]));
+        else {
+            p.pre[d] = int(std::floor(pos[d]));
+            p.rel[d] = pos[d] - double(p.pre[d]);
+        }
+    }
+}
+
+/// Interpolation points that have been computed in advance (e.g., from a deformation field)
+template<class InterpolationPoint>
+struct TabulatedPoints
+{
+    typedef InterpolationPoint point_type;
+    TabulatedPoints(const std::vector<InterpolationPoint> &points) : _points(points) {}
+    size_t size() const { return _points.size(); }
+    void get(const size_t v, InterpolationPoint &p) const { p = _points[v]; }
+private:
+    const std::vector<InterpolationPoint> &_points;
+};
+
+/// Interpolation points of an affine transformation, computed on the fly from the reference voxel indices
+template<class InterpolationPoint>
+struct AffinePoints
+{
+    typedef InterpolationPoint point_type;
+
+    /// ref_to_flo maps reference voxel indices to floating voxel indices
+    AffinePoints(const double ref_to_flo[4][4], const int ref_dims[3], const bool is_nn, const bool is_2d) :
+        _is_nn(is_nn), _is_2d(is_2d)
+    {
+        for (int i=0; i<3; ++i) {
+            _dims[i] = ref_dims[i];
+            for (int j=0; j<4; ++j)
+                _m[i][j] = ref_to_flo[i][j];
+        }
+    }
+    size_t size() const { return size_t(_dims[0]) * size_t(_dims[1]) * size_t(_dims[2]); }
+    void get(const size_t v, InterpolationPoint &p) const
+    {
+        const double i = double(v % size_t(_dims[0]));
+        const double j = double((v / size_t(_dims[0])) % size_t(_dims[1]));
+        const double k = double(v / (size_t(_dims[0]) * size_t(_dims[1])));
+        double pos[3];
+        for (int d=0; d<3; ++d)
+            pos[d] = _m[d][0]*i + _m[d][1]*j + _m[d][2]*k + _m[d][3];
+        set_interpolation_point(p, pos, _is_nn, _is_2d);
+    }
+private:
+    double _m[3][4];
+    int _dims[3];
+    bool _is_nn, _is_2d;
+};
+
+template<class dataType>
+bool NiftyResampler<dataType>::set_up_interpolation_points()
+{
+    if (this->_interpolation_type != Resampler<dataType>::NEARESTNEIGHBOUR &&
+            this->_interpolation_type != Resampler<dataType>::LINEAR)
+        return false;
+
+    // Already done
+    if (!_interpolation_points.empty())
+        return true;
+
+    set_up_deformation();
+
+    const nifti_image * const def_ptr = _deformation_sptr->get_raw_nifti_sptr().get();
+    const nifti_image * const flo_ptr = _floating_image_niftis.real()->get_raw_nifti_sptr().get();
+    const mat44 &flo_ijk = flo_ptr->sform_code > 0 ? flo_ptr->sto_ijk : flo_ptr->qto_ijk;
+    const bool is_2d = def_ptr->nu == 2;
+    const bool is_nn = this->_interpolation_type == Resampler<dataType>::NEARESTNEIGHBOUR;
+
+    const size_t num_vox = size_t(def_ptr->nx) * size_t(def_ptr->ny) * size_t(def_ptr->nz);
+    const dataType * const def_x = static_cast<const dataType*>(def_ptr->data);
+    const dataType * const def_y = def_x + num_vox;
+    const dataType * const def_z = is_2d ? nullptr : def_y + num_vox;
+
+    _interpolation_points.resize(num_vox);
+
+#pragma omp parallel for
+    for (long long v=0; v<(long long)num_vox; ++v) {
+        InterpolationPoint &p = _interpolation_points[size_t(v)];
+        const float world[3] = { float(def_x[v]), float(def_y[v]), is_2d ? 0.f : float(def_z[v]) };
+        if (std::isnan(world[0]) || std::isnan(world[1]) || std::isnan(world[2])) {
+            for (int d=0; d<3; ++d) {
+                p.pre[d] = 0;
+                p.rel[d] = 0;
+            }
+            p.valid = false;
+            continue;
+        }
+        double pos[3] = { 0., 0., 0. };
+        for (int d=0; d<(is_2d ? 2 : 3); ++d)
+            pos[d] = flo_ijk.m[d][0]*world[0] + flo_ijk.m[d][1]*world[1] + flo_ijk.m[d][2]*world[2] + flo_ijk.m[d][3];
+        set_interpolation_point(p, pos, is_nn, is_2d);
+    }
+    return true;
+}
+
+/// Get the matrix mapping reference voxel indices to floating voxel indices for an affine transformation
+static void get_affine_ref_to_flo(double ref_to_flo[4][4], const mat44 &tm, const nifti_image &ref, const nifti_image &flo, const bool is_2d)
+{
+    const mat44 &ref_xyz = ref.sform_code > 0 ? ref.sto_xyz : ref.qto_xyz;
+    const mat44 &flo_ijk = flo.sform_code > 0 ? flo.sto_ijk : flo.qto_ijk;
+
+    // world = tm * ref_xyz * voxel
+    double world[4][4];
+    for (int i=0; i<4; ++i)
+        for (int j=0; j<4; ++j) {
+            world[i][j] = 0.;
+            for (int k=0; k<4; ++k)
+                world[i][j] += double(tm.m[i][k]) * double(ref_xyz.m[k][j]);
+        }
+
+    // As with NiftyReg's 2D deformation fields, the world z-coordinate is dropped
+    if (is_2d)
+        for (int j=0; j<4; ++j)
+            world[2][j] = 0.;
+
+    for (int i=0; i<4; ++i)
+        for (int j=0; j<4; ++j) {
+            ref_to_flo[i][j] = 0.;
+            for (int k=0; k<4; ++k)
+                ref_to_flo[i][j] += double(flo_ijk.m[i][k]) * world[k][j];
+        }
+}
+
+template<class dataType, class PointSource>
+static void resample_forward_with_points(dataType * const out, const dataType * const in,
+                                         const PointSource &points,
+                                         const int flo_dims[3], const size_t num_vols, const bool is_nn, const bool is_2d,
+                                         const dataType padding, const bool parallel)
+{
+    typedef typename PointSource::point_type InterpolationPoint;
+    const size_t num_out_vox = points.size();
+    const size_t num_in_vox = size_t(flo_dims[0]) * size_t(flo_dims[1]) * size_t(flo_dims[2]);
+    const int num_z = is_2d ? 1 : 2;
+
+    for (size_t t=0; t<num_vols; ++t) {
+        dataType * const out_t = out + t*num_out_vox;
+        const dataType * const in_t = in + t*num_in_vox;
+#pragma omp parallel for if (parallel)
+        for (long long v=0; v<(long long)num_out_vox; ++v) {
+            InterpolationPoint p;
+            points.get(size_t(v), p);
+            if (!p.valid) {
+                out_t[v] = padding;
+                continue;
+            }
+            if (is_nn) {
+                const bool inside = p.pre[0]>=0 && p.pre[0]<flo_dims[0] &&
+                                    p.pre[1]>=0 && p.pre[1]<flo_dims[1] &&
+                                    p.pre[2]>=0 && p.pre[2]<flo_dims[2];
+                out_t[v] = inside ? in_t[p.pre[0] + flo_dims[0]*(p.pre[1] + size_t(flo_dims[1])*p.pre[2])] : padding;
+                continue;
+            }
+            double value = 0.;
+            for (int c=0; c<num_z; ++c) {
+                const int Z = p.pre[2] + c;
+                const double wz = is_2d ? 1. : (c ? p.rel[2] : 1.-p.rel[2]);
+                for (int b=0; b<2; ++b) {
+                    const int Y = p.pre[1] + b;
+                    const double wy = b ? p.rel[1] : 1.-p.rel[1];
+                    for (int a=0; a<2; ++a) {
+                        const int X = p.pre[0] + a;
+                        const double w = (a ? p.rel[0] : 1.-p.rel[0]) * wy * wz;
+                        if (X>=0 && X<flo_dims[0] && Y>=0 && Y<flo_dims[1] && Z>=0 && Z<flo_dims[2])
+                            value += w * in_t[X + flo_dims[0]*(Y + size_t(flo_dims[1])*Z)];
+                        else
+                            value += w * padding;
+                    }
+                }
+            }
+            out_t[v] = dataType(value);
+        }
+    }
+}
+
+/// Add the value of a reference voxel to the floating voxels of its interpolation stencil
+template<class dataType, class InterpolationPoint>
+static inline void scatter_interpolation_point(dataType * const out, const InterpolationPoint &p, const dataType value,
+                                               const int flo_dims[3], const bool is_nn, const bool is_2d)
+{
+    const int num_z = is_2d ? 1 : 2;
+    for (int c=0; c<(is_nn ? 1 : num_z); ++c) {
+        const int Z = p.pre[2] + c;
+        const double wz = is_nn || is_2d ? 1. : (c ? p.rel[2] : 1.-p.rel[2]);
+        for (int b=0; b<(is_nn ? 1 : 2); ++b) {
+            const int Y = p.pre[1] + b;
+            const double wy = is_nn ? 1. : (b ? p.rel[1] : 1.-p.rel[1]);
+            for (int a=0; a<(is_nn ? 1 : 2); ++a) {
+                const int X = p.pre[0] + a;
+                const double w = is_nn ? 1. : (a ? p.rel[0] : 1.-p.rel[0]) * wy * wz;
+                if (X>=0 && X<flo_dims[0] && Y>=0 && Y<flo_dims[1] && Z>=0 && Z<flo_dims[2])
+                    out[X + flo_dims[0]*(Y + size_t(flo_dims[1])*Z)] += dataType(w * value);
+            }
+        }
+    }
+}
+
+template<class dataType, class PointSource>
+static void resample_adjoint_with_points(dataType * const out, const dataType * const in,
+                                         const PointSource &points,
+                                         const int flo_dims[3], const size_t num_vols, const bool is_nn, const bool is_2d,
+                                         const bool parallel)
+{
+    typedef typename PointSource::point_type InterpolationPoint;
+    const size_t num_in_vox = points.size();
+    const size_t num_out_vox = size_t(flo_dims[0]) * size_t(flo_dims[1]) * size_t(flo_dims[2]);
+
+    int num_threads = 1;
+#ifdef _OPENMP
+    if (parallel)
+        num_threads = omp_get_max_threads();
+#endif
+
+    std::fill(out, out + num_vols*num_out_vox, dataType(0));
+
+    // Scatter, so threads can't write to the same output. Each thread (but the first, which uses
+    // the output) accumulates into its own image, and these are summed afterwards.
+    std::vector<dataType> accumulators(size_t(num_threads-1)*num_out_vox);
+    for (size_t t=0; t<num_vols; ++t) {
+        dataType * const out_t = out + t*num_out_vox;
+        const dataType * const in_t = in + t*num_in_vox;
+        std::fill(accumulators.begin(), accumulators.end(), dataType(0));
+#pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+        {
+            int thread = 0;
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            dataType * const acc = thread == 0 ? out_t : accumulators.data() + size_t(thread-1)*num_out_vox;
+#pragma omp for schedule(static)
+            for (long long v=0; v<(long long)num_in_vox; ++v) {
+                InterpolationPoint p;
+                points.get(size_t(v), p);
+                if (p.valid)
+                    scatter_interpolation_point(acc, p, in_t[v], flo_dims, is_nn, is_2d);
+            }
+            // The loop above ends with a barrier, so all accumulators are complete
+#pragma omp for schedule(static)
+            for (long long x=0; x<(long long)num_out_vox; ++x)
+                for (int i=0; i<num_threads-1; ++i)
+                    out_t[x] += accumulators[size_t(i)*num_out_vox + size_t(x)];
+        }
+    }
+}
+
+template<class dataType, class PointSource>
+static void resample_forward_batch(std::vector<ResampleBuffers<dataType> > &out, const std::vector<ResampleBuffers<dataType> > &in,
+                                   const PointSource &points, const int flo_dims[3], const size_t num_vols,
+                                   const bool is_nn, const bool is_2d, const dataType padding)
+{
+    const int num_ims = int(in.size());
+
+    // Parallelise over images if there are several, else over voxels
+#pragma omp parallel for schedule(dynamic) if (num_ims > 1)
+    for (int i=0; i<num_ims; ++i) {
+        for (size_t c=0; c<out[i].data.size(); ++c)
+            resample_forward_with_points(out[i].data[c], in[i].data[c], points,
+                                         flo_dims, num_vols, is_nn, is_2d, padding, num_ims == 1);
+    }
+}
+
+template<class dataType, class PointSource>
+static void resample_adjoint_batch(std::vector<ResampleBuffers<dataType> > &out, const std::vector<ResampleBuffers<dataType> > &in,
+                                   const PointSource &points, const int flo_dims[3], const size_t num_vols,
+                                   const bool is_nn, const bool is_2d)
+{
+    const int num_ims = int(in.size());
+
+    // Parallelise over images if there are several, else over voxels
+#pragma omp parallel for schedule(dynamic) if (num_ims > 1)
+    for (int i=0; i<num_ims; ++i) {
+        for (size_t c=0; c<out[i].data.size(); ++c)
+            resample_adjoint_with_points(out[i].data[c], in[i].data[c], points,
+                                         flo_dims, num_vols, is_nn, is_2d, num_ims == 1);
+    }
+}
+
+template<class dataType>
+std::vector<std::shared_ptr<ImageData> > NiftyResampler<dataType>::forward(const std::vector<std::shared_ptr<const ImageData> > &input_sptrs)
+{
+    std::vector<std::shared_ptr<ImageData> > output_sptrs(input_sptrs.size());
+    for (size_t i=0; i<input_sptrs.size(); ++i)
+        output_sptrs[i] = this->_reference_image_sptr->clone();
+    forward(output_sptrs, input_sptrs);
+    return output_sptrs;
+}
+
+template<class dataType>
+void NiftyResampler<dataType>::forward(const std::vector<std::shared_ptr<ImageData> > &output_sptrs, const std::vector<std::shared_ptr<const ImageData> > &input_sptrs)
+{
+    if (output_sptrs.size() != input_sptrs.size())
+        throw std::runtime_error("NiftyResampler::forward: Number of input and output images should match.");
+
+    // The batched forward only needs the deformation (or affine)
+    set_up();
+
+    const bool affine = use_affine_kernel();
+
+    // Interpolation not supported by the batched kernels, resample one by one
+    if (!affine && !set_up_interpolation_points()) {
+        for (size_t i=0; i<input_sptrs.size(); ++i)
+            forward(output_sptrs[i], input_sptrs[i]);
+        return;
+    }
+
+    const nifti_image * const ref_ptr = _reference_image_niftis.real()->get_raw_nifti_sptr().get();
+    const nifti_image * const flo_ptr = _floating_image_niftis.real()->get_raw_nifti_sptr().get();
+    const int ref_dims[3] = { ref_ptr->nx, ref_ptr->ny, ref_ptr->nz };
+    const int flo_dims[3] = { flo_ptr->nx, flo_ptr->ny, flo_ptr->nz };
+    const size_t num_vols = _reference_image_niftis.real()->get_num_voxels() / (size_t(ref_dims[0]) * size_t(ref_dims[1]) * size_t(ref_dims[2]));
+    const bool is_nn = this->_interpolation_type == Resampler<dataType>::NEARESTNEIGHBOUR;
+    const bool is_2d = ref_dims[2] == 1;
+    const dataType padding = dataType(this->_padding_value);
+    const size_t num_ims = input_sptrs.size();
+
+    // Get the buffers (converting if necessary)
+    std::vector<ResampleBuffers<dataType> > in(num_ims), out(num_ims);
+    for (size_t i=0; i<num_ims; ++i) {
+        get_input_buffers(in[i], input_sptrs[i], _floating_image_niftis,
+                          "NiftyResampler::forward: Metadata of input image should match floating image.");
+        get_output_buffers(out[i], output_sptrs[i], _reference_image_niftis, _floating_image_niftis,
+                           "NiftyResampler::forward: Metadata of output image should match reference image.");
+        // As in the non-batched forward, real and complex images can't be mixed
+        if (in[i].data.size() != out[i].data.size())
+            throw std::runtime_error("NiftyResampler::forward: Input and output images should both be real or both be complex.");
+    }
+
+    if (affine) {
+        double ref_to_flo[4][4];
+        get_affine_ref_to_flo(ref_to_flo, _affine_sptr->get_as_mat44(), *ref_ptr, *flo_ptr, is_2d);
+        resample_forward_batch(out, in, AffinePoints<InterpolationPoint>(ref_to_flo, ref_dims, is_nn, is_2d),
+                               flo_dims, num_vols, is_nn, is_2d, padding);
+    }
+    else
+        resample_forward_batch(out, in, TabulatedPoints<InterpolationPoint>(_interpolation_points),
+                               flo_dims, num_vols, is_nn, is_2d, padding);
+
+    // Outputs written in place are marked as modified, the others are filled (which marks them)
+    for (size_t i=0; i<num_ims; ++i) {
+        if (out[i].converted)
+            fill_output_from_niftis(output_sptrs[i], out[i].niftis);
+        else
+            output_sptrs[i]->mark_modified();
+    }
+}
+
+template<class dataType>
+std::vector<std::shared_ptr<ImageData> > NiftyResampler<dataType>::adjoint(const std::vector<std::shared_ptr<const ImageData> > &input_sptrs)
+{
+    std::vector<std::shared_ptr<ImageData> > output_sptrs(input_sptrs.size());
+    for (size_t i=0; i<input_sptrs.size(); ++i)
+        output_sptrs[i] = this->_floating_image_sptr->clone();
+    adjoint(output_sptrs, input_sptrs);
+    return output_sptrs;
+}
+
+template<class dataType>
+void NiftyResampler<dataType>::adjoint(const std::vector<std::shared_ptr<ImageData> > &output_sptrs, const std::vector<std::shared_ptr<const ImageData> > &input_sptrs)
+{
+    if (output_sptrs.size() != input_sptrs.size())
+        throw std::runtime_error("NiftyResampler::adjoint: Number of input and output images should match.");
+
+    // The batched adjoint only needs the deformation (or affine), not the NiftyMoMo transformer
+    set_up();
+
+    const bool affine = use_affine_kernel();
+
+    // Interpolation not supported by the batched kernels, resample one by one
+    if (!affine && !set_up_interpolation_points()) {
+        for (size_t i=0; i<input_sptrs.size(); ++i)
+            adjoint(output_sptrs[i], input_sptrs[i]);
+        return;
+    }
+
+    const nifti_image * const ref_ptr = _reference_image_niftis.real()->get_raw_nifti_sptr().get();
+    const nifti_image * const flo_ptr = _floating_image_niftis.real()->get_raw_nifti_sptr().get();
+    const int ref_dims[3] = { ref_ptr->nx, ref_ptr->ny, ref_ptr->nz };
+    const int flo_dims[3] = { flo_ptr->nx, flo_ptr->ny, flo_ptr->nz };
+    const size_t num_vols = _reference_image_niftis.real()->get_num_voxels() / (size_t(ref_dims[0]) * size_t(ref_dims[1]) * size_t(ref_dims[2]));
+    const bool is_nn = this->_interpolation_type == Resampler<dataType>::NEARESTNEIGHBOUR;
+    const bool is_2d = ref_dims[2] == 1;
+    const size_t num_ims = input_sptrs.size();
+
+    // Get the buffers (converting if necessary)
+    std::vector<ResampleBuffers<dataType> > in(num_ims), out(num_ims);
+    for (size_t i=0; i<num_ims; ++i) {
+        get_input_buffers(in[i], input_sptrs[i], _reference_image_niftis,
+                          "NiftyResampler::adjoint: Metadata of input image should match reference image.");
+        get_output_buffers(out[i], output_sptrs[i], _floating_image_niftis, _reference_image_niftis,
+                           "NiftyResampler::adjoint: Metadata of output image should match floating image.");
+        // As in the non-batched adjoint, real and complex images can't be mixed
+        if (in[i].data.size() != out[i].data.size())
+            throw std::runtime_error("NiftyResampler::adjoint: Input and output images should both be real or both be complex.");
+    }
+
+    if (affine) {
+        double ref_to_flo[4][4];
+        get_affine_ref_to_flo(ref_to_flo, _affine_sptr->get_as_mat44(), *ref_ptr, *flo_ptr, is_2d);
+        resample_adjoint_batch(out, in, AffinePoints<InterpolationPoint>(ref_to_flo, ref_dims, is_nn, is_2d),
+                               flo_dims, num_vols, is_nn, is_2d);
+    }
+    else
+        resample_adjoint_batch(out, in, TabulatedPoints<InterpolationPoint>(_interpolation_points),
+                               flo_dims, num_vols, is_nn, is_2d);
+
+    // Outputs written in place are marked as modified, the others are filled (which marks them)
+    for (size_t i=0; i<num_ims; ++i) {
+        if (out[i].converted)
+            fill_output_from_niftis(output_sptrs[i], out[i].niftis);
+        else
+            output_sptrs[i]->mark_modified();
+    }
+}
+
 namespace sirf {
 template class NiftyResampler<float>;
 using NiftyResample SIRF_DEPRECATED_USING = NiftyResampler<float>;
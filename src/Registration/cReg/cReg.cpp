@@ -20,6 +20,7 @@ limitations under the License.
 */
 
 #include "sirf/iUtilities/DataHandle.h"
+#include "sirf/common/Profiler.h"
 #include "sirf/Reg/cReg.h"
 #include "sirf/Reg/cReg_p.h"
 #include "sirf/Reg/NiftiImageData3D.h"
@@ -54,6 +55,37 @@ unknownObject(const char* obj, const char* name, const char* file, int line)
 	return (void*)handle;
 }
 
+// profiling
+extern "C"
+void* cReg_setProfiling(int on)
+{
+    try {
+        Profiler::instance().set_enabled(on != 0);
+        return new DataHandle;
+    }
+    CATCH;
+}
+
+extern "C"
+void* cReg_resetProfiling()
+{
+    try {
+        Profiler::instance().reset();
+        return new DataHandle;
+    }
+    CATCH;
+}
+
+extern "C"
+void* cReg_profile(const char* format)
+{
+    try {
+        std::string profile = Profiler::instance().report(format);
+        return charDataHandleFromCharData(profile.c_str());
+    }
+    CATCH;
+}
+
 //default constructors
 extern "C"
 void* cReg_newObject(const char* name)
@@ -765,15 +797,15 @@ void* cReg_NiftyRegistration_print_all_wrapped_methods(const char* name)
 //      NiftyAladinSym
 // -------------------------------------------------------------------------------- //
 extern "C"
-void* cReg_NiftyAladin_get_TM(const void* ptr, const char* dir)
+void* cReg_NiftyAladin_get_TM(const void* ptr, const char* dir, const int idx)
 {
     try {
         NiftyAladinSym<float>& reg = objectFromHandle<NiftyAladinSym<float> >(ptr);
         std::shared_ptr<const AffineTransformation<float> > sptr;
         if (strcmp(dir, "forward") == 0)
-            sptr = reg.get_transformation_matrix_forward_sptr();
+            sptr = reg.get_transformation_matrix_forward_sptr(unsigned(idx));
         else if (strcmp(dir, "inverse") == 0)
-            sptr = reg.get_transformation_matrix_inverse_sptr();
+            sptr = reg.get_transformation_matrix_inverse_sptr(unsigned(idx));
         else
             throw std::runtime_error("only accept forward or inverse as argument to dir for saving transformation matrix");
         return newObjectHandle(sptr);
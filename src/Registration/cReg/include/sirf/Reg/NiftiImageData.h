@@ -31,6 +31,7 @@ limitations under the License.
 
 #include <nifti1_io.h>
 #include <vector>
+#include <array>
 #include <string>
 #include <memory>
 #include <iostream>
@@ -306,24 +307,41 @@ public:
     /// Access data element via 1D index (const)
     float operator()(const int index) const;
 
-    /// Access data element via 1D index
+    /// Access data element via 1D index (call mark_modified() after writing through the reference)
     float &operator()(const int index);
 
     /// Access data element via 7D index (const)
     float operator()(const int index[7]) const;
 
-    /// Access data element via 7D index
+    /// Access data element via 7D index (call mark_modified() after writing through the reference)
     float &operator()(const int index[7]);
 
     /// Access data element via 7D index (const)
     float operator()(const int x, const int y, const int z, const int t=0, const int u=0, const int v=0, const int w=0) const;
 
-    /// Access data element via 7D index
+    /// Access data element via 7D index (call mark_modified() after writing through the reference)
     float &operator()(const int x, const int y, const int z, const int t=0, const int u=0, const int v=0, const int w=0);
 
     /// Is the image initialised? (Should be unless default constructor was used.)
     bool is_initialised() const { return (_nifti_image && _data && _nifti_image->datatype == DT_FLOAT32 ? true : false); }
 
+    /// Voxel values if the image is initialised and 3D (see ImageData::contiguous_float_data)
+    virtual const float* contiguous_float_data() const
+    {
+        if (!is_initialised() || _nifti_image->nvox != size_t(_nifti_image->nx)*_nifti_image->ny*_nifti_image->nz)
+            return NULL;
+        return _data;
+    }
+
+    /// Voxel values if the image is initialised and 3D (the image is marked as modified)
+    virtual float* contiguous_float_data()
+    {
+        if (!static_cast<const NiftiImageData&>(*this).contiguous_float_data())
+            return NULL;
+        this->mark_modified();
+        return _data;
+    }
+
     /// Get image as nifti as const
     std::shared_ptr<const nifti_image> get_raw_nifti_sptr() const;
 
@@ -428,11 +446,17 @@ public:
 
 	/// Set the voxel spacing. Requires resampling image, and so interpolation order is required.
     /// As per NiftyReg, interpolation_order can be either 0, 1 or 3 meaning nearest neighbor, linear or cubic spline interpolation.
+    /// When downsampling (with interpolation_order != 0), the image is first smoothed with a Gaussian along the downsampled axes.
     void set_voxel_spacing(const float factors[3], const int interpolation_order);
 
-    /// Kernel convolution
+    /// Kernel convolution. As per NiftyReg, sigma is in mm if positive, or voxels if negative.
+    /// The filtering is separable and done in place (parallelised over lines if built with OpenMP).
+    /// Parts of the kernel outside of the image (or on NaNs) are ignored and the rest renormalised.
     void kernel_convolution(const float sigma, NREG_CONV_KERNEL_TYPE conv_type = GAUSSIAN_KERNEL);
 
+    /// Kernel convolution with a different sigma along each axis (a sigma of 0 leaves that axis unfiltered).
+    void kernel_convolution(const std::array<float,3> &sigma, NREG_CONV_KERNEL_TYPE conv_type = GAUSSIAN_KERNEL);
+
     /// Does the image contain any NaNs?
     bool get_contains_nans() const { return (this->get_nan_count() > 0); }
 
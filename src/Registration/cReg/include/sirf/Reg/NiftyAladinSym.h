@@ -37,6 +37,7 @@ namespace sirf {
 
 /// Forward declarations
 template<class dataType> class AffineTransformation;
+template<class dataType> class NiftiImageData3D;
 
 /*!
 \ingroup Registration
@@ -55,10 +56,10 @@ public:
     void process();
 
     /// Get forwards transformation matrix
-    const std::shared_ptr<const AffineTransformation<float> > get_transformation_matrix_forward_sptr() const { return _TM_forward_sptr; }
+    const std::shared_ptr<const AffineTransformation<float> > get_transformation_matrix_forward_sptr(const unsigned idx = 0) const { return _TMs_fwd.at(idx); }
 
     /// Get inverse transformation matrix
-    const std::shared_ptr<const AffineTransformation<float> > get_transformation_matrix_inverse_sptr() const { return _TM_inverse_sptr; }
+    const std::shared_ptr<const AffineTransformation<float> > get_transformation_matrix_inverse_sptr(const unsigned idx = 0) const { return _TMs_inv.at(idx); }
 
     /// Get inverse deformation field image
     virtual const std::shared_ptr<const Transformation<dataType> > get_deformation_field_inverse_sptr(const unsigned idx = 0) const;
@@ -68,18 +69,18 @@ public:
 
 protected:
 
+    /// Register a single floating image to the reference image (on copies of the inputs, so that it can run in parallel).
+    void register_floating_image(const unsigned idx);
+
     /// Parse parameter file
-    virtual void parse_parameter_file();
+    void parse_parameter_file(const std::shared_ptr<reg_aladin_sym<dataType> > &registration_sptr) const;
 
     /// Set extra parameters.
-    void set_parameters();
-
-    /// Register object
-    std::shared_ptr<reg_aladin_sym<dataType> > _registration_sptr;
+    void set_parameters(const std::shared_ptr<reg_aladin_sym<dataType> > &registration_sptr) const;
 
-    /// Forwards transformation matrix
-    std::shared_ptr<AffineTransformation<float> > _TM_forward_sptr;
-    /// Inverse transformation matrix
-    std::shared_ptr<AffineTransformation<float> > _TM_inverse_sptr;
+    /// Forwards transformation matrices
+    std::vector<std::shared_ptr<AffineTransformation<float> > > _TMs_fwd;
+    /// Inverse transformation matrices
+    std::vector<std::shared_ptr<AffineTransformation<float> > > _TMs_inv;
 };
 }
@@ -41,6 +41,7 @@ namespace sirf {
 
 /// Forward declarations
 template<class dataType> class AffineTransformation;
+template<class dataType> class NiftiImageData3D;
 
 /*!
 \ingroup Registration
@@ -92,14 +93,14 @@ protected:
     /// Check parameters
     virtual void check_parameters() const;
 
+    /// Register a single floating image to the reference image (on copies of the inputs, so that it can run in parallel).
+    void register_floating_image(const unsigned idx);
+
     /// Parse parameter file
-    virtual void parse_parameter_file();
+    void parse_parameter_file(const std::shared_ptr<reg_f3d<dataType> > &registration_sptr) const;
 
     /// Set extra parameters.
-    void set_parameters();
-
-    /// Registration object
-    std::shared_ptr<reg_f3d<dataType> > _registration_sptr;
+    void set_parameters(const std::shared_ptr<reg_f3d<dataType> > &registration_sptr) const;
 
     /// Floating time point
     int _floating_time_point;
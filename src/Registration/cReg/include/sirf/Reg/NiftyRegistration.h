@@ -40,6 +40,11 @@ template<class dataType> class NiftiImageData3D;
 \ingroup Registration
 \brief Base class for all NiftyReg registrations.
 
+Several floating images can be registered to the same reference with add_floating_image().
+In that case, the reference (and masks) are converted and copied once, and the floating
+images are registered concurrently (if SIRF was built with OpenMP). Outputs can be
+accessed with the index of the corresponding floating image.
+
 \author Richard Brown
 \author SyneRBI
 */
@@ -71,14 +76,14 @@ public:
 
 protected:
 
-    /// Parse parameter file
-    virtual void parse_parameter_file() = 0;
-
     /// Set up inputs
     void set_up_inputs();
 
-    /// Set any extra parameters
-    virtual void set_parameters() = 0;
+    /// Number of floating images (only valid after set_up_inputs())
+    unsigned get_num_floating_images() const { return unsigned(this->_floating_images_nifti.size()); }
+
+    /// Throw if any of the concurrent registrations failed
+    static void check_errors(const std::vector<std::string> &errors);
 
     /// Store extra parameters. Only apply them after parsing.
     std::vector<std::string> _extra_params;
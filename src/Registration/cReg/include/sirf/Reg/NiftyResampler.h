@@ -34,6 +34,7 @@ limitations under the License.
 #include <vector>
 #include <iostream>
 #include "sirf/Reg/Resample.h"
+#include "sirf/common/OperatorMemo.h"
 #include "sirf/iUtilities/iutilities.h"
 
 namespace NiftyMoMo {
@@ -42,6 +43,8 @@ class BSplineTransformation;
 
 namespace sirf {
 
+template<class dataType> class AffineTransformation;
+
 namespace detail {
 /*! \ingroup Registration
   \brief This is an internal class requied by NiftyResampler to handle complex images.
@@ -94,6 +97,22 @@ private:
 
 The reference image and floating image can have nt and/or nu != 1.
 
+Several images sharing the same transformation can be resampled in one call with
+the batched forward() and adjoint() methods. For nearest neighbour and linear
+interpolation, the position of each reference voxel in the floating image is
+computed once from the deformation and reused for all images (and all subsequent
+calls). Real NiftiImageData inputs and outputs are then read and written in place.
+
+If all the transformations are affine, they are composed by multiplying their matrices.
+For nearest neighbour and linear interpolation, the floating image position of each
+voxel is then computed on the fly, so no deformation field is created. Otherwise (and
+for cubic spline and sinc interpolation), the transformations are composed into a
+single deformation field.
+
+If memoisation is switched on (see set_memoisation()), the result of the (single image)
+forward transformation is remembered, and returned without resampling if the next
+input is the same image and has not been modified since (see DataContainer::version()).
+
 \author Richard Brown
 \author SyneRBI
 */
@@ -123,8 +142,36 @@ public:
     /// Do the adjoint transformation
     virtual void adjoint(std::shared_ptr<ImageData> output_sptr, const std::shared_ptr<const ImageData> input_sptr);
 
+    /// Do the forward transformation of several images. Inputs should match the floating image.
+    std::vector<std::shared_ptr<ImageData> > forward(const std::vector<std::shared_ptr<const ImageData> > &input_sptrs);
+
+    /// Do the forward transformation of several images. Outputs should match the reference image.
+    void forward(const std::vector<std::shared_ptr<ImageData> > &output_sptrs, const std::vector<std::shared_ptr<const ImageData> > &input_sptrs);
+
+    /// Do the adjoint transformation of several images. Inputs should match the reference image.
+    std::vector<std::shared_ptr<ImageData> > adjoint(const std::vector<std::shared_ptr<const ImageData> > &input_sptrs);
+
+    /// Do the adjoint transformation of several images. Outputs should match the floating image.
+    void adjoint(const std::vector<std::shared_ptr<ImageData> > &output_sptrs, const std::vector<std::shared_ptr<const ImageData> > &input_sptrs);
+
+    /// Remember the result of the forward transformation for an unchanged input (off by default)
+    void set_memoisation(const bool memoise) { _forward_memo.set_enabled(memoise); }
+
+    /// Is the result of the forward transformation remembered
+    bool get_memoisation() const { return _forward_memo.enabled(); }
+
 protected:
 
+    /// Position of a reference voxel in the floating image (used for nearest neighbour and linear interpolation)
+    struct InterpolationPoint {
+        /// Lower corner of the interpolation stencil (in voxels of the floating image)
+        int pre[3];
+        /// Fractional offset from the lower corner
+        dataType rel[3];
+        /// False if the deformation is NaN at this voxel (output is the padding value)
+        bool valid;
+    };
+
     /// Set up
     virtual void set_up();
 
@@ -134,9 +181,24 @@ protected:
     /// Set up adjoint
     virtual void set_up_adjoint();
 
+    /// Forward transformation of a single image (without memoisation)
+    void resample_forward(std::shared_ptr<ImageData> output_sptr, const std::shared_ptr<const ImageData> input_sptr);
+
+    /// Arguments (besides the input) the memoised forward result depends on
+    std::vector<uint64_t> forward_memo_arguments() const;
+
     /// Set up the input images (convert from ImageData to NiftiImageData if necessary)
     void set_up_input_images();
 
+    /// Compose the transformations into a single deformation field (if not already done)
+    void set_up_deformation();
+
+    /// True if the transformations compose to a single affine and the interpolation is nearest neighbour or linear
+    bool use_affine_kernel() const;
+
+    /// Set up the interpolation points for batched resampling. Returns false if the interpolation type is not supported.
+    bool set_up_interpolation_points();
+
     /// Reference image as a NiftiImageData
     detail::ComplexNiftiImageData<dataType> _reference_image_niftis;
     /// Floating image as a NiftiImageData
@@ -146,13 +208,21 @@ protected:
     /// Adjoint resampled image as a NiftiImageData
     detail::ComplexNiftiImageData<dataType> _output_image_adjoint_niftis;
 
-    /// Deformation
+    /// Deformation (only created if needed)
     std::shared_ptr<NiftiImageData3DDeformation<dataType> > _deformation_sptr;
+    /// Composition of the transformations, if they are all affine
+    std::shared_ptr<AffineTransformation<float> > _affine_sptr;
     /// Needed for the adjoint transformation
     std::shared_ptr<NiftyMoMo::BSplineTransformation> _adjoint_transformer_sptr;
     /// Adjoint reference weights. Vector as may be complex
     std::shared_ptr<NiftiImageData<dataType> > _adjoint_input_weights_sptr;
     /// Adjoint output weights. Vector as may be complex
     std::shared_ptr<NiftiImageData<dataType> > _adjoint_output_weights_sptr;
+
+    /// Interpolation points (one per spatial voxel of the reference image) for batched resampling
+    std::vector<InterpolationPoint> _interpolation_points;
+
+    /// Last forward result (if memoisation is on)
+    OperatorMemo<ImageData> _forward_memo;
 };
 }
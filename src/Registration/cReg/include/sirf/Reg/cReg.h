@@ -33,6 +33,11 @@ extern "C" {
 #define PTR_DOUBLE double*
 #endif
 
+    // Profiling
+    void* cReg_setProfiling(int on);
+    void* cReg_resetProfiling();
+    void* cReg_profile(const char* format);
+
     // Common Reg Object methods
     void* cReg_newObject(const char* name);
     void* cReg_objectFromFile(const char* name, const char* filename);
@@ -99,7 +104,7 @@ extern "C" {
     void* cReg_NiftyRegistration_print_all_wrapped_methods(const char* name);
 
     // Aladin methods
-    void* cReg_NiftyAladin_get_TM(const void* ptr, const char* dir);
+    void* cReg_NiftyAladin_get_TM(const void* ptr, const char* dir, const int idx);
 
     // SPM methods
     void* cReg_SPMRegistration_get_TM(const void* ptr, const char* dir, const int idx);
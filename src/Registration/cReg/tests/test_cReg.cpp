@@ -30,6 +30,7 @@ limitations under the License.
 
 #include <iostream>
 #include "sirf/common/getenv.h"
+#include "sirf/common/ImagePrior.h"
 #include "sirf/Reg/NiftyAladinSym.h"
 #include "sirf/Reg/NiftyF3dSym.h"
 #include "sirf/Reg/NiftyResampler.h"
@@ -258,6 +259,48 @@ int main(int argc, char* argv[])
         if (x != u)
             throw std::runtime_error("NiftiImageData::upsample()/downsample() failed.");
 
+        // Kernel convolution. Kernel is renormalised at the edges, so a constant image should be unchanged.
+        NiftiImageData<float> conv = u;
+        conv.fill(3.f);
+        conv.kernel_convolution(-2.f, GAUSSIAN_KERNEL);
+        if (std::abs(conv.get_min() - 3.f) > 1e-4f || std::abs(conv.get_max() - 3.f) > 1e-4f)
+            throw std::runtime_error("NiftiImageData::kernel_convolution() failed for constant image.");
+        // Smoothing an impulse (away from the edges) should preserve its sum and spread it along the filtered axes only
+        conv.fill(0.f);
+        const int *conv_dims = conv.get_dimensions();
+        const int impulse_idx[7] = { conv_dims[1]/2, conv_dims[2]/2, conv_dims[3]/2, 0, 0, 0, 0 };
+        conv(impulse_idx) = 1.f;
+        conv.kernel_convolution({-1.f, -1.5f, 0.f}, CUBIC_SPLINE_KERNEL);
+        const int off_slice_idx[7] = { conv_dims[1]/2, conv_dims[2]/2, conv_dims[3]/2 + 1, 0, 0, 0, 0 };
+        if (std::abs(conv.get_sum() - 1.f) > 1e-4f || conv(impulse_idx) >= 1.f || conv(off_slice_idx) != 0.f)
+            throw std::runtime_error("NiftiImageData::kernel_convolution() failed for impulse.");
+
+        // Image prior. Compare the gradient with a finite difference of the value,
+        // and the Hessian times an impulse with the Hessian diagonal.
+        NiftiImageData<float> prior_im = u;
+        const int *prior_dims = prior_im.get_dimensions();
+        const int centre_idx[7] = { prior_dims[1]/2, prior_dims[2]/2, prior_dims[3]/2, 0, 0, 0, 0 };
+        LogCoshImagePrior prior;
+        prior.set_delta(0.1f*prior_im.get_max());
+        NiftiImageData<float> prior_grad = prior_im;
+        NiftiImageData<float> prior_diag = prior_im;
+        NiftiImageData<float> prior_hv = prior_im;
+        NiftiImageData<float> impulse = prior_im;
+        prior.gradient(prior_grad, prior_im);
+        prior.hessian_diagonal(prior_diag, prior_im);
+        impulse.fill(0.f);
+        impulse(centre_idx) = 1.f;
+        prior.hessian_times(prior_hv, prior_im, impulse);
+        const float step = 1e-3f*prior_im.get_max();
+        NiftiImageData<float> prior_plus = prior_im;
+        NiftiImageData<float> prior_minus = prior_im;
+        prior_plus(centre_idx) += step;
+        prior_minus(centre_idx) -= step;
+        const double prior_fd = (prior.value(prior_plus) - prior.value(prior_minus)) / (2*step);
+        if (std::abs(prior_fd - prior_grad(centre_idx)) > 1e-2*(std::abs(prior_fd) + 1e-3) ||
+                std::abs(prior_hv(centre_idx) - prior_diag(centre_idx)) > 1e-4f*std::abs(prior_diag(centre_idx)))
+            throw std::runtime_error("LogCoshImagePrior gradient or Hessian failed.");
+
         // Test inner product
         NiftiImageData<float> y = x;
         for (unsigned i=0; i<x.get_num_voxels(); ++i)
@@ -815,6 +858,29 @@ int main(int argc, char* argv[])
         if (*out1_sptr != *out2_sptr)
             throw std::runtime_error("NiftiImageData3DDeformation::get_inverse() failed.");
 
+        // Check batch registration of several floating images against the same reference
+        {
+            NiftyAladinSym<float> NA_batch;
+            NA_batch.set_reference_image(ref_aladin);
+            NA_batch.set_floating_image (flo_aladin);
+            NA_batch.add_floating_image (ref_aladin);
+            NA_batch.set_parameter_file (parameter_file_aladin);
+            NA_batch.set_parameter("SetInterpolationToCubic");
+            NA_batch.set_parameter("SetLevelsToPerform","1");
+            NA_batch.set_parameter("SetMaxIterations","5");
+            NA_batch.set_parameter("SetPerformRigid","1");
+            NA_batch.set_parameter("SetPerformAffine","0");
+            NA_batch.set_reference_mask(ref_mask);
+            NA_batch.set_floating_mask(flo_mask);
+            NA_batch.process();
+            if (*NA_batch.get_transformation_matrix_forward_sptr(0) != TM_forward_)
+                throw std::runtime_error("NiftyAladinSym batch registration failed: TM 0 differs from single registration");
+            if (*NA_batch.get_output_sptr(0) != warped_)
+                throw std::runtime_error("NiftyAladinSym batch registration failed: output 0 differs from single registration");
+            if (*NA_batch.get_output_sptr(1) != *ref_aladin)
+                throw std::runtime_error("NiftyAladinSym batch registration failed: ref==flo, but registered image != ref");
+        }
+
         // Check 2D registration
         {
             // Create 2D images
@@ -901,6 +967,24 @@ int main(int argc, char* argv[])
         if (*NF2.get_output_sptr() != *ref_f3d_crop)
             throw std::runtime_error("NiftyF3dSym failed: ref==flo, but registered image != ref");
 
+        // Check batch registration of several floating images against the same reference
+        NiftyF3dSym<float> NF_batch;
+        NF_batch.set_reference_image          (    ref_f3d_crop    );
+        NF_batch.set_floating_image           (    flo_f3d_crop    );
+        NF_batch.add_floating_image           (    ref_f3d_crop    );
+        NF_batch.set_parameter_file           ( parameter_file_f3d );
+        NF_batch.set_reference_time_point     (          1         );
+        NF_batch.set_floating_time_point      (          1         );
+        NF_batch.set_reference_mask(ref_mask);
+        NF_batch.set_floating_mask(flo_mask);
+        NF_batch.process();
+        if (*NF_batch.get_output_sptr(0) != *warped_sptr)
+            throw std::runtime_error("NiftyF3dSym batch registration failed: output 0 differs from single registration");
+        if (*NF_batch.get_output_sptr(1) != *ref_f3d_crop)
+            throw std::runtime_error("NiftyF3dSym batch registration failed: ref==flo, but registered image != ref");
+        if (*std::dynamic_pointer_cast<const NiftiImageData3DDeformation<float> >(NF_batch.get_deformation_field_forward_sptr(0)) != *def_forward_sptr)
+            throw std::runtime_error("NiftyF3dSym batch registration failed: deformation 0 differs from single registration");
+
         // Check 2D registration
         {
             // Create 2D images
@@ -1043,6 +1127,44 @@ int main(int argc, char* argv[])
         if (*out1_sptr != *out2_sptr)
             throw std::runtime_error("out = NiftyResampler::forward(in) and NiftyResampler::forward(out, in) do not give same result.");
 
+        std::cout << "Testing affine chain...\n";
+        // Chain of affines is resampled without a deformation field. Compare with composing the deformation field of each
+        // affine (as deformation fields, the affines are not multiplied, but composed with reg_defField_compose).
+        std::shared_ptr<const AffineTransformation<float> > tm_shift =
+                std::make_shared<const AffineTransformation<float> >(std::array<float,3>{2.f, -1.f, 3.f}, std::array<float,3>{1.f, 2.f, -3.f});
+        std::vector<std::shared_ptr<const Transformation<float> > > chain = { tm, tm_shift, tm_iden };
+        NiftyResampler<float> nr4;
+        nr4.set_reference_image(ref_aladin);
+        nr4.set_floating_image(flo_aladin);
+        nr4.set_interpolation_type_to_linear();
+        nr4.set_padding_value(padding_value);
+        for (const auto &t : chain)
+            nr4.add_transformation(t);
+
+        NiftyResampler<float> nr5;
+        nr5.set_reference_image(ref_aladin);
+        nr5.set_floating_image(flo_aladin);
+        nr5.set_interpolation_type_to_linear();
+        nr5.set_padding_value(padding_value);
+        std::vector<std::shared_ptr<const Transformation<float> > > chain_defs;
+        for (const auto &t : chain)
+            chain_defs.push_back(std::make_shared<const NiftiImageData3DDeformation<float> >(t->get_as_deformation_field(*ref_aladin)));
+        nr5.add_transformation(std::make_shared<const NiftiImageData3DDeformation<float> >(
+                                   NiftiImageData3DDeformation<float>::compose_single_deformation(chain_defs, *ref_aladin)));
+
+        const std::shared_ptr<const NiftiImageData<float> > affine_out_sptr =
+                std::dynamic_pointer_cast<const NiftiImageData<float> >(nr4.forward(flo_aladin));
+        const std::shared_ptr<const NiftiImageData<float> > def_out_sptr =
+                std::dynamic_pointer_cast<const NiftiImageData<float> >(nr5.forward(flo_aladin));
+        if (!NiftiImageData<float>::are_equal_to_given_accuracy(*affine_out_sptr, *def_out_sptr, 1e-3f))
+            throw std::runtime_error("NiftyResampler with chain of affines does not match resampling with deformation field.");
+        const std::shared_ptr<const NiftiImageData<float> > affine_adj_sptr =
+                std::dynamic_pointer_cast<const NiftiImageData<float> >(nr4.adjoint(ref_aladin));
+        const std::shared_ptr<const NiftiImageData<float> > def_adj_sptr =
+                std::dynamic_pointer_cast<const NiftiImageData<float> >(nr5.adjoint(ref_aladin));
+        if (!NiftiImageData<float>::are_equal_to_given_accuracy(*affine_adj_sptr, *def_adj_sptr, 1e-3f))
+            throw std::runtime_error("NiftyResampler adjoint with chain of affines does not match adjoint with deformation field.");
+
         // TODO this doesn't work. For some reason (even with NiftyReg directly), resampling with the TM from the registration
         // doesn't give the same result as the output from the registration itself (even with same interpolations). Even though
         // ref and flo images are positive, the output of the registration can be negative. This implies that linear interpolation
@@ -1121,6 +1243,42 @@ int main(int argc, char* argv[])
         if (*out1_sptr != *out2_sptr)
             throw std::runtime_error("out = NiftyResampler::adjoint(in) and NiftyResampler::adjoint(out, in) do not give same result.");
 
+        // Check batched resampling (shared interpolation weights) against single-image resampling
+        const std::shared_ptr<NiftiImageData<float> > y2 = y->clone();
+        *y2 *= 2.f;
+        const std::vector<std::shared_ptr<ImageData> > Ty_batch =
+                nr.forward(std::vector<std::shared_ptr<const ImageData> >{y, y2});
+        const NiftiImageData<float> &Ty_batch_0 = dynamic_cast<const NiftiImageData<float>&>(*Ty_batch.at(0));
+        const NiftiImageData<float> &Ty_batch_1 = dynamic_cast<const NiftiImageData<float>&>(*Ty_batch.at(1));
+        if (Ty_batch_0 != *Ty || Ty_batch_1 != *Ty * 2.f)
+            throw std::runtime_error("NiftyResampler batched forward differs from single-image forward.");
+
+        const std::vector<std::shared_ptr<ImageData> > Tsx_batch =
+                nr.adjoint(std::vector<std::shared_ptr<const ImageData> >{x, x});
+        const NiftiImageData<float> &Tsx_batch_0 = dynamic_cast<const NiftiImageData<float>&>(*Tsx_batch.at(0));
+        const NiftiImageData<float> &Tsx_batch_1 = dynamic_cast<const NiftiImageData<float>&>(*Tsx_batch.at(1));
+        if (Tsx_batch_0 != Tsx_batch_1)
+            throw std::runtime_error("NiftyResampler batched adjoint gives different results for identical inputs.");
+        const float inner_x_Ty_batch  = x->get_inner_product(Ty_batch_0);
+        const float inner_y_Tsx_batch = y->get_inner_product(Tsx_batch_0);
+        const float adjoint_test_batch = std::abs(inner_x_Ty_batch - inner_y_Tsx_batch) / (0.5f * (std::abs(inner_x_Ty_batch) +std::abs(inner_y_Tsx_batch)));
+        std::cout << "Batched: |<x, Ty> - <y, Tsx>| / 0.5*(|<x, Ty>|+|<y, Tsx>|) = " << adjoint_test_batch << "\n";
+        if (adjoint_test_batch > 1e-4F)
+            throw std::runtime_error("NiftyResampler batched adjoint failed");
+
+        // Check the memoised forward is only reused while the input is unchanged
+        nr.set_memoisation(true);
+        const std::shared_ptr<NiftiImageData<float> > y3 = y->clone();
+        const std::shared_ptr<const ImageData> Ty3_first  = nr.forward(y3);
+        const std::shared_ptr<const ImageData> Ty3_second = nr.forward(y3);
+        *y3 *= 2.f;
+        const std::shared_ptr<const ImageData> Ty3_scaled = nr.forward(y3);
+        nr.set_memoisation(false);
+        if (dynamic_cast<const NiftiImageData<float>&>(*Ty3_first)  != *Ty ||
+            dynamic_cast<const NiftiImageData<float>&>(*Ty3_second) != *Ty ||
+            dynamic_cast<const NiftiImageData<float>&>(*Ty3_scaled) != *Ty * 2.f)
+            throw std::runtime_error("NiftyResampler memoised forward gives wrong results.");
+
         std::cout << "// ----------------------------------------------------------------------- //\n";
         std::cout << "//                  Finished NiftyMoMo test.\n";
         std::cout << "//------------------------------------------------------------------------ //\n";
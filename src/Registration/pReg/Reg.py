@@ -952,20 +952,20 @@ class NiftyAladinSym(_NiftyRegistration):
         if self.handle is not None:
             pyiutil.deleteDataHandle(self.handle)
 
-    def get_transformation_matrix_forward(self):
+    def get_transformation_matrix_forward(self, idx=0):
         """Get forward transformation matrix."""
         if self.handle is None:
             raise AssertionError()
         tm = AffineTransformation()
-        tm.handle = pyreg.cReg_NiftyAladin_get_TM(self.handle, 'forward')
+        tm.handle = pyreg.cReg_NiftyAladin_get_TM(self.handle, 'forward', int(idx))
         return tm
 
-    def get_transformation_matrix_inverse(self):
+    def get_transformation_matrix_inverse(self, idx=0):
         """Get inverse transformation matrix."""
         if self.handle is None:
             raise AssertionError()
         tm = AffineTransformation()
-        tm.handle = pyreg.cReg_NiftyAladin_get_TM(self.handle, 'inverse')
+        tm.handle = pyreg.cReg_NiftyAladin_get_TM(self.handle, 'inverse', int(idx))
         return tm
 
     @staticmethod
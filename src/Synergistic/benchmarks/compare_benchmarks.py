@@ -0,0 +1,84 @@
+"""Compare two sirf_benchmarks result files.
+
+Usage:
+  compare_benchmarks [--help | options] <reference> <current>
+
+Arguments:
+  <reference>  JSON file written by sirf_benchmarks (e.g. for the previous release)
+  <current>    JSON file written by sirf_benchmarks for the build to check
+
+Options:
+  -t <tol>, --tolerance=<tol>  relative slow-down reported as a regression
+                               [default: 0.1]
+  -s <stat>, --statistic=<stat>  timing statistic to compare: min, median or mean
+                                 [default: median]
+
+Prints the ratio of the current to the reference timing of each benchmark
+present in both files (for the same number of threads), and exits with
+status 1 if any benchmark is slower by more than the tolerance.
+"""
+
+# SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+# Copyright 2021 University College London
+#
+# This is software developed for the Collaborative Computational
+# Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+# (http://www.ccpsynerbi.ac.uk/).
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# http://www.apache.org/licenses/LICENSE-2.0
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import json
+import sys
+
+
+def read_timings(filename, statistic):
+    """Returns a dictionary of the timings keyed by (name, threads)."""
+    with open(filename) as f:
+        results = json.load(f)['results']
+    return {(r['name'], r['threads']): r[statistic] for r in results}
+
+
+def main():
+    from docopt import docopt
+    args = docopt(__doc__)
+    tolerance = float(args['--tolerance'])
+    statistic = args['--statistic']
+    if statistic not in ('min', 'median', 'mean'):
+        raise ValueError('unknown statistic ' + statistic)
+
+    reference = read_timings(args['<reference>'], statistic)
+    current = read_timings(args['<current>'], statistic)
+
+    regressions = 0
+    print('%-40s %7s %12s %12s %8s' %
+          ('benchmark', 'threads', 'reference', 'current', 'ratio'))
+    for key in sorted(set(reference) & set(current)):
+        name, threads = key
+        ratio = current[key] / reference[key] if reference[key] > 0 else 1.0
+        slower = ratio > 1 + tolerance
+        regressions += slower
+        print('%-40s %7d %12.6f %12.6f %8.3f%s' %
+              (name, threads, reference[key], current[key], ratio,
+               '  <-- slower' if slower else ''))
+    for key in sorted(set(reference) ^ set(current)):
+        print('%s (%d threads) is only in %s' %
+              (key[0], key[1],
+               args['<reference>'] if key in reference else args['<current>']))
+
+    if regressions:
+        print('\n%d benchmark(s) slower by more than %g%%' %
+              (regressions, 100 * tolerance))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,376 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Synergistic
+\brief Benchmarks of frequently used SIRF operations.
+
+Times DataContainer algebra for all container types, MR forward and backward
+projections (Cartesian and, if available, radial phase encoding), coil sensitivity
+estimation, PET forward and backward projections on a small scanner,
+NiftyResampler forward and adjoint, and image conversion between the engines.
+Each benchmark is run once to warm up and then timed a number of times, for each
+of the requested numbers of threads. The timings are written to a JSON file,
+which can be compared with an earlier one by compare_benchmarks.py.
+
+The input data are those of the SIRF examples (found via SIRF_PATH).
+
+\author SyneRBI
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "sirf/common/getenv.h"
+#include "sirf/STIR/stir_x.h"
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/gadgetron_x.h"
+#include "sirf/Gadgetron/FourierEncoding.h"
+#include "sirf/Gadgetron/TrajectoryPreparation.h"
+#if GADGETRON_TOOLBOXES_AVAILABLE
+#include "sirf/Gadgetron/NonCartesianEncoding.h"
+#endif
+#include "sirf/Reg/NiftiImageData3D.h"
+#include "sirf/Reg/NiftyResampler.h"
+#include "sirf/Reg/AffineTransformation.h"
+
+using namespace sirf;
+
+/// Timings of a benchmark with a given number of threads
+struct BenchmarkResult {
+    std::string name;
+    int threads;
+    std::vector<double> seconds;
+};
+
+/// Runs benchmarks and collects their timings
+class Benchmarks {
+public:
+    Benchmarks(const int repeats, const std::string &filter) :
+        _repeats(repeats), _filter(filter), _threads(1) {}
+
+    /// Sets the number of threads used by the following benchmarks
+    void set_threads(const int threads)
+    {
+        _threads = threads;
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+    }
+
+    /// Runs f once to warm up, then times it (unless name does not contain the filter)
+    void run(const std::string &name, const std::function<void()> &f)
+    {
+        if (!_filter.empty() && name.find(_filter) == std::string::npos)
+            return;
+        f();
+        BenchmarkResult result;
+        result.name = name;
+        result.threads = _threads;
+        for (int i=0; i<_repeats; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            f();
+            const auto stop = std::chrono::steady_clock::now();
+            result.seconds.push_back(std::chrono::duration<double>(stop - start).count());
+        }
+        std::cout << std::left << std::setw(40) << name << std::right << std::setw(4) << _threads
+                  << " threads: " << std::setw(12) << median(result.seconds) << " s\n";
+        _results.push_back(result);
+    }
+
+    /// Writes the timings (and their minimum, median and mean) to a JSON file
+    void write_json(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+            throw std::runtime_error("sirf_benchmarks: cannot write " + filename);
+        file << std::setprecision(9);
+        file << "{\n  \"format_version\": 1,\n";
+        file << "  \"repeats\": " << _repeats << ",\n";
+        file << "  \"results\": [";
+        for (size_t i=0; i<_results.size(); ++i) {
+            const BenchmarkResult &r = _results[i];
+            const double mean = std::accumulate(r.seconds.begin(), r.seconds.end(), 0.0) / r.seconds.size();
+            file << (i > 0 ? ",\n" : "\n");
+            file << "    {\"name\": \"" << r.name << "\", \"threads\": " << r.threads
+                 << ", \"min\": " << *std::min_element(r.seconds.begin(), r.seconds.end())
+                 << ", \"median\": " << median(r.seconds)
+                 << ", \"mean\": " << mean
+                 << ", \"seconds\": [";
+            for (size_t j=0; j<r.seconds.size(); ++j)
+                file << (j > 0 ? ", " : "") << r.seconds[j];
+            file << "]}";
+        }
+        file << "\n  ]\n}\n";
+    }
+
+private:
+    static double median(std::vector<double> v)
+    {
+        std::sort(v.begin(), v.end());
+        const size_t n = v.size();
+        return n % 2 ? v[n/2] : 0.5 * (v[n/2 - 1] + v[n/2]);
+    }
+
+    int _repeats;
+    std::string _filter;
+    int _threads;
+    std::vector<BenchmarkResult> _results;
+};
+
+/// Benchmarks the algebra of the container type of x
+static void benchmark_algebra(Benchmarks &b, const std::string &prefix, const DataContainer &x)
+{
+    std::shared_ptr<DataContainer> sptr_y(x.clone());
+    std::shared_ptr<DataContainer> sptr_z(x.clone());
+    DataContainer &y = *sptr_y;
+    DataContainer &z = *sptr_z;
+    const float a = 2.f, c = -1.f;
+    const std::complex<float> ca(2.f), cc(-1.f);
+    const void *ptr_a = x.is_complex() ? static_cast<const void*>(&ca) : static_cast<const void*>(&a);
+    const void *ptr_c = x.is_complex() ? static_cast<const void*>(&cc) : static_cast<const void*>(&c);
+
+    b.run(prefix + ".axpby",    [&]() { z.axpby(ptr_a, x, ptr_c, y); });
+    b.run(prefix + ".multiply", [&]() { z.multiply(x, y); });
+    b.run(prefix + ".dot",      [&]() { std::complex<float> d; x.dot(y, &d); });
+    b.run(prefix + ".norm",     [&]() { x.norm(); });
+}
+
+/// Benchmarks the MR acquisition model and coil sensitivities estimation for the given encoding
+static void benchmark_mr(Benchmarks &b, const std::string &prefix,
+                         std::shared_ptr<MRAcquisitionData> sptr_ad,
+                         std::shared_ptr<FourierEncoding> sptr_enc)
+{
+    std::shared_ptr<CoilSensitivitiesVector> sptr_csm = std::make_shared<CoilSensitivitiesVector>();
+    sptr_csm->calculate(*sptr_ad);
+    b.run(prefix + ".csm_calculate", [&]() { sptr_csm->calculate(*sptr_ad); });
+
+    std::shared_ptr<GadgetronImageData> sptr_template(new GadgetronImagesVector);
+    MRAcquisitionModel am;
+    am.set_up(sptr_ad, sptr_template);
+    am.set_csm(sptr_csm);
+    if (sptr_enc)
+        am.set_encoder(sptr_enc);
+
+    std::shared_ptr<GadgetronImageData> sptr_image = am.bwd(*sptr_ad);
+    b.run(prefix + ".bwd", [&]() { am.bwd(*sptr_ad); });
+    b.run(prefix + ".fwd", [&]() { am.fwd(*sptr_image); });
+}
+
+/// print usage
+void print_usage()
+{
+    std::cout << "\n*** sirf_benchmarks usage ***\n";
+
+    // Optional flags
+    std::cout << "\n  Optional flags:\n";
+    std::cout << "    -data:\t\tSIRF source directory (default: $SIRF_PATH)\n";
+    std::cout << "    -out:\t\toutput JSON file (default: sirf_benchmarks.json)\n";
+    std::cout << "    -threads:\t\tcomma-separated numbers of threads (default: 1,max)\n";
+    std::cout << "    -repeats:\t\ttimed runs of each benchmark (default: 5)\n";
+    std::cout << "    -filter:\t\tonly run benchmarks whose name contains this string\n";
+}
+
+/// throw error
+void err(const std::string &message)
+{
+    std::cerr << "\n" << message << "\n";
+    exit(EXIT_FAILURE);
+}
+
+/// main
+int main(int argc, char* argv[])
+{
+    try {
+
+        std::string SIRF_PATH = sirf::getenv("SIRF_PATH");
+        std::string out_filename = "sirf_benchmarks.json";
+        std::string filter = "";
+        int repeats = 5;
+        std::vector<int> threads;
+
+        // Loop over all input arguments (ignore first argument (name of executable))
+        argc--; argv++;
+        while (argc>0) {
+            if (strcmp(argv[0], "-h") == 0) {
+                print_usage();
+                exit(EXIT_SUCCESS);
+            }
+            if (argc<2)
+                err(std::string("Option '") + argv[0] + "' expects an argument.");
+            if (strcmp(argv[0], "-data") == 0)
+                SIRF_PATH = argv[1];
+            else if (strcmp(argv[0], "-out") == 0)
+                out_filename = argv[1];
+            else if (strcmp(argv[0], "-filter") == 0)
+                filter = argv[1];
+            else if (strcmp(argv[0], "-repeats") == 0)
+                repeats = std::stoi(argv[1]);
+            else if (strcmp(argv[0], "-threads") == 0) {
+                std::stringstream ss(argv[1]);
+                std::string n;
+                while (std::getline(ss, n, ','))
+                    threads.push_back(std::stoi(n));
+            }
+            else
+                err(std::string("Unknown option '") + argv[0] + "'.");
+            argc-=2; argv+=2;
+        }
+        if (SIRF_PATH.empty())
+            err("SIRF_PATH not defined, cannot find data (use -data).");
+        if (repeats < 1)
+            err("The number of repeats must be positive.");
+        if (threads.empty()) {
+            threads.push_back(1);
+#ifdef _OPENMP
+            if (omp_get_max_threads() > 1)
+                threads.push_back(omp_get_max_threads());
+#endif
+        }
+
+        // suppress STIR info output
+        TextWriter w; // create writer with no output
+        TextWriterHandle h;
+        h.set_information_channel(&w);
+
+        // ------------------------------------------------------------------ //
+        // Input data (read once, outside the timings)
+        // ------------------------------------------------------------------ //
+
+        // PET: a small scanner, data and images stored in memory
+        PETAcquisitionDataInMemory::set_as_template();
+        stir::shared_ptr<stir::ExamInfo> sptr_ei(new stir::ExamInfo());
+        sptr_ei->imaging_modality = stir::ImagingModality::PT;
+        stir::shared_ptr<PETAcquisitionData> sptr_pet_ad
+            (new PETAcquisitionDataInMemory(sptr_ei, "ECAT 953", 3, -1, 2));
+        sptr_pet_ad->fill(1.0f);
+        stir::shared_ptr<STIRImageData> sptr_pet_image(new STIRImageData(*sptr_pet_ad));
+        sptr_pet_image->fill(1.0f);
+        stir::shared_ptr<RayTracingMatrix> sptr_matrix(new RayTracingMatrix);
+        PETAcquisitionModelUsingMatrix pet_am;
+        pet_am.set_matrix(sptr_matrix);
+        if (pet_am.set_up(sptr_pet_ad, sptr_pet_image) != stir::Succeeded::yes)
+            throw std::runtime_error("sirf_benchmarks: PET acquisition model set-up failed");
+        stir::shared_ptr<PETAcquisitionData> sptr_pet_fwd = pet_am.forward(*sptr_pet_image);
+
+        // MR: simulated Cartesian data
+        std::shared_ptr<AcquisitionsVector> sptr_mr_cart(new AcquisitionsVector);
+        sptr_mr_cart->read(SIRF_PATH + "/data/examples/MR/simulated_MR_2D_cartesian.h5");
+        sptr_mr_cart->sort();
+
+        std::shared_ptr<GadgetronImageData> sptr_mr_image;
+        {
+            std::shared_ptr<CoilSensitivitiesVector> sptr_csm = std::make_shared<CoilSensitivitiesVector>();
+            sptr_csm->calculate(*sptr_mr_cart);
+            MRAcquisitionModel am;
+            am.set_up(sptr_mr_cart, std::shared_ptr<GadgetronImageData>(new GadgetronImagesVector));
+            am.set_csm(sptr_csm);
+            sptr_mr_image = am.bwd(*sptr_mr_cart);
+        }
+
+#if GADGETRON_TOOLBOXES_AVAILABLE
+        // MR: radial phase encoding data (downloaded from zenodo when building the tests)
+        const std::string rpe_filename = SIRF_PATH + "/data/examples/MR/zenodo/3D_RPE_Lowres.h5";
+        std::shared_ptr<AcquisitionsVector> sptr_mr_rpe;
+        if (boost::filesystem::exists(rpe_filename)) {
+            sptr_mr_rpe.reset(new AcquisitionsVector);
+            sptr_mr_rpe->read(rpe_filename);
+            sptr_mr_rpe->sort();
+            GRPETrajectoryPrep rpe_tp;
+            rpe_tp.set_trajectory(*sptr_mr_rpe);
+        }
+        else
+            std::cout << "\n" << rpe_filename << " not found, skipping radial phase encoding benchmarks.\n";
+#endif
+
+        // Registration: NIfTI image resampled with an affine transformation
+        const std::string examples_path = SIRF_PATH + "/data/examples/Registration";
+        std::shared_ptr<NiftiImageData3D<float> > sptr_nifti
+            = std::make_shared<NiftiImageData3D<float> >(examples_path + "/test.nii.gz");
+        float tm[4][4] = {{1.f, 0.f, 0.f, 2.f}, {0.f, 1.f, 0.f, -1.f}, {0.f, 0.f, 1.f, 1.f}, {0.f, 0.f, 0.f, 1.f}};
+        std::shared_ptr<AffineTransformation<float> > sptr_tm = std::make_shared<AffineTransformation<float> >(tm);
+        NiftyResampler<float> resampler;
+        resampler.set_reference_image(sptr_nifti);
+        resampler.set_floating_image(sptr_nifti);
+        resampler.add_transformation(sptr_tm);
+        resampler.set_interpolation_type_to_linear();
+        resampler.set_up();
+        std::shared_ptr<ImageData> sptr_resampled = sptr_nifti->clone();
+
+        // ------------------------------------------------------------------ //
+        // Benchmarks
+        // ------------------------------------------------------------------ //
+
+        Benchmarks b(repeats, filter);
+        for (size_t t=0; t<threads.size(); ++t) {
+            b.set_threads(threads[t]);
+
+            benchmark_algebra(b, "algebra.PETAcquisitionData", *sptr_pet_ad);
+            benchmark_algebra(b, "algebra.STIRImageData", *sptr_pet_image);
+            benchmark_algebra(b, "algebra.MRAcquisitionData", *sptr_mr_cart);
+            benchmark_algebra(b, "algebra.GadgetronImagesVector", *sptr_mr_image);
+            benchmark_algebra(b, "algebra.NiftiImageData", *sptr_nifti);
+
+            b.run("pet.forward", [&]() { pet_am.forward(*sptr_pet_image); });
+            b.run("pet.backward", [&]() { pet_am.backward(*sptr_pet_fwd); });
+
+            benchmark_mr(b, "mr.cartesian", sptr_mr_cart, std::shared_ptr<FourierEncoding>());
+#if GADGETRON_TOOLBOXES_AVAILABLE
+            if (sptr_mr_rpe)
+                benchmark_mr(b, "mr.rpe", sptr_mr_rpe, std::make_shared<RPEFourierEncoding>());
+#endif
+
+            b.run("reg.resampler_forward", [&]() { resampler.forward(sptr_resampled, sptr_nifti); });
+            b.run("reg.resampler_adjoint", [&]() { resampler.adjoint(sptr_resampled, sptr_nifti); });
+
+            b.run("convert.STIR_to_Nifti", [&]() { NiftiImageData3D<float> im(*sptr_pet_image); });
+            b.run("convert.Nifti_to_STIR", [&]() { STIRImageData im(*sptr_nifti); });
+            b.run("convert.Gadgetron_to_Nifti", [&]() { NiftiImageData3D<float> im(*sptr_mr_image); });
+        }
+
+        b.write_json(out_filename);
+        std::cout << "\nTimings written to " << out_filename << "\n";
+    }
+
+    // If there was an error
+    catch(const std::exception &error) {
+        std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
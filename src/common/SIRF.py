@@ -21,7 +21,10 @@ Object-Oriented wrap for the cSIRF-to-Python interface pysirf.py
 ##   limitations under the License.
 
 import abc
+import atexit
+import json
 import numpy
+import os
 try:
     import pylab
     HAVE_PYLAB = True
@@ -42,6 +45,104 @@ if sys.version_info[0] >= 3 and sys.version_info[1] >= 4:
 else:
     ABC = abc.ABCMeta('ABC', (), {})
 
+
+# the SIRF libraries are static, so each SIRF Python module has its own profiler
+_PROFILED_MODULES = (('sirf.pysirf', 'cSIRF_'), ('sirf.pystir', 'cSTIR_'),
+                     ('sirf.pygadgetron', 'cGT_'), ('sirf.pyreg', 'cReg_'))
+
+
+def _profiled_modules():
+    return [(i, sys.modules[name], prefix)
+            for i, (name, prefix) in enumerate(_PROFILED_MODULES)
+            if name in sys.modules]
+
+
+def set_profiling(on=True):
+    """Switches the recording of timings and counters of SIRF operations on or off.
+
+    Applies to all SIRF Python modules, including those imported later.
+    """
+    os.environ['SIRF_PROFILING'] = '1' if on else '0'
+    for _, module, prefix in _profiled_modules():
+        try_calling(getattr(module, prefix + 'setProfiling')(int(on)))
+
+
+def reset_profiling():
+    """Discards the timings and counters recorded so far."""
+    for _, module, prefix in _profiled_modules():
+        try_calling(getattr(module, prefix + 'resetProfiling')())
+
+
+def profile(format='json'):
+    """Returns the recorded timings and counters of all SIRF Python modules.
+
+    format: 'json' for a dictionary of counters per operation, or 'chrome'
+    for a dictionary holding the trace of the timed calls in the Chrome trace
+    event format (one process per SIRF module)
+    """
+    if format not in ('json', 'chrome'):
+        raise error('unknown profile format ' + repr(format))
+    records = {}
+    events = []
+    for i, module, prefix in _profiled_modules():
+        h = getattr(module, prefix + 'profile')(format)
+        check_status(h)
+        report = json.loads(pyiutil.charDataFromHandle(h))
+        pyiutil.deleteDataHandle(h)
+        if format == 'chrome':
+            events.append({'name': 'process_name', 'ph': 'M', 'pid': i,
+                           'args': {'name': _PROFILED_MODULES[i][0]}})
+            for event in report['traceEvents']:
+                event['pid'] = i
+                events.append(event)
+            continue
+        for name, r in report.items():
+            total = records.get(name)
+            if total is None:
+                records[name] = r
+                continue
+            if r['calls'] > 0:
+                if total['calls'] > 0:
+                    total['min_seconds'] = min(total['min_seconds'],
+                                               r['min_seconds'])
+                else:
+                    total['min_seconds'] = r['min_seconds']
+                total['max_seconds'] = max(total['max_seconds'],
+                                           r['max_seconds'])
+            for key in ('calls', 'seconds', 'bytes',
+                        'allocations', 'allocated_bytes'):
+                total[key] += r[key]
+    if format == 'chrome':
+        return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+    return records
+
+
+def write_profile(filename, format='json'):
+    """Writes the recorded timings and counters of all SIRF Python modules.
+
+    format: 'json' for a summary per operation, or 'chrome' for a trace of
+    the timed calls viewable with chrome://tracing or https://ui.perfetto.dev
+    """
+    records = profile(format)
+    with open(filename, 'w') as file:
+        json.dump(records, file, indent=2)
+
+
+def _write_profiles_at_exit(summary_file, trace_file):
+    if summary_file:
+        write_profile(summary_file, 'json')
+    if trace_file:
+        write_profile(trace_file, 'chrome')
+
+
+# SIRF_PROFILING and SIRF_PROFILING_TRACE may name the files to write at exit
+_summary_file = os.environ.get('SIRF_PROFILING', '')
+if _summary_file in ('0', '1'):
+    _summary_file = ''
+_trace_file = os.environ.get('SIRF_PROFILING_TRACE', '')
+if _summary_file or _trace_file:
+    atexit.register(_write_profiles_at_exit, _summary_file, _trace_file)
+
 class DataContainer(ABC):
     '''
     Abstract base class for an abstract data container.
@@ -719,6 +820,216 @@ class DataHandleVector(object):
         try_calling(pysirf.cSIRF_DataHandleVector_push_back(self.handle, handle))
         check_status(self.handle)
 
+class ImagePrior(ABC):
+    """
+    Engine-agnostic neighbourhood prior for 3D ImageData of real values.
+
+    The prior value for an image x is
+        beta/2 sum_j sum_{k in N_j} w_jk kappa_j kappa_k a_jk phi(x_j, x_k),
+    where N_j are the neighbours of voxel j, w_jk are inverse distance
+    weights, kappa is an optional penalty weight image, a_jk are optional
+    anatomical similarity weights and phi is the potential of the prior.
+    """
+    def __init__(self):
+        self.handle = pysirf.cSIRF_newObject(self.name)
+        check_status(self.handle)
+
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def _set_parameter(self, name, handle):
+        try_calling(pysirf.cSIRF_ImagePrior_setParameter(
+            self.handle, name, handle))
+
+    def _set_float_parameter(self, name, value):
+        h = pyiutil.floatDataHandle(float(value))
+        self._set_parameter(name, h)
+        pyiutil.deleteDataHandle(h)
+
+    def set_penalisation_factor(self, value):
+        """Sets the penalisation factor beta."""
+        self._set_float_parameter('penalisation_factor', value)
+
+    def set_only_2D(self, only_2D):
+        """Use only the neighbours in the same z-plane if only_2D is True."""
+        h = pyiutil.intDataHandle(int(only_2D))
+        self._set_parameter('only_2D', h)
+        pyiutil.deleteDataHandle(h)
+
+    def set_kappa(self, kappa):
+        """Sets the penalty weight image kappa."""
+        assert_validity(kappa, ImageData)
+        self._set_parameter('kappa', kappa.handle)
+
+    def set_anatomical_image(self, image, sigma=None):
+        """
+        Sets the anatomical image u, giving the weights
+        exp(-(u_j - u_k)^2/(2 sigma^2)).
+        """
+        assert_validity(image, ImageData)
+        if sigma is not None:
+            self._set_float_parameter('anatomical_sigma', sigma)
+        self._set_parameter('anatomical_image', image.handle)
+
+    def value(self, image):
+        """Returns the prior value at image."""
+        assert_validity(image, ImageData)
+        handle = pysirf.cSIRF_ImagePrior_value(self.handle, image.handle)
+        check_status(handle)
+        v = pyiutil.floatDataFromHandle(handle)
+        pyiutil.deleteDataHandle(handle)
+        return v
+
+    def gradient(self, image, out=None):
+        """Returns the gradient of the prior at image."""
+        assert_validity(image, ImageData)
+        if out is None:
+            out = image.clone()
+        try_calling(pysirf.cSIRF_ImagePrior_gradient(
+            self.handle, image.handle, out.handle))
+        return out
+
+    def hessian_times(self, image, x, out=None):
+        """Returns the product of the Hessian of the prior at image with x."""
+        assert_validities(image, x)
+        if out is None:
+            out = image.clone()
+        try_calling(pysirf.cSIRF_ImagePrior_hessianTimes(
+            self.handle, image.handle, x.handle, out.handle))
+        return out
+
+    def hessian_diagonal(self, image, out=None):
+        """
+        Returns the diagonal of the Hessian of the prior at image
+        (its inverse can be used as a diagonal preconditioner).
+        """
+        assert_validity(image, ImageData)
+        if out is None:
+            out = image.clone()
+        try_calling(pysirf.cSIRF_ImagePrior_hessianDiagonal(
+            self.handle, image.handle, out.handle))
+        return out
+
+
+class QuadraticImagePrior(ImagePrior):
+    """Quadratic prior, phi(a, b) = (a - b)^2/2."""
+    def __init__(self):
+        self.name = 'QuadraticImagePrior'
+        super(QuadraticImagePrior, self).__init__()
+
+
+class RelativeDifferenceImagePrior(ImagePrior):
+    """
+    Relative difference prior,
+    phi(a, b) = (a - b)^2/(a + b + gamma |a - b| + epsilon).
+    """
+    def __init__(self):
+        self.name = 'RelativeDifferenceImagePrior'
+        super(RelativeDifferenceImagePrior, self).__init__()
+
+    def set_gamma(self, value):
+        self._set_float_parameter('gamma', value)
+
+    def set_epsilon(self, value):
+        self._set_float_parameter('epsilon', value)
+
+
+class LogCoshImagePrior(ImagePrior):
+    """Log-cosh prior, phi(a, b) = delta^2 log cosh((a - b)/delta)."""
+    def __init__(self):
+        self.name = 'LogCoshImagePrior'
+        super(LogCoshImagePrior, self).__init__()
+
+    def set_delta(self, value):
+        self._set_float_parameter('delta', value)
+
+
+class SmoothedTVImagePrior(ImagePrior):
+    """
+    Smoothed total variation prior,
+    phi(a, b) = sqrt((a - b)^2 + epsilon^2) - epsilon.
+    """
+    def __init__(self):
+        self.name = 'SmoothedTVImagePrior'
+        super(SmoothedTVImagePrior, self).__init__()
+
+    def set_epsilon(self, value):
+        self._set_float_parameter('epsilon', value)
+
+
+class WriteCompletion(object):
+    """Completion handle of a write by SnapshotWriter."""
+    def __init__(self, handle):
+        self.handle = handle
+
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def done(self):
+        """Returns True if the file has been written (or the write failed)."""
+        h = pysirf.cSIRF_WriteCompletion_isDone(self.handle)
+        check_status(h)
+        done = pyiutil.intDataFromHandle(h) != 0
+        pyiutil.deleteDataHandle(h)
+        return done
+
+    def wait(self):
+        """Waits for the file to be written, raises an error if the write failed."""
+        try_calling(pysirf.cSIRF_WriteCompletion_wait(self.handle))
+
+
+class SnapshotWriter(object):
+    """
+    Writes copies of data containers to files in a background thread,
+    e.g. to save the iterates of a reconstruction without waiting for the
+    files to be written.
+
+    At most max_in_flight copies are waiting or being written at any time:
+    write() waits for one of them to be written if needed.
+    """
+    def __init__(self, max_in_flight=2):
+        self.handle = pysirf.cSIRF_newObject('SnapshotWriter')
+        check_status(self.handle)
+        self.set_max_in_flight(max_in_flight)
+
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def set_max_in_flight(self, n):
+        h = pyiutil.intDataHandle(int(n))
+        try_calling(pysirf.cSIRF_SnapshotWriter_setParameter(
+            self.handle, 'max_in_flight', h))
+        pyiutil.deleteDataHandle(h)
+
+    def in_flight(self):
+        """Returns the number of copies waiting or being written."""
+        h = pysirf.cSIRF_SnapshotWriter_inFlight(self.handle)
+        check_status(h)
+        n = pyiutil.intDataFromHandle(h)
+        pyiutil.deleteDataHandle(h)
+        return n
+
+    def write(self, x, filename):
+        """
+        Writes a copy of DataContainer x to filename (as x.write() would)
+        and returns its WriteCompletion.
+        """
+        assert_validity(x, DataContainer)
+        h = pysirf.cSIRF_SnapshotWriter_write(self.handle, x.handle, filename)
+        check_status(h)
+        return WriteCompletion(h)
+
+    def wait_all(self):
+        """
+        Waits for all writes, raises an error if any of them failed
+        since the last call.
+        """
+        try_calling(pysirf.cSIRF_SnapshotWriter_waitAll(self.handle))
+
+
 class GeometricalInfo(object):
     """
     Get the geometrical information in LPS space. These are encoded
@@ -25,6 +25,9 @@ limitations under the License.
 #include "sirf/iUtilities/DataHandle.h"
 #include "sirf/common/DataContainer.h"
 #include "sirf/common/ImageData.h"
+#include "sirf/common/ImagePrior.h"
+#include "sirf/common/Profiler.h"
+#include "sirf/common/SnapshotWriter.h"
 #include "sirf/Syn/utilities.h"
 #include "sirf/common/deprecate.h"
 
@@ -56,6 +59,16 @@ void* cSIRF_newObject(const char* name)
 	try {
         if (strcmp(name, "DataHandleVector") == 0)
             return newObjectHandle(std::shared_ptr<DataHandleVector>(new DataHandleVector));
+		if (strcmp(name, "QuadraticImagePrior") == 0)
+			return newObjectHandle(std::shared_ptr<ImagePrior>(new QuadraticImagePrior));
+		if (strcmp(name, "RelativeDifferenceImagePrior") == 0)
+			return newObjectHandle(std::shared_ptr<ImagePrior>(new RelativeDifferenceImagePrior));
+		if (strcmp(name, "LogCoshImagePrior") == 0)
+			return newObjectHandle(std::shared_ptr<ImagePrior>(new LogCoshImagePrior));
+		if (strcmp(name, "SmoothedTVImagePrior") == 0)
+			return newObjectHandle(std::shared_ptr<ImagePrior>(new SmoothedTVImagePrior));
+		if (strcmp(name, "SnapshotWriter") == 0)
+			return NEW_OBJECT_HANDLE(SnapshotWriter);
 		return unknownObject("object", name, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -131,6 +144,7 @@ cSIRF_axpby(
 		void* h = x.new_data_container_handle();
 		DataContainer& z = objectFromHandle<DataContainer>(h);
 		z.xapyb(x, ptr_a, y, ptr_b);
+		z.mark_modified();
 		return h;
 	}
 	CATCH;
@@ -151,6 +165,7 @@ cSIRF_axpbyAlt(
 		DataContainer& z =
 			objectFromHandle<DataContainer >(ptr_z);
 		z.xapyb(x, ptr_a, y, ptr_b);
+		z.mark_modified();
 		return new DataHandle;
 	}
 	CATCH;
@@ -174,6 +189,7 @@ cSIRF_xapyb(
 		void* h = x.new_data_container_handle();
 		DataContainer& z = objectFromHandle<DataContainer>(h);
 		z.xapyb(x, a, y, b);
+		z.mark_modified();
 		return h;
 	}
 	CATCH;
@@ -198,6 +214,7 @@ cSIRF_xapybAlt(
 		DataContainer& z =
 			objectFromHandle<DataContainer >(ptr_z);
 		z.xapyb(x, a, y, b);
+		z.mark_modified();
 		return new DataHandle;
 	}
 	CATCH;
@@ -215,6 +232,7 @@ cSIRF_multiply(const void* ptr_x, const void* ptr_y, const void* ptr_z)
 		DataContainer& z =
 			objectFromHandle<DataContainer >(ptr_z);
 		z.multiply(x, y);
+		z.mark_modified();
 		return new DataHandle;
 	}
 	CATCH;
@@ -232,6 +250,7 @@ cSIRF_product(const void* ptr_x, const void* ptr_y)
 		void* h = x.new_data_container_handle();
 		DataContainer& z = objectFromHandle<DataContainer>(h);
 		z.multiply(x, y);
+		z.mark_modified();
 		return h;
 	}
 	CATCH;
@@ -249,6 +268,7 @@ cSIRF_divide(const void* ptr_x, const void* ptr_y, const void* ptr_z)
 		DataContainer& z =
 			objectFromHandle<DataContainer >(ptr_z);
 		z.divide(x, y);
+		z.mark_modified();
 		return new DataHandle;
 	}
 	CATCH;
@@ -266,6 +286,7 @@ cSIRF_ratio(const void* ptr_x, const void* ptr_y)
 		void* h = x.new_data_container_handle();
 		DataContainer& z = objectFromHandle<DataContainer>(h);
 		z.divide(x, y);
+		z.mark_modified();
 		return h;
 	}
 	CATCH;
@@ -297,6 +318,232 @@ cSIRF_clone(void* ptr_x)
 	CATCH;
 }
 
+extern "C"
+void*
+cSIRF_ImagePrior_setParameter(void* ptr_p, const char* name, const void* ptr_v)
+{
+	try {
+		ImagePrior& prior = objectFromHandle<ImagePrior>(ptr_p);
+		if (strcmp(name, "penalisation_factor") == 0)
+			prior.set_penalisation_factor(dataFromHandle<float>(ptr_v));
+		else if (strcmp(name, "only_2D") == 0)
+			prior.set_only_2D(dataFromHandle<int>(ptr_v) != 0);
+		else if (strcmp(name, "kappa") == 0) {
+			SPTR_FROM_HANDLE(ImageData, sptr_kappa, ptr_v);
+			prior.set_kappa(sptr_kappa);
+		}
+		else if (strcmp(name, "anatomical_image") == 0) {
+			SPTR_FROM_HANDLE(ImageData, sptr_anatomical, ptr_v);
+			prior.set_anatomical_image(sptr_anatomical);
+		}
+		else if (strcmp(name, "anatomical_sigma") == 0)
+			prior.set_anatomical_sigma(dataFromHandle<float>(ptr_v));
+		else if (strcmp(name, "gamma") == 0 &&
+			dynamic_cast<RelativeDifferenceImagePrior*>(&prior))
+			dynamic_cast<RelativeDifferenceImagePrior&>(prior).set_gamma
+			(dataFromHandle<float>(ptr_v));
+		else if (strcmp(name, "epsilon") == 0 &&
+			dynamic_cast<RelativeDifferenceImagePrior*>(&prior))
+			dynamic_cast<RelativeDifferenceImagePrior&>(prior).set_epsilon
+			(dataFromHandle<float>(ptr_v));
+		else if (strcmp(name, "epsilon") == 0 &&
+			dynamic_cast<SmoothedTVImagePrior*>(&prior))
+			dynamic_cast<SmoothedTVImagePrior&>(prior).set_epsilon
+			(dataFromHandle<float>(ptr_v));
+		else if (strcmp(name, "delta") == 0 &&
+			dynamic_cast<LogCoshImagePrior*>(&prior))
+			dynamic_cast<LogCoshImagePrior&>(prior).set_delta
+			(dataFromHandle<float>(ptr_v));
+		else
+			return unknownObject("parameter", name, __FILE__, __LINE__);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_ImagePrior_value(const void* ptr_p, const void* ptr_im)
+{
+	try {
+		const ImagePrior& prior = objectFromHandle<const ImagePrior>(ptr_p);
+		const ImageData& image = objectFromHandle<const ImageData>(ptr_im);
+		return dataHandle<float>(float(prior.value(image)));
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_ImagePrior_gradient(const void* ptr_p, const void* ptr_im, void* ptr_out)
+{
+	try {
+		const ImagePrior& prior = objectFromHandle<const ImagePrior>(ptr_p);
+		const ImageData& image = objectFromHandle<const ImageData>(ptr_im);
+		ImageData& out = objectFromHandle<ImageData>(ptr_out);
+		prior.gradient(out, image);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_ImagePrior_hessianTimes(const void* ptr_p, const void* ptr_im,
+	const void* ptr_in, void* ptr_out)
+{
+	try {
+		const ImagePrior& prior = objectFromHandle<const ImagePrior>(ptr_p);
+		const ImageData& image = objectFromHandle<const ImageData>(ptr_im);
+		const ImageData& input = objectFromHandle<const ImageData>(ptr_in);
+		ImageData& out = objectFromHandle<ImageData>(ptr_out);
+		prior.hessian_times(out, image, input);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_ImagePrior_hessianDiagonal(const void* ptr_p, const void* ptr_im, void* ptr_out)
+{
+	try {
+		const ImagePrior& prior = objectFromHandle<const ImagePrior>(ptr_p);
+		const ImageData& image = objectFromHandle<const ImageData>(ptr_im);
+		ImageData& out = objectFromHandle<ImageData>(ptr_out);
+		prior.hessian_diagonal(out, image);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_setProfiling(int on)
+{
+	try {
+		Profiler::instance().set_enabled(on != 0);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_resetProfiling()
+{
+	try {
+		Profiler::instance().reset();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_profile(const char* format)
+{
+	try {
+		std::string profile = Profiler::instance().report(format);
+		return charDataHandleFromCharData(profile.c_str());
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_writeProfile(const char* filename, const char* format)
+{
+	try {
+		if (strcmp(format, "json") == 0)
+			Profiler::instance().write_json(filename);
+		else if (strcmp(format, "chrome") == 0)
+			Profiler::instance().write_chrome_trace(filename);
+		else
+			return unknownObject("profile format", format, __FILE__, __LINE__);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_SnapshotWriter_setParameter(void* ptr_w, const char* name, const void* ptr_v)
+{
+	try {
+		SnapshotWriter& writer = objectFromHandle<SnapshotWriter>(ptr_w);
+		if (strcmp(name, "max_in_flight") == 0)
+			writer.set_max_in_flight(dataFromHandle<int>(ptr_v));
+		else
+			return unknownObject("parameter", name, __FILE__, __LINE__);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_SnapshotWriter_inFlight(const void* ptr_w)
+{
+	try {
+		const SnapshotWriter& writer = objectFromHandle<const SnapshotWriter>(ptr_w);
+		return dataHandle<int>(writer.in_flight());
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_SnapshotWriter_write(void* ptr_w, const void* ptr_x, const char* filename)
+{
+	try {
+		SnapshotWriter& writer = objectFromHandle<SnapshotWriter>(ptr_w);
+		const DataContainer& x = objectFromHandle<const DataContainer>(ptr_x);
+		std::shared_ptr<SnapshotWriter::Completion> sptr_c
+			(new SnapshotWriter::Completion(writer.write(x, filename)));
+		return newObjectHandle(sptr_c);
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_SnapshotWriter_waitAll(void* ptr_w)
+{
+	try {
+		SnapshotWriter& writer = objectFromHandle<SnapshotWriter>(ptr_w);
+		writer.wait_all();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_WriteCompletion_isDone(const void* ptr_c)
+{
+	try {
+		const SnapshotWriter::Completion& c =
+			objectFromHandle<const SnapshotWriter::Completion>(ptr_c);
+		return dataHandle<int>(c.wait_for(std::chrono::seconds(0)) ==
+			std::future_status::ready);
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSIRF_WriteCompletion_wait(const void* ptr_c)
+{
+	try {
+		const SnapshotWriter::Completion& c =
+			objectFromHandle<const SnapshotWriter::Completion>(ptr_c);
+		c.get();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cSIRF_DataHandleVector_push_back(void* self, void* to_append)
@@ -314,6 +561,7 @@ cSIRF_fillImageFromImage(void* ptr_im, const void* ptr_src)
 		ImageData& id = objectFromHandle<ImageData>(ptr_im);
 		ImageData& id_src = objectFromHandle<ImageData>(ptr_src);
 		id.fill(id_src);
+		id.mark_modified();
 		return new DataHandle;
 	}
     CATCH;
@@ -353,6 +601,7 @@ cSIRF_ImageData_reorient(void* im_ptr, void *geom_info_ptr)
         VoxelisedGeometricalInfo3D geom_info =
                 objectFromHandle<VoxelisedGeometricalInfo3D>(geom_info_ptr);
         id.reorient(geom_info);
+        id.mark_modified();
         return new DataHandle;
     }
     CATCH;
@@ -21,7 +21,10 @@ limitations under the License.
 #ifndef SIRF_ABSTRACT_DATA_CONTAINER_TYPE
 #define SIRF_ABSTRACT_DATA_CONTAINER_TYPE
 
+#include <chrono>
+#include <cstdint>
 #include <map>
+#include <random>
 #include "sirf/iUtilities/DataHandle.h"
 
 /*!
@@ -32,6 +35,15 @@ A class for a set of generally heterogeneous items of data.
 
 Has vector features: norm, dot product, linear combination,
 which rely on the same features of the items.
+
+Each container has a version number that changes whenever its data are
+modified by the container methods or the C interface. Version numbers
+are random 64-bit values, so that (with overwhelming probability) no two
+containers, or two states of one container, share a version, even if they
+were modified by different engine libraries (each of which is statically
+linked into its own Python module, so that a shared counter would not be
+shared). Code that modifies the data by other means (e.g. via iterators
+or pointers to the underlying engine data) should call mark_modified().
 */
 
 namespace sirf {
@@ -40,6 +52,13 @@ namespace sirf {
 
 	class DataContainer {
 	public:
+		DataContainer() : version_(new_version_()) {}
+		DataContainer(const DataContainer&) : version_(new_version_()) {}
+		DataContainer& operator=(const DataContainer&)
+		{
+			mark_modified();
+			return *this;
+		}
 		virtual ~DataContainer() {}
 		//virtual DataContainer* new_data_container() const = 0;
 		virtual ObjectHandle<DataContainer>* new_data_container_handle() const = 0;
@@ -77,8 +96,40 @@ namespace sirf {
 		{
 			return std::unique_ptr<DataContainer>(this->clone_impl());
 		}
+		/// Version of the data, changes every time the data are modified
+		uint64_t version() const
+		{
+			return version_;
+		}
+		/// Gives the data a new version
+		void mark_modified()
+		{
+			version_ = new_version_();
+		}
 	protected:
 		virtual DataContainer* clone_impl() const = 0;
+	private:
+		uint64_t version_;
+		static uint64_t new_version_()
+		{
+			// one generator per thread, seeded differently in each module and thread
+			thread_local std::mt19937_64 generator(new_generator_());
+			uint64_t version;
+			do
+				version = generator();
+			while (version == 0); // 0 means no version
+			return version;
+		}
+		static std::mt19937_64 new_generator_()
+		{
+			std::random_device device;
+			static const int module_tag = 0;
+			const uint64_t time = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+			const uint64_t address = reinterpret_cast<std::uintptr_t>(&module_tag);
+			std::seed_seq seq{ device(), device(), device(), device(),
+				uint32_t(time), uint32_t(time >> 32), uint32_t(address), uint32_t(address >> 32) };
+			return std::mt19937_64(seq);
+		}
 	};
 }
 
@@ -0,0 +1,147 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#ifndef SIRF_HALF_FLOAT
+#define SIRF_HALF_FLOAT
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*!
+\file
+\ingroup Common
+\brief Conversions between float and the 16-bit floating point formats.
+
+\author SyneRBI
+*/
+
+namespace sirf {
+
+	/*!
+	\ingroup Common
+	\brief Precision of the values stored by a data container.
+
+	half is IEEE 754 binary16 (11 significant bits, range 6e-8 to 65504),
+	bfloat16 has the range of float and 8 significant bits.
+	*/
+	enum class StoragePrecision { single, half, bfloat16 };
+
+	inline uint32_t float_bits(float v)
+	{
+		uint32_t u;
+		std::memcpy(&u, &v, sizeof(u));
+		return u;
+	}
+	inline float float_from_bits(uint32_t u)
+	{
+		float v;
+		std::memcpy(&v, &u, sizeof(v));
+		return v;
+	}
+
+	//! rounds to the nearest binary16 value (overflows to infinity)
+	inline uint16_t float_to_half(float v)
+	{
+		const uint32_t u = float_bits(v);
+		const uint16_t sign = (u >> 16) & 0x8000;
+		const uint32_t a = u & 0x7fffffff;
+		if (a >= 0x7f800000) // infinity or NaN
+			return sign | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0);
+		if (a >= 0x477ff000) // rounds to above 65504
+			return sign | 0x7c00;
+		if (a < 0x38800000) { // subnormal half
+			if (a < 0x33000000) // below half the smallest subnormal
+				return sign;
+			const uint32_t m = (a & 0x007fffff) | 0x00800000;
+			const int shift = 126 - int(a >> 23);
+			uint32_t h = m >> shift;
+			const uint32_t rest = m & ((1u << shift) - 1);
+			const uint32_t half_way = 1u << (shift - 1);
+			if (rest > half_way || (rest == half_way && (h & 1)))
+				h++;
+			return sign | uint16_t(h);
+		}
+		// normal: rebias the exponent and round off 13 mantissa bits
+		uint32_t h = ((a - 0x38000000) >> 13);
+		const uint32_t rest = a & 0x1fff;
+		if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+			h++;
+		return sign | uint16_t(h);
+	}
+	inline float half_to_float(uint16_t h)
+	{
+		const uint32_t sign = uint32_t(h & 0x8000) << 16;
+		const uint32_t e = (h >> 10) & 0x1f;
+		uint32_t m = h & 0x3ff;
+		if (e == 0x1f)
+			return float_from_bits(sign | 0x7f800000 | (m << 13));
+		if (e)
+			return float_from_bits(sign | ((e + 112) << 23) | (m << 13));
+		if (m == 0)
+			return float_from_bits(sign);
+		// subnormal half: normalise
+		int shift = 0;
+		while (!(m & 0x400)) {
+			m <<= 1;
+			shift++;
+		}
+		return float_from_bits(sign | uint32_t(113 - shift) << 23 | ((m & 0x3ff) << 13));
+	}
+
+	//! rounds to the nearest bfloat16 value
+	inline uint16_t float_to_bfloat16(float v)
+	{
+		const uint32_t u = float_bits(v);
+		if ((u & 0x7fffffff) > 0x7f800000) // NaN: keep it quiet
+			return uint16_t((u >> 16) | 0x40);
+		return uint16_t((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+	}
+	inline float bfloat16_to_float(uint16_t b)
+	{
+		return float_from_bits(uint32_t(b) << 16);
+	}
+
+	//! converts n floats to 16-bit values of the given precision (half or bfloat16)
+	inline void pack_16bit(StoragePrecision precision,
+		const float* src, uint16_t* dst, size_t n)
+	{
+		if (precision == StoragePrecision::half)
+			for (size_t i = 0; i < n; i++)
+				dst[i] = float_to_half(src[i]);
+		else
+			for (size_t i = 0; i < n; i++)
+				dst[i] = float_to_bfloat16(src[i]);
+	}
+	//! converts n 16-bit values of the given precision (half or bfloat16) to floats
+	inline void unpack_16bit(StoragePrecision precision,
+		const uint16_t* src, float* dst, size_t n)
+	{
+		if (precision == StoragePrecision::half)
+			for (size_t i = 0; i < n; i++)
+				dst[i] = half_to_float(src[i]);
+		else
+			for (size_t i = 0; i < n; i++)
+				dst[i] = bfloat16_to_float(src[i]);
+	}
+
+}
+
+#endif
@@ -129,6 +129,10 @@ namespace sirf {
         }
         /// Is complex? Unless overwridden (Gadgetron), assume not complex.
         virtual bool is_complex() const { return false; }
+        /// Voxel values if stored contiguously as floats (x varying fastest), otherwise null.
+        virtual const float* contiguous_float_data() const { return 0; }
+        /// As above, for modifying the voxel values (the image is marked as modified).
+        virtual float* contiguous_float_data() { return 0; }
         /// Reorient image. Requires that dimesions and spacing match
         virtual void reorient(const VoxelisedGeometricalInfo3D &);
         /// Can reorient? (check dimensions and spacing)
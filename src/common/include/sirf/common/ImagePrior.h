@@ -0,0 +1,632 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#ifndef SIRF_IMAGE_PRIOR
+#define SIRF_IMAGE_PRIOR
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "sirf/common/ImageData.h"
+
+/*!
+\file
+\ingroup Common
+\brief Engine-agnostic neighbourhood priors for 3D images.
+
+\author SyneRBI
+*/
+
+namespace sirf {
+
+	/*!
+	\ingroup Common
+	\brief Geometry of a 3D image stored contiguously with x varying fastest.
+	*/
+	struct ImagePriorGrid {
+		int nx, ny, nz;
+		float dx, dy, dz;
+		size_t size() const
+		{
+			return size_t(nx)*ny*nz;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Abstract base class for neighbourhood priors.
+
+	The prior value for an image x is
+
+	\f[ R(x) = \frac{\beta}{2} \sum_j \sum_{k \in N_j} w_{jk} \kappa_j \kappa_k a_{jk} \phi(x_j, x_k) \f]
+
+	where N_j are the 26 neighbours of voxel j (8 in-plane neighbours if only_2D is set),
+	w_{jk} is the inverse distance between the voxels (relative to the x voxel size),
+	\f$ \kappa \f$ is an optional spatially varying penalty weight, \f$ a_{jk} \f$ are
+	optional anatomical weights \f$ \exp(-(u_j - u_k)^2/(2\sigma^2)) \f$ computed from
+	an anatomical image u, and \f$ \phi \f$ is a symmetric potential defined by the
+	derived class.
+
+	The value, gradient, Hessian-vector product and the diagonal of the Hessian (the
+	inverse of which is a diagonal preconditioner) can be computed for any ImageData
+	of real values. Images providing contiguous float storage (see
+	ImageData::contiguous_float_data()) are used in place, others are copied.
+
+	The kernels process the image in blocks of rows (so that neighbouring rows stay in
+	cache) and, if built with OpenMP, in parallel.
+	*/
+	class ImagePrior {
+	public:
+		virtual ~ImagePrior() {}
+
+		void set_penalisation_factor(float beta)
+		{
+			beta_ = beta;
+		}
+		float get_penalisation_factor() const
+		{
+			return beta_;
+		}
+		//! use only the neighbours in the same z-plane
+		void set_only_2D(bool only_2D)
+		{
+			only_2D_ = only_2D;
+		}
+		bool get_only_2D() const
+		{
+			return only_2D_;
+		}
+		//! sets the penalty weight image (empty pointer to remove)
+		void set_kappa(std::shared_ptr<const ImageData> sptr_kappa)
+		{
+			sptr_kappa_ = sptr_kappa;
+		}
+		//! sets the anatomical image (empty pointer to remove)
+		void set_anatomical_image(std::shared_ptr<const ImageData> sptr_anatomical)
+		{
+			sptr_anatomical_ = sptr_anatomical;
+		}
+		//! sets the anatomical image and the width of its similarity weights
+		void set_anatomical_image(std::shared_ptr<const ImageData> sptr_anatomical, float sigma)
+		{
+			set_anatomical_sigma(sigma);
+			sptr_anatomical_ = sptr_anatomical;
+		}
+		//! sets the width of the anatomical similarity weights
+		void set_anatomical_sigma(float sigma)
+		{
+			if (sigma <= 0)
+				throw std::runtime_error("ImagePrior: anatomical sigma must be positive");
+			sigma_ = sigma;
+		}
+		float get_anatomical_sigma() const
+		{
+			return sigma_;
+		}
+
+		//! returns the prior value at image
+		double value(const ImageData& image) const
+		{
+			const ImagePriorGrid grid = grid_(image);
+			const Input x(image, grid);
+			const Weights w(*this, grid);
+			return value(grid, x.data(), w.kappa(), w.anatomical());
+		}
+		//! computes the gradient of the prior at image
+		void gradient(ImageData& grad, const ImageData& image) const
+		{
+			const ImagePriorGrid grid = grid_(image);
+			const Input x(image, grid);
+			const Weights w(*this, grid);
+			Output g(grad, grid);
+			gradient(grid, g.data(), x.data(), w.kappa(), w.anatomical());
+		}
+		//! computes the product of the Hessian of the prior at image with input
+		void hessian_times(ImageData& out, const ImageData& image, const ImageData& input) const
+		{
+			const ImagePriorGrid grid = grid_(image);
+			const Input x(image, grid);
+			const Input v(input, grid);
+			const Weights w(*this, grid);
+			Output h(out, grid);
+			hessian_times(grid, h.data(), x.data(), v.data(), w.kappa(), w.anatomical());
+		}
+		//! computes the diagonal of the Hessian of the prior at image
+		void hessian_diagonal(ImageData& out, const ImageData& image) const
+		{
+			const ImagePriorGrid grid = grid_(image);
+			const Input x(image, grid);
+			const Weights w(*this, grid);
+			Output d(out, grid);
+			hessian_diagonal(grid, d.data(), x.data(), w.kappa(), w.anatomical());
+		}
+
+		/* the same on contiguous arrays; kappa and anatomical may be null,
+		output arrays may not alias the inputs */
+		virtual double value(const ImagePriorGrid& grid, const float* x,
+			const float* kappa, const float* anatomical) const = 0;
+		virtual void gradient(const ImagePriorGrid& grid, float* grad, const float* x,
+			const float* kappa, const float* anatomical) const = 0;
+		virtual void hessian_times(const ImagePriorGrid& grid, float* out, const float* x,
+			const float* v, const float* kappa, const float* anatomical) const = 0;
+		virtual void hessian_diagonal(const ImagePriorGrid& grid, float* out, const float* x,
+			const float* kappa, const float* anatomical) const = 0;
+
+	protected:
+		float beta_ = 1.0f;
+		bool only_2D_ = false;
+		std::shared_ptr<const ImageData> sptr_kappa_;
+		std::shared_ptr<const ImageData> sptr_anatomical_;
+		float sigma_ = 1.0f;
+
+	private:
+		static ImagePriorGrid grid_(const ImageData& image)
+		{
+			if (image.is_complex())
+				throw std::runtime_error("ImagePrior: complex images are not supported");
+			std::shared_ptr<const VoxelisedGeometricalInfo3D> sptr_geom =
+				image.get_geom_info_sptr();
+			const VoxelisedGeometricalInfo3D::Size size = sptr_geom->get_size();
+			const VoxelisedGeometricalInfo3D::Spacing spacing = sptr_geom->get_spacing();
+			ImagePriorGrid grid;
+			grid.nx = int(size[0]);
+			grid.ny = int(size[1]);
+			grid.nz = int(size[2]);
+			grid.dx = spacing[0];
+			grid.dy = spacing[1];
+			grid.dz = spacing[2];
+			return grid;
+		}
+		static void check_size_(const ImageData& image, const ImagePriorGrid& grid)
+		{
+			const VoxelisedGeometricalInfo3D::Size size =
+				image.get_geom_info_sptr()->get_size();
+			if (int(size[0]) != grid.nx || int(size[1]) != grid.ny || int(size[2]) != grid.nz)
+				throw std::runtime_error("ImagePrior: image sizes differ");
+		}
+		// read access to the voxel values (copied if not stored contiguously)
+		class Input {
+		public:
+			Input(const ImageData& image, const ImagePriorGrid& grid)
+			{
+				check_size_(image, grid);
+				ptr_ = image.contiguous_float_data();
+				if (ptr_)
+					return;
+				copy_.reserve(grid.size());
+				ImageData::Iterator_const& end = image.end();
+				for (ImageData::Iterator_const& i = image.begin(); i != end; ++i)
+					copy_.push_back(float(*i));
+				if (copy_.size() != grid.size())
+					throw std::runtime_error("ImagePrior: only 3D images are supported");
+				ptr_ = &copy_[0];
+			}
+			const float* data() const
+			{
+				return ptr_;
+			}
+		private:
+			const float* ptr_;
+			std::vector<float> copy_;
+		};
+		// write access to the voxel values (copied back on destruction if not contiguous)
+		class Output {
+		public:
+			Output(ImageData& image, const ImagePriorGrid& grid) : image_(image)
+			{
+				check_size_(image, grid);
+				ptr_ = image.contiguous_float_data();
+				if (!ptr_) {
+					copy_.resize(grid.size());
+					ptr_ = &copy_[0];
+				}
+			}
+			~Output()
+			{
+				if (copy_.empty())
+					return;
+				ImageData::Iterator& end = image_.end();
+				size_t j = 0;
+				for (ImageData::Iterator& i = image_.begin(); i != end; ++i, ++j) {
+					FloatRef r(&copy_[j]);
+					*i = r;
+				}
+				image_.mark_modified();
+			}
+			float* data()
+			{
+				return ptr_;
+			}
+		private:
+			ImageData& image_;
+			float* ptr_;
+			std::vector<float> copy_;
+		};
+		class Weights {
+		public:
+			Weights(const ImagePrior& prior, const ImagePriorGrid& grid)
+			{
+				if (prior.sptr_kappa_)
+					kappa_.reset(new Input(*prior.sptr_kappa_, grid));
+				if (prior.sptr_anatomical_)
+					anatomical_.reset(new Input(*prior.sptr_anatomical_, grid));
+			}
+			const float* kappa() const
+			{
+				return kappa_ ? kappa_->data() : 0;
+			}
+			const float* anatomical() const
+			{
+				return anatomical_ ? anatomical_->data() : 0;
+			}
+		private:
+			std::unique_ptr<Input> kappa_;
+			std::unique_ptr<Input> anatomical_;
+		};
+	};
+
+	/*!
+	\ingroup Common
+	\brief Neighbourhood prior with the potential given by the template argument.
+
+	The potential class provides (for a = x_j, b = x_k) the methods value(a, b),
+	d1(a, b) (derivative with respect to a), d11(a, b) (second derivative with
+	respect to a) and d12(a, b) (mixed derivative).
+	*/
+	template<class Potential>
+	class NeighbourhoodImagePrior : public ImagePrior {
+	public:
+		using ImagePrior::value;
+		using ImagePrior::gradient;
+		using ImagePrior::hessian_times;
+		using ImagePrior::hessian_diagonal;
+
+		Potential& potential()
+		{
+			return potential_;
+		}
+		const Potential& potential() const
+		{
+			return potential_;
+		}
+
+		virtual double value(const ImagePriorGrid& grid, const float* x,
+			const float* kappa, const float* anatomical) const
+		{
+			return 0.5*beta_*apply_<VALUE>(grid, 0, x, 0, kappa, anatomical);
+		}
+		virtual void gradient(const ImagePriorGrid& grid, float* grad, const float* x,
+			const float* kappa, const float* anatomical) const
+		{
+			apply_<GRADIENT>(grid, grad, x, 0, kappa, anatomical);
+		}
+		virtual void hessian_times(const ImagePriorGrid& grid, float* out, const float* x,
+			const float* v, const float* kappa, const float* anatomical) const
+		{
+			apply_<HESSIAN_TIMES>(grid, out, x, v, kappa, anatomical);
+		}
+		virtual void hessian_diagonal(const ImagePriorGrid& grid, float* out, const float* x,
+			const float* kappa, const float* anatomical) const
+		{
+			apply_<HESSIAN_DIAGONAL>(grid, out, x, 0, kappa, anatomical);
+		}
+
+	protected:
+		Potential potential_;
+
+	private:
+		enum Mode { VALUE, GRADIENT, HESSIAN_TIMES, HESSIAN_DIAGONAL };
+		// rows of a block stay in cache while their neighbours are visited
+		static const int BLOCK_ROWS = 8;
+
+		struct Neighbour {
+			int dx, dy, dz;
+			float w;
+		};
+		std::vector<Neighbour> neighbours_(const ImagePriorGrid& grid) const
+		{
+			std::vector<Neighbour> nbrs;
+			const int dz_max = (only_2D_ || grid.nz == 1) ? 0 : 1;
+			for (int dz = -dz_max; dz <= dz_max; dz++)
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++) {
+						if (dx == 0 && dy == 0 && dz == 0)
+							continue;
+						const float d = std::sqrt(dx*dx*grid.dx*grid.dx +
+							dy*dy*grid.dy*grid.dy + dz*dz*grid.dz*grid.dz);
+						Neighbour n = { dx, dy, dz, grid.dx / d };
+						nbrs.push_back(n);
+					}
+			return nbrs;
+		}
+
+		/* For VALUE, returns the sum over voxels and neighbours (without beta/2);
+		otherwise, fills out (multiplied by beta). */
+		template<int mode>
+		double apply_(const ImagePriorGrid& grid, float* out, const float* x, const float* v,
+			const float* kappa, const float* anatomical) const
+		{
+			const std::vector<Neighbour> nbrs = neighbours_(grid);
+			const int nx = grid.nx;
+			const int ny = grid.ny;
+			const int nz = grid.nz;
+			const int num_y_blocks = (ny + BLOCK_ROWS - 1) / BLOCK_ROWS;
+			const int num_blocks = nz*num_y_blocks;
+			const float c = -0.5f / (sigma_*sigma_);
+			double sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:sum)
+#endif
+			for (int b = 0; b < num_blocks; b++) {
+				const int z = b / num_y_blocks;
+				const int y_start = (b % num_y_blocks)*BLOCK_ROWS;
+				const int y_stop = std::min(y_start + BLOCK_ROWS, ny);
+				std::vector<float> acc(nx);
+				for (int y = y_start; y < y_stop; y++) {
+					const size_t row = (size_t(z)*ny + y)*nx;
+					std::fill(acc.begin(), acc.end(), 0.0f);
+					for (size_t n = 0; n < nbrs.size(); n++) {
+						const Neighbour& nbr = nbrs[n];
+						const int zk = z + nbr.dz;
+						const int yk = y + nbr.dy;
+						if (zk < 0 || zk >= nz || yk < 0 || yk >= ny)
+							continue;
+						const size_t row_k = (size_t(zk)*ny + yk)*nx + nbr.dx;
+						const int x_start = std::max(0, -nbr.dx);
+						const int x_stop = std::min(nx, nx - nbr.dx);
+						for (int i = x_start; i < x_stop; i++) {
+							const size_t j = row + i;
+							const size_t k = row_k + i;
+							float w = nbr.w;
+							if (kappa)
+								w *= kappa[j] * kappa[k];
+							if (anatomical) {
+								const float t = anatomical[j] - anatomical[k];
+								w *= std::exp(c*t*t);
+							}
+							const float a = x[j];
+							const float bk = x[k];
+							switch (mode) {
+							case VALUE:
+								acc[i] += w*potential_.value(a, bk);
+								break;
+							case GRADIENT:
+								acc[i] += w*potential_.d1(a, bk);
+								break;
+							case HESSIAN_TIMES:
+								acc[i] += w*(potential_.d11(a, bk)*v[j] + potential_.d12(a, bk)*v[k]);
+								break;
+							case HESSIAN_DIAGONAL:
+								acc[i] += w*potential_.d11(a, bk);
+								break;
+							}
+						}
+					}
+					if (mode == VALUE)
+						for (int i = 0; i < nx; i++)
+							sum += acc[i];
+					else
+						for (int i = 0; i < nx; i++)
+							out[row + i] = beta_*acc[i];
+				}
+			}
+			return sum;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Quadratic potential \f$ (a - b)^2/2 \f$.
+	*/
+	class QuadraticPotential {
+	public:
+		float value(float a, float b) const
+		{
+			const float t = a - b;
+			return 0.5f*t*t;
+		}
+		float d1(float a, float b) const
+		{
+			return a - b;
+		}
+		float d11(float, float) const
+		{
+			return 1.0f;
+		}
+		float d12(float, float) const
+		{
+			return -1.0f;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Relative difference potential \f$ (a - b)^2/(a + b + \gamma |a - b| + \epsilon) \f$.
+
+	Intended for non-negative images.
+	*/
+	class RelativeDifferencePotential {
+	public:
+		float gamma = 2.0f;
+		float epsilon = 1e-6f;
+		float value(float a, float b) const
+		{
+			const float t = a - b;
+			const float d = denominator_(a, b);
+			return d > 0 ? t*t / d : 0.0f;
+		}
+		float d1(float a, float b) const
+		{
+			const float t = a - b;
+			const float d = denominator_(a, b);
+			return d > 0 ? t*(a + 3*b + gamma*std::abs(t) + 2*epsilon) / (d*d) : 0.0f;
+		}
+		float d11(float a, float b) const
+		{
+			const float d = denominator_(a, b);
+			const float s = 2*b + epsilon;
+			return d > 0 ? 2*s*s / (d*d*d) : 0.0f;
+		}
+		float d12(float a, float b) const
+		{
+			const float d = denominator_(a, b);
+			return d > 0 ? -2*(2*a + epsilon)*(2*b + epsilon) / (d*d*d) : 0.0f;
+		}
+	private:
+		float denominator_(float a, float b) const
+		{
+			return a + b + gamma*std::abs(a - b) + epsilon;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Log-cosh potential \f$ \delta^2 \log\cosh((a - b)/\delta) \f$.
+
+	Quadratic for differences much smaller than \f$ \delta \f$, linear for larger ones.
+	*/
+	class LogCoshPotential {
+	public:
+		float delta = 1.0f;
+		float value(float a, float b) const
+		{
+			const float u = std::abs(a - b) / delta;
+			// log(cosh(u)) computed without overflow
+			return delta*delta*(u + std::log1p(std::exp(-2*u)) - std::log(2.0f));
+		}
+		float d1(float a, float b) const
+		{
+			return delta*std::tanh((a - b) / delta);
+		}
+		float d11(float a, float b) const
+		{
+			const float th = std::tanh((a - b) / delta);
+			return 1 - th*th;
+		}
+		float d12(float a, float b) const
+		{
+			return -d11(a, b);
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Smoothed total variation potential \f$ \sqrt{(a - b)^2 + \epsilon^2} - \epsilon \f$.
+
+	This is the (anisotropic) total variation of the differences with the neighbours,
+	made differentiable by \f$ \epsilon > 0 \f$.
+	*/
+	class SmoothedTVPotential {
+	public:
+		float epsilon = 1e-3f;
+		float value(float a, float b) const
+		{
+			const float t = a - b;
+			return std::sqrt(t*t + epsilon*epsilon) - epsilon;
+		}
+		float d1(float a, float b) const
+		{
+			const float t = a - b;
+			return t / std::sqrt(t*t + epsilon*epsilon);
+		}
+		float d11(float a, float b) const
+		{
+			const float t = a - b;
+			const float s = std::sqrt(t*t + epsilon*epsilon);
+			return epsilon*epsilon / (s*s*s);
+		}
+		float d12(float a, float b) const
+		{
+			return -d11(a, b);
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Quadratic prior.
+	*/
+	typedef NeighbourhoodImagePrior<QuadraticPotential> QuadraticImagePrior;
+
+	/*!
+	\ingroup Common
+	\brief Relative difference prior.
+	*/
+	class RelativeDifferenceImagePrior :
+		public NeighbourhoodImagePrior<RelativeDifferencePotential> {
+	public:
+		void set_gamma(float gamma)
+		{
+			potential_.gamma = gamma;
+		}
+		float get_gamma() const
+		{
+			return potential_.gamma;
+		}
+		void set_epsilon(float epsilon)
+		{
+			potential_.epsilon = epsilon;
+		}
+		float get_epsilon() const
+		{
+			return potential_.epsilon;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Log-cosh prior.
+	*/
+	class LogCoshImagePrior : public NeighbourhoodImagePrior<LogCoshPotential> {
+	public:
+		void set_delta(float delta)
+		{
+			if (delta <= 0)
+				throw std::runtime_error("LogCoshImagePrior: delta must be positive");
+			potential_.delta = delta;
+		}
+		float get_delta() const
+		{
+			return potential_.delta;
+		}
+	};
+
+	/*!
+	\ingroup Common
+	\brief Smoothed total variation prior.
+	*/
+	class SmoothedTVImagePrior : public NeighbourhoodImagePrior<SmoothedTVPotential> {
+	public:
+		void set_epsilon(float epsilon)
+		{
+			if (epsilon <= 0)
+				throw std::runtime_error("SmoothedTVImagePrior: epsilon must be positive");
+			potential_.epsilon = epsilon;
+		}
+		float get_epsilon() const
+		{
+			return potential_.epsilon;
+		}
+	};
+}
+
+#endif
@@ -20,8 +20,12 @@ limitations under the License.
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 
@@ -36,91 +40,180 @@ namespace sirf {
 	template<class value_type>
 	class JacobiCG {
 	public:
-		/* This simplified version does fixed number of iterations. */
-		JacobiCG() : nit_(10) {}
+		/* This simplified version does fixed number of iterations,
+		   unless a tolerance is set (see set_tolerance). */
+		JacobiCG() : nit_(10), tol_(0) {}
 		void set_num_iterations(int nit)
 		{
 			nit_ = nit;
 		}
+		/* Iterations stop once the relative change in the eigenvalue
+		   estimate falls below tol (0, the default, means never). */
+		void set_tolerance(float tol)
+		{
+			tol_ = tol;
+		}
+		/* Number of iterations performed by the last call to largest
+		   (the maximum over operators for several operators). */
+		int num_iterations_done() const
+		{
+			return nit_done_;
+		}
 
-		/* Computes the largest eigenvalue of a positive semi-definite operator */
+		/* Computes the largest eigenvalue of a positive semi-definite operator.
+		   On return, x is the corresponding (normalized) eigenvector estimate,
+		   which can be used as the initial guess for a similar operator. */
 		template<class vector_type>
 		float largest(Operator<vector_type>& A,
 			vector_type& x /*non-zero initial guess*/, int verb=0)
 		{
-			value_type lmd;
+			State_<vector_type> st;
+			start_(A, x, st);
+			while (!st.done && st.it < nit_)
+				step_(A, x, st, verb);
+			nit_done_ = st.it;
+			return abs(st.lmd);
+		}
+
+		/* Computes the largest eigenvalues of several positive semi-definite
+		   operators (e.g. one per subset) in lock-step: each iteration applies
+		   each operator to its own vector, so nothing is shared between the
+		   operators but the iteration loop. Operators whose eigenvalue
+		   estimates have converged (see set_tolerance) are not applied any more. */
+		template<class vector_type>
+		std::vector<float> largest(const std::vector<Operator<vector_type>*>& A,
+			const std::vector<vector_type*>& x /*non-zero initial guesses*/, int verb=0)
+		{
+			if (A.size() != x.size())
+				throw std::runtime_error
+				("JacobiCG::largest: numbers of operators and initial guesses differ");
+			const size_t n = A.size();
+			std::vector<State_<vector_type> > st(n);
+			for (size_t i = 0; i < n; i++)
+				start_(*A[i], *x[i], st[i]);
+			for (int it = 0; it < nit_; it++) {
+				bool done = true;
+				for (size_t i = 0; i < n; i++) {
+					if (st[i].done)
+						continue;
+					if (verb > 0)
+						std::cout << "operator " << i << ", ";
+					step_(*A[i], *x[i], st[i], verb);
+					done = done && st[i].done;
+				}
+				if (done)
+					break;
+			}
+			std::vector<float> lmd(n);
+			nit_done_ = 0;
+			for (size_t i = 0; i < n; i++) {
+				lmd[i] = abs(st[i].lmd);
+				nit_done_ = std::max(nit_done_, st[i].it);
+			}
+			return lmd;
+		}
+	private:
+		/* Work vectors and scalars of one eigenvalue computation. */
+		template<class vector_type>
+		struct State_ {
+			std::unique_ptr<vector_type> y;
+			std::unique_ptr<vector_type> z;
+			std::unique_ptr<vector_type> w;
+			std::unique_ptr<vector_type> Az;
+			std::shared_ptr<vector_type> Ax;
+			value_type lmd = 0;
+			int it = 0;
+			bool done = false;
+		};
+
+		template<class vector_type>
+		void start_(Operator<vector_type>& A, vector_type& x, State_<vector_type>& st) const
+		{
+			st.y = x.clone();
+			st.z = x.clone();
+			st.w = x.clone();
+			st.Az = x.clone();
+			float s = sqrt(abs(x.dot(x)));
+			x.scale(s);
+			st.Ax = A(x);
+			st.lmd = st.Ax->dot(x);
+		}
+
+		/* Performs one iteration. */
+		template<class vector_type>
+		void step_(Operator<vector_type>& A, vector_type& x, State_<vector_type>& st, int verb) const
+		{
 			value_type a[] = { 0, 0, 0, 0 };
 			value_type mu[2];
 			value_type u[2];
 			value_type v[2];
-			value_type zero = 0;
 			value_type t;
+			float s;
 
-			std::unique_ptr<vector_type> uptr_y = x.clone();
-			vector_type& y = *uptr_y;
-			std::unique_ptr<vector_type> uptr_z = x.clone();
-			vector_type& z = *uptr_z;
-			std::unique_ptr<vector_type> uptr_w = x.clone();
-			vector_type& w = *uptr_w;
-			std::unique_ptr<vector_type> uptr_Az = x.clone();
-			vector_type& Az = *uptr_Az;
-
-			float s = sqrt(abs(x.dot(x)));
-			x.scale(s);
-			std::shared_ptr<vector_type> sptr_Ax = A(x);
-			vector_type& Ax = *sptr_Ax;
+			vector_type& y = *st.y;
+			vector_type& z = *st.z;
+			vector_type& w = *st.w;
+			vector_type& Az = *st.Az;
+			vector_type& Ax = *st.Ax;
+			value_type& lmd = st.lmd;
+			const int it = st.it++;
 
-			for (int it = 0; it < nit_; it++) {
-				lmd = Ax.dot(x);
-				y.axpby(1.0, Ax, -lmd, x); // residual
-				if (verb > 0)
-					std::cout << it << ": " << abs(lmd) << '\n';
-				if (it) { // conjugate y to the previous search direction
-					t = Az.dot(z);
-					w.axpby(1.0, Az, -t, z);
-					t = w.dot(y) / (lmd - t);
-					y.axpby(1.0, y, t, z);
-				}
-				// normalize y
-				s = sqrt(abs(y.dot(y)));
-				if (s == 0.0)
-					break; // converged
-				y.scale(s);
-				// orthogonalize y to x
-				t = y.dot(x);
-				y.axpby(1.0, y, -t, x);
-				// normalize y again
-				s = sqrt(abs(y.dot(y)));
-				if (s == 0.0)
-					break; // converged
-				y.scale(s);
-				// perform Rayleigh-Ritz procedure in span{x,y}
-				std::shared_ptr<vector_type> sptr_Ay = A(y);
-				vector_type& Ay = *sptr_Ay;
-				a[0] = lmd;
-				a[1] = Ay.dot(x);
-				a[2] = x.dot(Ay);
-				a[3] = Ay.dot(y);
-				// compute eigenvalues and eigenvectors of 2x2 matrix a
-				eigh2_(a, mu, u, v);
-				z.axpby(u[0], x, u[1], y);
-				x.axpby(v[0], x, v[1], y);
-				// span{x,y} = span{x,z} => the new x is a linear combination
-				// of the old x and z => we use z as previous search direction
-				// on the next iteration
-				Az.axpby(u[0], Ax, u[1], Ay);
-				Ax.axpby(v[0], Ax, v[1], Ay);
-				lmd = mu[1];
-//				s = sqrt(abs(x.dot(x)));
-				complex_float_t t = x.dot(x);
-				s = sqrt(abs(t));
-				x.scale(s);
-				Ax.scale(s);
+			lmd = Ax.dot(x);
+			y.axpby(1.0, Ax, -lmd, x); // residual
+			if (verb > 0)
+				std::cout << it << ": " << abs(lmd) << '\n';
+			if (it) { // conjugate y to the previous search direction
+				t = Az.dot(z);
+				w.axpby(1.0, Az, -t, z);
+				t = w.dot(y) / (lmd - t);
+				y.axpby(1.0, y, t, z);
 			}
-			return abs(lmd);
+			// normalize y
+			s = sqrt(abs(y.dot(y)));
+			if (s == 0.0) {
+				st.done = true; // converged
+				return;
+			}
+			y.scale(s);
+			// orthogonalize y to x
+			t = y.dot(x);
+			y.axpby(1.0, y, -t, x);
+			// normalize y again
+			s = sqrt(abs(y.dot(y)));
+			if (s == 0.0) {
+				st.done = true; // converged
+				return;
+			}
+			y.scale(s);
+			// perform Rayleigh-Ritz procedure in span{x,y}
+			std::shared_ptr<vector_type> sptr_Ay = A(y);
+			vector_type& Ay = *sptr_Ay;
+			a[0] = lmd;
+			a[1] = Ay.dot(x);
+			a[2] = x.dot(Ay);
+			a[3] = Ay.dot(y);
+			// compute eigenvalues and eigenvectors of 2x2 matrix a
+			eigh2_(a, mu, u, v);
+			z.axpby(u[0], x, u[1], y);
+			x.axpby(v[0], x, v[1], y);
+			// span{x,y} = span{x,z} => the new x is a linear combination
+			// of the old x and z => we use z as previous search direction
+			// on the next iteration
+			Az.axpby(u[0], Ax, u[1], Ay);
+			Ax.axpby(v[0], Ax, v[1], Ay);
+			if (tol_ > 0 && abs(mu[1] - lmd) <= tol_ * abs(mu[1]))
+				st.done = true;
+			lmd = mu[1];
+//			s = sqrt(abs(x.dot(x)));
+			complex_float_t tx = x.dot(x);
+			s = sqrt(abs(tx));
+			x.scale(s);
+			Ax.scale(s);
 		}
-	private:
+
 		int nit_;
+		float tol_;
+		int nit_done_ = 0;
 		/* computes eigenvalues and eigenvectors of a 2x2 real symmetric
 		   or Hermitian matrix [ [a[0], a[1]], [a[2], a[3]] ]
 		*/
@@ -0,0 +1,110 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#ifndef SIRF_OPERATOR_MEMO
+#define SIRF_OPERATOR_MEMO
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "sirf/common/DataContainer.h"
+
+/*!
+\file
+\ingroup Common
+\brief Memoisation of the result of an operator application.
+
+\author SyneRBI
+*/
+
+namespace sirf {
+
+	/*!
+	\ingroup Common
+	\brief Remembers the output of an operator for its last input.
+
+	The input is identified by its address and version (see DataContainer::version()),
+	and the operator call by a vector of integer arguments, which should include
+	anything the output depends on apart from the input (e.g. subset numbers and
+	the versions of other data used by the operator). The owner calls clear() when
+	its configuration changes.
+
+	The memo is disabled by default, in which case find() always fails and
+	store() does nothing. It is not thread-safe.
+	*/
+	template<class Output>
+	class OperatorMemo {
+	public:
+		typedef std::vector<uint64_t> Arguments;
+
+		void set_enabled(bool enabled)
+		{
+			enabled_ = enabled;
+			if (!enabled)
+				clear();
+		}
+		bool enabled() const
+		{
+			return enabled_;
+		}
+		void clear()
+		{
+			input_ = 0;
+			sptr_output_.reset();
+		}
+		/*!
+		\brief Returns the stored output if the input and arguments are those
+		of the last store(), otherwise an empty pointer.
+		*/
+		std::shared_ptr<const Output> find(const DataContainer& input,
+			const Arguments& args = Arguments()) const
+		{
+			if (!enabled_ || !sptr_output_ || &input != input_ ||
+				input.version() != input_version_ || args != args_)
+				return std::shared_ptr<const Output>();
+			return sptr_output_;
+		}
+		/*!
+		\brief Stores the output for the input and arguments.
+
+		The caller should pass an output that is not modified later (e.g. a copy).
+		*/
+		void store(const DataContainer& input, std::shared_ptr<const Output> sptr_output,
+			const Arguments& args = Arguments())
+		{
+			if (!enabled_)
+				return;
+			input_ = &input;
+			input_version_ = input.version();
+			args_ = args;
+			sptr_output_ = sptr_output;
+		}
+
+	private:
+		bool enabled_ = false;
+		const DataContainer* input_ = 0;
+		uint64_t input_version_ = 0;
+		Arguments args_;
+		std::shared_ptr<const Output> sptr_output_;
+	};
+}
+
+#endif
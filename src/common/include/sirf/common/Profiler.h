@@ -0,0 +1,269 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#ifndef SIRF_PROFILER
+#define SIRF_PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*!
+\file
+\ingroup Common
+\brief Lightweight timers and counters for the time-consuming SIRF operations.
+
+\author SyneRBI
+*/
+
+namespace sirf {
+
+	/*!
+	\ingroup Common
+	\brief Collects the number of calls, wall time, bytes moved and allocations
+	of named operations.
+
+	Profiling is off by default, in which case the timers and counters cost
+	one atomic load. It is switched on by set_enabled(), or by defining the
+	environment variable SIRF_PROFILING (other than as 0) before the first use.
+
+	The profiler is a singleton per binary: the SIRF libraries are static, so
+	each Python module (pysirf, pystir, pygadgetron, pyreg) has its own records.
+	Each module therefore has C entry points to switch profiling on or off, to
+	reset it and to return report() (cSIRF_, cSTIR_, cGT_ and cReg_ followed by
+	setProfiling, resetProfiling and profile), and the Python functions in
+	sirf.SIRF call those of all loaded modules and merge the reports. In Python,
+	if SIRF_PROFILING is a file name, the merged summary is written to it at
+	exit, and likewise the merged Chrome trace to SIRF_PROFILING_TRACE.
+	*/
+	class Profiler {
+	public:
+		struct Record {
+			uint64_t calls = 0;
+			uint64_t ns = 0;
+			uint64_t min_ns = std::numeric_limits<uint64_t>::max();
+			uint64_t max_ns = 0;
+			uint64_t bytes = 0;
+			uint64_t allocations = 0;
+			uint64_t allocated_bytes = 0;
+		};
+		struct TraceEvent {
+			std::string name;
+			uint64_t start_ns;
+			uint64_t ns;
+			size_t thread;
+		};
+
+		static Profiler& instance()
+		{
+			static Profiler profiler;
+			return profiler;
+		}
+		static bool enabled()
+		{
+			return instance().enabled_.load(std::memory_order_relaxed);
+		}
+		static uint64_t now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>
+				(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		//! records the bytes read and written by an operation
+		static void count_bytes(const char* name, uint64_t bytes)
+		{
+			if (!enabled())
+				return;
+			Profiler& p = instance();
+			std::lock_guard<std::mutex> lock(p.mutex_);
+			p.records_[name].bytes += bytes;
+		}
+		//! records the allocation of a data container by an operation
+		static void count_allocation(const char* name, uint64_t bytes)
+		{
+			if (!enabled())
+				return;
+			Profiler& p = instance();
+			std::lock_guard<std::mutex> lock(p.mutex_);
+			Record& r = p.records_[name];
+			r.allocations++;
+			r.allocated_bytes += bytes;
+		}
+
+		void set_enabled(bool enabled)
+		{
+			enabled_.store(enabled, std::memory_order_relaxed);
+		}
+		//! discards all records
+		void reset()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			records_.clear();
+			events_.clear();
+		}
+		void add_time(const char* name, uint64_t start_ns, uint64_t ns)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Record& r = records_[name];
+			r.calls++;
+			r.ns += ns;
+			if (ns < r.min_ns)
+				r.min_ns = ns;
+			if (ns > r.max_ns)
+				r.max_ns = ns;
+			if (events_.size() < max_trace_events) {
+				TraceEvent e = { name, start_ns, ns,
+					std::hash<std::thread::id>()(std::this_thread::get_id()) };
+				events_.push_back(e);
+			}
+		}
+		std::map<std::string, Record> records() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return records_;
+		}
+		/*!
+		\brief Returns the records as JSON.
+
+		format: "json" for an object keyed by the operation names, or "chrome"
+		for the timed calls in the Chrome trace event format, which can be viewed
+		with chrome://tracing or https://ui.perfetto.dev (only the first
+		max_trace_events calls after reset() are kept).
+		*/
+		std::string report(const std::string& format) const
+		{
+			std::ostringstream out;
+			if (format == "json") {
+				write_records_(out, "\n  ");
+				out << "\n}\n";
+			}
+			else if (format == "chrome") {
+				out << "{\"traceEvents\": [";
+				write_events_(out, ",");
+				out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+			}
+			else
+				throw std::runtime_error("Profiler: unknown report format " + format);
+			return out.str();
+		}
+		//! writes the records as a JSON object keyed by the operation names
+		void write_json(const std::string& filename) const
+		{
+			write_(filename, report("json"));
+		}
+		//! writes the timed calls in the Chrome trace event format (see report())
+		void write_chrome_trace(const std::string& filename) const
+		{
+			write_(filename, report("chrome"));
+		}
+
+		static const size_t max_trace_events = 1000000;
+
+	private:
+		Profiler() : enabled_(false)
+		{
+			const char* v = std::getenv("SIRF_PROFILING");
+			if (v && *v && std::string(v) != "0")
+				set_enabled(true);
+		}
+		Profiler(const Profiler&) = delete;
+		Profiler& operator=(const Profiler&) = delete;
+
+		static void write_(const std::string& filename, const std::string& text)
+		{
+			std::ofstream file(filename);
+			if (!file.is_open())
+				throw std::runtime_error("Profiler: cannot write " + filename);
+			file << text;
+		}
+		// writes the records without the closing brace
+		void write_records_(std::ostream& file, const char* indent) const
+		{
+			std::map<std::string, Record> records = this->records();
+			file << std::fixed << std::setprecision(9) << "{";
+			for (auto i = records.begin(); i != records.end(); ++i) {
+				const Record& r = i->second;
+				file << (i == records.begin() ? "" : ",") << indent;
+				file << "\"" << i->first << "\": {\"calls\": " << r.calls
+					<< ", \"seconds\": " << r.ns*1e-9
+					<< ", \"min_seconds\": " << (r.calls ? r.min_ns*1e-9 : 0.0)
+					<< ", \"max_seconds\": " << r.max_ns*1e-9
+					<< ", \"bytes\": " << r.bytes
+					<< ", \"allocations\": " << r.allocations
+					<< ", \"allocated_bytes\": " << r.allocated_bytes << "}";
+			}
+		}
+		// writes the trace events separated by sep, without the trailing one
+		void write_events_(std::ostream& file, const char* sep) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			file << std::fixed << std::setprecision(3);
+			for (size_t i = 0; i < events_.size(); i++) {
+				const TraceEvent& e = events_[i];
+				file << (i ? sep : "") << "\n";
+				file << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 0"
+					<< ", \"tid\": " << e.thread % 1000000
+					<< ", \"ts\": " << e.start_ns*1e-3
+					<< ", \"dur\": " << e.ns*1e-3 << "}";
+			}
+		}
+
+		std::atomic<bool> enabled_;
+		mutable std::mutex mutex_;
+		std::map<std::string, Record> records_;
+		std::vector<TraceEvent> events_;
+	};
+
+	/*!
+	\ingroup Common
+	\brief Times the scope in which it is created if profiling is on.
+
+	The name must be a string literal (or otherwise outlive the timer).
+	*/
+	class ScopedTimer {
+	public:
+		explicit ScopedTimer(const char* name) :
+			name_(Profiler::enabled() ? name : 0), start_ns_(name_ ? Profiler::now_ns() : 0)
+		{}
+		~ScopedTimer()
+		{
+			if (name_)
+				Profiler::instance().add_time(name_, start_ns_, Profiler::now_ns() - start_ns_);
+		}
+	private:
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+		const char* name_;
+		uint64_t start_ns_;
+	};
+}
+
+#endif
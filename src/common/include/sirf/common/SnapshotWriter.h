@@ -0,0 +1,235 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#ifndef SIRF_SNAPSHOT_WRITER
+#define SIRF_SNAPSHOT_WRITER
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "sirf/common/DataContainer.h"
+#include "sirf/common/Profiler.h"
+
+/*!
+\file
+\ingroup Common
+\brief Writing of data container snapshots by a background thread.
+
+\author SyneRBI
+*/
+
+namespace sirf {
+
+	/*!
+	\ingroup Common
+	\brief Writes snapshots of data containers to files in the background.
+
+	write() copies the container (or takes a container that the caller will
+	not modify any more) and returns at once, the file being written by a
+	background thread in the order of the calls. This lets iterative
+	algorithms save their checkpoints while going on with the next iteration.
+
+	At most max_in_flight() snapshots are waiting or being written at any
+	time: write() blocks until a slot is free before copying, so the memory
+	taken by the snapshots is bounded.
+
+	write() returns a completion handle, whose get() waits for the file to be
+	written and rethrows the exception thrown by the write, if any. The first
+	exception not yet reported is also rethrown by wait_all(). The destructor
+	waits for the pending writes and ignores their errors.
+	*/
+	class SnapshotWriter {
+	public:
+		typedef std::shared_future<void> Completion;
+
+		explicit SnapshotWriter(unsigned int max_in_flight = 2) :
+			max_in_flight_(max_in_flight ? max_in_flight : 1), in_flight_(0), stop_(false)
+		{}
+		~SnapshotWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			queued_.notify_all();
+			if (thread_.joinable())
+				thread_.join();
+		}
+
+		//! maximal number of snapshots waiting or being written, default 2
+		void set_max_in_flight(unsigned int n)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				max_in_flight_ = n ? n : 1;
+			}
+			done_.notify_all();
+		}
+		unsigned int max_in_flight() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return max_in_flight_;
+		}
+		//! number of snapshots waiting or being written
+		unsigned int in_flight() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return in_flight_;
+		}
+
+		//! writes a copy of x to filename (in the format of x.write())
+		Completion write(const DataContainer& x, const std::string& filename)
+		{
+			reserve_();
+			std::shared_ptr<const DataContainer> sptr_snapshot;
+			try {
+				ScopedTimer timer("SnapshotWriter::snapshot");
+				sptr_snapshot.reset(x.clone().release());
+			}
+			catch (...) {
+				release_();
+				throw;
+			}
+			return enqueue_(sptr_snapshot, filename);
+		}
+		/*!
+		\brief Writes *sptr_x to filename without copying it.
+
+		The container must not be modified until the write is completed.
+		*/
+		Completion write(std::shared_ptr<const DataContainer> sptr_x,
+			const std::string& filename)
+		{
+			if (!sptr_x)
+				throw std::runtime_error("SnapshotWriter::write: null container");
+			reserve_();
+			return enqueue_(sptr_x, filename);
+		}
+		//! waits for all pending writes and rethrows the first unreported error
+		void wait_all()
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_.wait(lock, [this] { return in_flight_ == 0; });
+			if (error_) {
+				std::exception_ptr error = error_;
+				error_ = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		SnapshotWriter(const SnapshotWriter&) = delete;
+		SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+		struct Task {
+			std::shared_ptr<const DataContainer> sptr_data;
+			std::string filename;
+			std::shared_ptr<std::promise<void> > sptr_done;
+		};
+
+		// waits for a free slot and takes it
+		void reserve_()
+		{
+			ScopedTimer timer("SnapshotWriter::wait");
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_.wait(lock, [this] { return in_flight_ < max_in_flight_; });
+			in_flight_++;
+		}
+		void release_()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				in_flight_--;
+			}
+			done_.notify_all();
+		}
+		Completion enqueue_(std::shared_ptr<const DataContainer> sptr_data,
+			const std::string& filename)
+		{
+			Task task;
+			task.sptr_data = sptr_data;
+			task.filename = filename;
+			task.sptr_done.reset(new std::promise<void>);
+			Completion completion = task.sptr_done->get_future().share();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				tasks_.push_back(task);
+				if (!thread_.joinable())
+					thread_ = std::thread(&SnapshotWriter::run_, this);
+			}
+			queued_.notify_one();
+			return completion;
+		}
+		void run_()
+		{
+			for (;;) {
+				Task task;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					queued_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+					if (tasks_.empty())
+						return;
+					task = tasks_.front();
+					tasks_.pop_front();
+				}
+				std::exception_ptr error;
+				try {
+					ScopedTimer timer("SnapshotWriter::write");
+					task.sptr_data->write(task.filename);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				// the snapshot is freed before the slot is released
+				task.sptr_data.reset();
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (error && !error_)
+						error_ = error;
+					in_flight_--;
+				}
+				if (error)
+					task.sptr_done->set_exception(error);
+				else
+					task.sptr_done->set_value();
+				done_.notify_all();
+			}
+		}
+
+		mutable std::mutex mutex_;
+		std::condition_variable queued_;
+		std::condition_variable done_;
+		std::deque<Task> tasks_;
+		std::thread thread_;
+		std::exception_ptr error_;
+		unsigned int max_in_flight_;
+		unsigned int in_flight_;
+		bool stop_;
+	};
+
+}
+
+#endif
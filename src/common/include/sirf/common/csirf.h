@@ -64,6 +64,28 @@ void* cSIRF_readImageData(const char* file, const char* eng, int verb);
 void* cSIRF_equalImages(const void* ptr_im_a, const void* ptr_im_b);
 void* cSIRF_ImageData_reorient(void* im_ptr, void *geom_info_ptr);
 
+// ImagePrior
+void* cSIRF_ImagePrior_setParameter(void* ptr_p, const char* name, const void* ptr_v);
+void* cSIRF_ImagePrior_value(const void* ptr_p, const void* ptr_im);
+void* cSIRF_ImagePrior_gradient(const void* ptr_p, const void* ptr_im, void* ptr_out);
+void* cSIRF_ImagePrior_hessianTimes(const void* ptr_p, const void* ptr_im,
+	const void* ptr_in, void* ptr_out);
+void* cSIRF_ImagePrior_hessianDiagonal(const void* ptr_p, const void* ptr_im, void* ptr_out);
+
+// Profiling
+void* cSIRF_setProfiling(int on);
+void* cSIRF_resetProfiling();
+void* cSIRF_profile(const char* format);
+void* cSIRF_writeProfile(const char* filename, const char* format);
+
+// SnapshotWriter
+void* cSIRF_SnapshotWriter_setParameter(void* ptr_w, const char* name, const void* ptr_v);
+void* cSIRF_SnapshotWriter_inFlight(const void* ptr_w);
+void* cSIRF_SnapshotWriter_write(void* ptr_w, const void* ptr_x, const char* filename);
+void* cSIRF_SnapshotWriter_waitAll(void* ptr_w);
+void* cSIRF_WriteCompletion_isDone(const void* ptr_c);
+void* cSIRF_WriteCompletion_wait(const void* ptr_c);
+
 // DataHandleVector methods
 void* cSIRF_DataHandleVector_push_back(void* self, void* to_append);
 
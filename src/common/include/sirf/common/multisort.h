@@ -21,7 +21,7 @@ namespace Multisort {
 	}
 
 	template<typename T, size_t N>
-	void sort(std::vector<std::array<T, N> > v, int* index)
+	void sort(const std::vector<std::array<T, N> >& v, int* index)
 	{
 		int n = v.size();
 		std::iota(index, index + n, 0);
@@ -47,7 +47,7 @@ namespace NewMultisort {
 	}
 
 	template<typename T>
-	void sort(std::vector<std::vector<T> > v, int* index)
+	void sort(const std::vector<std::vector<T> >& v, int* index)
 	{
 		int n = v.size();
 		std::iota(index, index + n, 0);
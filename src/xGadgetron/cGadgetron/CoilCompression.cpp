@@ -0,0 +1,566 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Implementation file for the coil compression.
+
+\author SyneRBI
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include <fftw3.h>
+
+#include <ismrmrd/xml.h>
+
+#include "sirf/Gadgetron/CoilCompression.h"
+#include "sirf/Gadgetron/xgadgetron_utilities.h"
+#include "sirf/common/Profiler.h"
+#include "sirf/iUtilities/LocalisedException.h"
+
+using namespace sirf;
+
+typedef std::complex<double> complex_double_t;
+
+namespace {
+
+	/*
+	Eigenvalues (in decreasing order) and eigenvectors (the columns of v,
+	row-major) of the Hermitian n x n matrix a (row-major, overwritten),
+	computed by cyclic Jacobi rotations.
+	*/
+	void hermitian_eigen(int n, std::vector<complex_double_t>& a,
+		std::vector<double>& lambda, std::vector<complex_double_t>& v)
+	{
+		v.assign(size_t(n)*n, 0.0);
+		for (int i = 0; i < n; i++)
+			v[size_t(i)*n + i] = 1.0;
+		double scale = 0;
+		for (int i = 0; i < n; i++)
+			scale = std::max(scale, std::abs(a[size_t(i)*n + i]));
+		for (int sweep = 0; sweep < 50; sweep++) {
+			double off = 0;
+			for (int p = 0; p < n; p++)
+				for (int q = p + 1; q < n; q++)
+					off += std::norm(a[size_t(p)*n + q]);
+			if (off <= 1e-30*scale*scale)
+				break;
+			for (int p = 0; p < n; p++) {
+				for (int q = p + 1; q < n; q++) {
+					const complex_double_t apq = a[size_t(p)*n + q];
+					const double r = std::abs(apq);
+					if (r <= 1e-300)
+						continue;
+					// the rotation G = diag(1, e^{-i phi}) R, R the real rotation
+					// annihilating the real 2x2 problem [[app, r], [r, aqq]]
+					const complex_double_t e = apq / r;
+					const double app = a[size_t(p)*n + p].real();
+					const double aqq = a[size_t(q)*n + q].real();
+					const double theta = (aqq - app) / (2 * r);
+					const double t = (theta >= 0 ? 1.0 : -1.0) /
+						(std::abs(theta) + std::sqrt(theta*theta + 1));
+					const double c = 1 / std::sqrt(t*t + 1);
+					const double s = t*c;
+					const complex_double_t gpp = c;
+					const complex_double_t gpq = s;
+					const complex_double_t gqp = -s*std::conj(e);
+					const complex_double_t gqq = c*std::conj(e);
+					// a := a G
+					for (int k = 0; k < n; k++) {
+						complex_double_t& akp = a[size_t(k)*n + p];
+						complex_double_t& akq = a[size_t(k)*n + q];
+						const complex_double_t x = akp, y = akq;
+						akp = x*gpp + y*gqp;
+						akq = x*gpq + y*gqq;
+					}
+					// a := G^H a
+					for (int k = 0; k < n; k++) {
+						complex_double_t& apk = a[size_t(p)*n + k];
+						complex_double_t& aqk = a[size_t(q)*n + k];
+						const complex_double_t x = apk, y = aqk;
+						apk = std::conj(gpp)*x + std::conj(gqp)*y;
+						aqk = std::conj(gpq)*x + std::conj(gqq)*y;
+					}
+					a[size_t(p)*n + q] = 0;
+					a[size_t(q)*n + p] = 0;
+					// v := v G
+					for (int k = 0; k < n; k++) {
+						complex_double_t& vkp = v[size_t(k)*n + p];
+						complex_double_t& vkq = v[size_t(k)*n + q];
+						const complex_double_t x = vkp, y = vkq;
+						vkp = x*gpp + y*gqp;
+						vkq = x*gpq + y*gqq;
+					}
+				}
+			}
+		}
+		std::vector<int> order(n);
+		for (int i = 0; i < n; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int i, int j) {
+			return a[size_t(i)*n + i].real() > a[size_t(j)*n + j].real(); });
+		std::vector<complex_double_t> w(v);
+		lambda.resize(n);
+		for (int j = 0; j < n; j++) {
+			lambda[j] = a[size_t(order[j])*n + order[j]].real();
+			for (int k = 0; k < n; k++)
+				v[size_t(k)*n + j] = w[size_t(k)*n + order[j]];
+		}
+	}
+
+	/*
+	Replaces the n x m matrix v (row-major) by v P, P being the unitary
+	matrix closest to v^H r (the polar factor), so that the columns of v
+	are as close to those of r as possible.
+	*/
+	void align(int n, int m, std::vector<complex_double_t>& v,
+		const std::vector<complex_double_t>& r)
+	{
+		std::vector<complex_double_t> c(size_t(m)*m, 0.0); // v^H r
+		for (int i = 0; i < m; i++)
+			for (int j = 0; j < m; j++)
+				for (int k = 0; k < n; k++)
+					c[size_t(i)*m + j] += std::conj(v[size_t(k)*m + i])*r[size_t(k)*m + j];
+		std::vector<complex_double_t> chc(size_t(m)*m, 0.0); // c^H c = W S^2 W^H
+		for (int i = 0; i < m; i++)
+			for (int j = 0; j < m; j++)
+				for (int k = 0; k < m; k++)
+					chc[size_t(i)*m + j] += std::conj(c[size_t(k)*m + i])*c[size_t(k)*m + j];
+		std::vector<double> s2;
+		std::vector<complex_double_t> w;
+		hermitian_eigen(m, chc, s2, w);
+		if (s2[m - 1] <= 1e-12*s2[0])
+			return; // v^H r is (nearly) singular: no alignment
+		// P = c W S^{-1} W^H
+		std::vector<complex_double_t> ws(size_t(m)*m);
+		for (int i = 0; i < m; i++)
+			for (int j = 0; j < m; j++)
+				ws[size_t(i)*m + j] = w[size_t(i)*m + j] / std::sqrt(s2[j]);
+		std::vector<complex_double_t> wsw(size_t(m)*m, 0.0);
+		for (int i = 0; i < m; i++)
+			for (int j = 0; j < m; j++)
+				for (int k = 0; k < m; k++)
+					wsw[size_t(i)*m + j] += ws[size_t(i)*m + k]*std::conj(w[size_t(j)*m + k]);
+		std::vector<complex_double_t> p(size_t(m)*m, 0.0);
+		for (int i = 0; i < m; i++)
+			for (int j = 0; j < m; j++)
+				for (int k = 0; k < m; k++)
+					p[size_t(i)*m + j] += c[size_t(i)*m + k]*wsw[size_t(k)*m + j];
+		std::vector<complex_double_t> vp(size_t(n)*m, 0.0);
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < m; j++)
+				for (int k = 0; k < m; k++)
+					vp[size_t(i)*m + j] += v[size_t(i)*m + k]*p[size_t(k)*m + j];
+		v.swap(vp);
+	}
+
+	/*
+	Centred unitary Fourier transforms of the channels of readouts of
+	a given length, as done by fft3c/ifft3c along the first dimension.
+	*/
+	class ReadoutFFT {
+	public:
+		ReadoutFFT(int num_samples, int num_channels, bool forward) :
+			ns_(num_samples), nc_(num_channels)
+		{
+			fftwf_complex* buff = (fftwf_complex*)fftwf_malloc
+				(sizeof(fftwf_complex)*ns_*nc_);
+			// the FFTW planner is not thread-safe
+			std::lock_guard<std::mutex> lock(planner_mutex());
+			plan_ = fftwf_plan_many_dft(1, &ns_, nc_, buff, 0, 1, ns_, buff, 0, 1, ns_,
+				forward ? FFTW_FORWARD : FFTW_BACKWARD, FFTW_ESTIMATE);
+			fftwf_free(buff);
+		}
+		~ReadoutFFT()
+		{
+			std::lock_guard<std::mutex> lock(planner_mutex());
+			fftwf_destroy_plan(plan_);
+		}
+		// transforms nc_ readouts in buff, which must be allocated by fftwf_malloc
+		void execute(complex_float_t* buff) const
+		{
+			const int half = ns_ / 2;
+			for (int c = 0; c < nc_; c++) {
+				complex_float_t* ptr = buff + size_t(c)*ns_;
+				std::rotate(ptr, ptr + half, ptr + ns_); // ifftshift
+			}
+			fftwf_execute_dft(plan_, (fftwf_complex*)buff, (fftwf_complex*)buff);
+			const float scale = 1.0f / std::sqrt(float(ns_));
+			for (int c = 0; c < nc_; c++) {
+				complex_float_t* ptr = buff + size_t(c)*ns_;
+				std::rotate(ptr, ptr + ns_ - half, ptr + ns_); // fftshift
+				for (int s = 0; s < ns_; s++)
+					ptr[s] *= scale;
+			}
+		}
+	private:
+		int ns_;
+		int nc_;
+		fftwf_plan plan_;
+
+		static std::mutex& planner_mutex()
+		{
+			static std::mutex mutex;
+			return mutex;
+		}
+	};
+
+	struct FFTWBuffer {
+		FFTWBuffer(size_t n) :
+			ptr((complex_float_t*)fftwf_malloc(sizeof(complex_float_t)*n))
+		{
+			if (!ptr)
+				throw LocalisedException("FFTW buffer allocation failed", __FILE__, __LINE__);
+		}
+		~FFTWBuffer() { fftwf_free(ptr); }
+		complex_float_t* ptr;
+	};
+
+}
+
+void
+CoilCompression::set_num_virtual_coils(int n)
+{
+	if (n < 0)
+		throw LocalisedException("number of virtual coils must not be negative",
+			__FILE__, __LINE__);
+	num_virtual_coils_ = n;
+}
+
+void
+CoilCompression::set_energy_fraction(float f)
+{
+	if (f <= 0 || f > 1)
+		throw LocalisedException("energy fraction must be in (0, 1]", __FILE__, __LINE__);
+	energy_fraction_ = f;
+}
+
+const std::vector<complex_float_t>&
+CoilCompression::matrix(int x) const
+{
+	check_computed_();
+	if (x < 0 || x >= (int)matrices_.size())
+		throw LocalisedException("compression matrix number out of range", __FILE__, __LINE__);
+	return matrices_[x];
+}
+
+void
+CoilCompression::check_computed_() const
+{
+	if (matrices_.empty())
+		throw LocalisedException("coil compression matrices not computed", __FILE__, __LINE__);
+}
+
+void
+CoilCompression::compute(const MRAcquisitionData& ad)
+{
+	ScopedTimer timer("CoilCompression::compute");
+
+	const std::vector<ISMRMRD::ISMRMRD_AcquisitionFlags> calibration_flags{
+		ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION,
+		ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING };
+	std::vector<int> calib = ad.get_flagged_acquisitions_index(calibration_flags);
+	if (calib.empty())
+		for (unsigned int i = 0; i < ad.number(); i++)
+			calib.push_back(i);
+	if (calib.empty())
+		throw LocalisedException("no acquisitions to compute coil compression from",
+			__FILE__, __LINE__);
+
+	gadgetron::shared_ptr<const ISMRMRD::Acquisition> sptr_acq =
+		ad.get_acquisition_sptr(calib[0]);
+	const int nc = sptr_acq->active_channels();
+	const int ns = sptr_acq->number_of_samples();
+	const bool geometric = (mode_ == GEOMETRIC);
+	const int nx = geometric ? ns : 1;
+	const size_t ncc = size_t(nc)*nc;
+
+	// channel covariance matrices (one per readout position if geometric),
+	// accumulated by each thread separately
+	std::vector<std::vector<complex_double_t> > cov;
+	std::mutex mutex;
+	xGadgetronUtilities::parallel_for(calib.size(), 16, [&](size_t begin, size_t end, size_t) {
+		std::vector<complex_double_t> c(ncc*nx, 0.0);
+		FFTWBuffer buff(size_t(ns)*nc);
+		std::unique_ptr<ReadoutFFT> uptr_fft;
+		if (geometric)
+			uptr_fft.reset(new ReadoutFFT(ns, nc, false));
+		for (size_t i = begin; i < end; i++) {
+			gadgetron::shared_ptr<const ISMRMRD::Acquisition> sptr_a =
+				ad.get_acquisition_sptr(calib[i]);
+			if (sptr_a->active_channels() != nc)
+				throw LocalisedException("calibration data channel numbers differ",
+					__FILE__, __LINE__);
+			const int n = sptr_a->number_of_samples();
+			if (geometric && n != ns)
+				throw LocalisedException("calibration data readout lengths differ",
+					__FILE__, __LINE__);
+			const complex_float_t* data = sptr_a->getDataPtr();
+			if (geometric) {
+				std::copy(data, data + size_t(ns)*nc, buff.ptr);
+				uptr_fft->execute(buff.ptr);
+				data = buff.ptr;
+			}
+			for (int a = 0; a < nc; a++) {
+				const complex_float_t* xa = data + size_t(a)*n;
+				for (int b = 0; b <= a; b++) {
+					const complex_float_t* xb = data + size_t(b)*n;
+					if (geometric) {
+						complex_double_t* cab = &c[size_t(a)*nc + b];
+						for (int s = 0; s < n; s++)
+							cab[ncc*s] += complex_double_t(xa[s])*std::conj(complex_double_t(xb[s]));
+					}
+					else {
+						complex_double_t t = 0;
+						for (int s = 0; s < n; s++)
+							t += complex_double_t(xa[s])*std::conj(complex_double_t(xb[s]));
+						c[size_t(a)*nc + b] += t;
+					}
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		cov.push_back(std::move(c));
+	});
+	std::vector<complex_double_t>& c = cov[0];
+	for (size_t t = 1; t < cov.size(); t++)
+		for (size_t i = 0; i < c.size(); i++)
+			c[i] += cov[t][i];
+	for (int x = 0; x < nx; x++) {
+		complex_double_t* cx = &c[ncc*x];
+		for (int a = 0; a < nc; a++)
+			for (int b = a + 1; b < nc; b++)
+				cx[size_t(a)*nc + b] = std::conj(cx[size_t(b)*nc + a]);
+	}
+
+	// the number of virtual channels is chosen by the eigenvalues of the
+	// total covariance (the sum over the readout positions if geometric)
+	std::vector<complex_double_t> total(c.begin(), c.begin() + ncc);
+	for (int x = 1; x < nx; x++)
+		for (size_t i = 0; i < ncc; i++)
+			total[i] += c[ncc*x + i];
+	std::vector<double> lambda;
+	std::vector<complex_double_t> v;
+	hermitian_eigen(nc, total, lambda, v);
+	double energy = 0;
+	for (int i = 0; i < nc; i++)
+		energy += std::max(lambda[i], 0.0);
+	int nv = nc;
+	if (num_virtual_coils_ > 0)
+		nv = std::min(num_virtual_coils_, nc);
+	else {
+		double e = 0;
+		for (int i = 0; i < nc; i++) {
+			e += std::max(lambda[i], 0.0);
+			if (e >= energy_fraction_*energy) {
+				nv = i + 1;
+				break;
+			}
+		}
+	}
+
+	// the leading eigenvectors of each covariance (nc x nv, row-major)
+	std::vector<std::vector<complex_double_t> > basis(nx);
+	double kept = 0;
+	for (int x = 0; x < nx; x++) {
+		if (geometric) {
+			std::vector<complex_double_t> cx(c.begin() + ncc*x, c.begin() + ncc*(x + 1));
+			hermitian_eigen(nc, cx, lambda, v);
+		}
+		for (int i = 0; i < nv; i++)
+			kept += std::max(lambda[i], 0.0);
+		basis[x].resize(size_t(nc)*nv);
+		for (int k = 0; k < nc; k++)
+			for (int j = 0; j < nv; j++)
+				basis[x][size_t(k)*nv + j] = v[size_t(k)*nc + j];
+	}
+	// align the bases of neighbouring readout positions, starting from the centre
+	for (int x = nx/2 + 1; x < nx; x++)
+		align(nc, nv, basis[x], basis[x - 1]);
+	for (int x = nx/2 - 1; x >= 0; x--)
+		align(nc, nv, basis[x], basis[x + 1]);
+
+	matrices_.assign(nx, std::vector<complex_float_t>(size_t(nv)*nc));
+	coefs_.resize(size_t(nv)*nc*nx);
+	for (int x = 0; x < nx; x++)
+		for (int j = 0; j < nv; j++)
+			for (int k = 0; k < nc; k++) {
+				const complex_float_t m = complex_float_t(std::conj(basis[x][size_t(k)*nv + j]));
+				matrices_[x][size_t(j)*nc + k] = m;
+				coefs_[(size_t(j)*nc + k)*nx + x] = m;
+			}
+	num_coils_ = nc;
+	num_samples_ = ns;
+	num_virtual_ = nv;
+	energy_kept_ = energy > 0 ? float(kept / energy) : 1.0f;
+}
+
+void
+CoilCompression::compress_(const complex_float_t* in, size_t in_stride,
+	complex_float_t* out, size_t out_stride, size_t n) const
+{
+	// out_v = sum_c M[v][c] in_c, the real and imaginary parts being computed
+	// explicitly so that the loops vectorise
+	const bool geometric = (mode_ == GEOMETRIC);
+	for (int v = 0; v < num_virtual_; v++) {
+		float* o = (float*)(out + v*out_stride);
+		std::fill(o, o + 2*n, 0.0f);
+		for (int c = 0; c < num_coils_; c++) {
+			const float* i = (const float*)(in + c*in_stride);
+			const complex_float_t* m = &coefs_[(size_t(v)*num_coils_ + c)*(geometric ? num_samples_ : 1)];
+			if (geometric) {
+				const float* mf = (const float*)m;
+				for (size_t s = 0; s < n; s++) {
+					const float mr = mf[2*s], mi = mf[2*s + 1];
+					const float ir = i[2*s], ii = i[2*s + 1];
+					o[2*s] += mr*ir - mi*ii;
+					o[2*s + 1] += mr*ii + mi*ir;
+				}
+			}
+			else {
+				const float mr = m->real(), mi = m->imag();
+				for (size_t s = 0; s < n; s++) {
+					const float ir = i[2*s], ii = i[2*s + 1];
+					o[2*s] += mr*ir - mi*ii;
+					o[2*s + 1] += mr*ii + mi*ir;
+				}
+			}
+		}
+	}
+}
+
+void
+CoilCompression::apply(MRAcquisitionData& ad) const
+{
+	ScopedTimer timer("CoilCompression::apply");
+	check_computed_();
+
+	// the acquisitions of each block are compressed in parallel and stored serially
+	const size_t n = ad.number();
+	const size_t block = 4096;
+	std::vector<ISMRMRD::Acquisition> compressed(std::min(n, block));
+	for (size_t start = 0; start < n; start += block) {
+		const size_t m = std::min(block, n - start);
+		xGadgetronUtilities::parallel_for(m, 64, [&](size_t begin, size_t end, size_t) {
+			// in the geometric mode, the channels are compressed in hybrid space
+			// (readouts Fourier transformed), with FFT plans made once per thread
+			std::unique_ptr<ReadoutFFT> uptr_ifft;
+			std::unique_ptr<ReadoutFFT> uptr_fft;
+			std::unique_ptr<FFTWBuffer> uptr_in;
+			std::unique_ptr<FFTWBuffer> uptr_x;
+			const int ns = num_samples_;
+			if (mode_ == GEOMETRIC) {
+				uptr_ifft.reset(new ReadoutFFT(ns, num_coils_, false));
+				uptr_fft.reset(new ReadoutFFT(ns, num_virtual_, true));
+				uptr_in.reset(new FFTWBuffer(size_t(ns)*num_coils_));
+				uptr_x.reset(new FFTWBuffer(size_t(ns)*num_virtual_));
+			}
+			for (size_t i = begin; i < end; i++) {
+				const ISMRMRD::Acquisition& acq = *ad.get_acquisition_sptr(start + i);
+				ISMRMRD::Acquisition& out = compressed[i];
+				const int n = acq.number_of_samples();
+				const int nt = acq.trajectory_dimensions();
+				if (acq.active_channels() != num_coils_)
+					throw LocalisedException("acquisition channel number differs from that of the calibration data",
+						__FILE__, __LINE__);
+				if (mode_ == GEOMETRIC && n != ns)
+					throw LocalisedException("acquisition readout length differs from that of the calibration data",
+						__FILE__, __LINE__);
+				out.setHead(acq.getHead());
+				out.resize(n, num_virtual_, nt);
+				if (nt > 0)
+					std::copy(acq.getTrajPtr(), acq.getTrajPtr() + size_t(nt)*n, out.getTrajPtr());
+				out.available_channels() = num_virtual_;
+				out.setAllChannelsNotActive();
+				out.setAllChannelsActive(num_virtual_);
+				if (mode_ == GEOMETRIC) {
+					complex_float_t* in = uptr_in->ptr;
+					complex_float_t* x = uptr_x->ptr;
+					std::copy(acq.getDataPtr(), acq.getDataPtr() + size_t(n)*num_coils_, in);
+					uptr_ifft->execute(in);
+					compress_(in, n, x, n, n);
+					uptr_fft->execute(x);
+					std::copy(x, x + size_t(n)*num_virtual_, out.getDataPtr());
+				}
+				else
+					compress_(acq.getDataPtr(), n, out.getDataPtr(), n, n);
+			}
+		});
+		for (size_t i = 0; i < m; i++)
+			ad.set_acquisition(start + i, compressed[i]);
+	}
+
+	ISMRMRD::IsmrmrdHeader hdr = ad.acquisitions_info().get_IsmrmrdHeader();
+	if (hdr.acquisitionSystemInformation.is_present()) {
+		ISMRMRD::AcquisitionSystemInformation& asi = hdr.acquisitionSystemInformation.get();
+		asi.receiverChannels = (unsigned short)num_virtual_;
+		asi.coilLabel.clear();
+	}
+	std::stringstream hdr_stream;
+	ISMRMRD::serialize(hdr, hdr_stream);
+	ad.set_acquisitions_info(AcquisitionsInfo(hdr_stream.str()));
+	ad.mark_modified();
+	Profiler::count_bytes("CoilCompression::apply",
+		uint64_t(n)*num_samples_*(num_coils_ + num_virtual_)*sizeof(complex_float_t));
+}
+
+void
+CoilCompression::apply(CoilSensitivitiesVector& csms) const
+{
+	ScopedTimer timer("CoilCompression::apply_csm");
+	check_computed_();
+
+	xGadgetronUtilities::parallel_for(csms.number(), 1, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			gadgetron::shared_ptr<ImageWrap> sptr_iw = csms.sptr_image_wrap(i);
+			if (sptr_iw->type() != ISMRMRD::ISMRMRD_CXFLOAT)
+				throw LocalisedException("coil sensitivity maps must be complex float images",
+					__FILE__, __LINE__);
+			CFImage& csm = *(CFImage*)sptr_iw->ptr_image();
+			const size_t nx = csm.getMatrixSizeX();
+			const size_t ny = csm.getMatrixSizeY();
+			const size_t nz = csm.getMatrixSizeZ();
+			if (csm.getNumberOfChannels() != num_coils_)
+				throw LocalisedException("coil sensitivity maps channel number differs from that of the calibration data",
+					__FILE__, __LINE__);
+			if (mode_ == GEOMETRIC && nx != (size_t)num_samples_)
+				throw LocalisedException("coil sensitivity maps x-size differs from the readout length",
+					__FILE__, __LINE__);
+			const size_t nxyz = nx*ny*nz;
+			std::vector<complex_float_t> out(nxyz*num_virtual_);
+			const complex_float_t* in = csm.getDataPtr();
+			if (mode_ == GEOMETRIC)
+				for (size_t l = 0; l < ny*nz; l++)
+					compress_(in + l*nx, nxyz, out.data() + l*nx, nxyz, nx);
+			else
+				compress_(in, nxyz, out.data(), nxyz, nxyz);
+			csm.resize(nx, ny, nz, num_virtual_);
+			std::copy(out.begin(), out.end(), csm.getDataPtr());
+		}
+	});
+	csms.mark_modified();
+}
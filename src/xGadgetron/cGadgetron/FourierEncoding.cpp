@@ -20,6 +20,8 @@ limitations under the License.
 
 #include "sirf/Gadgetron/FourierEncoding.h"
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <math.h>
 
@@ -231,3 +233,80 @@ void sirf::CartesianFourierEncoding::backward(CFImage& img, const MRAcquisitionD
 }
 
 
+
+bool sirf::CartesianFourierEncoding::normal_kernel(ISMRMRD::NDArray<float>& kernel, const MRAcquisitionData& ac) const
+{
+    ISMRMRD::IsmrmrdHeader header = ac.acquisitions_info().get_IsmrmrdHeader();
+    ISMRMRD::Encoding e = header.encoding[0];
+
+    unsigned int ny = e.encodedSpace.matrixSize.y;
+    unsigned int nz = e.encodedSpace.matrixSize.z;
+
+    ISMRMRD::Limit ky_lim, kz_lim(0,0,0);
+
+    ky_lim = e.encodingLimits.kspace_encoding_step_1.get();
+    if(e.encodingLimits.kspace_encoding_step_2.is_present())
+        kz_lim = e.encodingLimits.kspace_encoding_step_2.get();
+
+    std::vector<size_t> dims{ny, nz};
+    kernel.resize(dims);
+    std::fill(kernel.begin(), kernel.end(), 0.f);
+
+    // forward() samples the line (y, z) once per acquisition, and backward()
+    // adds them all up, so the line is weighted by the number of acquisitions
+    const MRAcquisitionHeaderIndex& hi = ac.header_index();
+    for (size_t a = 0; a < hi.size(); a++) {
+        int y = ny/2 - ky_lim.center + hi[a].idx.kspace_encode_step_1;
+        int z = nz/2 - kz_lim.center + hi[a].idx.kspace_encode_step_2;
+        if (y < 0 || y >= (int)ny || z < 0 || z >= (int)nz)
+            throw LocalisedException("Acquisition outside of the encoded k-space.", __FILE__, __LINE__);
+        kernel(y, z) += 1.f;
+    }
+    return true;
+}
+
+void sirf::FourierEncoding::apply_normal_kernel(CFImage& img, const ISMRMRD::NDArray<float>& kernel)
+{
+    size_t const nx = img.getMatrixSizeX();
+    size_t const ny = img.getMatrixSizeY();
+    size_t const nz = img.getMatrixSizeZ();
+    size_t const nc = img.getNumberOfChannels();
+
+    size_t const gy = kernel.getDims()[0];
+    size_t const gz = kernel.getDims()[1];
+    if (gy < ny || gz < nz)
+        throw LocalisedException("The normal operator kernel is smaller than the image.", __FILE__, __LINE__);
+
+    // the image centre (at n/2, as in fft3c) goes to the grid centre
+    size_t const oy = gy/2 - ny/2;
+    size_t const oz = gz/2 - nz/2;
+
+    std::vector<size_t> dims{nx, gy, gz, nc};
+    ISMRMRD::NDArray<complex_float_t> grid(dims);
+    memset(grid.getDataPtr(), 0, grid.getDataSize());
+
+    for (size_t c = 0; c < nc; c++)
+        for (size_t z = 0; z < nz; z++)
+            for (size_t y = 0; y < ny; y++)
+                std::memcpy(&grid(0, oy + y, oz + z, c), &img(0, y, z, c),
+                    nx*sizeof(complex_float_t));
+
+    fft3c(grid);
+
+    for (size_t c = 0; c < nc; c++)
+        for (size_t z = 0; z < gz; z++)
+            for (size_t y = 0; y < gy; y++) {
+                float const k = kernel(y, z);
+                complex_float_t* ptr = &grid(0, y, z, c);
+                for (size_t x = 0; x < nx; x++)
+                    ptr[x] *= k;
+            }
+
+    ifft3c(grid);
+
+    for (size_t c = 0; c < nc; c++)
+        for (size_t z = 0; z < nz; z++)
+            for (size_t y = 0; y < ny; y++)
+                std::memcpy(&img(0, y, z, c), &grid(0, oy + y, oz + z, c),
+                    nx*sizeof(complex_float_t));
+}
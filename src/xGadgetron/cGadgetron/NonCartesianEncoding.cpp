@@ -212,6 +212,73 @@ void RPEFourierEncoding::forward(MRAcquisitionData& ac, const CFImage& img) cons
 }
 
 
+bool RPEFourierEncoding::normal_kernel(ISMRMRD::NDArray<float>& kernel, const MRAcquisitionData& ac) const
+{
+    ASSERT( ac.number() >0, "Give a non-empty rawdata container if you want to compute the rpe normal kernel.");
+    ASSERT( ac.get_trajectory_type() == ISMRMRD::TrajectoryType::OTHER, "Give a MRAcquisitionData reference with the trajectory type OTHER.");
+
+    ISMRMRD::IsmrmrdHeader hdr = ac.acquisitions_info().get_IsmrmrdHeader();
+    EncodingSpace rec_space = hdr.encoding[0].reconSpace;
+
+    size_t const nx = rec_space.matrixSize.x;
+    size_t const ny = rec_space.matrixSize.y;
+    size_t const nz = rec_space.matrixSize.z;
+    size_t const gy = 2*ny;
+    size_t const gz = 2*nz;
+
+    // point spread function of the trajectory for all distances between two
+    // image points, i.e. on a grid of twice the image size
+    GadgetronTrajectoryType2D traj = this->get_trajectory(ac);
+    std::vector < size_t > psf_dims{gy, gz};
+    Gridder_2D nufft(psf_dims, traj);
+
+    CFGThoNDArr ones(traj.get_number_of_elements());
+    ones.fill(complex_float_t(1.f, 0.f));
+    CFGThoNDArr psf;
+    nufft.ifft(psf, ones);
+
+    std::vector<size_t> grid_dims{1, gy, gz};
+    ISMRMRD::NDArray<complex_float_t> psf_ft(grid_dims);
+    for(size_t iz=0; iz<gz; ++iz)
+    for(size_t iy=0; iy<gy; ++iy)
+        psf_ft(0, iy, iz) = psf(iy, iz);
+    fft3c(psf_ft);
+
+    // the convolution at zero distance is the mean of the kernel; matching it
+    // to the response of the encoding to a point takes care of the
+    // normalisations of the transforms
+    ISMRMRD::Acquisition acq;
+    ac.get_acquisition(0, acq);
+    size_t const nc = acq.active_channels();
+
+    CFImage point(nx, ny, nz, nc);
+    std::fill(point.begin(), point.end(), complex_float_t(0.f, 0.f));
+    point(nx/2, ny/2, nz/2, 0) = complex_float_t(1.f, 0.f);
+
+    gadgetron::unique_ptr<MRAcquisitionData> uptr_ac = ac.clone();
+    this->forward(*uptr_ac, point);
+    CFImage response;
+    this->backward(response, *uptr_ac);
+
+    complex_float_t mean(0.f, 0.f);
+    for(size_t i=0; i<gy*gz; ++i)
+        mean += psf_ft.getDataPtr()[i];
+    mean /= float(gy*gz);
+    if (std::abs(mean) == 0)
+        throw LocalisedException("The point spread function of the trajectory vanishes." , __FILE__, __LINE__);
+    float const scale = std::real(response(nx/2, ny/2, nz/2, 0) / mean);
+
+    // the imaginary part only affects distances of a whole image size
+    std::vector<size_t> kernel_dims{gy, gz};
+    kernel.resize(kernel_dims);
+    for(size_t iz=0; iz<gz; ++iz)
+    for(size_t iy=0; iy<gy; ++iy)
+        kernel(iy, iz) = scale * std::real(psf_ft(0, iy, iz));
+
+    return true;
+}
+
+
 void Gridder_2D::setup_nufft(const std::vector<size_t> img_output_dims, const GadgetronTrajectoryType2D &traj)
 {
     if( img_output_dims.size() != 2)
@@ -38,6 +38,7 @@ limitations under the License.
 #include "sirf/Gadgetron/gadget_lib.h"
 #include "sirf/Gadgetron/chain_lib.h"
 #include "sirf/Gadgetron/TrajectoryPreparation.h"
+#include "sirf/Gadgetron/CoilCompression.h"
 // #include "sirf/Gadgetron/FourierEncoding.h"
 
 #if GADGETRON_TOOLBOXES_AVAILABLE
@@ -110,6 +111,39 @@ file_exists(const std::string& filename)
 	return false;
 }
 
+extern "C"
+void*
+cGT_setProfiling(int on)
+{
+	try {
+		Profiler::instance().set_enabled(on != 0);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_resetProfiling()
+{
+	try {
+		Profiler::instance().reset();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_profile(const char* format)
+{
+	try {
+		std::string profile = Profiler::instance().report(format);
+		return charDataHandleFromCharData(profile.c_str());
+	}
+	CATCH;
+}
+
 extern "C"
 void* cGT_newObject(const char* name)
 {
@@ -120,6 +154,8 @@ void* cGT_newObject(const char* name)
 			return NEW_OBJECT_HANDLE(GTConnector);
 		if (boost::iequals(name, "CoilImages"))
 			return NEW_OBJECT_HANDLE(CoilImagesVector);
+		if (boost::iequals(name, "CoilCompression"))
+			return NEW_OBJECT_HANDLE(CoilCompression);
         if (boost::iequals(name, "AcquisitionModel"))
 			return NEW_OBJECT_HANDLE(MRAcquisitionModel);
 		NEW_GADGET_CHAIN(GadgetChain);
@@ -201,6 +237,8 @@ cGT_parameter(void* ptr, const char* obj, const char* name)
 		if (boost::iequals(obj, "AcquisitionModel")) {
 			return cGT_AcquisitionModelParameter(ptr, name);
 		}
+		if (boost::iequals(obj, "coil_compression"))
+			return cGT_coilCompressionParameter(ptr, name);
 		return unknownObject("object", obj, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -213,6 +251,8 @@ cGT_setParameter(void* ptr, const char* obj, const char* par, const void* val)
 	try {
 		if (boost::iequals(obj, "coil_sensitivity"))
 			return cGT_setCSParameter(ptr, par, val);
+		if (boost::iequals(obj, "coil_compression"))
+			return cGT_setCoilCompressionParameter(ptr, par, val);
 		return unknownObject("object", obj, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -303,6 +343,88 @@ cGT_computeCoilSensitivitiesFromCoilImages(void* ptr_csms, void* ptr_imgs)
     CATCH;
 }
 
+extern "C"
+void*
+cGT_setCoilCompressionParameter(void* ptr, const char* par, const void* val)
+{
+	CoilCompression& cc = objectFromHandle<CoilCompression>(ptr);
+	if (boost::iequals(par, "mode")) {
+		std::string mode = charDataFromDataHandle((const DataHandle*)val);
+		if (boost::iequals(mode, "SVD"))
+			cc.set_mode(CoilCompression::SVD);
+		else if (boost::iequals(mode, "geometric"))
+			cc.set_mode(CoilCompression::GEOMETRIC);
+		else
+			return unknownObject("coil compression mode", mode.c_str(), __FILE__, __LINE__);
+	}
+	else if (boost::iequals(par, "num_virtual_coils"))
+		cc.set_num_virtual_coils(dataFromHandle<int>(val));
+	else if (boost::iequals(par, "energy_fraction"))
+		cc.set_energy_fraction(dataFromHandle<float>(val));
+	else
+		return unknownObject("parameter", par, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+extern "C"
+void*
+cGT_coilCompressionParameter(void* ptr, const char* name)
+{
+	CoilCompression& cc = objectFromHandle<CoilCompression>(ptr);
+	if (boost::iequals(name, "num_coils"))
+		return dataHandle<int>(cc.num_coils());
+	if (boost::iequals(name, "num_virtual_coils"))
+		return dataHandle<int>(cc.num_virtual_coils());
+	if (boost::iequals(name, "energy_kept"))
+		return dataHandle<float>(cc.energy_kept());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
+extern "C"
+void*
+cGT_computeCoilCompression(void* ptr_cc, const void* ptr_acqs)
+{
+	try {
+		CoilCompression& cc = objectFromHandle<CoilCompression>(ptr_cc);
+		MRAcquisitionData& acqs = objectFromHandle<MRAcquisitionData>(ptr_acqs);
+		cc.compute(acqs);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_compressAcquisitions(void* ptr_cc, const void* ptr_acqs)
+{
+	try {
+		CoilCompression& cc = objectFromHandle<CoilCompression>(ptr_cc);
+		MRAcquisitionData& acqs = objectFromHandle<MRAcquisitionData>(ptr_acqs);
+		shared_ptr<MRAcquisitionData> sptr_ac(acqs.clone());
+		cc.apply(*sptr_ac);
+		return newObjectHandle(sptr_ac);
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_compressCoilSensitivities(void* ptr_cc, const void* ptr_csms)
+{
+	try {
+		CoilCompression& cc = objectFromHandle<CoilCompression>(ptr_cc);
+		CoilSensitivitiesVector& csms =
+			objectFromHandle<CoilSensitivitiesVector>(ptr_csms);
+		shared_ptr<CoilSensitivitiesVector> sptr_csms(new CoilSensitivitiesVector);
+		sptr_csms->set_meta_data(csms.get_meta_data());
+		for (unsigned int i = 0; i < csms.number(); i++)
+			sptr_csms->append(csms.image_wrap(i));
+		cc.apply(*sptr_csms);
+		return newObjectHandle(sptr_csms);
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cGT_AcquisitionModel(const void* ptr_acqs, const void* ptr_imgs)
@@ -369,6 +491,10 @@ cGT_setAcquisitionModelParameter
 			getObjectSptrFromHandle<CoilSensitivitiesVector>(handle, sptr_csc);
 			am.set_csm(sptr_csc);
 		}
+		else if (boost::iequals(name, "use_normal_kernels")) {
+			MRAcquisitionModel& am = objectFromHandle<MRAcquisitionModel>(h_am);
+			am.set_use_normal_kernels(dataFromHandle<int>(ptr));
+		}
 		else
 			return unknownObject("parameter", name, __FILE__, __LINE__);
 		return (void*)new DataHandle;
@@ -453,6 +579,21 @@ cGT_AcquisitionModelBackward(void* ptr_am, const void* ptr_acqs)
 	CATCH;
 }
 
+extern "C"
+void*
+cGT_AcquisitionModelNormal(void* ptr_am, const void* ptr_imgs)
+{
+	try {
+		CAST_PTR(DataHandle, h_am, ptr_am);
+		CAST_PTR(DataHandle, h_imgs, ptr_imgs);
+		MRAcquisitionModel& am = objectFromHandle<MRAcquisitionModel>(h_am);
+		GadgetronImageData& imgs = objectFromHandle<GadgetronImageData>(h_imgs);
+		shared_ptr<GadgetronImageData> sptr_imgs = am.normal(imgs);
+		return newObjectHandle<GadgetronImageData>(sptr_imgs);
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cGT_sortAcquisitions(void* ptr_acqs)
@@ -1170,6 +1311,20 @@ cGT_setPort(void* ptr_gc, const char* port)
 	return (void*)new DataHandle;
 }
 
+extern "C"
+void*
+cGT_setConfigDir(void* ptr_gc, const char* dir)
+{
+	try {
+		CAST_PTR(DataHandle, h_gc, ptr_gc);
+		GadgetChain& gc = objectFromHandle<GadgetChain>(h_gc);
+		gc.set_config_dir(dir);
+	}
+	CATCH;
+
+	return (void*)new DataHandle;
+}
+
 extern "C"
 void*
 cGT_addReader(void* ptr_gc, const char* id, const void* ptr_r)
@@ -1287,9 +1442,7 @@ cGT_configGadgetChain(void* ptr_con, void* ptr_gc)
 		GTConnector& conn = objectFromHandle<GTConnector>(h_con);
 		GadgetronClientConnector& con = conn();
 		GadgetChain& gc = objectFromHandle<GadgetChain>(h_gc);
-		std::string config = gc.xml();
-		//std::cout << config << std::endl;
-		con.send_gadgetron_configuration_script(config);
+		gc.send_config(con);
 	}
 	CATCH;
 
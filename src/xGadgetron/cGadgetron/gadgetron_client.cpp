@@ -71,6 +71,7 @@ using namespace sirf;
 void
 GadgetronClientAcquisitionMessageCollector::read(boost::asio::ip::tcp::socket* stream)
 {
+	ScopedTimer timer("GadgetronClientConnector::receive_acquisition");
 	ISMRMRD::Acquisition acq;
 	ISMRMRD::AcquisitionHeader h;
 	boost::asio::read
@@ -92,6 +93,9 @@ GadgetronClientAcquisitionMessageCollector::read(boost::asio::ip::tcp::socket* s
 			boost::asio::buffer
 			(&acq.getDataPtr()[0], 2 * sizeof(float)*data_elements));
 	}
+	Profiler::count_bytes("GadgetronClientConnector::receive_acquisition",
+		sizeof(ISMRMRD::AcquisitionHeader) +
+		sizeof(float)*(trajectory_elements + 2 * data_elements));
 
 	ptr_acqs_->append_acquisition(acq);
 }
@@ -99,6 +103,7 @@ GadgetronClientAcquisitionMessageCollector::read(boost::asio::ip::tcp::socket* s
 void 
 GadgetronClientImageMessageCollector::read(boost::asio::ip::tcp::socket* stream)
 {
+	ScopedTimer timer("GadgetronClientConnector::receive_image");
 	//Read the image headerfrom the socket
 	ISMRMRD::ImageHeader h;
 	boost::asio::read
@@ -275,6 +280,7 @@ GadgetronClientConnector::send_gadgetron_parameters(std::string xml_string)
 void 
 GadgetronClientConnector::send_ismrmrd_acquisition(ISMRMRD::Acquisition& acq)
 {
+	ScopedTimer timer("GadgetronClientConnector::send_acquisition");
 	if (!socket_)
 		throw GadgetronClientException("Invalid socket.");
 
@@ -303,6 +309,9 @@ GadgetronClientConnector::send_ismrmrd_acquisition(ISMRMRD::Acquisition& acq)
 			boost::asio::buffer
 			(&acq.getDataPtr()[0], 2 * sizeof(float)*data_elements));
 	}
+	Profiler::count_bytes("GadgetronClientConnector::send_acquisition",
+		sizeof(ISMRMRD::AcquisitionHeader) +
+		sizeof(float)*(trajectory_elements + 2 * data_elements));
 }
 
 GadgetronClientMessageReader* 
@@ -32,6 +32,7 @@ limitations under the License.
 #include <cmath>
 #include <iomanip>
 #include <algorithm> 
+#include <mutex>
 
 #include <ismrmrd/xml.h>
 #include <ismrmrd/ismrmrd.h>
@@ -43,6 +44,7 @@ limitations under the License.
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
+#include "sirf/Gadgetron/xgadgetron_utilities.h"
 
 using namespace gadgetron;
 using namespace sirf;
@@ -69,24 +71,18 @@ static std::string get_date_time_string()
 void 
 MRAcquisitionData::write(const std::string &filename) const
 {
-	Mutex mtx;
-	mtx.lock();
-	shared_ptr<ISMRMRD::Dataset> dataset
-		(new ISMRMRD::Dataset(filename.c_str(), "/dataset", true));
-	dataset->writeHeader(acqs_info_.c_str());
-	mtx.unlock();
+	ISMRMRDWriter writer(filename);
+	write(writer);
+	writer.close();
+}
+
+void
+MRAcquisitionData::write(ISMRMRDWriter& writer) const
+{
+	writer.write_header(acqs_info_.c_str());
 	int n = number();
-	ISMRMRD::Acquisition a;
-	for (int i = 0; i < n; i++) {
-		get_acquisition(i, a);
-		//std::cout << i << ' ' << a.idx().repetition << '\n';
-		//if (TO_BE_IGNORED(a)) {
-		//	continue;
-		//}
-		mtx.lock();
-		dataset->appendAcquisition(a);
-		mtx.unlock();
-	}
+	for (int i = 0; i < n; i++)
+		writer.append_acquisition(*get_acquisition_sptr(i));
 }
 
 void
@@ -280,20 +276,158 @@ MRAcquisitionData::set_user_floats(float const * const z, int const idx)
 
 
 
+// Kernels of the acquisitions algebra.
+// Complex numbers are handled as pairs of floats, so that the loops are
+// vectorised (the std::complex operators check for infinities and NaNs);
+// out may be the same as any of the inputs.
+
+// out := a x + b y
+static void axpby_kernel(size_t n, complex_float_t a, const complex_float_t* x,
+	complex_float_t b, const complex_float_t* y, complex_float_t* out)
+{
+	const float* px = reinterpret_cast<const float*>(x);
+	const float* py = reinterpret_cast<const float*>(y);
+	float* po = reinterpret_cast<float*>(out);
+	const float ar = a.real();
+	const float ai = a.imag();
+	const float br = b.real();
+	const float bi = b.imag();
+	if (b == complex_float_t(0.0)) {
+		for (size_t i = 0; i < 2*n; i += 2) {
+			const float xr = px[i];
+			const float xi = px[i + 1];
+			po[i] = ar*xr - ai*xi;
+			po[i + 1] = ar*xi + ai*xr;
+		}
+		return;
+	}
+	for (size_t i = 0; i < 2*n; i += 2) {
+		const float xr = px[i];
+		const float xi = px[i + 1];
+		const float yr = py[i];
+		const float yi = py[i + 1];
+		po[i] = ar*xr - ai*xi + br*yr - bi*yi;
+		po[i + 1] = ar*xi + ai*xr + br*yi + bi*yr;
+	}
+}
+
+// out := a .* x + b .* y
+static void xapyb_kernel(size_t n, const complex_float_t* x, const complex_float_t* a,
+	const complex_float_t* y, const complex_float_t* b, complex_float_t* out)
+{
+	const float* px = reinterpret_cast<const float*>(x);
+	const float* pa = reinterpret_cast<const float*>(a);
+	const float* py = reinterpret_cast<const float*>(y);
+	const float* pb = reinterpret_cast<const float*>(b);
+	float* po = reinterpret_cast<float*>(out);
+	for (size_t i = 0; i < 2*n; i += 2) {
+		const float xr = px[i];
+		const float xi = px[i + 1];
+		const float yr = py[i];
+		const float yi = py[i + 1];
+		const float ar = pa[i];
+		const float ai = pa[i + 1];
+		const float br = pb[i];
+		const float bi = pb[i + 1];
+		po[i] = ar*xr - ai*xi + br*yr - bi*yi;
+		po[i + 1] = ar*xi + ai*xr + br*yi + bi*yr;
+	}
+}
+
+// out := x .* y
+static void multiply_kernel(size_t n, const complex_float_t* x,
+	const complex_float_t* y, complex_float_t* out)
+{
+	const float* px = reinterpret_cast<const float*>(x);
+	const float* py = reinterpret_cast<const float*>(y);
+	float* po = reinterpret_cast<float*>(out);
+	for (size_t i = 0; i < 2*n; i += 2) {
+		const float xr = px[i];
+		const float xi = px[i + 1];
+		const float yr = py[i];
+		const float yi = py[i + 1];
+		po[i] = xr*yr - xi*yi;
+		po[i + 1] = xr*yi + xi*yr;
+	}
+}
+
+// out := x ./ y (without the scaling of std::complex division, so the
+// result overflows if |y|^2 does)
+static void divide_kernel(size_t n, const complex_float_t* x,
+	const complex_float_t* y, complex_float_t* out)
+{
+	const float* px = reinterpret_cast<const float*>(x);
+	const float* py = reinterpret_cast<const float*>(y);
+	float* po = reinterpret_cast<float*>(out);
+	for (size_t i = 0; i < 2*n; i += 2) {
+		const float xr = px[i];
+		const float xi = px[i + 1];
+		const float yr = py[i];
+		const float yi = py[i + 1];
+		const float d = yr*yr + yi*yi;
+		po[i] = (xr*yr + xi*yi)/d;
+		po[i + 1] = (xi*yr - xr*yi)/d;
+	}
+}
+
+// sum of x conj(y); the partial sums are accumulated in independent lanes,
+// so that the loop is vectorised without reordering the additions
+static complex_double_t dot_kernel(size_t n, const complex_float_t* x,
+	const complex_float_t* y)
+{
+	const size_t lanes = 8;
+	const float* px = reinterpret_cast<const float*>(x);
+	const float* py = reinterpret_cast<const float*>(y);
+	float re[lanes] = { 0 };
+	float im[lanes] = { 0 };
+	size_t i = 0;
+	for (; i + lanes <= n; i += lanes)
+		for (size_t l = 0; l < lanes; l++) {
+			const float xr = px[2 * (i + l)];
+			const float xi = px[2 * (i + l) + 1];
+			const float yr = py[2 * (i + l)];
+			const float yi = py[2 * (i + l) + 1];
+			re[l] += xr*yr + xi*yi;
+			im[l] += xi*yr - xr*yi;
+		}
+	complex_double_t z = 0;
+	for (size_t l = 0; l < lanes; l++)
+		z += complex_double_t(re[l], im[l]);
+	for (; i < n; i++)
+		z += complex_double_t(x[i] * std::conj(y[i]));
+	return z;
+}
+
+// sum of |x|^2
+static double norm2_kernel(size_t n, const complex_float_t* x)
+{
+	const size_t lanes = 16;
+	const float* px = reinterpret_cast<const float*>(x);
+	float s[lanes] = { 0 };
+	size_t i = 0;
+	for (; i + lanes <= 2*n; i += lanes)
+		for (size_t l = 0; l < lanes; l++)
+			s[l] += px[i + l] * px[i + l];
+	double r = 0;
+	for (size_t l = 0; l < lanes; l++)
+		r += s[l];
+	for (; i < 2*n; i++)
+		r += double(px[i])*px[i];
+	return r;
+}
+
+static size_t data_size(const ISMRMRD::Acquisition& acq)
+{
+	return acq.data_end() - acq.data_begin();
+}
+
 void 
 MRAcquisitionData::axpby
 (complex_float_t a, const ISMRMRD::Acquisition& acq_x,
 	complex_float_t b, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		if (b == complex_float_t(0.0))
-			*py = a * (*px);
-		else
-			*py = a * (*px) + b * (*py);
-	}
+	const size_t n = std::min(data_size(acq_x), data_size(acq_y));
+	axpby_kernel(n, a, acq_x.data_begin(), b, acq_y.data_begin(), acq_y.data_begin());
 }
 
 void 
@@ -309,68 +443,40 @@ MRAcquisitionData::xapyb
 (const ISMRMRD::Acquisition& acq_x, const ISMRMRD::Acquisition& acq_a,
 	ISMRMRD::Acquisition& acq_y, const ISMRMRD::Acquisition& acq_b)
 {
-	complex_float_t* px;
-	complex_float_t* pa;
-	complex_float_t* py;
-	complex_float_t* pb;
-	for (px = acq_x.data_begin(), pa = acq_a.data_begin(),
-		py = acq_y.data_begin(), pb = acq_b.data_begin();
-		px != acq_x.data_end() && pa != acq_a.data_end(),
-		py != acq_y.data_end() && pb != acq_b.data_end();
-		px++, pa++, py++, pb++) {
-		*py = (*pa) * (*px) + (*pb) * (*py);
-	}
+	const size_t n = std::min(std::min(data_size(acq_x), data_size(acq_a)),
+		std::min(data_size(acq_y), data_size(acq_b)));
+	xapyb_kernel(n, acq_x.data_begin(), acq_a.data_begin(),
+		acq_y.data_begin(), acq_b.data_begin(), acq_y.data_begin());
 }
 
 void
 MRAcquisitionData::multiply
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		*py = complex_float_t(*px) * complex_float_t(*py);
-	}
+	const size_t n = std::min(data_size(acq_x), data_size(acq_y));
+	multiply_kernel(n, acq_x.data_begin(), acq_y.data_begin(), acq_y.data_begin());
 }
 
 void
 MRAcquisitionData::divide
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		*py = complex_float_t(*px) / complex_float_t(*py);
-	}
+	const size_t n = std::min(data_size(acq_x), data_size(acq_y));
+	divide_kernel(n, acq_x.data_begin(), acq_y.data_begin(), acq_y.data_begin());
 }
 
 complex_float_t
 MRAcquisitionData::dot
 (const ISMRMRD::Acquisition& acq_a, const ISMRMRD::Acquisition& acq_b)
 {
-	complex_float_t* pa;
-	complex_float_t* pb;
-	complex_float_t z = 0;
-	for (pa = acq_a.data_begin(), pb = acq_b.data_begin();
-		pa != acq_a.data_end() && pb != acq_b.data_end(); pa++, pb++) {
-		z += std::conj(*pb) * (*pa);
-	}
-	return z;
+	const size_t n = std::min(data_size(acq_a), data_size(acq_b));
+	return complex_float_t(dot_kernel(n, acq_a.data_begin(), acq_b.data_begin()));
 }
 
 float 
 MRAcquisitionData::norm(const ISMRMRD::Acquisition& acq_a)
 {
-	complex_float_t* pa;
-	float r = 0;
-	for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++) {
-		complex_float_t z = std::conj(*pa) * (*pa);
-		r += z.real();
-	}
-	r = sqrt(r);
-	return r;
+	return (float)std::sqrt(norm2_kernel(data_size(acq_a), acq_a.data_begin()));
 }
 
 void
@@ -378,28 +484,25 @@ MRAcquisitionData::dot(const DataContainer& dc, void* ptr) const
 {
 	//MRAcquisitionData& other = (MRAcquisitionData&)dc;
 	DYNAMIC_CAST(const MRAcquisitionData, other, dc);
-	int n = number();
-	int m = other.number();
-	complex_float_t z = 0;
-	ISMRMRD::Acquisition a;
-	ISMRMRD::Acquisition b;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		get_acquisition(i, a);
-		if (TO_BE_IGNORED(a)) {
-			i++;
-			continue;
-		}
-		other.get_acquisition(j, b);
-		if (TO_BE_IGNORED(b)) {
-			j++;
-			continue;
+	// the i-th active acquisitions of the two containers are paired
+	const std::vector<int>& ia = active_index();
+	const std::vector<int>& ib = other.active_index();
+	const size_t n = std::min(ia.size(), ib.size());
+	complex_double_t z = 0;
+	std::mutex mutex;
+	xGadgetronUtilities::parallel_for(n, 64, [&](size_t begin, size_t end, size_t) {
+		complex_double_t s = 0;
+		for (size_t i = begin; i < end; i++) {
+			const ISMRMRD::Acquisition& a = *get_acquisition_sptr(ia[i]);
+			const ISMRMRD::Acquisition& b = *other.get_acquisition_sptr(ib[i]);
+			s += dot_kernel(std::min(data_size(a), data_size(b)),
+				a.data_begin(), b.data_begin());
 		}
-		z += MRAcquisitionData::dot(a, b);
-		i++;
-		j++;
-	}
+		std::lock_guard<std::mutex> lock(mutex);
+		z += s;
+	});
 	complex_float_t* ptr_z = (complex_float_t*)ptr;
-	*ptr_z = z;
+	*ptr_z = complex_float_t(z);
 }
 
 void
@@ -457,10 +560,12 @@ const void* ptr_a, const void* ptr_b)
 	//DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
 	if (!x.sorted() || !y.sorted())
 		THROW("binary algebraic operations cannot be applied to unsorted data");
+	if (op != 1 && op != -1 && op != 2 && op != 3)
+		THROW("wrong operation in MRAcquisitionData::binary_op_");
 	complex_float_t a;
 	complex_float_t b;
-	const MRAcquisitionData* ptr_aa;
-	const MRAcquisitionData* ptr_ab;
+	const MRAcquisitionData* ptr_aa = 0;
+	const MRAcquisitionData* ptr_ab = 0;
 	if (op == 1) {
 		a = *(complex_float_t*)ptr_a;
 		b = *(complex_float_t*)ptr_b;
@@ -470,83 +575,61 @@ const void* ptr_a, const void* ptr_b)
 		ptr_ab = (const MRAcquisitionData*)ptr_b;
 	}
 
-	int nx = x.number();
-	int ny = y.number();
-	int na = 1;
-	int nb = 1;
+	// the i-th active acquisitions of all operands are paired; the indices
+	// are copied, since setting the acquisitions of this container may reset
+	// its index, and any of the operands may be this container
+	const std::vector<int> ix = x.active_index();
+	const std::vector<int> iy = y.active_index();
+	std::vector<int> ia;
+	std::vector<int> ib;
+	size_t n = std::min(ix.size(), iy.size());
 	if (op < 0) {
-		na = ptr_aa->number();
-		nb = ptr_ab->number();
+		ia = ptr_aa->active_index();
+		ib = ptr_ab->active_index();
+		n = std::min(n, std::min(ia.size(), ib.size()));
 	}
-	ISMRMRD::Acquisition ax;
-	ISMRMRD::Acquisition ay;
-	ISMRMRD::Acquisition aa;
-	ISMRMRD::Acquisition ab;
-	ISMRMRD::Acquisition acq;
-	bool isempty = (number() < 1);
-	for (int ix = 0, iy = 0, ia = 0, ib = 0, k = 0; 
-		ix < nx && iy < ny && ia < na && ib < nb;) {
-		x.get_acquisition(ix, ax);
-		if (TO_BE_IGNORED(ax)) {
-			std::cout << ix << " ignored (ax)\n";
-			ix++;
-			continue;
-		}
-		y.get_acquisition(iy, ay);
-		if (TO_BE_IGNORED(ay)) {
-			std::cout << iy << " ignored (ay)\n";
-			iy++;
-			continue;
-		}
-		if (op < 0) {
-			ptr_aa->get_acquisition(ia, aa);
-			if (TO_BE_IGNORED(aa)) {
-				std::cout << ia << " ignored (aa)\n";
-				ia++;
-				continue;
-			}
-			ptr_ab->get_acquisition(ib, ab);
-			if (TO_BE_IGNORED(ab)) {
-				std::cout << ib << " ignored (ab)\n";
-				ib++;
-				continue;
-			}
-		}
-		if (!isempty) {
-			get_acquisition(k, acq);
-			if (TO_BE_IGNORED(acq)) {
-				std::cout << k << " ignored (acq)\n";
-				k++;
-				continue;
+	const bool isempty = (number() < 1);
+	std::vector<int> iz;
+	if (!isempty) {
+		iz = active_index();
+		n = std::min(n, iz.size());
+	}
+
+	// the results for each block of acquisitions are computed in parallel
+	// and stored serially
+	const size_t block = 4096;
+	std::vector<ISMRMRD::Acquisition> out(std::min(n, block));
+	for (size_t start = 0; start < n; start += block) {
+		const size_t m = std::min(block, n - start);
+		xGadgetronUtilities::parallel_for(m, 64, [&](size_t begin, size_t end, size_t) {
+			for (size_t i = begin; i < end; i++) {
+				const size_t j = start + i;
+				ISMRMRD::Acquisition& acq = out[i];
+				const ISMRMRD::Acquisition& acq_x = *x.get_acquisition_sptr(ix[j]);
+				acq = *y.get_acquisition_sptr(iy[j]);
+				switch (op) {
+				case 1:
+					MRAcquisitionData::axpby(a, acq_x, b, acq);
+					break;
+				case -1:
+					MRAcquisitionData::xapyb(acq_x, *ptr_aa->get_acquisition_sptr(ia[j]),
+						acq, *ptr_ab->get_acquisition_sptr(ib[j]));
+					break;
+				case 2:
+					MRAcquisitionData::multiply(acq_x, acq);
+					break;
+				case 3:
+					MRAcquisitionData::divide(acq_x, acq);
+					break;
+				}
 			}
+		});
+		for (size_t i = 0; i < m; i++) {
+			if (isempty)
+				append_acquisition(out[i]);
+			else
+				set_acquisition(iz[start + i], out[i]);
 		}
-		switch (op) {
-		case 1:
-			MRAcquisitionData::axpby(a, ax, b, ay);
-			break;
-		case -1:
-			MRAcquisitionData::xapyb(ax, aa, ay, ab);
-			break;
-		case 2:
-			MRAcquisitionData::multiply(ax, ay);
-			break;
-		case 3:
-			MRAcquisitionData::divide(ax, ay);
-			break;
-		default:
-			THROW("wrong operation in MRAcquisitionData::binary_op_");
-		}
-		if (isempty)
-			append_acquisition(ay);
-		else
-			set_acquisition(k, ay);
-		ix++;
-		iy++;
-		if (op < 0) {
-			ia++;
-			ib++;
-		}
-		k++;
 	}
 	this->set_sorted(true);
 	this->organise_kspace();
@@ -555,18 +638,19 @@ const void* ptr_a, const void* ptr_b)
 float 
 MRAcquisitionData::norm() const
 {
-	int n = number();
-	float r = 0;
-	ISMRMRD::Acquisition a;
-	for (int i = 0; i < n; i++) {
-		get_acquisition(i, a);
-		if (TO_BE_IGNORED(a)) {
-			continue;
+	const std::vector<int>& ia = active_index();
+	double r = 0;
+	std::mutex mutex;
+	xGadgetronUtilities::parallel_for(ia.size(), 64, [&](size_t begin, size_t end, size_t) {
+		double s = 0;
+		for (size_t i = begin; i < end; i++) {
+			const ISMRMRD::Acquisition& a = *get_acquisition_sptr(ia[i]);
+			s += norm2_kernel(data_size(a), a.data_begin());
 		}
-		float s = MRAcquisitionData::norm(a);
-		r += s*s;
-	}
-	return sqrt(r);
+		std::lock_guard<std::mutex> lock(mutex);
+		r += s;
+	});
+	return (float)std::sqrt(r);
 }
 
 
@@ -593,17 +677,14 @@ void
 MRAcquisitionData::sort_by_time()
 {
 	typedef std::array<uint32_t , 1>  tuple;
-	tuple t;
-	std::vector< tuple > vt;
-	size_t const num_acquis = this->number();
+	// the header index is in the storage order, so the new sorting index
+	// does not depend on the previous one
+	const MRAcquisitionHeaderIndex& hi = header_index();
+	size_t const num_acquis = hi.size();
+	std::vector< tuple > vt(num_acquis);
 
 	for(size_t i=0; i<num_acquis; i++)
-	{
-		ISMRMRD::Acquisition acq;
-		get_acquisition(i, acq);
-		t[0] = acq.acquisition_time_stamp();
-		vt.push_back( t );
-	}
+		vt[i][0] = hi[i].acquisition_time_stamp;
 
 	index_.resize(num_acquis);
 	
@@ -611,6 +692,7 @@ MRAcquisitionData::sort_by_time()
 		std::cerr << "WARNING: You try to sort by time an empty container of acquisition data." << std::endl;
 	else
 		Multisort::sort( vt, &index_[0] );
+	active_index_valid_ = false;
     
     this->organise_kspace();
     sorted_ = true;
@@ -685,12 +767,10 @@ void MRAcquisitionData::organise_kspace()
         this->sorting_.push_back(sorting);
     }
 
-    ISMRMRD::Acquisition acq;
+    const MRAcquisitionHeaderIndex& hi = this->header_index();
     for(int i=0; i<this->number(); ++i)
     {
-        this->get_acquisition(i, acq);
-
-        KSpaceSubset::TagType tag = KSpaceSubset::get_tag_from_acquisition(acq);
+        KSpaceSubset::TagType tag = KSpaceSubset::get_tag_from_counters(hi[this->index(i)].idx);
         int access_idx = (((((tag[0] * NSlice + tag[1])*NCont + tag[2])*NPhase + tag[3])*NRep + tag[4])*NSet + tag[5])*NSegm + tag[6];
         this->sorting_.at(access_idx).add_idx_to_set(i);
     }
@@ -707,15 +787,15 @@ std::vector<int> MRAcquisitionData::get_flagged_acquisitions_index(const std::ve
     if(flags.empty())
         return flags_true_index;
 
-    ISMRMRD::Acquisition acq;
+    const MRAcquisitionHeaderIndex& hi = this->header_index();
 
     for(int i=0; i<this->number(); ++i)
     {
-        this->get_acquisition(i, acq);
+        const MRAcquisitionHeaderIndex::Entry& e = hi[this->index(i)];
         bool one_flag_is_set = false;
         
         for(auto it: flags)
-            one_flag_is_set = (one_flag_is_set || acq.isFlagSet(it));
+            one_flag_is_set = (one_flag_is_set || e.is_flag_set(it));
         
         if(one_flag_is_set)
             flags_true_index.push_back(i);
@@ -724,6 +804,75 @@ std::vector<int> MRAcquisitionData::get_flagged_acquisitions_index(const std::ve
     return flags_true_index;
 }
 
+void MRAcquisitionHeaderIndex::build(const MRAcquisitionData& ad)
+{
+    ScopedTimer timer("MRAcquisitionHeaderIndex::build");
+    const unsigned int n = ad.number();
+    std::vector<Entry> entries(n);
+    ISMRMRD::AcquisitionHeader head;
+    for(unsigned int i=0; i<n; ++i)
+    {
+        ad.get_acquisition_header(i, head);
+        int ind = ad.index(i);
+        if(ind < 0 || ind >= (int)n)
+            throw LocalisedException("The sorting index of the acquisition data is inconsistent", __FILE__, __LINE__);
+        entries[ind] = entry(head);
+    }
+    entries_.swap(entries);
+    valid_ = true;
+}
+
+const MRAcquisitionHeaderIndex& MRAcquisitionData::header_index() const
+{
+    if(!header_index_.valid() || header_index_.size() != this->number())
+        header_index_.build(*this);
+    return header_index_;
+}
+
+const std::vector<int>& MRAcquisitionData::active_index() const
+{
+    if(active_index_valid_ && header_index_.valid() && header_index_.size() == this->number())
+        return active_index_;
+    const MRAcquisitionHeaderIndex& hi = this->header_index();
+    std::vector<int> idx;
+    idx.reserve(this->number());
+    for(int i=0; i<this->number(); ++i)
+        if(!hi[this->index(i)].to_be_ignored())
+            idx.push_back(i);
+    active_index_.swap(idx);
+    active_index_valid_ = true;
+    return active_index_;
+}
+
+std::vector<int> MRAcquisitionData::select_acquisitions
+(const std::function<bool(const MRAcquisitionHeaderIndex::Entry&)>& selected) const
+{
+    const MRAcquisitionHeaderIndex& hi = this->header_index();
+    std::vector<int> idx;
+    for(int i=0; i<this->number(); ++i)
+        if(selected(hi[this->index(i)]))
+            idx.push_back(i);
+    return idx;
+}
+
+std::vector<KSpaceSubset::SetType> MRAcquisitionData::bin_acquisitions
+(const std::function<int(const MRAcquisitionHeaderIndex::Entry&)>& bin, int num_bins) const
+{
+    if(num_bins < 1)
+        throw LocalisedException("The number of bins must be positive", __FILE__, __LINE__);
+    const MRAcquisitionHeaderIndex& hi = this->header_index();
+    std::vector<KSpaceSubset::SetType> bins(num_bins);
+    for(int i=0; i<this->number(); ++i)
+    {
+        int b = bin(hi[this->index(i)]);
+        if(b >= num_bins)
+            throw LocalisedException("The bin number is out of range", __FILE__, __LINE__);
+        if(b >= 0)
+            bins[b].push_back(i);
+    }
+    return bins;
+}
+
 void MRAcquisitionData::get_subset(MRAcquisitionData& subset, const std::vector<int> subset_idx) const
 {
     subset.set_acquisitions_info(this->acquisitions_info());
@@ -772,6 +921,8 @@ void
 AcquisitionsVector::empty()
 {
 	acqs_.clear();
+	header_index_.invalidate();
+	active_index_valid_ = false;
 }
 
 void
@@ -834,19 +985,24 @@ KSpaceSubset::TagType KSpaceSubset::get_tag_from_img(const CFImage& img)
 }
 
 
-KSpaceSubset::TagType KSpaceSubset::get_tag_from_acquisition(ISMRMRD::Acquisition acq)
+KSpaceSubset::TagType KSpaceSubset::get_tag_from_acquisition(const ISMRMRD::Acquisition& acq)
+{
+    return get_tag_from_counters(acq.idx());
+}
+
+KSpaceSubset::TagType KSpaceSubset::get_tag_from_counters(const ISMRMRD::EncodingCounters& idx)
 {
     TagType tag;
-    tag[0] = acq.idx().average;
-    tag[1] = acq.idx().slice;
-    tag[2] = acq.idx().contrast;
-    tag[3] = acq.idx().phase;
-    tag[4] = acq.idx().repetition;
-    tag[5] = acq.idx().set;
-    tag[6] = 0; //acq.idx().segment;
+    tag[0] = idx.average;
+    tag[1] = idx.slice;
+    tag[2] = idx.contrast;
+    tag[3] = idx.phase;
+    tag[4] = idx.repetition;
+    tag[5] = idx.set;
+    tag[6] = 0; //idx.segment;
 
     for(int i=7; i<tag.size(); ++i)
-        tag[i]=acq.idx().user[i];
+        tag[i]=idx.user[i-7];
 
     return tag;
 }
@@ -887,6 +1043,7 @@ GadgetronImageData::axpby(
 const void* ptr_a, const DataContainer& a_x,
 const void* ptr_b, const DataContainer& a_y)
 {
+	mark_modified();
 	complex_float_t a = *(complex_float_t*)ptr_a;
 	complex_float_t b = *(complex_float_t*)ptr_b;
 	DYNAMIC_CAST(const GadgetronImageData, x, a_x);
@@ -928,6 +1085,7 @@ GadgetronImageData::multiply(
 const DataContainer& a_x,
 const DataContainer& a_y)
 {
+	mark_modified();
 	DYNAMIC_CAST(const GadgetronImageData, x, a_x);
 	DYNAMIC_CAST(const GadgetronImageData, y, a_y);
 	unsigned int nx = x.number();
@@ -956,6 +1114,7 @@ GadgetronImageData::divide(
 const DataContainer& a_x,
 const DataContainer& a_y)
 {
+	mark_modified();
 	DYNAMIC_CAST(const GadgetronImageData, x, a_x);
 	DYNAMIC_CAST(const GadgetronImageData, y, a_y);
 	unsigned int nx = x.number();
@@ -995,6 +1154,7 @@ GadgetronImageData::norm() const
 void
 GadgetronImageData::fill(float s)
 {
+	mark_modified();
 	for (unsigned int i = 0; i < number(); i++) {
 		ImageWrap& u = image_wrap(i);
 		u.fill(s);
@@ -1004,6 +1164,7 @@ GadgetronImageData::fill(float s)
 void
 GadgetronImageData::scale(float s)
 {
+	mark_modified();
 	for (unsigned int i = 0; i < number(); i++) {
 		ImageWrap& u = image_wrap(i);
 		u.scale(s);
@@ -1111,7 +1272,12 @@ GadgetronImageData::read(std::string filename, std::string variable, int iv)
 	int ng = names.size();
 	const char* group = names[0].c_str();
 	printf("group %s\n", group);
-        Mutex mtx;
+
+	ISMRMRDReader reader(filename, group);
+	// the header is optional
+	std::string& xml = this->acqs_info_;
+	xml = reader.read_header();
+
 	for (int ig = 0; ig < ng; ig++) {
 		const char* var = names[ig].c_str();
 		if (!ig)
@@ -1127,38 +1293,15 @@ GadgetronImageData::read(std::string filename, std::string variable, int iv)
 		if (strcmp(var, "xml") == 0)
 			continue;
 
-		mtx.lock();
-
-		ISMRMRD::ISMRMRD_Dataset dataset;
-		ISMRMRD::ISMRMRD_Image im;
-		ismrmrd_init_dataset(&dataset, filename.c_str(), group);
-		ismrmrd_open_dataset(&dataset, false);
-		int num_im = ismrmrd_get_number_of_images(&dataset, var);
+		size_t num_im = reader.number_of_images(var);
 		std::cout << "number of images: " << num_im << '\n';
-		ismrmrd_init_image(&im);
-		ismrmrd_read_image(&dataset, var, 0, &im);
-		printf("image data type: %d\n", im.head.data_type);
-		ismrmrd_cleanup_image(&im);
-		ismrmrd_close_dataset(&dataset);
-
-		shared_ptr<ISMRMRD::Dataset> sptr_dataset
-			(new ISMRMRD::Dataset(filename.c_str(), group, false));
-
-		// ISMRMRD throws an error if no XML is present.
-		try {
-			sptr_dataset->readHeader(this->acqs_info_);
-		}
-		catch (const std::exception &error) {
-		}
+		if (num_im > 0)
+			printf("image data type: %d\n", reader.image_data_type(var));
 
-		mtx.unlock();
-
-		for (int i = 0; i < num_im; i++) {
-			shared_ptr<ImageWrap> sptr_iw(new ImageWrap(im.head.data_type, *sptr_dataset, var, i));
-			//sptr_iw->read(*sptr_dataset, var, i);
-			append(*sptr_iw);
-			//images_.push_back(sptr_iw);
-		}
+		// the images are built by the reader and appended without copying
+		reader.read_images(var, [this](uint16_t type, void* ptr_image) {
+			append(type, ptr_image);
+		});
 		//int dim[3];
 		//sptr_iw->get_dim(dim);
 		//std::cout << "image dimensions: "
@@ -1186,15 +1329,13 @@ GadgetronImageData::write(const std::string &filename, const std::string &groupn
         std::string group = groupname;
         if (group.empty())
             group = get_date_time_string();
-        Mutex mtx;
-        mtx.lock();
-        ISMRMRD::Dataset dataset(filename.c_str(), group.c_str());
-        dataset.writeHeader(acqs_info_.c_str());
-        mtx.unlock();
+        ISMRMRDWriter writer(filename, group);
+        writer.write_header(acqs_info_.c_str());
         for (unsigned int i = 0; i < number(); i++) {
             const ImageWrap& iw = image_wrap(i);
-            iw.write(dataset);
+            iw.write(writer);
         }
+        writer.close();
     }
     // If DICOM
     else {
@@ -1218,6 +1359,7 @@ GadgetronImageData::get_data(complex_float_t* data) const
 void
 GadgetronImageData::set_data(const complex_float_t* z)
 {
+	mark_modified();
 	int dim[4];
 	for (unsigned int i = 0; i < number(); i++) {
 		ImageWrap& iw = image_wrap(i);
@@ -1242,6 +1384,7 @@ GadgetronImageData::get_real_data(float* data) const
 void
 GadgetronImageData::set_real_data(const float* z)
 {
+	mark_modified();
 	int dim[4];
 	for (unsigned int i = 0; i < number(); i++) {
 		ImageWrap& iw = image_wrap(i);
@@ -1361,6 +1504,7 @@ GadgetronImagesVector::get_data(complex_float_t* data) const
 void
 GadgetronImagesVector::set_data(const complex_float_t* data)
 {
+	mark_modified();
 	//int dim[4];
 	//size_t n = number();
 	//get_image_dimensions(0, dim);
@@ -1389,6 +1533,7 @@ GadgetronImagesVector::get_real_data(float* data) const
 void
 GadgetronImagesVector::set_real_data(const float* data)
 {
+	mark_modified();
 	GadgetronImagesVector::Iterator stop = end();
 	GadgetronImagesVector::Iterator iter = begin();
 	for (; iter != stop; ++iter, ++data)
@@ -1781,10 +1926,24 @@ void CoilSensitivitiesVector::forward(GadgetronImageData& img, GadgetronImageDat
     if(combined_img.dimensions()["c"] != 1)
         throw LocalisedException("The source image has more than one channel.",   __FILE__, __LINE__);
 
+    img.mark_modified();
+    const OperatorMemo<GadgetronImageData>::Arguments args(1, this->version());
+    gadgetron::shared_ptr<const GadgetronImageData> sptr_memo = forward_memo_.find(combined_img, args);
+    if (sptr_memo) {
+        img.set_meta_data(sptr_memo->get_meta_data());
+        img.clear_data();
+        for (unsigned int i = 0; i < sptr_memo->number(); i++)
+            img.append(sptr_memo->image_wrap(i));
+        return;
+    }
+
     img.set_meta_data( combined_img.get_meta_data());
     img.clear_data();
 
     this->coilchannels_from_combined_image(img, combined_img);
+
+    if (forward_memo_.enabled())
+        forward_memo_.store(combined_img, gadgetron::shared_ptr<const GadgetronImageData>(img.clone()), args);
 }
 
 void CoilSensitivitiesVector::coilchannels_from_combined_image(GadgetronImageData& img, GadgetronImageData& combined_img) const
@@ -1895,8 +2054,10 @@ void CoilSensitivitiesVector::combine_images_with_coilmaps(GadgetronImageData& c
 void 
 CoilSensitivitiesVector::calculate(CoilImagesVector& iv)
 {
+    ScopedTimer timer("CoilSensitivitiesVector::calculate_from_coil_images");
 
     this->empty();
+    this->mark_modified();
 
     for(int i_img=0; i_img<iv.items();++i_img)
     {
@@ -27,11 +27,17 @@ limitations under the License.
 \author Evgueni Ovtchinnikov
 \author SyneRBI
 */
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 #include "sirf/iUtilities/DataHandle.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
 #include "sirf/Gadgetron/gadgetron_client.h"
+#include "sirf/Gadgetron/xgadgetron_utilities.h"
 
 using namespace gadgetron;
 using namespace sirf;
@@ -99,9 +105,33 @@ GadgetChain::gadget_sptr(std::string id)
 	return shared_ptr<aGadget>();
 }
 
+std::vector<unsigned long>
+GadgetChain::revisions_() const
+{
+	std::vector<unsigned long> revisions;
+#if defined(_MSC_VER) && _MSC_VER < 1900
+	std::list<shared_ptr<GadgetHandle> >::const_iterator gh;
+#else
+	typename std::list<shared_ptr<GadgetHandle> >::const_iterator gh;
+#endif
+	for (gh = readers_.begin(); gh != readers_.end(); ++gh)
+		revisions.push_back(gh->get()->gadget().revision());
+	for (gh = writers_.begin(); gh != writers_.end(); ++gh)
+		revisions.push_back(gh->get()->gadget().revision());
+	for (gh = gadgets_.begin(); gh != gadgets_.end(); ++gh)
+		revisions.push_back(gh->get()->gadget().revision());
+	if (endgadget_.get())
+		revisions.push_back(endgadget_->revision());
+	return revisions;
+}
+
 std::string 
 GadgetChain::xml() const 
 {
+	std::vector<unsigned long> revisions = revisions_();
+	if (!xml_.empty() && revisions == xml_revisions_)
+		return xml_;
+
 	std::string xml_script("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
 	xml_script += "<gadgetronStreamConfiguration xsi:schemaLocation=";
 	xml_script += "\"http://gadgetron.sf.net/gadgetron gadgetron.xsd\"\n";
@@ -126,7 +156,86 @@ GadgetChain::xml() const
 		xml_script += endgadget_->xml() + '\n';
 	xml_script += "</gadgetronStreamConfiguration>\n";
 
-	return xml_script;
+	xml_ = xml_script;
+	xml_revisions_.swap(revisions);
+	return xml_;
+}
+
+// 64-bit FNV-1a hash, which (unlike std::hash) is the same in all runs
+// and on all platforms, so that the configuration files can be reused
+static uint64_t
+config_hash(const std::string& config)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < config.size(); i++) {
+		h ^= (unsigned char)config[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::string
+GadgetChain::config_name() const
+{
+	std::ostringstream name;
+	name << "sirf_" << std::hex << std::setw(16) << std::setfill('0')
+		<< config_hash(xml()) << ".xml";
+	return name.str();
+}
+
+void
+GadgetChain::write_config() const
+{
+	if (config_dir_.empty())
+		THROW("Gadgetron configuration directory not set");
+	const std::string config = xml();
+	const std::string path = config_dir_ + '/' + config_name();
+	if (path == config_file_)
+		return;
+
+	// the file may have been written by an earlier run
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		if (in) {
+			std::ostringstream content;
+			content << in.rdbuf();
+			if (content.str() == config) {
+				config_file_ = path;
+				return;
+			}
+		}
+	}
+
+	// the file is written under a temporary name and then renamed, so that
+	// the server never reads a partially written file
+	const std::string tmp = path + '.' +
+		std::to_string(xGadgetronUtilities::milliseconds()) + ".tmp";
+	{
+		std::ofstream out(tmp.c_str(), std::ios::binary);
+		out << config;
+		if (!out)
+			THROW("cannot write Gadgetron configuration file " + tmp);
+	}
+	// (rename does not replace an existing file on Windows)
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(path.c_str());
+		if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+			std::remove(tmp.c_str());
+			THROW("cannot write Gadgetron configuration file " + path);
+		}
+	}
+	config_file_ = path;
+}
+
+void
+GadgetChain::send_config(GadgetronClientConnector& con) const
+{
+	if (config_dir_.empty()) {
+		con.send_gadgetron_configuration_script(xml());
+		return;
+	}
+	write_config();
+	con.send_gadgetron_configuration_file(config_name());
 }
 
 /*
@@ -181,7 +290,6 @@ AcquisitionsProcessor::process(MRAcquisitionData& acquisitions)
 		return;
 
 	ISMRMRD::Acquisition acq_tmp;
-	std::string config = xml();
 
 	// quick fix: checking if AcquisitionFinishGadget is needed (= running old Gadgetron)
 	shared_ptr<MRAcquisitionData> sptr_acqs = acquisitions.new_acquisitions_container();
@@ -194,7 +302,7 @@ AcquisitionsProcessor::process(MRAcquisitionData& acquisitions)
 //			std::cout << "connection attempt " << nt << '\n';
 			try {
 				conn().connect(host_, port_);
-				conn().send_gadgetron_configuration_script(config);
+				send_config(conn());
 				conn().send_gadgetron_parameters(acquisitions.acquisitions_info());
 				acquisitions.get_acquisition(0, acq_tmp);
 				conn().send_ismrmrd_acquisition(acq_tmp);
@@ -216,7 +324,6 @@ AcquisitionsProcessor::process(MRAcquisitionData& acquisitions)
 		gadgetron::shared_ptr<AcquisitionFinishGadget>
 			endgadget(new AcquisitionFinishGadget);
 		set_endgadget(endgadget);
-		config = xml();
 	}
 
 	GTConnector conn;
@@ -224,7 +331,7 @@ AcquisitionsProcessor::process(MRAcquisitionData& acquisitions)
 		shared_ptr<GadgetronClientMessageReader>
 		(new GadgetronClientAcquisitionMessageCollector(sptr_acqs_)));
 	conn().connect(host_, port_);
-	conn().send_gadgetron_configuration_script(config);
+	send_config(conn());
 	conn().send_gadgetron_parameters(acquisitions.acquisitions_info());
 	for (uint32_t i = 0; i < nacq; i++) {
 		acquisitions.get_acquisition(i, acq_tmp);
@@ -240,7 +347,6 @@ ImagesReconstructor::process(MRAcquisitionData& acquisitions)
 {
 	//check_gadgetron_connection(host_, port_);
 
-	std::string config = xml();
 	//std::cout << "config:\n" << config << std::endl;
 
 	uint32_t nacquisitions = 0;
@@ -257,7 +363,7 @@ ImagesReconstructor::process(MRAcquisitionData& acquisitions)
 	for (int nt = 0; nt < N_TRIALS; nt++) {
 		try {
 			conn().connect(host_, port_);
-			conn().send_gadgetron_configuration_script(config);
+			send_config(conn());
 			conn().send_gadgetron_parameters(acquisitions.acquisitions_info());
 			for (uint32_t i = 0; i < nacquisitions; i++) {
 				acquisitions.get_acquisition(i, acq_tmp);
@@ -281,7 +387,6 @@ ImagesReconstructor::process(MRAcquisitionData& acquisitions)
 void 
 ImagesProcessor::process(const GadgetronImageData& images)
 {
-	std::string config = xml();
 	GTConnector conn;
 	sptr_images_ = images.new_images_container();
 	if (dicom_)
@@ -295,7 +400,7 @@ ImagesProcessor::process(const GadgetronImageData& images)
 	for (int nt = 0; nt < N_TRIALS; nt++) {
 		try {
 			conn().connect(host_, port_);
-			conn().send_gadgetron_configuration_script(config);
+			send_config(conn());
 			for (unsigned int i = 0; i < images.number(); i++) {
 				if (dicom_)
 					conn().send_wrapped_image(*images.image_wrap(i).abs());
@@ -317,7 +422,6 @@ ImagesProcessor::process(const GadgetronImageData& images)
 void
 ImagesProcessor::check_connection()
 {
-	std::string config = xml();
 	GTConnector conn;
 	shared_ptr<GadgetronImageData> sptr_images(new GadgetronImagesVector);
 	GadgetronImageData& images = *sptr_images_;
@@ -325,7 +429,7 @@ ImagesProcessor::check_connection()
 		shared_ptr<GadgetronClientMessageReader>
 		(new GadgetronClientImageMessageCollector(sptr_images)));
 	conn().connect(host_, port_);
-	conn().send_gadgetron_configuration_script(config);
+	send_config(conn());
 	ISMRMRD::Image<float>* ptr_im = new ISMRMRD::Image<float>(128, 128, 1);
 	memset(ptr_im->getDataPtr(), 0, ptr_im->getDataSize());
 	ImageWrap iw(ptr_im->getDataType(), ptr_im);
@@ -389,13 +493,76 @@ MRAcquisitionModel::set_up(gadgetron::shared_ptr<MRAcquisitionData> sptr_ac,
 		throw std::runtime_error("Only cartesian or OTHER type of trajectory are available.");
 
 	sptr_acqs_ = sptr_ac;
+	normal_kernels_.clear();
 	set_image_template(sptr_ic);
 }
 
+void
+MRAcquisitionModel::set_up_normal_kernels_()
+{
+	ScopedTimer timer("MRAcquisitionModel::set_up_normal_kernels_");
+	normal_kernels_.clear();
+	gadgetron::unique_ptr<MRAcquisitionData> uptr_acqs = sptr_acqs_->clone();
+	uptr_acqs->sort();
+	std::vector<KSpaceSubset> kspace_sorting = uptr_acqs->get_kspace_sorting();
+	for (int i = 0; i < kspace_sorting.size(); i++) {
+		sirf::AcquisitionsVector subset;
+		uptr_acqs->get_subset(subset, kspace_sorting[i].get_idx_set());
+		ISMRMRD::NDArray<float> kernel;
+		if (!sptr_enc_->normal_kernel(kernel, subset))
+			throw LocalisedException
+			("The encoding of the acquisition data has no normal operator kernel", __FILE__, __LINE__);
+		normal_kernels_[kspace_sorting[i].get_tag()] = kernel;
+	}
+}
+
+gadgetron::shared_ptr<GadgetronImageData>
+MRAcquisitionModel::normal(GadgetronImageData& ic)
+{
+	if (!use_normal_kernels_) {
+		gadgetron::shared_ptr<MRAcquisitionData> sptr_fwd = fwd(ic);
+		return bwd(*sptr_fwd);
+	}
+
+	if (!sptr_acqs_.get())
+		throw LocalisedException
+		("Acquisition data template not set", __FILE__, __LINE__);
+	if (!sptr_imgs_.get())
+		throw LocalisedException
+		("image data template not set", __FILE__, __LINE__);
+	if (!sptr_csms_.get() || sptr_csms_->items() < 1)
+		throw LocalisedException
+		("Coil sensitivity maps not found", __FILE__, __LINE__);
+	check_data_role(ic);
+	ScopedTimer timer("MRAcquisitionModel::normal");
+
+	if (normal_kernels_.empty())
+		set_up_normal_kernels_();
+
+	GadgetronImagesVector images_channelresolved;
+	sptr_csms_->forward(images_channelresolved, ic);
+
+	for (unsigned int i = 0; i < images_channelresolved.number(); ++i) {
+		ImageWrap& iw = images_channelresolved.image_wrap(i);
+		CFImage* ptr_img = static_cast<CFImage*>(iw.ptr_image());
+		auto it = normal_kernels_.find(KSpaceSubset::get_tag_from_img(*ptr_img));
+		if (it == normal_kernels_.end())
+			throw LocalisedException("You didn't find rawdata corresponding to your image in the acquisition data.", __FILE__, __LINE__);
+		FourierEncoding::apply_normal_kernel(*ptr_img, it->second);
+	}
+
+	gadgetron::shared_ptr<GadgetronImageData> sptr_imgs =
+		sptr_imgs_->new_images_container();
+	sptr_csms_->backward(*sptr_imgs, images_channelresolved);
+	sptr_imgs->set_up_geom_info();
+	return sptr_imgs;
+}
+
 void
 MRAcquisitionModel::fwd(GadgetronImageData& ic, CoilSensitivitiesVector& cc,
 	MRAcquisitionData& ac)
 {
+    ScopedTimer timer("MRAcquisitionModel::fwd");
     GadgetronImagesVector images_channelresolved;
     cc.forward(images_channelresolved, ic);
 
@@ -437,6 +604,7 @@ void
 MRAcquisitionModel::bwd(GadgetronImageData& ic, const CoilSensitivitiesVector& cc,
     const MRAcquisitionData& ac)
 {
+    ScopedTimer timer("MRAcquisitionModel::bwd");
     GadgetronImagesVector iv;
     iv.set_meta_data(ac.acquisitions_info());
 
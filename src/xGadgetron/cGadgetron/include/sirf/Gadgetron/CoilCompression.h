@@ -0,0 +1,125 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Compression of the receiver channels of MR acquisitions and coil sensitivities.
+
+\author SyneRBI
+*/
+
+#ifndef SIRF_COIL_COMPRESSION
+#define SIRF_COIL_COMPRESSION
+
+#include <vector>
+
+#include <ismrmrd/ismrmrd.h>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup MR
+	\brief Replaces the receiver channels by a smaller number of virtual channels.
+
+	The virtual channels are the principal components of the channel values
+	of calibration data (the acquisitions flagged as parallel calibration, or
+	all acquisitions if none are): virtual channel v of a sample is
+	sum_c M[v][c] x[c], where the rows of M are the conjugated eigenvectors of
+	the channel covariance matrix with the largest eigenvalues.
+
+	In the geometric mode (Zhang et al., MRM 69:571, 2013) the data are Fourier
+	transformed along the readout first, and a matrix is computed for each
+	readout position, the matrices of neighbouring positions being aligned
+	so that the virtual channels vary smoothly. This keeps more of the signal
+	for the same number of virtual channels if the coils are spread along the
+	readout. The readout must not be oversampled with respect to the image
+	(as required by MRAcquisitionModel).
+
+	The same matrices applied to the coil sensitivity maps give the maps of
+	the virtual channels, so that an MRAcquisitionModel set up with the
+	compressed acquisitions and maps costs as much as one for the smaller
+	number of channels.
+	*/
+	class CoilCompression {
+	public:
+		enum Mode { SVD, GEOMETRIC };
+
+		CoilCompression() : mode_(SVD), num_virtual_coils_(0),
+			energy_fraction_(0.95f), num_coils_(0), num_samples_(0),
+			num_virtual_(0), energy_kept_(0)
+		{}
+
+		void set_mode(Mode mode) { mode_ = mode; }
+		Mode mode() const { return mode_; }
+		//! number of virtual channels (0, the default, chooses it by the energy fraction)
+		void set_num_virtual_coils(int n);
+		//! fraction of the calibration data energy kept if the number of virtual channels is not set
+		void set_energy_fraction(float f);
+
+		//! computes the compression matrices from the calibration data of ad
+		void compute(const MRAcquisitionData& ad);
+
+		int num_coils() const { return num_coils_; }
+		//! number of virtual channels (0 before compute())
+		int num_virtual_coils() const { return num_virtual_; }
+		//! number of matrices (1, or the number of readout samples in the geometric mode)
+		int num_matrices() const { return (int)matrices_.size(); }
+		/*!
+		\brief Compression matrix for readout position x (row-major, virtual channels by channels)
+
+		In the geometric mode, x is the position along the readout after the
+		centred Fourier transform (as in the image), otherwise it must be 0.
+		*/
+		const std::vector<complex_float_t>& matrix(int x = 0) const;
+		//! fraction of the calibration data energy kept by the virtual channels
+		float energy_kept() const { return energy_kept_; }
+
+		//! compresses the channels of all acquisitions and updates the acquisitions info
+		void apply(MRAcquisitionData& ad) const;
+		//! compresses the channels of the coil sensitivity maps
+		void apply(CoilSensitivitiesVector& csms) const;
+
+	private:
+		Mode mode_;
+		int num_virtual_coils_;
+		float energy_fraction_;
+		int num_coils_;
+		int num_samples_;
+		int num_virtual_;
+		float energy_kept_;
+		// the compression matrices, one per readout position in the geometric mode
+		std::vector<std::vector<complex_float_t> > matrices_;
+		// matrix coefficients in (virtual channel, channel, readout position)
+		// order, so that the kernels run over contiguous samples
+		std::vector<complex_float_t> coefs_;
+
+		void check_computed_() const;
+		// out channel v := sum_c M[v][c] in channel c, for n samples
+		// (from readout position 0 in the geometric mode)
+		void compress_(const complex_float_t* in, size_t in_stride,
+			complex_float_t* out, size_t out_stride, size_t n) const;
+	};
+
+}
+
+#endif
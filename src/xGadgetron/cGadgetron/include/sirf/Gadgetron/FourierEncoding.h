@@ -55,7 +55,24 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const =0;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const =0;
-    
+
+    /*!
+    \brief Kernel of the normal operator backward(forward(.)) for the acquisitions in ac.
+
+    The readout is Cartesian for all encodings, and the normal operator is a
+    convolution in the two phase encoding directions. For an image x of size
+    (nx, ny, nz) it is crop(ifft3c(K * fft3c(pad(x)))), where pad places x in
+    the centre of an (nx, gy, gz) grid of zeros, (gy, gz) being the dimensions
+    of the kernel K (the same for all readout positions), and crop extracts it
+    again. Returns false if the encoding provides no kernel.
+    */
+    virtual bool normal_kernel(ISMRMRD::NDArray<float>& kernel, const MRAcquisitionData& ac) const
+    {
+        return false;
+    }
+    //! Applies the normal operator given by kernel to all channels of img.
+    static void apply_normal_kernel(CFImage& img, const ISMRMRD::NDArray<float>& kernel);
+
     void match_img_header_to_acquisition(CFImage& img, const ISMRMRD::Acquisition& acq) const;
 };
 
@@ -77,7 +94,8 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const;
-    
+    //! The kernel is the number of times each k-space line is acquired.
+    virtual bool normal_kernel(ISMRMRD::NDArray<float>& kernel, const MRAcquisitionData& ac) const;
 };
 
 } // namespace sirf
@@ -96,6 +96,12 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const;
+    /*!
+    The kernel is the Fourier transform of the point spread function of the
+    trajectory on a grid twice the size of the image (Toeplitz embedding),
+    scaled to the response of backward(forward(.)) to a point at the centre.
+    */
+    virtual bool normal_kernel(ISMRMRD::NDArray<float>& kernel, const MRAcquisitionData& ac) const;
 protected:
     GadgetronTrajectoryType2D get_trajectory(const MRAcquisitionData& ac) const;
 
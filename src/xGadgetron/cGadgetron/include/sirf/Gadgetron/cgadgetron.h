@@ -37,6 +37,11 @@ extern "C" {
 	void* setParameter
 		(void* ptr, const char* obj, const char* par, const void* val);
 
+	// profiling
+	void* cGT_setProfiling(int on);
+	void* cGT_resetProfiling();
+	void* cGT_profile(const char* format);
+
 	// common Object methods
 	void* cGT_newObject(const char* name);
 	void* cGT_parameter(void* ptr, const char* obj, const char* name);
@@ -48,6 +53,9 @@ extern "C" {
 	void* cGT_computeCoilSensitivities(void* ptr_csms, void* ptr_acqs);
 	void* cGT_computeCoilImages(void* ptr_imgs, void* ptr_acqs);
 	void* cGT_computeCoilSensitivitiesFromCoilImages(void* ptr_csms, void* ptr_imgs);
+	void* cGT_computeCoilCompression(void* ptr_cc, const void* ptr_acqs);
+	void* cGT_compressAcquisitions(void* ptr_cc, const void* ptr_acqs);
+	void* cGT_compressCoilSensitivities(void* ptr_cc, const void* ptr_csms);
 
 	// acquisition model methods
 	void* cGT_AcquisitionModel(const void* ptr_acqs, const void* ptr_imgs);
@@ -60,6 +68,7 @@ extern "C" {
 	void* cGT_acquisitionModelNorm(void* ptr_am);
 	void* cGT_AcquisitionModelForward(void* ptr_am, const void* ptr_imgs);
 	void* cGT_AcquisitionModelBackward(void* ptr_am, const void* ptr_acqs);
+	void* cGT_AcquisitionModelNormal(void* ptr_am, const void* ptr_imgs);
 
 	// acquisition data methods
 	void* cGT_ISMRMRDAcquisitionsFromFile(const char* file);
@@ -108,6 +117,7 @@ extern "C" {
 	// gadget chain methods
 	void* cGT_setHost(void* ptr_gc, const char* host);
 	void* cGT_setPort(void* ptr_gc, const char* port);
+	void* cGT_setConfigDir(void* ptr_gc, const char* dir);
 	void* cGT_addReader(void* ptr_gc, const char* id, const void* ptr_r);
 	void* cGT_addWriter(void* ptr_gc, const char* id, const void* ptr_r);
 	void* cGT_addGadget(void* ptr_gc, const char* id, const void* ptr_r);
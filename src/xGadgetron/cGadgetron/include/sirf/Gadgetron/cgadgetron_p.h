@@ -37,6 +37,12 @@ namespace sirf {
 
 	extern "C"
 		void* cGT_setCSParameter(void* ptr, const char* par, const void* val);
+
+	extern "C"
+		void* cGT_setCoilCompressionParameter(void* ptr, const char* par, const void* val);
+
+	extern "C"
+		void* cGT_coilCompressionParameter(void* ptr, const char* name);
 }
 
 #endif
@@ -42,6 +42,7 @@ namespace sirf {
 */
 	class aGadget {
 	public:
+		aGadget() : revision_(0) {}
 		virtual void set_property(const char* prop, const char* value) = 0;
 		virtual std::string value_of(const char* prop) = 0;
 		virtual std::string vxml(const std::string& label) const = 0;
@@ -49,6 +50,19 @@ namespace sirf {
 		{
 			return vxml(label);
 		}
+		// changes whenever the xml-definition may have changed, so that
+		// gadget chains can keep their xml-definitions until then
+		virtual unsigned long revision() const
+		{
+			return revision_;
+		}
+	protected:
+		void properties_changed()
+		{
+			revision_++;
+		}
+	private:
+		unsigned long revision_;
 	};
 
 	/**
@@ -65,14 +79,19 @@ namespace sirf {
 		virtual void set_property(const char* prop, const char* value)
 		{
 			par_[prop] = value;
+			properties_changed();
 		}
 		virtual std::string value_of(const char* prop)
 		{
+			// an unknown property is added with an empty value
+			if (par_.find(prop) == par_.end())
+				properties_changed();
 			return par_[prop];
 		}
 		void add_property(const char* prop, const char* value)
 		{
 			par_[prop] = value;
+			properties_changed();
 		}
 		virtual std::string vxml(const std::string& label) const
 		{
@@ -717,6 +736,10 @@ namespace sirf {
 			xml_script += ias_.xml();
 			return xml_script;
 		}
+		virtual unsigned long revision() const
+		{
+			return aat_.revision() + bb_.revision();
+		}
 	private:
 		AcquisitionAccumulateTriggerGadget aat_;
 		BucketToBufferGadget bb_;
@@ -84,6 +84,7 @@ IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <ismrmrd/ismrmrd.h>
 #include <ismrmrd/meta.h>
 
+#include "sirf/common/Profiler.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 
@@ -197,6 +198,8 @@ namespace sirf {
 			//Read image data
 			boost::asio::read
 				(*stream, boost::asio::buffer(im.getDataPtr(), im.getDataSize()));
+			Profiler::count_bytes("GadgetronClientConnector::receive_image",
+				sizeof(ISMRMRD::ImageHeader) + meta_attrib_length + im.getDataSize());
 		}
 
 		virtual void read(boost::asio::ip::tcp::socket* stream);
@@ -328,6 +331,7 @@ namespace sirf {
 		template<typename T>
 		void send_ismrmrd_image(ISMRMRD::Image<T>* ptr_im)
 		{
+			ScopedTimer timer("GadgetronClientConnector::send_image");
 			ISMRMRD::Image<T>& im = *ptr_im;
 			if (!socket_)
 				throw GadgetronClientException("Invalid socket.");
@@ -360,6 +364,8 @@ namespace sirf {
 
 			boost::asio::write
 				(*socket_, boost::asio::buffer(im.getDataPtr(), im.getDataSize()));
+			Profiler::count_bytes("GadgetronClientConnector::send_image",
+				sizeof(ISMRMRD::ImageHeader) + meta_attrib_length + im.getDataSize());
 		}
 
 		void send_wrapped_image(const ImageWrap& iw)
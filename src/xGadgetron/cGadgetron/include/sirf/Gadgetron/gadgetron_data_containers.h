@@ -33,6 +33,7 @@ limitations under the License.
 #ifndef GADGETRON_DATA_CONTAINERS
 #define GADGETRON_DATA_CONTAINERS
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -44,9 +45,12 @@ limitations under the License.
 #include "sirf/common/DataContainer.h"
 #include "sirf/common/MRImageData.h"
 #include "sirf/common/multisort.h"
+#include "sirf/common/OperatorMemo.h"
+#include "sirf/common/Profiler.h"
 #include "sirf/Gadgetron/ismrmrd_fftw.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_image_wrap.h"
+#include "sirf/Gadgetron/ismrmrd_hdf5_writer.h"
 
 #include "sirf/iUtilities/LocalisedException.h"
 
@@ -183,7 +187,10 @@ namespace sirf {
         /*!
         * This allows to find out which k-space dimension an Acquisition belongs to.
         */
-        static TagType get_tag_from_acquisition(ISMRMRD::Acquisition acq);
+        static TagType get_tag_from_acquisition(const ISMRMRD::Acquisition& acq);
+
+        //! Function to get k-space dimension tag from the encoding counters of an acquisition header
+        static TagType get_tag_from_counters(const ISMRMRD::EncodingCounters& idx);
 
         //! Function to get k-space dimension tag from an ISMRMRD::Image
         /*!
@@ -207,6 +214,86 @@ namespace sirf {
         SetType idx_set_;
     };
 
+	class MRAcquisitionData;
+
+	/*!
+	\ingroup MR
+	\brief Compact table of the acquisition header fields used for sorting
+	and binning.
+
+	The table has one entry per acquisition, in the order in which the
+	acquisitions are stored (i.e. ignoring the sorting index of the container),
+	holding the flags, the encoding counters and the time stamps. It is built
+	once by MRAcquisitionData::header_index() and kept up to date by the
+	container when acquisitions are appended or replaced, so that sorting,
+	selecting and binning the acquisitions (e.g. by respiratory or cardiac phase
+	for motion-resolved reconstruction) neither copies nor reads the
+	acquisitions.
+	*/
+	class MRAcquisitionHeaderIndex {
+	public:
+		struct Entry {
+			uint64_t flags;
+			uint32_t acquisition_time_stamp;
+			uint32_t physiology_time_stamp[ISMRMRD::ISMRMRD_Constants::ISMRMRD_PHYS_STAMPS];
+			ISMRMRD::EncodingCounters idx;
+
+			bool is_flag_set(ISMRMRD::ISMRMRD_AcquisitionFlags flag) const
+			{
+				return (flags & (uint64_t(1) << (flag - 1))) != 0;
+			}
+			//! the TO_BE_IGNORED filter applied to the entry
+			bool to_be_ignored() const
+			{
+				return !is_flag_set(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION) &&
+					!is_flag_set(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING) &&
+					!is_flag_set(ISMRMRD::ISMRMRD_ACQ_LAST_IN_MEASUREMENT) &&
+					!is_flag_set(ISMRMRD::ISMRMRD_ACQ_IS_REVERSE) &&
+					flags >= (uint64_t(1) << (ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT - 1));
+			}
+		};
+
+		MRAcquisitionHeaderIndex() : valid_(false) {}
+
+		static Entry entry(const ISMRMRD::AcquisitionHeader& head)
+		{
+			Entry e;
+			e.flags = head.flags;
+			e.acquisition_time_stamp = head.acquisition_time_stamp;
+			for (int i = 0; i < ISMRMRD::ISMRMRD_Constants::ISMRMRD_PHYS_STAMPS; i++)
+				e.physiology_time_stamp[i] = head.physiology_time_stamp[i];
+			e.idx = head.idx;
+			return e;
+		}
+
+		//! reads the headers of all acquisitions in ad
+		void build(const MRAcquisitionData& ad);
+		bool valid() const { return valid_; }
+		void invalidate()
+		{
+			valid_ = false;
+			std::vector<Entry>().swap(entries_);
+		}
+		//! updates the entry of the acquisition stored at position i (if built)
+		void update(std::size_t i, const ISMRMRD::AcquisitionHeader& head)
+		{
+			if (valid_ && i < entries_.size())
+				entries_[i] = entry(head);
+		}
+		//! adds the entry of an appended acquisition (if built)
+		void append(const ISMRMRD::AcquisitionHeader& head)
+		{
+			if (valid_)
+				entries_.push_back(entry(head));
+		}
+		std::size_t size() const { return entries_.size(); }
+		const Entry& operator[](std::size_t i) const { return entries_[i]; }
+
+	private:
+		bool valid_;
+		std::vector<Entry> entries_;
+	};
+
 	/*!
 	\ingroup MR
 	\brief Abstract MR acquisition data container class.
@@ -254,6 +341,22 @@ namespace sirf {
 		virtual void get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const = 0;
 		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) = 0;
 		virtual void append_acquisition(ISMRMRD::Acquisition& acq) = 0;
+		//! acquisition num without copying it if the container stores it as such
+		virtual gadgetron::shared_ptr<const ISMRMRD::Acquisition>
+			get_acquisition_sptr(unsigned int num) const
+		{
+			gadgetron::shared_ptr<ISMRMRD::Acquisition> sptr_acq(new ISMRMRD::Acquisition);
+			get_acquisition(num, *sptr_acq);
+			return sptr_acq;
+		}
+		//! the header of acquisition num (by default copied from the acquisition)
+		virtual void get_acquisition_header
+			(unsigned int num, ISMRMRD::AcquisitionHeader& head) const
+		{
+			ISMRMRD::Acquisition acq;
+			get_acquisition(num, acq);
+			head = acq.getHead();
+		}
 
 		virtual void copy_acquisitions_info(const MRAcquisitionData& ac) = 0;
 		virtual void copy_acquisitions_data(const MRAcquisitionData& ac) = 0;
@@ -300,6 +403,8 @@ namespace sirf {
 		virtual float norm() const;
 
 		virtual void write(const std::string &filename) const;
+		//! writes the header and the acquisitions (the writer sets the HDF5 chunking and compression)
+		virtual void write(ISMRMRDWriter& writer) const;
 
 		// regular methods
 
@@ -345,6 +450,34 @@ namespace sirf {
 
 		virtual std::vector<int> get_flagged_acquisitions_index(const std::vector<ISMRMRD::ISMRMRD_AcquisitionFlags> flags) const;
 
+        //! Function to get the header index of the container, which is built on the first call
+        const MRAcquisitionHeaderIndex& header_index() const;
+
+        //! Function to get the numbers of the acquisitions that are not to be ignored
+        /*!
+        * The numbers (cf. TO_BE_IGNORED) are in increasing order. The index is built
+        * from the header index on the first call and kept until the acquisitions or
+        * their order change, so that the algebraic operations do not test the flags
+        * of every acquisition on every call.
+        */
+        const std::vector<int>& active_index() const;
+
+        //! Function to get the numbers of the acquisitions whose header index entries satisfy a condition
+        std::vector<int> select_acquisitions
+            (const std::function<bool(const MRAcquisitionHeaderIndex::Entry&)>& selected) const;
+
+        //! Function to group the acquisitions into bins
+        /*!
+        * The function bin returns the bin number (from 0 to num_bins - 1) of the acquisition
+        * with the given header index entry, or a negative number if the acquisition is not used.
+        * The acquisition numbers in each bin are in increasing order, so the bins can be passed
+        * to get_subset(). Regrouping the same data with different rules (e.g. respiratory phase,
+        * cardiac phase, time windows) costs one pass over the header index.
+        */
+        std::vector<KSpaceSubset::SetType> bin_acquisitions
+            (const std::function<int(const MRAcquisitionHeaderIndex::Entry&)>& bin,
+             int num_bins) const;
+
         virtual void get_subset(MRAcquisitionData& subset, const std::vector<int> subset_idx) const;
         virtual void set_subset(const MRAcquisitionData &subset, const std::vector<int> subset_idx);
 
@@ -378,6 +511,11 @@ namespace sirf {
 		std::vector<int> index_;
         std::vector<KSpaceSubset> sorting_;
 		AcquisitionsInfo acqs_info_;
+		// built on demand by header_index()
+		mutable MRAcquisitionHeaderIndex header_index_;
+		// built on demand by active_index()
+		mutable std::vector<int> active_index_;
+		mutable bool active_index_valid_ = false;
 
 		// new MRAcquisitionData objects will be created from this template
 		// using same_acquisitions_container()
@@ -419,16 +557,32 @@ namespace sirf {
 		{
 			acqs_.push_back(gadgetron::shared_ptr<ISMRMRD::Acquisition>
 				(new ISMRMRD::Acquisition(acq)));
+			header_index_.append(acq.getHead());
+			active_index_valid_ = false;
 		}
 		virtual void get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const
 		{
 			int ind = index(num);
 			acq = *acqs_[ind];
 		}
+		virtual void get_acquisition_header
+			(unsigned int num, ISMRMRD::AcquisitionHeader& head) const
+		{
+			int ind = index(num);
+			head = acqs_[ind]->getHead();
+		}
+		virtual gadgetron::shared_ptr<const ISMRMRD::Acquisition>
+			get_acquisition_sptr(unsigned int num) const
+		{
+			return acqs_[index(num)];
+		}
 		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
 		{
 			int ind = index(num);
+			if (acqs_[ind]->flags() != acq.flags())
+				active_index_valid_ = false;
 			*acqs_[ind] = acq;
+			header_index_.update(ind, acq.getHead());
 		}
 		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
 		{
@@ -910,6 +1064,7 @@ namespace sirf {
 			const char* target);
 		virtual void empty()
 		{
+			mark_modified();
 			images_.clear();
 		}
 		virtual unsigned int items() const
@@ -922,6 +1077,7 @@ namespace sirf {
 		}
 		virtual void append(int image_data_type, void* ptr_image)
 		{
+			mark_modified();
 			images_.push_back(gadgetron::shared_ptr<ImageWrap>
 				(new ImageWrap(image_data_type, ptr_image)));
 		}
@@ -932,15 +1088,18 @@ namespace sirf {
         }
 		virtual void append(const ImageWrap& iw)
 		{
+			mark_modified();
 			images_.push_back(gadgetron::shared_ptr<ImageWrap>(new ImageWrap(iw)));
 		}
 		virtual void append(gadgetron::shared_ptr<ImageWrap> sptr_iw)
 		{
+			mark_modified();
 			images_.push_back(sptr_iw);
 		}
 		virtual gadgetron::shared_ptr<GadgetronImageData> abs() const;
 		virtual void clear_data()
         {
+            mark_modified();
             std::vector<gadgetron::shared_ptr<ImageWrap> > empty_data;
             images_.swap(empty_data);
         }
@@ -1104,6 +1263,7 @@ namespace sirf {
         void calculate(CoilImagesVector& iv);
         void calculate(const MRAcquisitionData& acq)
         {
+            ScopedTimer timer("CoilSensitivitiesVector::calculate");
             CoilImagesVector ci;
 			ci.calculate(acq);
             calculate(ci);
@@ -1121,6 +1281,16 @@ namespace sirf {
         void forward(GadgetronImageData& img, GadgetronImageData& combined_img)const;
         void backward(GadgetronImageData& combined_img, const GadgetronImageData& img)const;
 
+        /*!
+        \brief Switches memoisation of forward() on or off (off by default).
+
+        If on, the coil images of the last forward() call are reused if the
+        combined image and the coil sensitivities are not modified in between
+        (see DataContainer::version()).
+        */
+        void set_memoisation(bool memoise){ forward_memo_.set_enabled(memoise); }
+        bool memoisation() const { return forward_memo_.enabled(); }
+
     protected:
 
         void coilchannels_from_combined_image(GadgetronImageData& img, GadgetronImageData& combined_img) const;
@@ -1130,6 +1300,7 @@ namespace sirf {
 
     private:
         int csm_smoothness_ = 0;
+        mutable OperatorMemo<GadgetronImageData> forward_memo_;
         void smoothen_(int nx, int ny, int nz, int nc, complex_float_t* u, complex_float_t* v, int* obj_mask, int w);
         void mask_noise_(int nx, int ny, int nz, float* u, float noise, int* mask);
         float max_diff_(int nx, int ny, int nz, int nc, float small_grad, complex_float_t* u, complex_float_t* v);
@@ -38,6 +38,7 @@ limitations under the License.
 
 #include "sirf/common/ANumRef.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
+#include "sirf/Gadgetron/ismrmrd_hdf5_writer.h"
 #include "sirf/Gadgetron/xgadgetron_utilities.h"
 
 #define IMAGE_PROCESSING_SWITCH(Type, Operation, Arguments, ...)\
@@ -445,6 +446,10 @@ namespace sirf {
 		{
 			IMAGE_PROCESSING_SWITCH_CONST(type_, write_, ptr_, dataset);
 		}
+		void write(ISMRMRDWriter& writer) const
+		{
+			IMAGE_PROCESSING_SWITCH_CONST(type_, write_, ptr_, writer);
+		}
 		void read(ISMRMRD::Dataset& dataset, const char* var, int ind)
 		{
 			IMAGE_PROCESSING_SWITCH(type_, read_, ptr_, dataset, var, ind, &ptr_);
@@ -607,6 +612,15 @@ namespace sirf {
 			}
 		}
 
+		template<typename T>
+		void write_
+			(const ISMRMRD::Image<T>* ptr_im, ISMRMRDWriter& writer) const
+		{
+			std::stringstream ss;
+			ss << "image_" << ptr_im->getHead().image_series_index;
+			writer.append_image(ss.str(), *ptr_im);
+		}
+
 		template<typename T>
 		void read_
 			(const ISMRMRD::Image<T>* ptr,
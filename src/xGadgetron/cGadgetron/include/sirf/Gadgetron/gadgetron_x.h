@@ -33,6 +33,7 @@ limitations under the License.
 #define WIN32_LEAN_AND_MEAN
 
 #include <cmath>
+#include <map>
 #include <string>
 
 #include <ismrmrd/ismrmrd.h>
@@ -42,6 +43,7 @@ limitations under the License.
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 
 #include "sirf/common/JacobiCG.h"
+#include "sirf/common/Profiler.h"
 #include "sirf/iUtilities/LocalisedException.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadget_lib.h"
@@ -129,6 +131,13 @@ namespace sirf {
 	-
 	writer gadget
 	(sends the final result to the client)
+
+	The xml-definition of the chain is kept until a gadget is added or a gadget
+	property changes. If a configuration directory is set (normally the
+	configuration directory of the Gadgetron server, or a directory it shares
+	with the client), the definition is written there once to a file named
+	after its hash (config_name()), and the processors then only send that
+	name to the server instead of the whole definition.
 	*/
 
 	class GadgetChain { //: public anObject {
@@ -149,6 +158,16 @@ namespace sirf {
 		{
 			port_ = port;
 		}
+		// sets the directory for the configuration files (empty: send the
+		// xml-definition to the server on each connection)
+		void set_config_dir(const std::string dir)
+		{
+			config_dir_ = dir;
+		}
+		std::string config_dir() const
+		{
+			return config_dir_;
+		}
 		// apparently caused crash in linux
 		//virtual ~GadgetChain() {}
 		// adds reader gadget
@@ -156,35 +175,57 @@ namespace sirf {
 		{
 			readers_.push_back(gadgetron::shared_ptr<GadgetHandle>
 				(new GadgetHandle(id, sptr_g)));
+			xml_.clear();
 		}
 		// adds writer gadget
 		void add_writer(std::string id, gadgetron::shared_ptr<aGadget> sptr_g)
 		{
 			writers_.push_back(gadgetron::shared_ptr<GadgetHandle>
 				(new GadgetHandle(id, sptr_g)));
+			xml_.clear();
 		}
 		// sdds finishig gadget
 		void set_endgadget(gadgetron::shared_ptr<aGadget> sptr_g)
 		{
 			endgadget_ = sptr_g;
+			xml_.clear();
 		}
 		// adds any other gadget
 		void add_gadget(std::string id, gadgetron::shared_ptr<aGadget> sptr_g)
 		{
 			gadgets_.push_back(gadgetron::shared_ptr<GadgetHandle>
 				(new GadgetHandle(id, sptr_g)));
+			xml_.clear();
 		}
 		gadgetron::shared_ptr<aGadget> gadget_sptr(std::string id);
 		// returns string containing the definition of the chain in xml format
+		// (regenerated only if the chain or a gadget property has changed)
 		std::string xml() const;
+		// name of the configuration file for the current xml-definition
+		// (derived from its hash)
+		std::string config_name() const;
+		// writes the xml-definition to the file config_name() in the
+		// configuration directory, unless it is already there
+		void write_config() const;
+		// sends the configuration file name if the configuration directory is
+		// set, or the xml-definition otherwise
+		void send_config(GadgetronClientConnector& con) const;
 	protected:
 		std::string host_;
 		std::string port_;
+		std::string config_dir_;
 	private:
 		std::list<gadgetron::shared_ptr<GadgetHandle> > readers_;
 		std::list<gadgetron::shared_ptr<GadgetHandle> > writers_;
 		std::list<gadgetron::shared_ptr<GadgetHandle> > gadgets_;
 		gadgetron::shared_ptr<aGadget> endgadget_;
+		// the xml-definition and the revisions of the gadgets it was made from
+		mutable std::string xml_;
+		mutable std::vector<unsigned long> xml_revisions_;
+		// the last configuration file written or found by write_config()
+		mutable std::string config_file_;
+
+		std::vector<unsigned long> revisions_() const;
 	};
 
 	/*!
@@ -348,7 +389,7 @@ namespace sirf {
 		\brief Class for the product of backward and forward projectors of the MR acquisition model.
 
 		For a given GadgetronImageData object x, computes B(F(x)), where F(x) is the forward projection of x,
-		and B(y) is the backprojection of MRAcquisitionData object y.
+		and B(y) is the backprojection of MRAcquisitionData object y (see MRAcquisitionModel::normal()).
 		*/
 		class BFOperator : public Operator<GadgetronImageData> {
 		public:
@@ -356,11 +397,7 @@ namespace sirf {
 			virtual std::shared_ptr<GadgetronImageData> 
 				apply(GadgetronImageData& image_data)
 			{
-				std::shared_ptr<MRAcquisitionData> sptr_fwd =
-					sptr_am_->fwd(image_data);
-				std::shared_ptr<GadgetronImageData> sptr_bwd =
-					sptr_am_->bwd(*sptr_fwd);
-				return sptr_bwd;
+				return sptr_am_->normal(image_data);
 			}
 		private:
 			std::shared_ptr<MRAcquisitionModel> sptr_am_;
@@ -389,19 +426,36 @@ namespace sirf {
 			this->set_up(sptr_ac, sptr_ic);
 		}
 		
+		/*
+		Returns the norm of the model, estimated by JacobiCG. The norm is cached
+		until the model changes, or the templates or coil sensitivities are
+		modified (see DataContainer::version()). The eigenvector estimate is
+		kept as the initial guess for the next estimate, unless the image
+		template changes.
+		*/
 		float norm()
 		{
+			if (norm_valid_ && norm_versions_ == current_norm_versions_())
+				return norm_;
+
+			// BFOperator needs a shared pointer, but must not delete this model
 			gadgetron::shared_ptr<MRAcquisitionModel> sptr_am
-				(new MRAcquisitionModel(sptr_acqs_, sptr_imgs_, sptr_csms_, acqs_info_));
+				(this, [](MRAcquisitionModel*) {});
 
 			BFOperator bf(sptr_am);
 			JacobiCG<complex_float_t> jcg;
 			jcg.set_num_iterations(2);
-			gadgetron::unique_ptr<GadgetronImageData> sptr_id = sptr_imgs_->clone();
-			GadgetronImageData& image_data = *sptr_id;
-			image_data.fill(1.0);
+			if (!sptr_norm_eigenvector_.get()) {
+				sptr_norm_eigenvector_ = sptr_imgs_->clone();
+				sptr_norm_eigenvector_->fill(1.0);
+			}
+			// on return, this is the eigenvector estimate
+			GadgetronImageData& image_data = *sptr_norm_eigenvector_;
 			float lmd = jcg.largest(bf, image_data);
-			return std::sqrt(lmd);
+			norm_ = std::sqrt(lmd);
+			norm_valid_ = true;
+			norm_versions_ = current_norm_versions_();
+			return norm_;
 		}
 
 		// make sure ic contains "true" images (and not e.g. G-factors)
@@ -412,6 +466,8 @@ namespace sirf {
 			(gadgetron::shared_ptr<MRAcquisitionData> sptr_ac)
 		{
 			sptr_acqs_ = sptr_ac;
+			norm_valid_ = false;
+			normal_kernels_.clear();
 		}
 		// Records the image template to be used. 
 		void set_image_template
@@ -419,6 +475,8 @@ namespace sirf {
 		{
 			check_data_role(*sptr_ic);
 			sptr_imgs_ = sptr_ic;
+			norm_valid_ = false;
+			sptr_norm_eigenvector_.reset();
 		}
 		// Returns shared pointer to the acquisitions template used. 
 		gadgetron::shared_ptr<const MRAcquisitionData> acq_template_sptr() const
@@ -434,13 +492,31 @@ namespace sirf {
         void set_csm(gadgetron::shared_ptr<CoilSensitivitiesVector> sptr_csms)
 		{
 			sptr_csms_ = sptr_csms;
+			norm_valid_ = false;
 		}
 
         void set_encoder(gadgetron::shared_ptr<sirf::FourierEncoding> sptr_enc)
         {
             sptr_enc_ = sptr_enc;
+            norm_valid_ = false;
+            normal_kernels_.clear();
         }
 
+		/*
+		Makes normal() apply bwd(fwd(.)) via the k-space kernels of the encoder
+		(see FourierEncoding::normal_kernel()), computed from the acquisition
+		template when first needed: the channels of the image are Fourier
+		transformed, multiplied by the kernel and transformed back, and no
+		acquisition data are created. Exact for Cartesian encoding, up to the
+		accuracy of the NUFFT otherwise.
+		*/
+		void set_use_normal_kernels(bool use)
+		{
+			use_normal_kernels_ = use;
+			norm_valid_ = false;
+		}
+		bool use_normal_kernels() const { return use_normal_kernels_; }
+
 		// Records templates
 		void set_up(gadgetron::shared_ptr<MRAcquisitionData> sptr_ac, 
 			gadgetron::shared_ptr<GadgetronImageData> sptr_ic);
@@ -469,12 +545,23 @@ namespace sirf {
 			check_data_role(ic);
             gadgetron::unique_ptr<MRAcquisitionData> uptr_acqs =
                 sptr_acqs_->clone();
+			if (Profiler::enabled()) {
+				uint64_t size = 0;
+				for (unsigned int i = 0; i < uptr_acqs->number(); i++)
+					size += uptr_acqs->get_acquisition_sptr(i)->getNumberOfDataElements();
+				Profiler::count_allocation("MRAcquisitionModel::fwd",
+					size * sizeof(complex_float_t));
+			}
 
             fwd(ic, *sptr_csms_, *uptr_acqs);
 
             return std::shared_ptr<MRAcquisitionData>(std::move(uptr_acqs));
 		}
 
+		// Applies the normal operator bwd(fwd(.)) to ic, using coil sensitivity
+		// maps referred to by sptr_csms_.
+		gadgetron::shared_ptr<GadgetronImageData> normal(GadgetronImageData& ic);
+
 		// Backprojects the whole AcquisitionContainer using
 		// coil sensitivity maps referred to by sptr_csms_.
         gadgetron::shared_ptr<GadgetronImageData> bwd(const MRAcquisitionData& ac)
@@ -488,6 +575,12 @@ namespace sirf {
 			gadgetron::shared_ptr<GadgetronImageData> sptr_imgs =
 				sptr_imgs_->new_images_container();
 			bwd(*sptr_imgs, *sptr_csms_, ac);
+			if (Profiler::enabled() && sptr_imgs->number() > 0) {
+				Dimensions dim = sptr_imgs->dimensions();
+				Profiler::count_allocation("MRAcquisitionModel::bwd",
+					uint64_t(dim["x"]) * dim["y"] * dim["z"] * dim["c"] * dim["n"]
+					* sizeof(complex_float_t));
+			}
 			return sptr_imgs;
 		}
 
@@ -497,6 +590,23 @@ namespace sirf {
 		gadgetron::shared_ptr<GadgetronImageData> sptr_imgs_;
         gadgetron::shared_ptr<CoilSensitivitiesVector> sptr_csms_;
         gadgetron::shared_ptr<FourierEncoding> sptr_enc_;
+		// cached norm, the versions of the templates and coil sensitivities
+		// it was computed for and the eigenvector estimate it was computed with
+		float norm_ = 0;
+		bool norm_valid_ = false;
+		std::vector<uint64_t> norm_versions_;
+		gadgetron::shared_ptr<GadgetronImageData> sptr_norm_eigenvector_;
+		// normal operator kernels of the k-space subsets of the acquisition template
+		bool use_normal_kernels_ = false;
+		std::map<KSpaceSubset::TagType, ISMRMRD::NDArray<float> > normal_kernels_;
+		void set_up_normal_kernels_();
+		std::vector<uint64_t> current_norm_versions_() const
+		{
+			return std::vector<uint64_t>{
+				sptr_acqs_.get() ? sptr_acqs_->version() : 0,
+				sptr_imgs_.get() ? sptr_imgs_->version() : 0,
+				sptr_csms_.get() ? sptr_csms_->version() : 0 };
+		}
 	};
 
 }
@@ -0,0 +1,144 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Specification file for the bulk writer and reader of ISMRMRD files.
+
+\author SyneRBI
+*/
+
+#ifndef SIRF_ISMRMRD_HDF5_WRITER
+#define SIRF_ISMRMRD_HDF5_WRITER
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <ismrmrd/ismrmrd.h>
+
+namespace sirf {
+
+	/*!
+	\ingroup MR
+	\brief Writes acquisitions and images to ISMRMRD (HDF5) files in blocks.
+
+	ISMRMRD::Dataset extends and writes its HDF5 datasets once per acquisition
+	or image. This writer packs the acquisitions (or the images of one
+	variable) into blocks and writes each block with one hyperslab write.
+	The blocks are written by a background thread fed via a bounded queue,
+	so that packing the next block overlaps with writing the previous one.
+
+	The HDF5 layout and types are those of ISMRMRD::Dataset, so the files are
+	read by it (and by the ISMRMRD Python package). The HDF5 chunk size
+	and the compression (deflate) level of new datasets can be set before the
+	first append. Images are chunked one image per chunk, as in ISMRMRD.
+
+	Errors of the background thread are rethrown by the next append or by
+	close(), which must be called to complete the file (the destructor
+	calls it but ignores errors).
+	*/
+	class ISMRMRDWriter {
+	public:
+		//! opens (creates if needed) the file and the group of datasets
+		ISMRMRDWriter(const std::string& filename, const std::string& groupname = "dataset");
+		~ISMRMRDWriter();
+
+		//! number of acquisitions (images) per HDF5 write, default 1024
+		void set_block_size(unsigned int n);
+		//! number of acquisitions (image headers) per HDF5 chunk, default 1024
+		void set_chunk_size(unsigned int n);
+		//! deflate level from 0 (no compression, the default) to 9
+		void set_compression_level(int level);
+		//! number of blocks waiting to be written before append blocks, default 4
+		void set_queue_size(unsigned int n);
+
+		//! writes the XML header (replacing the existing one)
+		void write_header(const std::string& xml);
+		void append_acquisition(const ISMRMRD::Acquisition& acq);
+		//! appends an image to the variable var (e.g. "image_0")
+		template<typename T>
+		void append_image(const std::string& var, const ISMRMRD::Image<T>& im)
+		{
+			std::string attributes;
+			im.getAttributeString(attributes);
+			append_image_(var, im.getHead(), attributes, im.getDataPtr(), im.getDataSize());
+		}
+		//! writes the remaining blocks and closes the file
+		void close();
+
+	private:
+		ISMRMRDWriter(const ISMRMRDWriter&) = delete;
+		ISMRMRDWriter& operator=(const ISMRMRDWriter&) = delete;
+
+		void append_image_(const std::string& var, const ISMRMRD::ImageHeader& head,
+			const std::string& attributes, const void* data, size_t size);
+
+		class Impl;
+		std::unique_ptr<Impl> impl_;
+	};
+
+	/*!
+	\ingroup MR
+	\brief Reads images from ISMRMRD (HDF5) files in blocks.
+
+	ISMRMRD::Dataset reads the header, the attributes and the data of each
+	image with separate HDF5 reads. This reader reads them for a block of
+	images of one variable with one hyperslab read each, the data into one
+	contiguous buffer, and the images are then built from the buffer (and the
+	attribute strings copied) by several threads. The HDF5 reads hold the
+	global HDF5 mutex, the building of the images does not.
+	*/
+	class ISMRMRDReader {
+	public:
+		//! opens the file for reading the group of datasets
+		ISMRMRDReader(const std::string& filename, const std::string& groupname = "dataset");
+		~ISMRMRDReader();
+
+		//! number of images per HDF5 read, default 256
+		void set_block_size(unsigned int n);
+
+		//! the XML header (empty if there is none)
+		std::string read_header();
+		//! number of images of the variable var (e.g. "image_0"), 0 if var holds no images
+		size_t number_of_images(const std::string& var);
+		//! ISMRMRD data type of the images of var
+		uint16_t image_data_type(const std::string& var);
+		/*!
+		\brief Reads all images of var.
+
+		For each image in order, calls append with the data type and a pointer
+		to a new ISMRMRD::Image of that type, which append takes over.
+		*/
+		void read_images(const std::string& var,
+			const std::function<void(uint16_t, void*)>& append);
+
+	private:
+		ISMRMRDReader(const ISMRMRDReader&) = delete;
+		ISMRMRDReader& operator=(const ISMRMRDReader&) = delete;
+
+		class Impl;
+		std::unique_ptr<Impl> impl_;
+	};
+
+}
+
+#endif
@@ -30,8 +30,12 @@ limitations under the License.
 #ifndef XGADGETRON_UTILITIES
 #define XGADGETRON_UTILITIES
 
+#include <algorithm>
 #include <chrono>
 #include <complex>
+#include <exception>
+#include <thread>
+#include <vector>
 
 #include <boost/thread/mutex.hpp>
 
@@ -61,6 +65,34 @@ namespace sirf {
 #endif
 			return std::string(buff);
 		}
+		// runs f(begin, end, thread) on ranges of [0, n) in parallel threads,
+		// each range having at least min_per_thread items
+		template<class F>
+		static void parallel_for(size_t n, size_t min_per_thread, F f)
+		{
+			size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+			num_threads = std::min(num_threads, std::max(size_t(1), n / min_per_thread));
+			if (num_threads < 2) {
+				f(size_t(0), n, size_t(0));
+				return;
+			}
+			std::vector<std::thread> threads;
+			std::vector<std::exception_ptr> errors(num_threads);
+			for (size_t t = 0; t < num_threads; t++)
+				threads.push_back(std::thread([&, t]() {
+					try {
+						f(n * t / num_threads, n * (t + 1) / num_threads, t);
+					}
+					catch (...) {
+						errors[t] = std::current_exception();
+					}
+				}));
+			for (size_t t = 0; t < num_threads; t++)
+				threads[t].join();
+			for (size_t t = 0; t < num_threads; t++)
+				if (errors[t])
+					std::rethrow_exception(errors[t]);
+		}
 		template<typename T>
 		static void convert_complex(std::complex<T> z, unsigned short& t)
 		{
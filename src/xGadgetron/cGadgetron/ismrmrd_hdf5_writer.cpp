@@ -0,0 +1,937 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Implementation file for the bulk writer and reader of ISMRMRD files.
+
+\author SyneRBI
+*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <hdf5.h>
+
+#include "sirf/common/Profiler.h"
+#include "sirf/iUtilities/LocalisedException.h"
+#include "sirf/Gadgetron/gadgetron_image_wrap.h"
+#include "sirf/Gadgetron/ismrmrd_hdf5_writer.h"
+#include "sirf/Gadgetron/xgadgetron_utilities.h"
+
+using namespace sirf;
+using namespace ISMRMRD;
+
+namespace {
+
+	void check_(herr_t status, const char* what)
+	{
+		if (status < 0)
+			THROW(std::string("ISMRMRD file I/O: HDF5 error in ") + what);
+	}
+
+	// owns an HDF5 identifier
+	class H5Handle {
+	public:
+		typedef herr_t(*Closer)(hid_t);
+		H5Handle(hid_t id, Closer close, const char* what) : id_(id), close_(close)
+		{
+			if (id < 0)
+				THROW(std::string("ISMRMRD file I/O: HDF5 error in ") + what);
+		}
+		~H5Handle()
+		{
+			close_(id_);
+		}
+		operator hid_t() const { return id_; }
+	private:
+		H5Handle(const H5Handle&) = delete;
+		H5Handle& operator=(const H5Handle&) = delete;
+		hid_t id_;
+		Closer close_;
+	};
+
+	// the HDF5 types below are those of the ISMRMRD library (dataset.c):
+	// HDF5 converts compound types member by member using the names
+
+#define ISMRMRD_H5_INSERT(TYPE, STRUCT, MEMBER, H5TYPE) \
+	check_(H5Tinsert(TYPE, #MEMBER, HOFFSET(STRUCT, MEMBER), H5TYPE), "H5Tinsert")
+
+	hid_t h5_array_type(hid_t base, hsize_t n)
+	{
+		return H5Tarray_create2(base, 1, &n);
+	}
+
+	hid_t h5_complex_type(hid_t base, size_t size)
+	{
+		hid_t type = H5Tcreate(H5T_COMPOUND, 2 * size);
+		check_(H5Tinsert(type, "real", 0, base), "H5Tinsert");
+		check_(H5Tinsert(type, "imag", size, base), "H5Tinsert");
+		return type;
+	}
+
+	hid_t h5_encoding_counters_type()
+	{
+		typedef ISMRMRD_EncodingCounters S;
+		hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(S));
+		ISMRMRD_H5_INSERT(type, S, kspace_encode_step_1, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, kspace_encode_step_2, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, average, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, slice, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, contrast, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, phase, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, repetition, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, set, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, segment, H5T_NATIVE_UINT16);
+		H5Handle user(h5_array_type(H5T_NATIVE_UINT16, ISMRMRD_USER_INTS), H5Tclose, "H5Tarray_create2");
+		ISMRMRD_H5_INSERT(type, S, user, user);
+		return type;
+	}
+
+	hid_t h5_acquisition_header_type()
+	{
+		typedef ISMRMRD_AcquisitionHeader S;
+		hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(S));
+		H5Handle phys(h5_array_type(H5T_NATIVE_UINT32, ISMRMRD_PHYS_STAMPS), H5Tclose, "H5Tarray_create2");
+		H5Handle mask(h5_array_type(H5T_NATIVE_UINT64, ISMRMRD_CHANNEL_MASKS), H5Tclose, "H5Tarray_create2");
+		H5Handle pos(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_POSITION_LENGTH), H5Tclose, "H5Tarray_create2");
+		H5Handle dir(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_DIRECTION_LENGTH), H5Tclose, "H5Tarray_create2");
+		H5Handle idx(h5_encoding_counters_type(), H5Tclose, "H5Tcreate");
+		H5Handle user_int(h5_array_type(H5T_NATIVE_INT32, ISMRMRD_USER_INTS), H5Tclose, "H5Tarray_create2");
+		H5Handle user_float(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_USER_FLOATS), H5Tclose, "H5Tarray_create2");
+		ISMRMRD_H5_INSERT(type, S, version, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, flags, H5T_NATIVE_UINT64);
+		ISMRMRD_H5_INSERT(type, S, measurement_uid, H5T_NATIVE_UINT32);
+		ISMRMRD_H5_INSERT(type, S, scan_counter, H5T_NATIVE_UINT32);
+		ISMRMRD_H5_INSERT(type, S, acquisition_time_stamp, H5T_NATIVE_UINT32);
+		ISMRMRD_H5_INSERT(type, S, physiology_time_stamp, phys);
+		ISMRMRD_H5_INSERT(type, S, number_of_samples, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, available_channels, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, active_channels, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, channel_mask, mask);
+		ISMRMRD_H5_INSERT(type, S, discard_pre, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, discard_post, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, center_sample, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, encoding_space_ref, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, trajectory_dimensions, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, sample_time_us, H5T_NATIVE_FLOAT);
+		ISMRMRD_H5_INSERT(type, S, position, pos);
+		ISMRMRD_H5_INSERT(type, S, read_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, phase_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, slice_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, patient_table_position, pos);
+		ISMRMRD_H5_INSERT(type, S, idx, idx);
+		ISMRMRD_H5_INSERT(type, S, user_int, user_int);
+		ISMRMRD_H5_INSERT(type, S, user_float, user_float);
+		return type;
+	}
+
+	// an acquisition as written by H5Dwrite: the trajectory and the samples
+	// (as pairs of floats) are variable length arrays
+	struct HDF5Acquisition {
+		ISMRMRD_AcquisitionHeader head;
+		hvl_t traj;
+		hvl_t data;
+	};
+
+	hid_t h5_acquisition_type()
+	{
+		typedef HDF5Acquisition S;
+		hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(S));
+		H5Handle head(h5_acquisition_header_type(), H5Tclose, "H5Tcreate");
+		H5Handle vlen(H5Tvlen_create(H5T_NATIVE_FLOAT), H5Tclose, "H5Tvlen_create");
+		ISMRMRD_H5_INSERT(type, S, head, head);
+		ISMRMRD_H5_INSERT(type, S, traj, vlen);
+		ISMRMRD_H5_INSERT(type, S, data, vlen);
+		return type;
+	}
+
+	hid_t h5_image_header_type()
+	{
+		typedef ISMRMRD_ImageHeader S;
+		hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(S));
+		H5Handle size(h5_array_type(H5T_NATIVE_UINT16, 3), H5Tclose, "H5Tarray_create2");
+		H5Handle fov(h5_array_type(H5T_NATIVE_FLOAT, 3), H5Tclose, "H5Tarray_create2");
+		H5Handle pos(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_POSITION_LENGTH), H5Tclose, "H5Tarray_create2");
+		H5Handle dir(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_DIRECTION_LENGTH), H5Tclose, "H5Tarray_create2");
+		H5Handle phys(h5_array_type(H5T_NATIVE_UINT32, ISMRMRD_PHYS_STAMPS), H5Tclose, "H5Tarray_create2");
+		H5Handle user_int(h5_array_type(H5T_NATIVE_INT32, ISMRMRD_USER_INTS), H5Tclose, "H5Tarray_create2");
+		H5Handle user_float(h5_array_type(H5T_NATIVE_FLOAT, ISMRMRD_USER_FLOATS), H5Tclose, "H5Tarray_create2");
+		ISMRMRD_H5_INSERT(type, S, version, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, data_type, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, flags, H5T_NATIVE_UINT64);
+		ISMRMRD_H5_INSERT(type, S, measurement_uid, H5T_NATIVE_UINT32);
+		ISMRMRD_H5_INSERT(type, S, matrix_size, size);
+		ISMRMRD_H5_INSERT(type, S, field_of_view, fov);
+		ISMRMRD_H5_INSERT(type, S, channels, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, position, pos);
+		ISMRMRD_H5_INSERT(type, S, read_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, phase_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, slice_dir, dir);
+		ISMRMRD_H5_INSERT(type, S, patient_table_position, pos);
+		ISMRMRD_H5_INSERT(type, S, average, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, slice, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, contrast, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, phase, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, repetition, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, set, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, acquisition_time_stamp, H5T_NATIVE_UINT32);
+		ISMRMRD_H5_INSERT(type, S, physiology_time_stamp, phys);
+		ISMRMRD_H5_INSERT(type, S, image_type, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, image_index, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, image_series_index, H5T_NATIVE_UINT16);
+		ISMRMRD_H5_INSERT(type, S, user_int, user_int);
+		ISMRMRD_H5_INSERT(type, S, user_float, user_float);
+		ISMRMRD_H5_INSERT(type, S, attribute_string_len, H5T_NATIVE_UINT32);
+		return type;
+	}
+
+#undef ISMRMRD_H5_INSERT
+
+	hid_t h5_string_type()
+	{
+		hid_t type = H5Tcopy(H5T_C_S1);
+		H5Tset_size(type, H5T_VARIABLE);
+		return type;
+	}
+
+	hid_t h5_image_data_type(uint16_t data_type)
+	{
+		switch (data_type) {
+		case ISMRMRD_USHORT:
+			return H5Tcopy(H5T_NATIVE_UINT16);
+		case ISMRMRD_SHORT:
+			return H5Tcopy(H5T_NATIVE_INT16);
+		case ISMRMRD_UINT:
+			return H5Tcopy(H5T_NATIVE_UINT32);
+		case ISMRMRD_INT:
+			return H5Tcopy(H5T_NATIVE_INT32);
+		case ISMRMRD_FLOAT:
+			return H5Tcopy(H5T_NATIVE_FLOAT);
+		case ISMRMRD_DOUBLE:
+			return H5Tcopy(H5T_NATIVE_DOUBLE);
+		case ISMRMRD_CXFLOAT:
+			return h5_complex_type(H5T_NATIVE_FLOAT, sizeof(float));
+		case ISMRMRD_CXDOUBLE:
+			return h5_complex_type(H5T_NATIVE_DOUBLE, sizeof(double));
+		default:
+			THROW("ISMRMRDWriter: unknown image data type");
+		}
+	}
+
+	// sets *ptr to a new image of the type of the first argument (only used
+	// to select the type) with the header, attributes and data given
+	template<typename T>
+	void new_image_(Image<T>*, void** ptr, const ISMRMRD_ImageHeader& head,
+		const std::string& attributes, const char* data, size_t size)
+	{
+		ImageHeader h;
+		static_cast<ISMRMRD_ImageHeader&>(h) = head;
+		std::unique_ptr<Image<T> > uptr_im(new Image<T>);
+		uptr_im->setHead(h);
+		uptr_im->setAttributeString(attributes);
+		if (uptr_im->getDataSize() != size)
+			THROW("ISMRMRDReader: image header does not match the image data");
+		std::memcpy(uptr_im->getDataPtr(), data, size);
+		*ptr = uptr_im.release();
+	}
+
+	// acquisitions or images of one variable, with their variable length
+	// parts (trajectories and samples, or attributes and image data) stored
+	// contiguously
+	struct Block {
+		bool images = false;
+		std::string var;
+		std::vector<ISMRMRD_AcquisitionHeader> acq_heads;
+		std::vector<ISMRMRD_ImageHeader> image_heads;
+		std::vector<std::string> attributes;
+		std::vector<float> traj;
+		std::vector<size_t> traj_end;
+		std::vector<char> data;
+		std::vector<size_t> data_end;
+		size_t size() const
+		{
+			return images ? image_heads.size() : acq_heads.size();
+		}
+	};
+
+}
+
+class ISMRMRDWriter::Impl {
+public:
+	Impl(const std::string& filename, const std::string& groupname) :
+		group_("/" + groupname), block_size_(1024), chunk_size_(1024),
+		compression_level_(0), queue_size_(4), closing_(false), closed_(false),
+		file_(-1), acquisition_type_(-1), image_header_type_(-1), string_type_(-1)
+	{
+		Mutex mtx;
+		mtx.lock();
+		try {
+			if (std::ifstream(filename.c_str()).good())
+				file_ = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+			else
+				file_ = H5Fcreate(filename.c_str(), H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+			if (file_ < 0)
+				THROW("ISMRMRDWriter: cannot open " + filename);
+			acquisition_type_ = h5_acquisition_type();
+			image_header_type_ = h5_image_header_type();
+			string_type_ = h5_string_type();
+			create_group_(group_);
+		}
+		catch (...) {
+			close_file_();
+			mtx.unlock();
+			throw;
+		}
+		mtx.unlock();
+	}
+	~Impl()
+	{
+		try {
+			close();
+		}
+		catch (...) {
+		}
+	}
+
+	void set_block_size(unsigned int n)
+	{
+		ASSERT(n > 0, "ISMRMRDWriter: block size must be positive");
+		block_size_ = n;
+	}
+	void set_chunk_size(unsigned int n)
+	{
+		ASSERT(n > 0, "ISMRMRDWriter: chunk size must be positive");
+		chunk_size_ = n;
+	}
+	void set_compression_level(int level)
+	{
+		ASSERT(level >= 0 && level <= 9, "ISMRMRDWriter: compression level must be 0 to 9");
+		compression_level_ = level;
+	}
+	void set_queue_size(unsigned int n)
+	{
+		ASSERT(n > 0, "ISMRMRDWriter: queue size must be positive");
+		queue_size_ = n;
+	}
+
+	void write_header(const std::string& xml)
+	{
+		ASSERT(!closed_, "ISMRMRDWriter: the file is closed");
+		Mutex mtx;
+		mtx.lock();
+		try {
+			const std::string path = group_ + "/xml";
+			if (H5Lexists(file_, path.c_str(), H5P_DEFAULT) > 0)
+				check_(H5Ldelete(file_, path.c_str(), H5P_DEFAULT), "H5Ldelete");
+			hsize_t dims = 1;
+			H5Handle space(H5Screate_simple(1, &dims, &dims), H5Sclose, "H5Screate_simple");
+			H5Handle dataset(H5Dcreate2(file_, path.c_str(), string_type_, space,
+				H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Dclose, "H5Dcreate2");
+			const char* buff[1] = { xml.c_str() };
+			check_(H5Dwrite(dataset, string_type_, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff), "H5Dwrite");
+		}
+		catch (...) {
+			mtx.unlock();
+			throw;
+		}
+		mtx.unlock();
+	}
+
+	void append_acquisition(const Acquisition& acq)
+	{
+		if (!block_ || block_->images)
+			new_block_(false, "");
+		Block& b = *block_;
+		b.acq_heads.push_back(acq.getHead());
+		const float* traj = acq.getTrajPtr();
+		b.traj.insert(b.traj.end(), traj, traj + acq.getNumberOfTrajElements());
+		b.traj_end.push_back(b.traj.size());
+		const char* data = reinterpret_cast<const char*>(acq.getDataPtr());
+		b.data.insert(b.data.end(), data, data + acq.getNumberOfDataElements()*sizeof(complex_float_t));
+		b.data_end.push_back(b.data.size());
+		if (b.size() >= block_size_)
+			flush_();
+	}
+
+	void append_image(const std::string& var, const ImageHeader& head,
+		const std::string& attributes, const void* data, size_t size)
+	{
+		if (!block_ || !block_->images || block_->var != var)
+			new_block_(true, var);
+		Block& b = *block_;
+		if (!b.image_heads.empty()) {
+			const ISMRMRD_ImageHeader& h = b.image_heads[0];
+			if (h.data_type != head.data_type || h.channels != head.channels ||
+				std::memcmp(h.matrix_size, head.matrix_size, sizeof(h.matrix_size)))
+				THROW("ISMRMRDWriter: images of " + var + " differ in type or size");
+		}
+		b.image_heads.push_back(head);
+		b.image_heads.back().attribute_string_len = uint32_t(attributes.size());
+		b.attributes.push_back(attributes);
+		const char* ptr = static_cast<const char*>(data);
+		b.data.insert(b.data.end(), ptr, ptr + size);
+		b.data_end.push_back(b.data.size());
+		if (b.size() >= block_size_)
+			flush_();
+	}
+
+	void close()
+	{
+		if (closed_)
+			return;
+		closed_ = true;
+		std::exception_ptr error;
+		try {
+			flush_();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex_);
+			closing_ = true;
+		}
+		not_empty_.notify_all();
+		if (thread_.joinable())
+			thread_.join();
+		Mutex mtx;
+		mtx.lock();
+		close_file_();
+		mtx.unlock();
+		if (!error)
+			error = error_;
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	void new_block_(bool images, const std::string& var)
+	{
+		flush_();
+		ASSERT(!closed_, "ISMRMRDWriter: the file is closed");
+		block_.reset(new Block);
+		block_->images = images;
+		block_->var = var;
+	}
+	// queues the current block
+	void flush_()
+	{
+		if (!block_ || block_->size() == 0)
+			return;
+		std::unique_lock<std::mutex> lock(queue_mutex_);
+		if (!thread_.joinable())
+			thread_ = std::thread(&Impl::run_, this);
+		not_full_.wait(lock, [this]() { return queue_.size() < queue_size_ || error_; });
+		if (error_)
+			std::rethrow_exception(error_);
+		queue_.push_back(std::move(block_));
+		lock.unlock();
+		not_empty_.notify_one();
+	}
+	// the background thread
+	void run_()
+	{
+		for (;;) {
+			std::unique_ptr<Block> block;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex_);
+				not_empty_.wait(lock, [this]() { return !queue_.empty() || closing_; });
+				if (queue_.empty())
+					return;
+				block = std::move(queue_.front());
+				queue_.pop_front();
+			}
+			not_full_.notify_one();
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex_);
+				if (error_)
+					continue; // discard the rest
+			}
+			Mutex mtx;
+			mtx.lock();
+			try {
+				if (block->images)
+					write_images_(*block);
+				else
+					write_acquisitions_(*block);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(queue_mutex_);
+				error_ = std::current_exception();
+			}
+			mtx.unlock();
+			not_full_.notify_all();
+		}
+	}
+
+	void write_acquisitions_(const Block& b)
+	{
+		ScopedTimer timer("ISMRMRDWriter::write_acquisitions");
+		const size_t n = b.size();
+		std::vector<HDF5Acquisition> acqs(n);
+		size_t t = 0;
+		size_t d = 0;
+		for (size_t i = 0; i < n; i++) {
+			HDF5Acquisition& a = acqs[i];
+			a.head = b.acq_heads[i];
+			a.traj.len = b.traj_end[i] - t;
+			a.traj.p = a.traj.len ? (void*)&b.traj[t] : 0;
+			a.data.len = (b.data_end[i] - d) / sizeof(float);
+			a.data.p = a.data.len ? (void*)&b.data[d] : 0;
+			t = b.traj_end[i];
+			d = b.data_end[i];
+		}
+		hid_t dataset = dataset_(group_ + "/data", acquisition_type_, 0, 0, chunk_size_);
+		append_(dataset, acquisition_type_, n, 0, 0, acqs.data());
+		Profiler::count_bytes("ISMRMRDWriter::write_acquisitions",
+			n*sizeof(ISMRMRD_AcquisitionHeader) + b.traj.size()*sizeof(float) + b.data.size());
+	}
+
+	void write_images_(const Block& b)
+	{
+		ScopedTimer timer("ISMRMRDWriter::write_images");
+		const size_t n = b.size();
+		const ISMRMRD_ImageHeader& head = b.image_heads[0];
+		const std::string path = group_ + "/" + b.var;
+		create_group_(path);
+
+		hid_t dataset = dataset_(path + "/header", image_header_type_, 0, 0, chunk_size_);
+		append_(dataset, image_header_type_, n, 0, 0, b.image_heads.data());
+
+		std::vector<const char*> attributes(n);
+		for (size_t i = 0; i < n; i++)
+			attributes[i] = b.attributes[i].c_str();
+		dataset = dataset_(path + "/attributes", string_type_, 0, 0, chunk_size_);
+		append_(dataset, string_type_, n, 0, 0, attributes.data());
+
+		hsize_t dims[4] = { head.channels,
+			head.matrix_size[2], head.matrix_size[1], head.matrix_size[0] };
+		H5Handle type(h5_image_data_type(head.data_type), H5Tclose, "H5Tcreate");
+		dataset = dataset_(path + "/data", type, 4, dims, 1);
+		append_(dataset, type, n, 4, dims, b.data.data());
+		Profiler::count_bytes("ISMRMRDWriter::write_images",
+			n*sizeof(ISMRMRD_ImageHeader) + b.data.size());
+	}
+
+	void create_group_(const std::string& path)
+	{
+		if (H5Lexists(file_, path.c_str(), H5P_DEFAULT) > 0)
+			return;
+		H5Handle group(H5Gcreate2(file_, path.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT),
+			H5Gclose, "H5Gcreate2");
+	}
+	// opens or creates a dataset extendable in the first dimension, whose
+	// items have item_rank dimensions item_dims
+	hid_t dataset_(const std::string& path, hid_t type,
+		int item_rank, const hsize_t* item_dims, hsize_t chunk)
+	{
+		auto i = datasets_.find(path);
+		if (i != datasets_.end())
+			return i->second;
+		hid_t dataset;
+		if (H5Lexists(file_, path.c_str(), H5P_DEFAULT) > 0)
+			dataset = H5Dopen2(file_, path.c_str(), H5P_DEFAULT);
+		else {
+			std::vector<hsize_t> dims(1 + item_rank, 0);
+			std::vector<hsize_t> max_dims(1 + item_rank, H5S_UNLIMITED);
+			std::vector<hsize_t> chunk_dims(1 + item_rank, chunk);
+			for (int d = 0; d < item_rank; d++)
+				dims[d + 1] = max_dims[d + 1] = chunk_dims[d + 1] = item_dims[d];
+			H5Handle space(H5Screate_simple(1 + item_rank, dims.data(), max_dims.data()),
+				H5Sclose, "H5Screate_simple");
+			H5Handle props(H5Pcreate(H5P_DATASET_CREATE), H5Pclose, "H5Pcreate");
+			check_(H5Pset_chunk(props, 1 + item_rank, chunk_dims.data()), "H5Pset_chunk");
+			if (compression_level_ > 0)
+				check_(H5Pset_deflate(props, compression_level_), "H5Pset_deflate");
+			dataset = H5Dcreate2(file_, path.c_str(), type, space,
+				H5P_DEFAULT, props, H5P_DEFAULT);
+		}
+		if (dataset < 0)
+			THROW("ISMRMRDWriter: cannot create " + path);
+		datasets_[path] = dataset;
+		return dataset;
+	}
+	// appends n items with one hyperslab write
+	void append_(hid_t dataset, hid_t type, size_t n,
+		int item_rank, const hsize_t* item_dims, const void* buff)
+	{
+		const int rank = 1 + item_rank;
+		std::vector<hsize_t> dims(rank);
+		{
+			H5Handle space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+			ASSERT(H5Sget_simple_extent_ndims(space) == rank,
+				"ISMRMRDWriter: existing dataset has a different rank");
+			H5Sget_simple_extent_dims(space, dims.data(), 0);
+		}
+		std::vector<hsize_t> offset(rank, 0);
+		std::vector<hsize_t> count(rank);
+		offset[0] = dims[0];
+		count[0] = n;
+		for (int d = 0; d < item_rank; d++) {
+			ASSERT(dims[d + 1] == item_dims[d],
+				"ISMRMRDWriter: existing dataset has different item dimensions");
+			count[d + 1] = item_dims[d];
+		}
+		dims[0] += n;
+		check_(H5Dset_extent(dataset, dims.data()), "H5Dset_extent");
+		H5Handle file_space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+		check_(H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+			offset.data(), 0, count.data(), 0), "H5Sselect_hyperslab");
+		H5Handle mem_space(H5Screate_simple(rank, count.data(), 0), H5Sclose, "H5Screate_simple");
+		check_(H5Dwrite(dataset, type, mem_space, file_space, H5P_DEFAULT, buff), "H5Dwrite");
+	}
+	void close_file_()
+	{
+		for (auto& d : datasets_)
+			H5Dclose(d.second);
+		datasets_.clear();
+		if (string_type_ >= 0)
+			H5Tclose(string_type_);
+		if (image_header_type_ >= 0)
+			H5Tclose(image_header_type_);
+		if (acquisition_type_ >= 0)
+			H5Tclose(acquisition_type_);
+		if (file_ >= 0)
+			H5Fclose(file_);
+		file_ = acquisition_type_ = image_header_type_ = string_type_ = -1;
+	}
+
+	std::string group_;
+	unsigned int block_size_;
+	unsigned int chunk_size_;
+	int compression_level_;
+	unsigned int queue_size_;
+
+	std::unique_ptr<Block> block_;
+	std::deque<std::unique_ptr<Block> > queue_;
+	std::mutex queue_mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+	std::thread thread_;
+	std::exception_ptr error_;
+	bool closing_;
+	bool closed_;
+
+	hid_t file_;
+	hid_t acquisition_type_;
+	hid_t image_header_type_;
+	hid_t string_type_;
+	std::map<std::string, hid_t> datasets_;
+};
+
+ISMRMRDWriter::ISMRMRDWriter(const std::string& filename, const std::string& groupname) :
+	impl_(new Impl(filename, groupname))
+{}
+
+ISMRMRDWriter::~ISMRMRDWriter()
+{}
+
+void ISMRMRDWriter::set_block_size(unsigned int n)
+{
+	impl_->set_block_size(n);
+}
+
+void ISMRMRDWriter::set_chunk_size(unsigned int n)
+{
+	impl_->set_chunk_size(n);
+}
+
+void ISMRMRDWriter::set_compression_level(int level)
+{
+	impl_->set_compression_level(level);
+}
+
+void ISMRMRDWriter::set_queue_size(unsigned int n)
+{
+	impl_->set_queue_size(n);
+}
+
+void ISMRMRDWriter::write_header(const std::string& xml)
+{
+	impl_->write_header(xml);
+}
+
+void ISMRMRDWriter::append_acquisition(const Acquisition& acq)
+{
+	impl_->append_acquisition(acq);
+}
+
+void ISMRMRDWriter::append_image_(const std::string& var, const ImageHeader& head,
+	const std::string& attributes, const void* data, size_t size)
+{
+	impl_->append_image(var, head, attributes, data, size);
+}
+
+void ISMRMRDWriter::close()
+{
+	impl_->close();
+}
+
+class ISMRMRDReader::Impl {
+public:
+	Impl(const std::string& filename, const std::string& groupname) :
+		group_("/" + groupname), block_size_(256),
+		file_(-1), image_header_type_(-1), string_type_(-1)
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		try {
+			file_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+			if (file_ < 0)
+				THROW("ISMRMRDReader: cannot open " + filename);
+			image_header_type_ = h5_image_header_type();
+			string_type_ = h5_string_type();
+		}
+		catch (...) {
+			close_file_();
+			throw;
+		}
+	}
+	~Impl()
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		close_file_();
+	}
+
+	void set_block_size(unsigned int n)
+	{
+		ASSERT(n > 0, "ISMRMRDReader: block size must be positive");
+		block_size_ = n;
+	}
+
+	std::string read_header()
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		const std::string path = group_ + "/xml";
+		if (H5Lexists(file_, path.c_str(), H5P_DEFAULT) <= 0)
+			return std::string();
+		H5Handle dataset(H5Dopen2(file_, path.c_str(), H5P_DEFAULT), H5Dclose, "H5Dopen2");
+		H5Handle space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+		char* buff[1] = { 0 };
+		check_(H5Dread(dataset, string_type_, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff), "H5Dread");
+		std::string xml(buff[0] ? buff[0] : "");
+		H5Dvlen_reclaim(string_type_, space, H5P_DEFAULT, buff);
+		return xml;
+	}
+
+	size_t number_of_images(const std::string& var)
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		return number_of_images_(var);
+	}
+
+	uint16_t image_data_type(const std::string& var)
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		ASSERT(number_of_images_(var) > 0, "ISMRMRDReader: no images in " + var);
+		ISMRMRD_ImageHeader head;
+		H5Handle dataset(open_(group_ + "/" + var + "/header"), H5Dclose, "H5Dopen2");
+		read_(dataset, image_header_type_, 0, 1, &head);
+		return head.data_type;
+	}
+
+	void read_images(const std::string& var,
+		const std::function<void(uint16_t, void*)>& append)
+	{
+		const size_t num_im = number_of_images(var);
+		for (size_t first = 0; first < num_im; first += block_size_) {
+			const size_t n = std::min(size_t(block_size_), num_im - first);
+			std::vector<ISMRMRD_ImageHeader> heads(n);
+			std::vector<std::string> attributes(n);
+			std::vector<char> data;
+			size_t image_size = 0;
+			read_block_(var, first, n, heads, attributes, data, image_size);
+
+			const uint16_t type = heads[0].data_type;
+			std::vector<void*> images(n, (void*)0);
+			try {
+				xGadgetronUtilities::parallel_for(n, 16,
+					[&](size_t begin, size_t end, size_t) {
+					for (size_t i = begin; i < end; i++) {
+						IMAGE_PROCESSING_SWITCH(type, new_image_, images[i], &images[i],
+							heads[i], attributes[i], &data[i*image_size], image_size);
+						if (!images[i])
+							THROW("ISMRMRDReader: unknown image data type");
+					}
+				});
+				for (size_t i = 0; i < n; i++) {
+					void* ptr = images[i];
+					images[i] = 0;
+					append(type, ptr);
+				}
+			}
+			catch (...) {
+				for (size_t i = 0; i < n; i++)
+					if (images[i]) {
+						IMAGE_PROCESSING_SWITCH(type, delete, images[i]);
+					}
+				throw;
+			}
+		}
+	}
+
+private:
+	// 0 if var is not a group of images
+	size_t number_of_images_(const std::string& var)
+	{
+		const std::string path = group_ + "/" + var + "/header";
+		if (H5Lexists(file_, (group_ + "/" + var).c_str(), H5P_DEFAULT) <= 0 ||
+			H5Lexists(file_, path.c_str(), H5P_DEFAULT) <= 0)
+			return 0;
+		H5Handle dataset(open_(path), H5Dclose, "H5Dopen2");
+		H5Handle space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+		hsize_t dims[1];
+		ASSERT(H5Sget_simple_extent_ndims(space) == 1,
+			"ISMRMRDReader: image headers must be a one-dimensional dataset");
+		H5Sget_simple_extent_dims(space, dims, 0);
+		return dims[0];
+	}
+	// reads the headers, attributes and data of images [first, first + n)
+	// of var, image_size being the size of the data of one image in bytes
+	void read_block_(const std::string& var, size_t first, size_t n,
+		std::vector<ISMRMRD_ImageHeader>& heads, std::vector<std::string>& attributes,
+		std::vector<char>& data, size_t& image_size)
+	{
+		Mutex mtx;
+		std::lock_guard<boost::mutex> guard(mtx());
+		ScopedTimer timer("ISMRMRDReader::read_images");
+		const std::string path = group_ + "/" + var;
+
+		{
+			H5Handle dataset(open_(path + "/header"), H5Dclose, "H5Dopen2");
+			read_(dataset, image_header_type_, first, n, heads.data());
+		}
+		for (size_t i = 1; i < n; i++)
+			if (heads[i].data_type != heads[0].data_type)
+				THROW("ISMRMRDReader: images of " + var + " differ in type");
+
+		if (H5Lexists(file_, (path + "/attributes").c_str(), H5P_DEFAULT) > 0) {
+			H5Handle dataset(open_(path + "/attributes"), H5Dclose, "H5Dopen2");
+			std::vector<char*> buff(n, (char*)0);
+			read_(dataset, string_type_, first, n, buff.data());
+			for (size_t i = 0; i < n; i++)
+				if (buff[i])
+					attributes[i] = buff[i];
+			hsize_t count = n;
+			H5Handle space(H5Screate_simple(1, &count, 0), H5Sclose, "H5Screate_simple");
+			H5Dvlen_reclaim(string_type_, space, H5P_DEFAULT, buff.data());
+		}
+
+		H5Handle dataset(open_(path + "/data"), H5Dclose, "H5Dopen2");
+		H5Handle type(h5_image_data_type(heads[0].data_type), H5Tclose, "H5Tcreate");
+		{
+			H5Handle space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+			const int rank = H5Sget_simple_extent_ndims(space);
+			ASSERT(rank > 1, "ISMRMRDReader: image data must have more than one dimension");
+			std::vector<hsize_t> dims(rank);
+			H5Sget_simple_extent_dims(space, dims.data(), 0);
+			image_size = H5Tget_size(type);
+			for (int d = 1; d < rank; d++)
+				image_size *= dims[d];
+		}
+		data.resize(n*image_size);
+		read_(dataset, type, first, n, data.data());
+		Profiler::count_bytes("ISMRMRDReader::read_images",
+			n*sizeof(ISMRMRD_ImageHeader) + data.size());
+	}
+	hid_t open_(const std::string& path)
+	{
+		return H5Dopen2(file_, path.c_str(), H5P_DEFAULT);
+	}
+	// reads items [first, first + n) of the dataset with one hyperslab read
+	void read_(hid_t dataset, hid_t type, size_t first, size_t n, void* buff)
+	{
+		H5Handle file_space(H5Dget_space(dataset), H5Sclose, "H5Dget_space");
+		const int rank = H5Sget_simple_extent_ndims(file_space);
+		std::vector<hsize_t> count(rank);
+		H5Sget_simple_extent_dims(file_space, count.data(), 0);
+		ASSERT(first + n <= count[0], "ISMRMRDReader: reading beyond the end of a dataset");
+		std::vector<hsize_t> offset(rank, 0);
+		offset[0] = first;
+		count[0] = n;
+		check_(H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+			offset.data(), 0, count.data(), 0), "H5Sselect_hyperslab");
+		H5Handle mem_space(H5Screate_simple(rank, count.data(), 0), H5Sclose, "H5Screate_simple");
+		check_(H5Dread(dataset, type, mem_space, file_space, H5P_DEFAULT, buff), "H5Dread");
+	}
+	void close_file_()
+	{
+		if (string_type_ >= 0)
+			H5Tclose(string_type_);
+		if (image_header_type_ >= 0)
+			H5Tclose(image_header_type_);
+		if (file_ >= 0)
+			H5Fclose(file_);
+		file_ = image_header_type_ = string_type_ = -1;
+	}
+
+	std::string group_;
+	unsigned int block_size_;
+	hid_t file_;
+	hid_t image_header_type_;
+	hid_t string_type_;
+};
+
+ISMRMRDReader::ISMRMRDReader(const std::string& filename, const std::string& groupname) :
+	impl_(new Impl(filename, groupname))
+{}
+
+ISMRMRDReader::~ISMRMRDReader()
+{}
+
+void ISMRMRDReader::set_block_size(unsigned int n)
+{
+	impl_->set_block_size(n);
+}
+
+std::string ISMRMRDReader::read_header()
+{
+	return impl_->read_header();
+}
+
+size_t ISMRMRDReader::number_of_images(const std::string& var)
+{
+	return impl_->number_of_images(var);
+}
+
+uint16_t ISMRMRDReader::image_data_type(const std::string& var)
+{
+	return impl_->image_data_type(var);
+}
+
+void ISMRMRDReader::read_images(const std::string& var,
+	const std::function<void(uint16_t, void*)>& append)
+{
+	impl_->read_images(var, append);
+}
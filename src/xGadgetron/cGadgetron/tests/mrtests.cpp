@@ -28,11 +28,15 @@ limitations under the License.
 \author SyneRBI
 */
 
+#include <cstdio>
 #include <iostream>
 #include <cstdlib>
+#include <fstream>
+#include <limits>
 #include <numeric>
 #include <vector>
 #include <random>
+#include <sstream>
 
 #include <ismrmrd/xml.h>
 
@@ -43,6 +47,7 @@ limitations under the License.
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
 
+#include "sirf/Gadgetron/CoilCompression.h"
 #include "sirf/Gadgetron/FourierEncoding.h"
 #include "sirf/Gadgetron/TrajectoryPreparation.h"
 
@@ -95,6 +100,259 @@ bool test_get_subset(const MRAcquisitionData& av)
     }
 }
 
+bool test_header_index(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // the index entries are those of the acquisitions
+        const MRAcquisitionHeaderIndex& hi = av.header_index();
+        test_successful *= (hi.size() == av.number());
+        ISMRMRD::Acquisition acq;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            const MRAcquisitionHeaderIndex::Entry& e = hi[av.index(i)];
+            test_successful *= (e.acquisition_time_stamp == acq.acquisition_time_stamp());
+            test_successful *= (e.flags == acq.flags());
+            test_successful *= (e.idx.kspace_encode_step_1 == acq.idx().kspace_encode_step_1);
+        }
+
+        // binning by the k-space tag reproduces the k-space order
+        auto kspace_order = av.get_kspace_order();
+        int num_slices = 0;
+        for(int i=0; i<hi.size(); ++i)
+            num_slices = std::max(num_slices, hi[i].idx.slice + 1);
+        auto bins = av.bin_acquisitions([](const MRAcquisitionHeaderIndex::Entry& e)
+            { return e.idx.average == 0 && e.idx.contrast == 0 && e.idx.phase == 0 &&
+                e.idx.repetition == 0 && e.idx.set == 0 ? int(e.idx.slice) : -1; }, num_slices);
+        test_successful *= (bins[0] == kspace_order[0]);
+
+        // selection by flags agrees with the flagged acquisitions
+        std::vector<ISMRMRD::ISMRMRD_AcquisitionFlags> flags{ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE};
+        auto selected = av.select_acquisitions([](const MRAcquisitionHeaderIndex::Entry& e)
+            { return e.is_flag_set(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE); });
+        test_successful *= (selected == av.get_flagged_acquisitions_index(flags));
+
+        // the index follows changes of the acquisition headers
+        gadgetron::unique_ptr<MRAcquisitionData> uptr_ad = av.clone();
+        uptr_ad->header_index();
+        uptr_ad->get_acquisition(0, acq);
+        acq.acquisition_time_stamp() = std::numeric_limits<uint32_t>::max();
+        uptr_ad->set_acquisition(0, acq);
+        uptr_ad->sort_by_time();
+        uptr_ad->get_acquisition(uptr_ad->number() - 1, acq);
+        test_successful *= (acq.acquisition_time_stamp() == std::numeric_limits<uint32_t>::max());
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_acquisition_algebra(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // the active index lists the acquisitions that are not to be ignored
+        gadgetron::unique_ptr<MRAcquisitionData> uptr_x = av.clone();
+        ISMRMRD::Acquisition acq;
+        uptr_x->get_acquisition(0, acq);
+        acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+        uptr_x->set_acquisition(0, acq);
+        std::vector<int> active;
+        for(int i=0; i<uptr_x->number(); ++i)
+        {
+            uptr_x->get_acquisition(i, acq);
+            if(!TO_BE_IGNORED(acq))
+                active.push_back(i);
+        }
+        test_successful *= (uptr_x->active_index() == active);
+
+        // the algebra skips the ignored acquisitions of all operands
+        float nx = uptr_x->norm();
+        complex_float_t xx;
+        uptr_x->dot(*uptr_x, &xx);
+        test_successful *= (std::abs(xx.real() - nx*nx) <= 1e-4*nx*nx);
+
+        complex_float_t a(2.0f, 1.0f);
+        complex_float_t b(-1.0f, -1.0f);
+        gadgetron::unique_ptr<MRAcquisitionData> uptr_y = uptr_x->new_acquisitions_container();
+        uptr_y->axpby(&a, *uptr_x, &b, *uptr_x);
+        test_successful *= (uptr_y->number() == active.size());
+        test_successful *= (std::abs(uptr_y->norm() - nx) <= 1e-5*nx);
+
+        complex_float_t one(1.0f);
+        complex_float_t minus_one(-1.0f);
+        uptr_y->axpby(&one, *uptr_y, &minus_one, *uptr_x);
+        test_successful *= (uptr_y->number() == active.size());
+        test_successful *= (uptr_y->norm() <= 1e-5*nx);
+
+        gadgetron::unique_ptr<MRAcquisitionData> uptr_z = uptr_x->new_acquisitions_container();
+        uptr_z->multiply(*uptr_x, *uptr_x);
+        complex_float_t xz;
+        uptr_x->dot(*uptr_z, &xz);
+        complex_float_t zx;
+        uptr_z->dot(*uptr_x, &zx);
+        test_successful *= (std::abs(xz - std::conj(zx)) <= 1e-4*std::abs(xz));
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_ISMRMRDWriter(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // acquisitions written in small compressed blocks are read back unchanged
+        std::string fname_acqs = std::string("output_") + __FUNCTION__ + ".h5";
+        std::remove(fname_acqs.c_str());
+        {
+            ISMRMRDWriter writer(fname_acqs);
+            writer.set_block_size(7);
+            writer.set_chunk_size(16);
+            writer.set_compression_level(1);
+            av.write(writer);
+            writer.close();
+        }
+        AcquisitionsVector av_read(fname_acqs);
+        test_successful *= (av_read.number() == av.number());
+        ISMRMRD::Acquisition acq, acq_read;
+        for(int i=0; test_successful && i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            av_read.get_acquisition(i, acq_read);
+            test_successful *= (acq.scan_counter() == acq_read.scan_counter());
+            test_successful *= (acq.idx().kspace_encode_step_1 == acq_read.idx().kspace_encode_step_1);
+            MRAcquisitionData::axpby(complex_float_t(1), acq, complex_float_t(-1), acq_read);
+            test_successful *= (MRAcquisitionData::norm(acq_read) == 0);
+        }
+
+        // so are images
+        std::string fname_imgs = std::string("output_") + __FUNCTION__ + "_images.h5";
+        std::remove(fname_imgs.c_str());
+        GadgetronImagesVector iv(av);
+        sirf::Dimensions dims = iv.dimensions();
+        size_t const num_values = size_t(dims["x"])*dims["y"]*dims["z"]*dims["c"]*dims["n"];
+        std::vector<complex_float_t> values(num_values);
+        for (size_t i = 0; i < num_values; i++)
+            values[i] = complex_float_t(float(i), -float(i % 7));
+        iv.set_data(&values[0]);
+        iv.write(fname_imgs);
+        GadgetronImagesVector iv_read;
+        iv_read.read(fname_imgs);
+        test_successful *= (iv_read.number() == iv.number());
+        std::vector<complex_float_t> values_read(num_values);
+        iv_read.get_data(&values_read[0]);
+        test_successful *= (values_read == values);
+
+        // also when read in blocks smaller than the number of images
+        std::string fname_blocks = std::string("output_") + __FUNCTION__ + "_blocks.h5";
+        std::remove(fname_blocks.c_str());
+        std::stringstream var;
+        var << "image_" << iv.image_wrap(0).head().image_series_index;
+        {
+            ISMRMRDWriter writer(fname_blocks, "images");
+            for (unsigned int i = 0; i < iv.number(); i++)
+                iv.image_wrap(i).write(writer);
+            writer.close();
+        }
+        GadgetronImagesVector iv_blocks;
+        {
+            ISMRMRDReader reader(fname_blocks, "images");
+            reader.set_block_size(2);
+            test_successful *= (reader.read_header().empty());
+            test_successful *= (reader.number_of_images(var.str()) == iv.number());
+            test_successful *= (reader.number_of_images("no_images") == 0);
+            reader.read_images(var.str(), [&iv_blocks](uint16_t type, void* ptr_image) {
+                iv_blocks.append(type, ptr_image);
+            });
+        }
+        test_successful *= (iv_blocks.number() == iv.number());
+        if (iv_blocks.number() == iv.number()) {
+            iv_blocks.get_data(&values_read[0]);
+            test_successful *= (values_read == values);
+            test_successful *= (iv_blocks.image_wrap(0).attributes() == iv.image_wrap(0).attributes());
+        }
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_GadgetChain_config()
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // the xml-definition is kept until a gadget property changes
+        AcquisitionsProcessor ap;
+        gadgetron::shared_ptr<RemoveROOversamplingGadget> sptr_g(new RemoveROOversamplingGadget);
+        ap.add_gadget("gadget", sptr_g);
+        std::string xml = ap.xml();
+        std::string name = ap.config_name();
+        test_successful *= (ap.xml() == xml);
+        test_successful *= (ap.config_name() == name);
+        ap.gadget_sptr("gadget")->set_property("test_property", "1");
+        test_successful *= (ap.xml() != xml);
+        test_successful *= (ap.xml().find("test_property") != std::string::npos);
+        test_successful *= (ap.config_name() != name);
+
+        // the configuration file is written once and then reused
+        ap.set_config_dir(".");
+        ap.write_config();
+        std::string fname = "./" + ap.config_name();
+        std::ifstream in(fname.c_str(), std::ios::binary);
+        std::ostringstream content;
+        content << in.rdbuf();
+        in.close();
+        test_successful *= (content.str() == ap.xml());
+        AcquisitionsProcessor ap_same;
+        ap_same.add_gadget("gadget", sptr_g);
+        test_successful *= (ap_same.config_name() == ap.config_name());
+        ap_same.set_config_dir(".");
+        ap_same.write_config();
+        std::remove(fname.c_str());
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_ISMRMRDImageData_from_MRAcquisitionData(MRAcquisitionData& av)
 {
      try
@@ -306,7 +564,19 @@ try
         else
             std::cout << sd_norm << " > " << bound << " failure!\n";
 
-        return ok;
+        // the cached norm is recomputed if the coil sensitivities are modified in place
+        std::cout << "checking that the cached norm follows in-place changes of the coil sensitivities: ";
+        auto sptr_csms = std::make_shared<CoilSensitivitiesVector>();
+        sptr_csms->calculate(*sptr_ad);
+        AM.set_csm(sptr_csms);
+        float csm_norm = AM.norm();
+        bool cache_ok = (AM.norm() == csm_norm);
+        sptr_csms->scale(2.0f);
+        float scaled_norm = AM.norm();
+        cache_ok = cache_ok && (std::abs(scaled_norm - csm_norm) > 0.1f * csm_norm);
+        std::cout << csm_norm << " -> " << scaled_norm << (cache_ok ? " ok!\n" : " failure!\n");
+
+        return ok && cache_ok;
         
     }
     catch( std::runtime_error const &e)
@@ -317,6 +587,40 @@ try
     }
 }
 
+bool test_acq_mod_normal_kernels(MRAcquisitionData& ad, float const tolerance)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        sirf::MRAcquisitionModel AM = sirf::get_prepared_MRAcquisitionModel(ad);
+
+        auto sptr_img = AM.bwd(ad);
+        auto sptr_fwd = AM.fwd(*sptr_img);
+        auto sptr_bwd_fwd = AM.bwd(*sptr_fwd);
+
+        AM.set_use_normal_kernels(true);
+        auto sptr_normal = AM.normal(*sptr_img);
+
+        complex_float_t const one(1.f, 0.f);
+        complex_float_t const minus_one(-1.f, 0.f);
+        auto uptr_diff = sptr_normal->clone();
+        uptr_diff->axpby(&one, *sptr_normal, &minus_one, *sptr_bwd_fwd);
+
+        float const rel_diff = uptr_diff->norm() / sptr_bwd_fwd->norm();
+        std::cout << "|normal(x) - bwd(fwd(x))|/|bwd(fwd(x))| = " << rel_diff << std::endl;
+        std::cout << "Accepting a relative tolerance of " << tolerance << std::endl;
+
+        return rel_diff < tolerance;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_bwd(MRAcquisitionData& av)
 {
     try
@@ -577,6 +881,79 @@ bool test_mracquisition_model_rpe_bwd(MRAcquisitionData& av)
 #endif
 
 
+bool test_CoilCompression(MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        sirf::CoilSensitivitiesVector csm;
+        csm.calculate(av);
+
+        sirf::MRAcquisitionModel acquis_model;
+        acquis_model.set_encoder(std::make_shared<sirf::CartesianFourierEncoding>());
+        sirf::GadgetronImagesVector img_vec;
+        acquis_model.bwd(img_vec, csm, av);
+
+        const CoilCompression::Mode modes[] = {CoilCompression::SVD, CoilCompression::GEOMETRIC};
+        for (CoilCompression::Mode mode : modes)
+        {
+            // keeping all channels, the compression is unitary
+            CoilCompression cc;
+            cc.set_mode(mode);
+            cc.set_num_virtual_coils(1000);
+            cc.compute(av);
+            const int nc = cc.num_coils();
+            test_successful *= (cc.num_virtual_coils() == nc);
+
+            auto uptr_cav = av.clone();
+            cc.apply(*uptr_cav);
+            test_successful *= (std::abs(uptr_cav->norm() - av.norm()) <= 1e-4 * av.norm());
+
+            // the model with compressed maps simulates the compressed data
+            cc.set_num_virtual_coils(nc > 1 ? nc / 2 : 1);
+            cc.compute(av);
+            const int nv = cc.num_virtual_coils();
+            test_successful *= (nv == (nc > 1 ? nc / 2 : 1));
+            test_successful *= (cc.energy_kept() > 0 && cc.energy_kept() <= 1.0001);
+
+            auto uptr_fwd = av.clone();
+            acquis_model.fwd(img_vec, csm, *uptr_fwd);
+            cc.apply(*uptr_fwd);
+
+            sirf::CoilSensitivitiesVector ccsm;
+            ccsm.set_meta_data(csm.get_meta_data());
+            for (unsigned int i = 0; i < csm.number(); i++)
+                ccsm.append(csm.image_wrap(i));
+            cc.apply(ccsm);
+            auto uptr_cfwd = av.clone();
+            cc.apply(*uptr_cfwd);
+            acquis_model.fwd(img_vec, ccsm, *uptr_cfwd);
+
+            ISMRMRD::Acquisition acq;
+            uptr_cfwd->get_acquisition(0, acq);
+            test_successful *= (acq.active_channels() == nv);
+            test_successful *= (uptr_cfwd->acquisitions_info().get_IsmrmrdHeader().
+                acquisitionSystemInformation.get().receiverChannels.get() == nv);
+
+            complex_float_t a = 1;
+            complex_float_t b = -1;
+            auto uptr_diff = uptr_fwd->clone();
+            uptr_diff->axpby(&a, *uptr_cfwd, &b, *uptr_fwd);
+            test_successful *= (uptr_diff->norm() <= 1e-3 * uptr_fwd->norm());
+        }
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 int main ( int argc, char* argv[])
 {
 	try{
@@ -603,6 +980,10 @@ int main ( int argc, char* argv[])
 
         ok *= test_get_kspace_order(av);
         ok *= test_get_subset(av);
+        ok *= test_header_index(av);
+        ok *= test_acquisition_algebra(av);
+        ok *= test_ISMRMRDWriter(av);
+        ok *= test_GadgetChain_config();
 
         ok *= test_ISMRMRDImageData_from_MRAcquisitionData(av);
 
@@ -610,9 +991,11 @@ int main ( int argc, char* argv[])
         ok *= test_CoilSensitivitiesVector_get_csm_as_cfimage(av);
 
         ok *= test_bwd(av);
+        ok *= test_CoilCompression(av);
 
         ok *= test_acq_mod_adjointness(av);
         ok *= test_acq_mod_norm(sptr_ad);
+        ok *= test_acq_mod_normal_kernels(av, 1e-4);
 
 
         #ifdef GADGETRON_TOOLBOXES_AVAILABLE
@@ -636,6 +1019,8 @@ int main ( int argc, char* argv[])
 
             ok *= test_mracquisition_model_rpe_bwd(rpe_av);
             ok *= test_acq_mod_adjointness(rpe_av);
+            // the Toeplitz kernel is exact, the NUFFT is not
+            ok *= test_acq_mod_normal_kernels(rpe_av, 5e-2);
 
             auto sptr_rpe_av = std::make_shared<AcquisitionsVector>(rpe_av);
             sirf::GRPETrajectoryPrep rpe_tp;
@@ -651,6 +651,69 @@ class CoilSensitivityData(ImageData):
 DataContainer.register(CoilSensitivityData)
 
 
+class CoilCompression(object):
+    '''
+    Class for compressing the receiver channels of acquisition data and
+    coil sensitivity maps into fewer virtual channels.
+
+    The compression matrices are computed from the calibration data
+    (or all acquisitions if none is flagged as calibration) by principal
+    component analysis of the channel values, either for all data (mode
+    'SVD', default) or for each readout position (mode 'geometric').
+    The acquisition model set up with the compressed acquisitions and
+    coil sensitivity maps works with the virtual channels only.
+    '''
+    def __init__(self, num_virtual_coils=0, mode='SVD'):
+        self.handle = pygadgetron.cGT_newObject('CoilCompression')
+        check_status(self.handle)
+        self.set_mode(mode)
+        self.set_num_virtual_coils(num_virtual_coils)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def set_mode(self, mode):
+        '''Sets the compression mode: 'SVD' or 'geometric'.'''
+        parms.set_char_par(self.handle, 'coil_compression', 'mode', mode)
+    def set_num_virtual_coils(self, n):
+        '''
+        Sets the number of virtual channels; if 0, it is the smallest number
+        keeping the energy fraction (see set_energy_fraction).
+        '''
+        parms.set_int_par(self.handle, 'coil_compression', 'num_virtual_coils', n)
+    def set_energy_fraction(self, f):
+        '''Sets the fraction of the calibration data energy to keep (default 0.95).'''
+        parms.set_float_par(self.handle, 'coil_compression', 'energy_fraction', f)
+    def num_coils(self):
+        return parms.int_par(self.handle, 'coil_compression', 'num_coils')
+    def num_virtual_coils(self):
+        return parms.int_par(self.handle, 'coil_compression', 'num_virtual_coils')
+    def energy_kept(self):
+        '''Returns the fraction of the calibration data energy kept.'''
+        return parms.float_par(self.handle, 'coil_compression', 'energy_kept')
+    def calculate(self, acq_data):
+        '''Computes the compression matrices from AcquisitionData.'''
+        assert_validity(acq_data, AcquisitionData)
+        try_calling(pygadgetron.cGT_computeCoilCompression \
+            (self.handle, acq_data.handle))
+    def compress(self, data):
+        '''
+        Returns a copy of AcquisitionData or CoilSensitivityData with the
+        channels compressed.
+        '''
+        if isinstance(data, AcquisitionData):
+            out = AcquisitionData()
+            out.handle = pygadgetron.cGT_compressAcquisitions \
+                (self.handle, data.handle)
+        elif isinstance(data, CoilSensitivityData):
+            out = CoilSensitivityData()
+            out.handle = pygadgetron.cGT_compressCoilSensitivities \
+                (self.handle, data.handle)
+        else:
+            raise error('Cannot compress %s' % repr(type(data)))
+        check_status(out.handle)
+        return out
+
+
 class Acquisition(object):
     ''' Provides access to ISMRMRD::Acquisition parameters (cf. ismrmrd.h).
     '''
@@ -1167,6 +1230,29 @@ class AcquisitionModel(object):
             (self.handle, ad.handle)
         check_status(image.handle)
         return image
+    def set_use_normal_kernels(self, flag=True):
+        '''
+        Makes normal() use k-space kernels computed from the acquisition
+        template (the sampling of k-space lines for Cartesian data, the
+        Toeplitz-embedded point spread function otherwise) instead of
+        forward and backward projections.
+        flag: bool
+        '''
+        h = pyiutil.intDataHandle(int(flag))
+        try_calling(pygadgetron.cGT_setAcquisitionModelParameter \
+            (self.handle, 'use_normal_kernels', h))
+        pyiutil.deleteDataHandle(h)
+    def normal(self, image):
+        '''
+        Returns backward(forward(image)), e.g. for CG-SENSE reconstruction.
+        image: ImageData
+        '''
+        assert_validity(image, ImageData)
+        out = ImageData()
+        out.handle = pygadgetron.cGT_AcquisitionModelNormal\
+            (self.handle, image.handle)
+        check_status(out.handle)
+        return out
     def inverse(self, ad, dcw=None):
         '''
         Weights acquisition data with k-space density prior to back-projection
@@ -1318,6 +1404,16 @@ class GadgetChain(object):
         port : port number (as a string)
         '''
         try_calling(pygadgetron.cGT_setPort(self.handle, port))
+    def set_config_dir(self, config_dir):
+        '''
+        Sets the directory for the chain configuration files.
+        If set (normally to the configuration directory of the Gadgetron
+        server), the chain configuration is written there once, to a file
+        named after its hash, and only the file name is then sent to the
+        server. By default, the whole configuration is sent on each run.
+        config_dir: directory name (string, empty to send the configuration)
+        '''
+        try_calling(pygadgetron.cGT_setConfigDir(self.handle, config_dir))
     def add_gadget(self, id, gadget):
         '''
         Adds a gadget to the chain.
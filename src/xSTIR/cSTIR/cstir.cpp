@@ -20,6 +20,7 @@ limitations under the License.
 */
 
 #include "sirf/iUtilities/DataHandle.h"
+#include "sirf/common/Profiler.h"
 #include "sirf/STIR/stir_types.h"
 #include "sirf/STIR/cstir_p.h"
 #include "sirf/STIR/stir_x.h"
@@ -114,6 +115,36 @@ void* cSTIR_scannerNames()
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_setProfiling(int on)
+{
+	try {
+		Profiler::instance().set_enabled(on != 0);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_resetProfiling()
+{
+	try {
+		Profiler::instance().reset();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_profile(const char* format)
+{
+	try {
+		std::string profile = Profiler::instance().report(format);
+		return charDataHandleFromCharData(profile.c_str());
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_newObject(const char* name)
 {
@@ -126,6 +157,10 @@ void* cSTIR_newObject(const char* name)
 			"PoissonLogLikelihoodWithLinearModelForMeanAndProjData"))
 			return NEW_OBJECT_HANDLE
 			(xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjData3DF);
+		if (boost::iequals(name,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return NEW_OBJECT_HANDLE
+			(xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeData3DF);
 		if (boost::iequals(name, "AcqModUsingMatrix"))
 			return NEW_OBJECT_HANDLE(AcqModUsingMatrix3DF);
 #ifdef STIR_WITH_NiftyPET_PROJECTOR
@@ -150,6 +185,8 @@ void* cSTIR_newObject(const char* name)
                   return NEW_OBJECT_HANDLE(PETSingleScatterSimulator);
                 if (boost::iequals(name, "PETScatterEstimator"))
                   return NEW_OBJECT_HANDLE(PETScatterEstimator);
+                if (boost::iequals(name, "PETSingleScatterEngine"))
+                  return NEW_OBJECT_HANDLE(PETSingleScatterEngine);
 		if (boost::iequals(name, "SeparableGaussianImageFilter"))
 			return NEW_OBJECT_HANDLE(xSTIR_SeparableGaussianImageFilter);
 		return unknownObject("object", name, __FILE__, __LINE__);
@@ -201,6 +238,11 @@ void* cSTIR_setParameter
 			return
 			cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 			(hs, name, hv);
+		else if (boost::iequals(obj,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return
+			cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+			(hs, name, hv);
 		else if (boost::iequals(obj, "Reconstruction"))
 			return cSTIR_setReconstructionParameter(hs, name, hv);
 		else if (boost::iequals(obj, "IterativeReconstruction"))
@@ -219,6 +261,8 @@ void* cSTIR_setParameter
                         return cSTIR_setScatterSimulatorParameter(hs, name, hv);
                 else if(boost::iequals(obj, "PETScatterEstimator"))
                         return cSTIR_setScatterEstimatorParameter(hs, name, hv);
+                else if(boost::iequals(obj, "PETSingleScatterEngine"))
+                        return cSTIR_setScatterEngineParameter(hs, name, hv);
 		else
 			return unknownObject("object", obj, __FILE__, __LINE__);
 	}
@@ -254,6 +298,11 @@ void* cSTIR_parameter(const void* ptr, const char* obj, const char* name)
 			return
 			cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 			(handle, name);
+		else if (boost::iequals(obj,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return
+			cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+			(handle, name);
 		else if (boost::iequals(obj, "IterativeReconstruction"))
 			return cSTIR_iterativeReconstructionParameter(handle, name);
 		else if (boost::iequals(obj, "OSMAPOSL"))
@@ -264,6 +313,8 @@ void* cSTIR_parameter(const void* ptr, const char* obj, const char* name)
 			return cSTIR_FBP2DParameter(handle, name);
                 else if(boost::iequals(obj, "PETScatterEstimator"))
                         return cSTIR_ScatterEstimatorParameter(handle, name);
+                else if(boost::iequals(obj, "PETSingleScatterEngine"))
+                        return cSTIR_ScatterEngineParameter(handle, name);
 		return unknownObject("object", obj, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -296,8 +347,13 @@ void* cSTIR_objectFromFile(const char* name, const char* filename)
             shared_ptr<PETAcquisitionData> sptr;
             if (PETAcquisitionData::storage_scheme().compare("file") == 0)
                 sptr.reset(new PETAcquisitionDataInFile(filename));
-            else
-                sptr.reset(new PETAcquisitionDataInMemory(filename));
+            else {
+                const PETAcquisitionDataInMemory& templ =
+                    dynamic_cast<const PETAcquisitionDataInMemory&>
+                    (*PETAcquisitionData::storage_template());
+                sptr.reset(new PETAcquisitionDataInMemory
+                    (filename, templ.storage_precision()));
+            }
 			return newObjectHandle(sptr);
 		}
 		if (boost::iequals(name, "ListmodeToSinograms")) {
@@ -445,6 +501,42 @@ void* cSTIR_runScatterEstimator(void* ptr_r)
     CATCH;
 }
 
+extern "C"
+void* cSTIR_setupScatterEngine(void* ptr_se, void* ptr_ad)
+{
+	try {
+		auto& se = objectFromHandle<PETSingleScatterEngine>(ptr_se);
+		SPTR_FROM_HANDLE(PETAcquisitionData, sptr_ad, ptr_ad);
+		se.set_up(sptr_ad);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_scatterEngineFwd(void* ptr_se, void* ptr_im)
+{
+	try {
+		auto& se = objectFromHandle<PETSingleScatterEngine>(ptr_se);
+		auto& id = objectFromHandle<STIRImageData>(ptr_im);
+		return newObjectHandle(se.forward(id));
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_scatterEngineFwdReplace(void* ptr_se, void* ptr_im, void* ptr_ad)
+{
+	try {
+		auto& se = objectFromHandle<PETSingleScatterEngine>(ptr_se);
+		auto& id = objectFromHandle<STIRImageData>(ptr_im);
+		auto& ad = objectFromHandle<PETAcquisitionData>(ptr_ad);
+		se.forward(ad, id);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_computeRandoms(void* ptr)
 {
@@ -522,10 +614,10 @@ extern "C"
 void* cSTIR_createPETAttenuationModel(const void* ptr_img, const void* ptr_am)
 {
 	try {
-		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_img);
+		SPTR_FROM_HANDLE(STIRImageData, sptr_id, ptr_img);
 		PETAcquisitionModel& am = objectFromHandle<PETAcquisitionModel>(ptr_am);
 		shared_ptr<PETAcquisitionSensitivityModel> 
-			sptr(new PETAttenuationModel(id, am));
+			sptr(new PETAttenuationModel(sptr_id, am));
 		return newObjectHandle(sptr);
 	}
 	CATCH;
@@ -684,6 +776,58 @@ void* cSTIR_acquisitionModelBwdReplace(void* ptr_am, void* ptr_ad,
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_acquisitionModelSubsetData(void* ptr_am, void* ptr_ad,
+	int subset_num, int num_subsets)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		shared_ptr<PETSubsetAcquisitionData> sptr_sd =
+			am.new_subset_acquisition_data(subset_num, num_subsets);
+		if (ptr_ad) {
+			PETAcquisitionData& ad = objectFromHandle<PETAcquisitionData>(ptr_ad);
+			sptr_sd->fill(ad);
+		}
+		return newObjectHandle(sptr_sd);
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_acquisitionModelFwdSubset(void* ptr_am, void* ptr_im,
+	int subset_num, int num_subsets)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_im);
+		return newObjectHandle(am.forward_subset(id, subset_num, num_subsets));
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_acquisitionModelBwdSubset(void* ptr_am, void* ptr_sd)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		PETSubsetAcquisitionData& sd = objectFromHandle<PETSubsetAcquisitionData>(ptr_sd);
+		return newObjectHandle(am.backward(sd));
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_subsetAcquisitionDataCopyTo(void* ptr_sd, void* ptr_ad)
+{
+	try {
+		PETSubsetAcquisitionData& sd = objectFromHandle<PETSubsetAcquisitionData>(ptr_sd);
+		PETAcquisitionData& ad = objectFromHandle<PETAcquisitionData>(ptr_ad);
+		sd.copy_to(ad);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cSTIR_setAcquisitionDataStorageScheme(const char* scheme)
@@ -691,6 +835,10 @@ cSTIR_setAcquisitionDataStorageScheme(const char* scheme)
 	try {
 		if (scheme[0] == 'f' || strcmp(scheme, "default") == 0)
 			PETAcquisitionDataInFile::set_as_template();
+		else if (strcmp(scheme, "memory_fp16") == 0)
+			PETAcquisitionDataInMemory::set_as_template(StoragePrecision::half);
+		else if (strcmp(scheme, "memory_bf16") == 0)
+			PETAcquisitionDataInMemory::set_as_template(StoragePrecision::bfloat16);
 		else
 			PETAcquisitionDataInMemory::set_as_template();
 		return (void*)new DataHandle;
@@ -897,6 +1045,45 @@ void* cSTIR_runFBP2DReconstruction(void* ptr_r)
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_runFBP2DReconstructionOfFrames(void* ptr_r, const void* ptr_frames)
+{
+	try {
+		DataHandle* handle = new DataHandle;
+		xSTIR_FBP2DReconstruction& recon =
+			objectFromHandle< xSTIR_FBP2DReconstruction >(ptr_r);
+		const DataHandleVector& frames = objectFromHandle<const DataHandleVector>(ptr_frames);
+		PETDynamicAcquisitionData ad;
+		for (size_t f = 0; f < frames.size(); f++) {
+			SPTR_FROM_HANDLE(PETAcquisitionData, sptr_frame, frames[f]);
+			ad.append(sptr_frame);
+		}
+		if (recon.process(ad) != Succeeded::yes) {
+			ExecutionStatus status("cSTIR_runFBP2DReconstructionOfFrames failed",
+				__FILE__, __LINE__);
+			handle->set(0, &status);
+		}
+		return (void*)handle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_FBP2DReconstructionFrame(void* ptr_r, int frame)
+{
+	try {
+		xSTIR_FBP2DReconstruction& recon =
+			objectFromHandle< xSTIR_FBP2DReconstruction >(ptr_r);
+		shared_ptr<STIRDynamicImageData> sptr_frames = recon.get_dynamic_output();
+		if (!sptr_frames.get())
+			THROW("cSTIR_FBP2DReconstructionFrame: no frames reconstructed");
+		if (frame < 0 || frame >= sptr_frames->get_num_frames())
+			THROW("cSTIR_FBP2DReconstructionFrame: frame number out of range");
+		return newObjectHandle(sptr_frames->frame_sptr(frame));
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_setupReconstruction(void* ptr_r, void* ptr_i)
 {
@@ -274,6 +274,8 @@ sirf::cSTIR_setAcquisitionModelParameter
 		SPTR_FROM_HANDLE(ImageDataProcessor, sptr_proc, hv);
 		am.set_image_data_processor(sptr_proc);
 	}
+	else if (boost::iequals(name, "memoisation"))
+		am.set_memoisation(dataFromHandle<int>(hv) != 0);
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -301,6 +303,8 @@ sirf::cSTIR_setAcqModUsingMatrixParameter
 		SPTR_FROM_HANDLE(ProjMatrixByBin, sptr_m, hv);
 		am.set_matrix(sptr_m);
 	}
+	else if (boost::iequals(name, "matrix_cache_directory"))
+		am.set_matrix_cache_directory(charDataFromHandle(hv));
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -496,6 +500,18 @@ sirf::cSTIR_setScatterEstimatorParameter
     {
         obj.set_output_prefix(charDataFromHandle(hv));
     }
+    else if (boost::iequals(name, "set_activity_image_zoom"))
+    {
+        obj.set_activity_image_zoom(dataFromHandle<float>(hv));
+    }
+    else if (boost::iequals(name, "set_OSEM_num_subsets"))
+    {
+        obj.set_OSEM_num_subsets(dataFromHandle<int>(hv));
+    }
+    else if (boost::iequals(name, "set_OSEM_num_subiterations"))
+    {
+        obj.set_OSEM_num_subiterations(dataFromHandle<int>(hv));
+    }
     else
         return parameterNotFound(name, __FILE__, __LINE__);
 
@@ -510,6 +526,43 @@ sirf::cSTIR_ScatterEstimatorParameter(DataHandle* hp, const char* name)
 		return newObjectHandle(processor.get_output());
 	if (boost::iequals(name, "num_iterations"))
           return dataHandle<int>(processor.get_num_iterations());
+	if (boost::iequals(name, "activity_image_zoom"))
+		return dataHandle<float>(processor.get_activity_image_zoom());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
+void*
+sirf::cSTIR_setScatterEngineParameter
+(const DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	PETSingleScatterEngine& obj = objectFromHandle<PETSingleScatterEngine>(hp);
+	if (boost::iequals(name, "setAttenuationImage")) {
+		SPTR_FROM_HANDLE(STIRImageData, sptr_id, hv);
+		obj.set_attenuation_image_sptr(sptr_id);
+	}
+	else if (boost::iequals(name, "attenuation_threshold"))
+		obj.set_attenuation_threshold(dataFromHandle<float>(hv));
+	else if (boost::iequals(name, "scatter_point_step"))
+		obj.set_scatter_point_step(dataFromHandle<int>(hv));
+	else if (boost::iequals(name, "low_energy_threshold"))
+		obj.set_low_energy_threshold(dataFromHandle<float>(hv));
+	else if (boost::iequals(name, "high_energy_threshold"))
+		obj.set_high_energy_threshold(dataFromHandle<float>(hv));
+	else if (boost::iequals(name, "energy_resolution"))
+		obj.set_energy_resolution(dataFromHandle<float>(hv));
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_ScatterEngineParameter(DataHandle* hp, const char* name)
+{
+	PETSingleScatterEngine& obj = objectFromHandle<PETSingleScatterEngine>(hp);
+	if (boost::iequals(name, "num_scatter_points"))
+		return dataHandle<int>((int)obj.num_scatter_points());
+	if (boost::iequals(name, "num_detectors"))
+		return dataHandle<int>((int)obj.num_detectors());
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
@@ -605,6 +658,50 @@ sirf::cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
+void*
+sirf::cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+(DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	PoissonLogLhLinModMeanListData3DF& obj_fun =
+		objectFromHandle<PoissonLogLhLinModMeanListData3DF>(hp);
+	if (boost::iequals(name, "input_filename"))
+		obj_fun.set_input_file(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "acquisition_model")) {
+		SPTR_FROM_HANDLE(AcqModUsingMatrix3DF, sptr_am, hv);
+		obj_fun.set_acquisition_model(sptr_am);
+	}
+	else if (boost::iequals(name, "max_ring_difference"))
+		obj_fun.set_max_ring_difference(dataFromHandle<int>((void*)hv));
+#if STIR_VERSION >= 050000
+	else if (boost::iequals(name, "cache_max_size"))
+		obj_fun.set_cache_max_size(dataFromHandle<int>((void*)hv));
+	else if (boost::iequals(name, "cache_path"))
+		obj_fun.set_cache_path(charDataFromDataHandle(hv));
+#endif
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+(const DataHandle* handle, const char* name)
+{
+	PoissonLogLhLinModMeanListData3DF& obj_fun =
+		objectFromHandle<PoissonLogLhLinModMeanListData3DF>(handle);
+	if (boost::iequals(name, "acquisition_model"))
+		return newObjectHandle(obj_fun.acquisition_model_sptr());
+	if (boost::iequals(name, "max_ring_difference"))
+		return dataHandle<int>(obj_fun.get_max_ring_difference());
+#if STIR_VERSION >= 050000
+	if (boost::iequals(name, "cache_max_size"))
+		return dataHandle<int>((int)obj_fun.get_cache_max_size());
+	if (boost::iequals(name, "cache_path"))
+		return charDataHandleFromCharData(obj_fun.get_cache_path().c_str());
+#endif
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
 void*
 sirf::cSTIR_setReconstructionParameter
 (DataHandle* hp, const char* name, const DataHandle* hv)
@@ -45,6 +45,9 @@ extern "C" {
 	void* cSTIR_useDefaultOMPThreads();
 	void* cSTIR_getDefaultOMPThreads();
 	void* cSTIR_scannerNames();
+	void* cSTIR_setProfiling(int on);
+	void* cSTIR_resetProfiling();
+	void* cSTIR_profile(const char* format);
 
 	// Common STIR Object methods
 	void* cSTIR_newObject(const char* name);
@@ -88,6 +91,12 @@ extern "C" {
 		int subset_num, int num_subsets);
 	void* cSTIR_acquisitionModelBwdReplace(void* ptr_am, void* ptr_ad,
 		int subset_num, int num_subsets, void* ptr_im);
+	void* cSTIR_acquisitionModelSubsetData(void* ptr_am, void* ptr_ad,
+		int subset_num, int num_subsets);
+	void* cSTIR_acquisitionModelFwdSubset(void* ptr_am, void* ptr_im,
+		int subset_num, int num_subsets);
+	void* cSTIR_acquisitionModelBwdSubset(void* ptr_am, void* ptr_sd);
+	void* cSTIR_subsetAcquisitionDataCopyTo(void* ptr_sd, void* ptr_ad);
 
 	// Acquisition data methods
 	void* cSTIR_getAcquisitionDataStorageScheme();
@@ -115,6 +124,8 @@ extern "C" {
 	// Reconstruction methods
 	void* cSTIR_setupFBP2DReconstruction(void* ptr_r, void* ptr_i);
 	void* cSTIR_runFBP2DReconstruction(void* ptr_r);
+	void* cSTIR_runFBP2DReconstructionOfFrames(void* ptr_r, const void* ptr_frames);
+	void* cSTIR_FBP2DReconstructionFrame(void* ptr_r, int frame);
 	void* cSTIR_setupReconstruction(void* ptr_r, void* ptr_i);
 	void* cSTIR_runReconstruction(void* ptr_r, void* ptr_i);
 	void* cSTIR_updateReconstruction(void* ptr_r, void* ptr_i);
@@ -124,6 +135,9 @@ extern "C" {
         void* cSTIR_setupScatterSimulator(void* ptr_am, void* ptr_ad, void* ptr_im);
         void* cSTIR_setupScatterEstimator(void* ptr_r);
         void* cSTIR_runScatterEstimator(void* ptr_r);
+        void* cSTIR_setupScatterEngine(void* ptr_se, void* ptr_ad);
+        void* cSTIR_scatterEngineFwd(void* ptr_se, void* ptr_im);
+        void* cSTIR_scatterEngineFwdReplace(void* ptr_se, void* ptr_im, void* ptr_ad);
 
 	// Objective function methods
 	void* cSTIR_setupObjectiveFunction(void* ptr_r, void* ptr_i);
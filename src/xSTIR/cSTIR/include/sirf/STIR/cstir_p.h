@@ -113,6 +113,12 @@ namespace sirf {
         void*
                 cSTIR_ScatterEstimatorParameter
                 (DataHandle* hp, const char* name);
+        void*
+                cSTIR_setScatterEngineParameter
+                (const DataHandle* hp, const char* name, const DataHandle* hv);
+        void*
+                cSTIR_ScatterEngineParameter
+                (DataHandle* hp, const char* name);
 
 	void*
 		cSTIR_setGeneralisedObjectiveFunctionParameter
@@ -130,6 +136,14 @@ namespace sirf {
 		cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 		(const DataHandle* handle, const char* name);
 
+	void*
+		cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+		(DataHandle* hp, const char* name, const DataHandle* hv);
+
+	void*
+		cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+		(const DataHandle* handle, const char* name);
+
 	void*
 		cSTIR_setReconstructionParameter
 		(DataHandle* hp, const char* name, const DataHandle* hv);
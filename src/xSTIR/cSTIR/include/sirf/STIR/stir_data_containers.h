@@ -34,9 +34,12 @@ limitations under the License.
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <exception>
+#include <memory>
+#include <vector>
 
 #include "sirf/iUtilities/LocalisedException.h"
 #include "sirf/iUtilities/DataHandle.h"
@@ -45,7 +48,17 @@ limitations under the License.
 #include "sirf/common/PETImageData.h"
 #include "sirf/STIR/stir_types.h"
 #include "sirf/common/GeometricalInfo.h"
+#include "sirf/common/HalfFloat.h"
 #include "stir/ZoomOptions.h"
+#include "stir/Bin.h"
+#include "stir/DataSymmetriesForViewSegmentNumbers.h"
+#include "stir/RelatedViewgrams.h"
+#include "stir/Sinogram.h"
+#include "stir/ViewSegmentNumbers.h"
+
+#ifdef SIRF_WITH_MPI
+#include <mpi.h>
+#endif
 
 #if STIR_VERSION < 050000
 #define SPTR_WRAP(X) X->create_shared_clone()
@@ -133,6 +146,92 @@ namespace sirf {
 		std::string _filename;
 	};
 
+	/*!
+	\ingroup PET
+	\brief STIR ProjData stored in memory as 16-bit floating point numbers.
+
+	Halves the memory taken by acquisition data that do not need the full
+	float precision, e.g. additive terms, attenuation and normalisation
+	factors. Viewgrams and sinograms are converted to float when read and
+	rounded to the nearest half or bfloat16 value when written, so that the
+	projectors and the linear algebra work in float (or double) as before.
+
+	Time-of-flight data are not supported.
+	*/
+	class ProjDataInHalfPrecision : public stir::ProjData {
+	public:
+		ProjDataInHalfPrecision(stir::shared_ptr<const stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info,
+			StoragePrecision precision = StoragePrecision::half);
+
+		StoragePrecision precision() const
+		{
+			return precision_;
+		}
+		//! the number of bytes taken by the values
+		size_t size_in_bytes() const
+		{
+			return values_.size() * sizeof(uint16_t);
+		}
+
+#if STIR_VERSION >= 060000
+		virtual stir::Viewgram<float> get_viewgram(const int view_num, const int segment_num,
+			const bool make_num_tangential_poss_odd = false, const int timing_pos = 0) const
+		{
+			return get_viewgram_(view_num, segment_num, make_num_tangential_poss_odd);
+		}
+		virtual stir::Sinogram<float> get_sinogram(const int ax_pos_num, const int segment_num,
+			const bool make_num_tangential_poss_odd = false, const int timing_pos = 0) const
+		{
+			return get_sinogram_(ax_pos_num, segment_num, make_num_tangential_poss_odd);
+		}
+#else
+		virtual stir::Viewgram<float> get_viewgram(const int view_num, const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const
+		{
+			return get_viewgram_(view_num, segment_num, make_num_tangential_poss_odd);
+		}
+		virtual stir::Sinogram<float> get_sinogram(const int ax_pos_num, const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const
+		{
+			return get_sinogram_(ax_pos_num, segment_num, make_num_tangential_poss_odd);
+		}
+#endif
+		virtual stir::Succeeded set_viewgram(const stir::Viewgram<float>& v);
+		virtual stir::Succeeded set_sinogram(const stir::Sinogram<float>& s);
+#if STIR_VERSION >= 050000
+		virtual float get_bin_value(stir::Bin& bin) const
+		{
+			return unpack_(offset_(bin.segment_num(), bin.axial_pos_num(),
+				bin.view_num(), bin.tangential_pos_num()));
+		}
+#endif
+
+	private:
+		StoragePrecision precision_;
+		std::vector<uint16_t> values_;
+		// offsets of the segments, ordered by sinogram (axial position, view, tangential position)
+		std::vector<size_t> segment_offsets_;
+
+		size_t offset_(int seg, int ax, int view, int tang) const
+		{
+			const stir::ProjDataInfo& pdi = *get_proj_data_info_sptr();
+			return segment_offsets_[seg - pdi.get_min_segment_num()] +
+				(size_t(ax - pdi.get_min_axial_pos_num(seg))*pdi.get_num_views() +
+				view - pdi.get_min_view_num())*pdi.get_num_tangential_poss() +
+				tang - pdi.get_min_tangential_pos_num();
+		}
+		float unpack_(size_t i) const
+		{
+			return precision_ == StoragePrecision::half ?
+				half_to_float(values_[i]) : bfloat16_to_float(values_[i]);
+		}
+		stir::Viewgram<float> get_viewgram_(int view_num, int segment_num,
+			bool make_num_tangential_poss_odd) const;
+		stir::Sinogram<float> get_sinogram_(int ax_pos_num, int segment_num,
+			bool make_num_tangential_poss_odd) const;
+	};
+
 	/*!
 	\ingroup PET
 	\brief STIR ProjData wrapper with added functionality.
@@ -219,19 +318,29 @@ namespace sirf {
 		}
 		void set_data(stir::shared_ptr<stir::ProjData> data)
 		{
+			mark_modified();
 			_data = data;
 		}
 
 		// data import/export
-		virtual void fill(const float v) { data()->fill(v); }
+		virtual void fill(const float v)
+		{
+			mark_modified();
+			data()->fill(v);
+		}
 		virtual void fill(const PETAcquisitionData& ad)
 		{
 			if (ad.is_empty())
 				THROW("The source of PETAcquisitionData::fill is empty");
+			mark_modified();
 			stir::shared_ptr<stir::ProjData> sptr = ad.data();
 			data()->fill(*sptr);
 		}
-		virtual void fill_from(const float* d) { data()->fill_from(d); }
+		virtual void fill_from(const float* d)
+		{
+			mark_modified();
+			data()->fill_from(d);
+		}
 		virtual void copy_to(float* d) const { data()->copy_to(d); }
 		std::unique_ptr<PETAcquisitionData> clone() const
 		{
@@ -338,6 +447,7 @@ namespace sirf {
 		}
 		virtual stir::Succeeded set_segment(const stir::SegmentBySinogram<float>& s)
 		{
+			mark_modified();
 			return data()->set_segment(s);
 		}
 		stir::shared_ptr<const stir::ExamInfo> get_exam_info_sptr() const
@@ -491,18 +601,30 @@ namespace sirf {
 	\ingroup PET
 	\brief In-memory implementation of PETAcquisitionData.
 
+	The data are stored as floats or, if the storage precision is half or
+	bfloat16, as 16-bit numbers (see ProjDataInHalfPrecision). Objects
+	created from a template have the precision of the template.
 	*/
 
 	class PETAcquisitionDataInMemory : public PETAcquisitionData {
 	public:
-		PETAcquisitionDataInMemory() {}
+		PETAcquisitionDataInMemory() : _precision(StoragePrecision::single) {}
+		explicit PETAcquisitionDataInMemory(StoragePrecision precision) :
+			_precision(precision) {}
 		PETAcquisitionDataInMemory(stir::shared_ptr<const stir::ExamInfo> sptr_exam_info,
-			stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info)
+			stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info,
+			StoragePrecision precision = StoragePrecision::single) :
+			_precision(precision)
 		{
-			_data = stir::shared_ptr<stir::ProjData>
-				(new stir::ProjDataInMemory(SPTR_WRAP(sptr_exam_info), SPTR_WRAP(sptr_proj_data_info)));
+			if (precision == StoragePrecision::single)
+				_data = stir::shared_ptr<stir::ProjData>
+					(new stir::ProjDataInMemory(SPTR_WRAP(sptr_exam_info), SPTR_WRAP(sptr_proj_data_info)));
+			else
+				_data = stir::shared_ptr<stir::ProjData>
+					(new ProjDataInHalfPrecision(sptr_exam_info, sptr_proj_data_info, precision));
 		}
-		PETAcquisitionDataInMemory(const stir::ProjData& templ)
+		PETAcquisitionDataInMemory(const stir::ProjData& templ) :
+			_precision(StoragePrecision::single)
 		{
 			_data = stir::shared_ptr<stir::ProjData>
 				(new stir::ProjDataInMemory(templ.get_exam_info_sptr(),
@@ -510,7 +632,8 @@ namespace sirf {
 		}
 		PETAcquisitionDataInMemory
 			(stir::shared_ptr<stir::ExamInfo> sptr_ei, std::string scanner_name,
-			int span = 1, int max_ring_diff = -1, int view_mash_factor = 1)
+			int span = 1, int max_ring_diff = -1, int view_mash_factor = 1) :
+			_precision(StoragePrecision::single)
 		{
 			stir::shared_ptr<stir::ProjDataInfo> sptr_pdi =
 				PETAcquisitionData::proj_data_info_from_scanner
@@ -520,7 +643,9 @@ namespace sirf {
 			_data.reset(ptr);
 		}
         /// Constructor for PETAcquisitionDataInMemory from filename
-        PETAcquisitionDataInMemory(const char* filename)
+        PETAcquisitionDataInMemory(const char* filename,
+			StoragePrecision precision = StoragePrecision::single) :
+			_precision(precision)
         {
             auto pd_sptr = stir::ProjData::read_from_file(filename);
 			bool is_empty = false;
@@ -530,7 +655,14 @@ namespace sirf {
 			catch (...) {
 				is_empty = true;
 			}
-			if (is_empty)
+			if (precision != StoragePrecision::single) {
+				_data = stir::shared_ptr<stir::ProjData>
+					(new ProjDataInHalfPrecision(pd_sptr->get_exam_info_sptr(),
+						pd_sptr->get_proj_data_info_sptr(), precision));
+				if (!is_empty)
+					_data->fill(*pd_sptr);
+			}
+			else if (is_empty)
 				_data = stir::shared_ptr<stir::ProjData>
 					(new stir::ProjDataInMemory(pd_sptr->get_exam_info_sptr(),
 						pd_sptr->get_proj_data_info_sptr()->create_shared_clone()));
@@ -543,11 +675,26 @@ namespace sirf {
 		{ 
 			PETAcquisitionDataInFile::init(); 
 		}
-		static void set_as_template()
+		/*!
+		\brief Makes the in-memory storage the default.
+
+		The storage scheme becomes "memory", "memory_fp16" or "memory_bf16"
+		depending on the precision.
+		*/
+		static void set_as_template(StoragePrecision precision = StoragePrecision::single)
 		{
 			init();
-			_storage_scheme = "memory";
-			_template.reset(new PETAcquisitionDataInMemory);
+			if (precision == StoragePrecision::half)
+				_storage_scheme = "memory_fp16";
+			else if (precision == StoragePrecision::bfloat16)
+				_storage_scheme = "memory_bf16";
+			else
+				_storage_scheme = "memory";
+			_template.reset(new PETAcquisitionDataInMemory(precision));
+		}
+		StoragePrecision storage_precision() const
+		{
+			return _precision;
 		}
 
 		virtual PETAcquisitionData* same_acquisition_data
@@ -555,7 +702,7 @@ namespace sirf {
 			stir::shared_ptr<stir::ProjDataInfo> sptr_proj_data_info) const
 		{
 			PETAcquisitionData* ptr_ad =
-				new PETAcquisitionDataInMemory(sptr_exam_info, sptr_proj_data_info);
+				new PETAcquisitionDataInMemory(sptr_exam_info, sptr_proj_data_info, _precision);
 			return ptr_ad;
 		}
 		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
@@ -584,6 +731,7 @@ namespace sirf {
                 return this->PETAcquisitionData::fill(v);
 
             // do it
+            mark_modified();
             auto iter = pd_ptr->begin();
             while (iter != pd_ptr->end())
                 *iter++ = v;
@@ -599,6 +747,7 @@ namespace sirf {
                 return this->PETAcquisitionData::fill(ad);
 
             // do it
+            mark_modified();
             auto iter = pd_ptr->begin();
             auto iter_other = pd2_ptr->begin();
             while (iter != pd_ptr->end())
@@ -613,6 +762,7 @@ namespace sirf {
                 return this->PETAcquisitionData::fill_from(d);
 
             // do it
+            mark_modified();
             auto iter = pd_ptr->begin();
             while (iter != pd_ptr->end())
                 *iter++ = *d++;
@@ -678,10 +828,11 @@ namespace sirf {
             auto *pd_y_ptr = dynamic_cast<const stir::ProjDataInMemory*>(a_y->data().get());
 
             // If either cast failed, fall back to general method
-            if (is_null_ptr(pd_ptr) || is_null_ptr(pd_x_ptr) || is_null_ptr(pd_x_ptr))
+            if (is_null_ptr(pd_ptr) || is_null_ptr(pd_x_ptr) || is_null_ptr(pd_y_ptr))
                 return this->PETAcquisitionData::multiply(x,y);
 
             // do it
+            mark_modified();
             auto iter = pd_ptr->begin();
             auto iter_x = pd_x_ptr->begin();
             auto iter_y = pd_y_ptr->begin();
@@ -700,10 +851,11 @@ namespace sirf {
             auto *pd_y_ptr = dynamic_cast<const stir::ProjDataInMemory*>(a_y->data().get());
 
             // If either cast failed, fall back to general method
-            if (is_null_ptr(pd_ptr) || is_null_ptr(pd_x_ptr) || is_null_ptr(pd_x_ptr))
+            if (is_null_ptr(pd_ptr) || is_null_ptr(pd_x_ptr) || is_null_ptr(pd_y_ptr))
                 return this->PETAcquisitionData::divide(x,y);
 
             // do it
+            mark_modified();
             auto iter = pd_ptr->begin();
             auto iter_x = pd_x_ptr->begin();
             auto iter_y = pd_y_ptr->begin();
@@ -712,6 +864,7 @@ namespace sirf {
         }
 
 	private:
+		StoragePrecision _precision;
 		virtual PETAcquisitionDataInMemory* clone_impl() const
 		{
 			init();
@@ -719,6 +872,239 @@ namespace sirf {
 		}
 	};
 
+	/*!
+	\ingroup PET
+	\brief Acquisition data restricted to the views of one subset.
+
+	Stores (in memory) only the viewgrams of the given subset, i.e. those
+	related by the symmetries of a projector to the basic view-segment
+	numbers \c vs with <tt>vs.view_num() % num_subsets == subset_num</tt>.
+	These are the viewgrams computed by PETAcquisitionModel::forward with the same
+	subset, so the memory used and the data moved are proportional to the
+	subset size rather than to the size of the whole scan.
+
+	The data are ordered by related viewgrams, see get_related_viewgrams().
+	Objects with the same subset and symmetries have the same layout, and linear
+	algebra operations between them are performed on the stored values directly.
+	*/
+	class PETSubsetAcquisitionData : public DataContainer {
+	public:
+		PETSubsetAcquisitionData(stir::shared_ptr<const stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info,
+			stir::shared_ptr<stir::DataSymmetriesForViewSegmentNumbers> sptr_symmetries,
+			int subset_num, int num_subsets);
+
+		//! new object with the same subset and layout, filled with zeros
+		stir::shared_ptr<PETSubsetAcquisitionData> new_subset_acquisition_data() const
+		{
+			return stir::shared_ptr<PETSubsetAcquisitionData>
+				(new PETSubsetAcquisitionData(*this, false));
+		}
+		std::unique_ptr<PETSubsetAcquisitionData> clone() const
+		{
+			return std::unique_ptr<PETSubsetAcquisitionData>(clone_impl());
+		}
+
+		int subset_num() const { return subset_num_; }
+		int num_subsets() const { return num_subsets_; }
+		stir::shared_ptr<const stir::ExamInfo> get_exam_info_sptr() const
+		{
+			return sptr_exam_info_;
+		}
+		stir::shared_ptr<const stir::ProjDataInfo> get_proj_data_info_sptr() const
+		{
+			return sptr_proj_data_info_;
+		}
+		stir::shared_ptr<stir::DataSymmetriesForViewSegmentNumbers> symmetries_sptr() const
+		{
+			return sptr_symmetries_;
+		}
+		//! number of stored values
+		size_t size() const { return data_.size(); }
+		float* data() { return data_.data(); }
+		const float* data() const { return data_.data(); }
+
+		//! number of groups of related viewgrams
+		int get_num_related_viewgrams() const { return (int)basic_vs_.size(); }
+		//! basic view-segment numbers of the groups of related viewgrams
+		const std::vector<stir::ViewSegmentNumbers>& basic_view_segment_numbers() const
+		{
+			return basic_vs_;
+		}
+		//! copy of the i-th group of related viewgrams
+		stir::RelatedViewgrams<float> get_related_viewgrams(int i) const;
+		//! replace the i-th group of related viewgrams
+		void set_related_viewgrams(int i, const stir::RelatedViewgrams<float>& viewgrams);
+
+		void fill(const float v)
+		{
+			mark_modified();
+			std::fill(data_.begin(), data_.end(), v);
+		}
+		//! copy the subset views of full acquisition data
+		void fill(const PETAcquisitionData& ad);
+		//! copy into the subset views of full acquisition data (other views are not changed)
+		void copy_to(PETAcquisitionData& ad) const;
+		void copy_to(stir::ProjData& pd) const;
+
+		// data container methods
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			return new ObjectHandle<DataContainer>
+				(stir::shared_ptr<DataContainer>(new PETSubsetAcquisitionData(*this, false)));
+		}
+		virtual unsigned int items() const { return 1; }
+		virtual bool is_complex() const { return false; }
+		virtual float norm() const;
+		virtual void dot(const DataContainer& a_x, void* ptr) const;
+		virtual void axpby(
+			const void* ptr_a, const DataContainer& a_x,
+			const void* ptr_b, const DataContainer& a_y)
+		{
+			xapyb(a_x, ptr_a, a_y, ptr_b);
+		}
+		virtual void xapyb(
+			const DataContainer& a_x, const void* ptr_a,
+			const DataContainer& a_y, const void* ptr_b);
+		virtual void xapyb(
+			const DataContainer& a_x, const DataContainer& a_a,
+			const DataContainer& a_y, const DataContainer& a_b);
+		virtual void multiply(const DataContainer& x, const DataContainer& y)
+		{
+			binary_op_(x, y, 1);
+		}
+		virtual void divide(const DataContainer& x, const DataContainer& y)
+		{
+			binary_op_(x, y, 2);
+		}
+		virtual void maximum(const DataContainer& x, const DataContainer& y)
+		{
+			binary_op_(x, y, 3);
+		}
+		virtual void minimum(const DataContainer& x, const DataContainer& y)
+		{
+			binary_op_(x, y, 4);
+		}
+		//! writes full-size acquisition data, with zeros outside the subset
+		virtual void write(const std::string &filename) const;
+
+	protected:
+		PETSubsetAcquisitionData(const PETSubsetAcquisitionData& other, bool copy_data) :
+			sptr_exam_info_(other.sptr_exam_info_),
+			sptr_proj_data_info_(other.sptr_proj_data_info_),
+			sptr_symmetries_(other.sptr_symmetries_),
+			subset_num_(other.subset_num_), num_subsets_(other.num_subsets_),
+			basic_vs_(other.basic_vs_), related_vs_(other.related_vs_),
+			offsets_(other.offsets_)
+		{
+			if (copy_data)
+				data_ = other.data_;
+			else
+				data_.assign(other.data_.size(), 0.0f);
+		}
+		virtual PETSubsetAcquisitionData* clone_impl() const
+		{
+			return new PETSubsetAcquisitionData(*this, true);
+		}
+		const PETSubsetAcquisitionData& same_layout_(const DataContainer& a_x) const;
+
+	private:
+		stir::shared_ptr<const stir::ExamInfo> sptr_exam_info_;
+		stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info_;
+		stir::shared_ptr<stir::DataSymmetriesForViewSegmentNumbers> sptr_symmetries_;
+		int subset_num_;
+		int num_subsets_;
+		std::vector<stir::ViewSegmentNumbers> basic_vs_;
+		// view-segment numbers of the viewgrams in each group, in RelatedViewgrams order
+		std::vector<std::vector<stir::ViewSegmentNumbers> > related_vs_;
+		// offsets of the groups in data_ (one more than the number of groups)
+		std::vector<size_t> offsets_;
+		std::vector<float> data_;
+
+		void binary_op_(const DataContainer& a_x, const DataContainer& a_y, int job);
+	};
+
+#ifdef SIRF_WITH_MPI
+	/*!
+	\ingroup PET
+	\brief Acquisition data distributed across the processes of an MPI communicator.
+
+	Each process stores the groups of related viewgrams of the subset whose
+	number is the process rank, the number of subsets being the number of
+	processes, so that the views of every segment are shared out evenly.
+	Together the processes hold all of the acquisition data.
+
+	The element-wise algebra is done by each process on its part of the data,
+	norm() and dot() add up the contributions of all processes, so all
+	processes get the same value and must call them together, as they must
+	write(), in which each process writes its part of the file in turn.
+
+	TOF data are not supported (as for PETSubsetAcquisitionData).
+	*/
+	class PETDistributedAcquisitionData : public PETSubsetAcquisitionData {
+	public:
+		PETDistributedAcquisitionData(stir::shared_ptr<const stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<const stir::ProjDataInfo> sptr_proj_data_info,
+			stir::shared_ptr<stir::DataSymmetriesForViewSegmentNumbers> sptr_symmetries,
+			MPI_Comm comm = MPI_COMM_WORLD) :
+			PETSubsetAcquisitionData(sptr_exam_info, sptr_proj_data_info,
+				sptr_symmetries, comm_rank_(comm), comm_size_(comm)),
+			comm_(comm)
+		{}
+
+		//! new object with the same distribution, filled with zeros
+		stir::shared_ptr<PETDistributedAcquisitionData>
+			new_distributed_acquisition_data() const
+		{
+			return stir::shared_ptr<PETDistributedAcquisitionData>
+				(new PETDistributedAcquisitionData(*this, false));
+		}
+		std::unique_ptr<PETDistributedAcquisitionData> clone() const
+		{
+			return std::unique_ptr<PETDistributedAcquisitionData>(clone_impl());
+		}
+
+		MPI_Comm communicator() const { return comm_; }
+
+		// data container methods
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			return new ObjectHandle<DataContainer>
+				(stir::shared_ptr<DataContainer>(new PETDistributedAcquisitionData(*this, false)));
+		}
+		virtual float norm() const;
+		virtual void dot(const DataContainer& a_x, void* ptr) const;
+		//! writes the data in Interfile format, each process writing its viewgrams
+		virtual void write(const std::string &filename) const;
+
+	protected:
+		PETDistributedAcquisitionData(const PETDistributedAcquisitionData& other,
+			bool copy_data) :
+			PETSubsetAcquisitionData(other, copy_data), comm_(other.comm_)
+		{}
+		virtual PETDistributedAcquisitionData* clone_impl() const
+		{
+			return new PETDistributedAcquisitionData(*this, true);
+		}
+
+	private:
+		MPI_Comm comm_;
+
+		static int comm_rank_(MPI_Comm comm)
+		{
+			int rank;
+			MPI_Comm_rank(comm, &rank);
+			return rank;
+		}
+		static int comm_size_(MPI_Comm comm)
+		{
+			int size;
+			MPI_Comm_size(comm, &size);
+			return size;
+		}
+	};
+#endif
+
 	/*!
 	\ingroup PET
 	\brief STIR DiscretisedDensity<3, float> wrapper with added functionality.
@@ -945,6 +1331,15 @@ namespace sirf {
 		{
 			return *_data;
 		}
+		// voxel values if the rows of the image are stored contiguously, else 0
+		virtual const float* contiguous_float_data() const;
+		virtual float* contiguous_float_data()
+		{
+			const float* ptr = static_cast<const STIRImageData&>(*this).contiguous_float_data();
+			if (ptr)
+				mark_modified();
+			return const_cast<float*>(ptr);
+		}
 		Image3DF* data_ptr()
 		{
 			return _data.get();
@@ -963,11 +1358,13 @@ namespace sirf {
 		}
 		void set_data_sptr(stir::shared_ptr<Image3DF> sptr_data)
 		{
+			mark_modified();
 			_data = sptr_data;
 		}
 
 		void fill(float v)
 		{
+			mark_modified();
 			_data->fill(v);
 		}
 		void scale(float s);
@@ -1067,6 +1464,262 @@ namespace sirf {
 		mutable stir::shared_ptr<Iterator_const> _end_const;
 	};
 
+	/*!
+	\ingroup PET
+	\brief Stack of frames of the same geometry (base of the dynamic containers).
+
+	The linear algebra operations are performed frame by frame.
+	*/
+	template<class Frame>
+	class PETDynamicData : public DataContainer {
+	public:
+		typedef Frame FrameType;
+
+		int get_num_frames() const { return (int)frames_.size(); }
+		//! (modifying a frame via this reference does not change the version of the stack)
+		Frame& frame(int i) { return *frames_.at(i); }
+		const Frame& frame(int i) const { return *frames_.at(i); }
+		stir::shared_ptr<Frame> frame_sptr(int i) { return frames_.at(i); }
+		stir::shared_ptr<const Frame> frame_sptr(int i) const { return frames_.at(i); }
+
+		virtual unsigned int items() const
+		{
+			return (unsigned int)frames_.size();
+		}
+		virtual bool is_complex() const
+		{
+			return false;
+		}
+		virtual float norm() const
+		{
+			double t = 0;
+			for (size_t i = 0; i < frames_.size(); i++) {
+				double r = frames_[i]->norm();
+				t += r*r;
+			}
+			return (float)std::sqrt(t);
+		}
+		virtual void dot(const DataContainer& a_x, void* ptr) const
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			double t = 0;
+			for (size_t i = 0; i < frames_.size(); i++) {
+				float s;
+				frames_[i]->dot(*x.frames_[i], &s);
+				t += s;
+			}
+			float* ptr_t = (float*)ptr;
+			*ptr_t = (float)t;
+		}
+		virtual void axpby(
+			const void* ptr_a, const DataContainer& a_x,
+			const void* ptr_b, const DataContainer& a_y)
+		{
+			xapyb(a_x, ptr_a, a_y, ptr_b);
+		}
+		virtual void xapyb(
+			const DataContainer& a_x, const void* ptr_a,
+			const DataContainer& a_y, const void* ptr_b)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& y = same_frames_(a_y);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->xapyb(*x.frames_[i], ptr_a, *y.frames_[i], ptr_b);
+		}
+		virtual void xapyb(
+			const DataContainer& a_x, const DataContainer& a_a,
+			const DataContainer& a_y, const DataContainer& a_b)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& a = same_frames_(a_a);
+			const PETDynamicData& y = same_frames_(a_y);
+			const PETDynamicData& b = same_frames_(a_b);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->xapyb(*x.frames_[i], *a.frames_[i], *y.frames_[i], *b.frames_[i]);
+		}
+		virtual void multiply(const DataContainer& a_x, const DataContainer& a_y)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& y = same_frames_(a_y);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->multiply(*x.frames_[i], *y.frames_[i]);
+		}
+		virtual void divide(const DataContainer& a_x, const DataContainer& a_y)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& y = same_frames_(a_y);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->divide(*x.frames_[i], *y.frames_[i]);
+		}
+		virtual void maximum(const DataContainer& a_x, const DataContainer& a_y)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& y = same_frames_(a_y);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->maximum(*x.frames_[i], *y.frames_[i]);
+		}
+		virtual void minimum(const DataContainer& a_x, const DataContainer& a_y)
+		{
+			const PETDynamicData& x = same_frames_(a_x);
+			const PETDynamicData& y = same_frames_(a_y);
+			mark_modified();
+			for (size_t i = 0; i < frames_.size(); i++)
+				frames_[i]->minimum(*x.frames_[i], *y.frames_[i]);
+		}
+		//! writes the frames to files <prefix>_f<frame number>.<extension>
+		virtual void write(const std::string &filename) const
+		{
+			std::string prefix = filename;
+			std::string ext;
+			size_t i = filename.find_last_of('.');
+			if (i != std::string::npos && filename.find_first_of("/\\", i) == std::string::npos) {
+				prefix = filename.substr(0, i);
+				ext = filename.substr(i);
+			}
+			for (size_t f = 0; f < frames_.size(); f++)
+				frames_[f]->write(prefix + "_f" + std::to_string(f) + ext);
+		}
+
+	protected:
+		std::vector<stir::shared_ptr<Frame> > frames_;
+
+		const PETDynamicData& same_frames_(const DataContainer& a_x) const
+		{
+			const PETDynamicData& x = dynamic_cast<const PETDynamicData&>(a_x);
+			if (x.frames_.size() != frames_.size())
+				THROW("PETDynamicData: numbers of frames differ");
+			return x;
+		}
+	};
+
+	/*!
+	\ingroup PET
+	\brief Dynamic (multi-frame) PET acquisition data.
+
+	All frames share one ProjDataInfo, so that a PETAcquisitionModel set up once
+	projects all of them (see PETAcquisitionModel::forward(PETDynamicAcquisitionData&,
+	const STIRDynamicImageData&, bool)).
+	*/
+	class PETDynamicAcquisitionData : public PETDynamicData<PETAcquisitionData> {
+	public:
+		PETDynamicAcquisitionData() {}
+		//! creates num_frames frames of the geometry of templ, using the current storage scheme
+		PETDynamicAcquisitionData(const PETAcquisitionData& templ, int num_frames)
+		{
+			stir::shared_ptr<stir::ProjDataInfo> sptr_pdi =
+				templ.get_proj_data_info_sptr()->create_shared_clone();
+			PETAcquisitionDataInFile::init();
+			for (int i = 0; i < num_frames; i++)
+				frames_.push_back(stir::shared_ptr<PETAcquisitionData>
+					(PETAcquisitionData::storage_template()->same_acquisition_data
+					(templ.get_exam_info_sptr(), sptr_pdi)));
+		}
+		//! appends a frame, which must have the same geometry as the existing ones
+		void append(stir::shared_ptr<PETAcquisitionData> sptr_frame)
+		{
+			if (!frames_.empty() && *sptr_frame->get_proj_data_info_sptr() !=
+				*frames_[0]->get_proj_data_info_sptr())
+				THROW("PETDynamicAcquisitionData::append: frame geometry differs");
+			frames_.push_back(sptr_frame);
+		}
+		stir::shared_ptr<const stir::ProjDataInfo> get_proj_data_info_sptr() const
+		{
+			if (frames_.empty())
+				THROW("PETDynamicAcquisitionData: no frames");
+			return frames_[0]->get_proj_data_info_sptr();
+		}
+		stir::shared_ptr<PETDynamicAcquisitionData> new_dynamic_acquisition_data() const
+		{
+			return stir::shared_ptr<PETDynamicAcquisitionData>(same_frames_data_());
+		}
+		std::unique_ptr<PETDynamicAcquisitionData> clone() const
+		{
+			return std::unique_ptr<PETDynamicAcquisitionData>(clone_impl());
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			return new ObjectHandle<DataContainer>
+				(stir::shared_ptr<DataContainer>(same_frames_data_()));
+		}
+
+	protected:
+		PETDynamicAcquisitionData* same_frames_data_() const
+		{
+			PETDynamicAcquisitionData* ptr = new PETDynamicAcquisitionData;
+			for (size_t i = 0; i < frames_.size(); i++)
+				ptr->frames_.push_back(frames_[i]->new_acquisition_data());
+			return ptr;
+		}
+		virtual PETDynamicAcquisitionData* clone_impl() const
+		{
+			PETDynamicAcquisitionData* ptr = new PETDynamicAcquisitionData;
+			for (size_t i = 0; i < frames_.size(); i++)
+				ptr->frames_.push_back(stir::shared_ptr<PETAcquisitionData>
+					(frames_[i]->clone().release()));
+			return ptr;
+		}
+	};
+
+	/*!
+	\ingroup PET
+	\brief Dynamic (multi-frame) PET image data.
+
+	All frames have the same geometry.
+	*/
+	class STIRDynamicImageData : public PETDynamicData<STIRImageData> {
+	public:
+		STIRDynamicImageData() {}
+		//! creates num_frames zero frames of the geometry of templ
+		STIRDynamicImageData(const STIRImageData& templ, int num_frames)
+		{
+			for (int i = 0; i < num_frames; i++) {
+				frames_.push_back(stir::shared_ptr<STIRImageData>(templ.same_image_data()));
+				frames_.back()->fill(0.0f);
+			}
+		}
+		//! appends a frame, which must have the same geometry as the existing ones
+		void append(stir::shared_ptr<STIRImageData> sptr_frame)
+		{
+			if (!frames_.empty() && !frames_[0]->data().has_same_characteristics(sptr_frame->data()))
+				THROW("STIRDynamicImageData::append: frame geometry differs");
+			frames_.push_back(sptr_frame);
+		}
+		stir::shared_ptr<STIRDynamicImageData> new_dynamic_image_data() const
+		{
+			return stir::shared_ptr<STIRDynamicImageData>(same_frames_data_());
+		}
+		std::unique_ptr<STIRDynamicImageData> clone() const
+		{
+			return std::unique_ptr<STIRDynamicImageData>(clone_impl());
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			return new ObjectHandle<DataContainer>
+				(stir::shared_ptr<DataContainer>(same_frames_data_()));
+		}
+
+	protected:
+		STIRDynamicImageData* same_frames_data_() const
+		{
+			STIRDynamicImageData* ptr = new STIRDynamicImageData;
+			for (size_t i = 0; i < frames_.size(); i++)
+				ptr->frames_.push_back(stir::shared_ptr<STIRImageData>(frames_[i]->same_image_data()));
+			return ptr;
+		}
+		virtual STIRDynamicImageData* clone_impl() const
+		{
+			STIRDynamicImageData* ptr = new STIRDynamicImageData;
+			for (size_t i = 0; i < frames_.size(); i++)
+				ptr->frames_.push_back(stir::shared_ptr<STIRImageData>(frames_[i]->clone().release()));
+			return ptr;
+		}
+	};
+
 }  // namespace sirf
 
 #endif
@@ -53,6 +53,7 @@ limitations under the License.
 #include "stir/recon_buildblock/BinNormalisationFromECAT8.h"
 #include "stir/recon_buildblock/BinNormalisationFromProjData.h"
 #include "stir/recon_buildblock/ChainedBinNormalisation.h"
+#include "stir/recon_buildblock/TrivialBinNormalisation.h"
 #include "stir/recon_buildblock/PLSPrior.h"
 #include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndProjData.h"
 #include "stir/recon_buildblock/ProjectorByBinPairUsingProjMatrixByBin.h"
@@ -34,11 +34,16 @@ limitations under the License.
 */
 
 #include <cmath>
+#include <map>
 #include <stdlib.h>
+#include <utility>
+#include <vector>
 
 #include "sirf/STIR/stir_data_containers.h"
 #include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndProjData.h"
+#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin.h"
 #include "sirf/common/JacobiCG.h"
+#include "sirf/common/OperatorMemo.h"
 
 #define MIN_BIN_EFFICIENCY 1.0e-20f
 //#define MIN_BIN_EFFICIENCY 1.0e-6f
@@ -258,6 +263,8 @@ The actual algorithm is described in
 		virtual void unnormalise(PETAcquisitionData& ad) const;
 		// divide by bin efficiencies
 		virtual void normalise(PETAcquisitionData& ad) const;
+		// multiply subset data by bin efficiencies
+		void unnormalise(PETSubsetAcquisitionData& ad) const;
 		// same as apply, but returns new data rather than changes old one
 		stir::shared_ptr<PETAcquisitionData> forward(PETAcquisitionData& ad) const
 		{
@@ -280,6 +287,12 @@ The actual algorithm is described in
 			return norm_;
 			//return std::dynamic_pointer_cast<stir::BinNormalisation>(norm_);
 		}
+		/* version of the data the model refers to and that can be modified
+		in place (see DataContainer::version()), 0 if there are none */
+		virtual uint64_t data_version() const
+		{
+			return 0;
+		}
 
 	protected:
 		stir::shared_ptr<stir::BinNormalisation> norm_;
@@ -374,27 +387,48 @@ The actual algorithm is described in
 			int num_sub_ = 1;
 		};
 
-		float norm(int subset_num = 0, int num_subsets = 1) const
-		{
-			BFOperator bf(*this);
-			bf.set_subset(subset_num);
-			bf.set_num_subsets(num_subsets);
-			JacobiCG<float> jcg;
-			jcg.set_num_iterations(2);
-			STIRImageData image_data = *sptr_image_template_->clone();
-			image_data.fill(1.0);
-			float lmd = jcg.largest(bf, image_data);
-			return std::sqrt(lmd);
-		}
+		/*! \brief Returns the norm of the linear part of the model for a subset.
+
+		The norm is estimated by JacobiCG and cached, together with the eigenvector
+		estimate, for each subset. Once the model changes (set_up, projectors,
+		image data processor, sensitivity model) or the templates or the data of
+		the sensitivity model are modified (see DataContainer::version()), the norm
+		is recomputed with the cached eigenvector as the initial guess.
+		*/
+		float norm(int subset_num = 0, int num_subsets = 1) const;
+		/*! \brief Returns the norms of the linear part of the model for all subsets.
+
+		The eigenvalue problems of the subsets are iterated on together (each
+		subset is still projected separately), sharing the cache with
+		norm(subset_num, num_subsets).
+		*/
+		std::vector<float> subset_norms(int num_subsets) const;
 
 		void set_projectors(stir::shared_ptr<stir::ProjectorByBinPair> sptr_projectors)
 		{
 			sptr_projectors_ = sptr_projectors;
+			invalidate_caches();
 		}
 		const stir::shared_ptr<stir::ProjectorByBinPair> projectors_sptr() const
 		{
 			return sptr_projectors_;
 		}
+		/*! \brief switches memoisation of forward and back projections on or off
+
+		If on, the last forward projection of full data and the last back projection
+		are remembered and reused if called again for the same unmodified image or
+		acquisition data (see DataContainer::version()) and the same subset.
+		Off by default.
+		*/
+		void set_memoisation(bool memoise)
+		{
+			fwd_memo_.set_enabled(memoise);
+			bwd_memo_.set_enabled(memoise);
+		}
+		bool memoisation() const
+		{
+			return fwd_memo_.enabled();
+		}
 		void set_additive_term(stir::shared_ptr<PETAcquisitionData> sptr)
 		{
 			sptr_add_ = sptr;
@@ -440,6 +474,7 @@ The actual algorithm is described in
 		{
 			//sptr_normalisation_ = sptr_asm->data();
 			sptr_asm_ = sptr_asm;
+			invalidate_caches();
 		}
 
 		//! sets data processor to use on the image before forward projection and after back projection
@@ -457,6 +492,7 @@ The actual algorithm is described in
 		void cancel_normalisation()
 		{
 			sptr_asm_.reset();
+			invalidate_caches();
 			//sptr_normalisation_.reset();
 		}
 		stir::shared_ptr<const PETAcquisitionModel> linear_acq_mod_sptr() const
@@ -466,6 +502,7 @@ The actual algorithm is described in
 			sptr_am->set_asm(sptr_asm_);
 			sptr_am->sptr_acq_template_ = sptr_acq_template_;
 			sptr_am->sptr_image_template_ = sptr_image_template_;
+			sptr_am->sptr_image_processor_ = sptr_image_processor_;
 			return sptr_am;
 		}
 
@@ -499,6 +536,60 @@ The actual algorithm is described in
 		void backward(STIRImageData& image, PETAcquisitionData& ad,
 			int subset_num = 0, int num_subsets = 1) const;
 
+		/*! \brief creates zero acquisition data storing only the views of a subset
+
+		The views are those forward-projected by
+		forward(const STIRImageData&, int, int, bool) with the same subset.
+		*/
+		stir::shared_ptr<PETSubsetAcquisitionData>
+			new_subset_acquisition_data(int subset_num, int num_subsets) const;
+		//! computes and returns a subset of forward-projected data, storing only its views
+		stir::shared_ptr<PETSubsetAcquisitionData>
+			forward_subset(const STIRImageData& image,
+			int subset_num, int num_subsets, bool do_linear_only = false) const;
+		//! replaces subset data with forward-projected data
+		void forward(PETSubsetAcquisitionData& acq_data, const STIRImageData& image,
+			bool do_linear_only = false) const;
+		// computes and returns back-projected subset data
+		stir::shared_ptr<STIRImageData> backward(const PETSubsetAcquisitionData& ad) const;
+		// puts back-projected subset data into image
+		void backward(STIRImageData& image, const PETSubsetAcquisitionData& ad) const;
+#ifdef SIRF_WITH_MPI
+		/*! \brief creates zero acquisition data distributed across the processes of comm
+
+		Each process stores the views it forward-projects, the image being
+		the same in all processes.
+		*/
+		stir::shared_ptr<PETDistributedAcquisitionData>
+			new_distributed_acquisition_data(MPI_Comm comm = MPI_COMM_WORLD) const;
+		//! computes and returns the distributed forward projection (all processes call it)
+		stir::shared_ptr<PETDistributedAcquisitionData>
+			forward_distributed(const STIRImageData& image,
+			MPI_Comm comm = MPI_COMM_WORLD, bool do_linear_only = false) const;
+		// computes and returns the back projection of distributed data
+		stir::shared_ptr<STIRImageData> backward(const PETDistributedAcquisitionData& ad) const;
+		/*! \brief puts the back projection of distributed data into image
+
+		The back projections of the parts of the data are added up across
+		the processes, so all processes get the full back projection.
+		*/
+		void backward(STIRImageData& image, const PETDistributedAcquisitionData& ad) const;
+#endif
+
+		/*! \brief computes and returns the forward projections of all frames
+
+		All frames must have the geometry of the image template the model was set up with.
+		*/
+		stir::shared_ptr<PETDynamicAcquisitionData>
+			forward(const STIRDynamicImageData& image, bool do_linear_only = false) const;
+		//! replaces the frames of acquisition data with the forward projections of the image frames
+		void forward(PETDynamicAcquisitionData& acq_data, const STIRDynamicImageData& image,
+			bool do_linear_only = false) const;
+		// computes and returns the back projections of all frames
+		stir::shared_ptr<STIRDynamicImageData> backward(const PETDynamicAcquisitionData& ad) const;
+		// puts the back projections of all frames into the image frames
+		void backward(STIRDynamicImageData& image, const PETDynamicAcquisitionData& ad) const;
+
 	protected:
 		stir::shared_ptr<stir::ProjectorByBinPair> sptr_projectors_;
 		stir::shared_ptr<PETAcquisitionData> sptr_acq_template_;
@@ -507,6 +598,49 @@ The actual algorithm is described in
 		stir::shared_ptr<PETAcquisitionData> sptr_background_;
 		stir::shared_ptr<PETAcquisitionSensitivityModel> sptr_asm_;
 		//shared_ptr<stir::BinNormalisation> sptr_normalisation_;
+		stir::shared_ptr<ImageDataProcessor> sptr_image_processor_;
+
+		// adds the additive and background terms and applies the sensitivity model
+		void apply_constant_terms_(PETAcquisitionData& ad, bool do_linear_only) const;
+		/* forward/back projection of all frames (with the image data processor applied);
+		the default projects them one by one */
+		virtual void forward_project_frames_(PETDynamicAcquisitionData& ad,
+			const STIRDynamicImageData& image) const;
+		virtual void back_project_frames_(STIRDynamicImageData& image,
+			const PETDynamicAcquisitionData& ad) const;
+
+		/* marks the cached norms as out of date (eigenvectors are kept as initial guesses)
+		and forgets the memoised projections */
+		void invalidate_caches() const
+		{
+			for (auto& entry : norm_cache_)
+				entry.second.valid = false;
+			fwd_memo_.clear();
+			bwd_memo_.clear();
+		}
+
+	private:
+		struct NormCacheEntry {
+			float norm = 0;
+			bool valid = false;
+			// versions of the data the norm was computed for (see norm_versions_)
+			std::vector<uint64_t> versions;
+			stir::shared_ptr<STIRImageData> sptr_eigenvector;
+		};
+		// cached norms, keyed on (subset_num, num_subsets)
+		mutable std::map<std::pair<int, int>, NormCacheEntry> norm_cache_;
+		// returns the cached eigenvector estimate if it matches the image template, else an image of ones
+		stir::shared_ptr<STIRImageData> norm_initial_guess_(const NormCacheEntry& entry) const;
+		// versions of the templates and of the sensitivity model data
+		std::vector<uint64_t> norm_versions_() const;
+		// whether the cached norm is valid and was computed for the current data
+		bool norm_cached_(const NormCacheEntry& entry) const
+		{
+			return entry.valid && entry.versions == norm_versions_();
+		}
+		// last forward and back projections (if memoisation is on)
+		mutable OperatorMemo<PETAcquisitionData> fwd_memo_;
+		mutable OperatorMemo<STIRImageData> bwd_memo_;
 	};
 
         /*!
@@ -632,6 +766,7 @@ The actual algorithm is described in
           filter_sptr->set_fwhms(stir::make_coordinate(15.F,15.F,15.F));
           recon_sptr->set_post_processor_sptr(filter_sptr);
           stir::ScatterEstimation::set_reconstruction_method_sptr(recon_sptr);
+          sptr_osem_ = recon_sptr;
         }
         //! Overloaded constructor which takes the parameter file
         PETScatterEstimator(std::string filename) :
@@ -693,6 +828,28 @@ The actual algorithm is described in
           return stir::ScatterEstimation::get_num_iterations();
         }
 
+        //! Set the zoom of the activity image reconstructed at each iteration (default 0.2)
+        void set_activity_image_zoom(float zoom)
+        {
+          if (zoom <= 0)
+            THROW("PETScatterEstimator::set_activity_image_zoom: zoom must be positive");
+          zoom_ = zoom;
+        }
+        float get_activity_image_zoom() const
+        {
+          return zoom_;
+        }
+        //! Set the numbers of subsets and subiterations of the default OSEM reconstruction
+        /*! Not available if the estimator was created from a parameter file. */
+        void set_OSEM_num_subsets(int num_subsets)
+        {
+          osem_().set_num_subsets(num_subsets);
+        }
+        void set_OSEM_num_subiterations(int num_subiterations)
+        {
+          osem_().set_num_subiterations(num_subiterations);
+        }
+
         stir::shared_ptr<PETAcquisitionData> get_scatter_estimate(int est_num = -1) const
         {
             if (est_num == -1) // Get the last one
@@ -729,11 +886,10 @@ The actual algorithm is described in
         Succeeded set_up()
         {
           // reconstruct an smooth image with a large voxel size
-          const float zoom = 0.2F;
           stir::shared_ptr<Voxels3DF>
             image_sptr(new Voxels3DF(MAKE_SHARED<stir::ExamInfo>(*this->get_input_data()->get_exam_info_sptr()),
                                      *this->get_input_data()->get_proj_data_info_sptr(),
-                                     zoom));
+                                     zoom_));
           image_sptr->fill(1.F);
           stir::ScatterEstimation::set_initial_activity_image_sptr(image_sptr);
           if (stir::ScatterEstimation::set_up() == Succeeded::no)
@@ -747,8 +903,227 @@ The actual algorithm is described in
           if (stir::ScatterEstimation::process_data() == Succeeded::no)
             THROW("scatter estimation failed");
         }
+
+    private:
+        float zoom_ = 0.2F;
+        stir::shared_ptr<stir::OSMAPOSLReconstruction<DiscretisedDensity<3,float> > > sptr_osem_;
+
+        stir::OSMAPOSLReconstruction<DiscretisedDensity<3,float> >& osem_()
+        {
+          if (!sptr_osem_)
+            THROW("PETScatterEstimator: the reconstruction is defined by the parameter file");
+          return *sptr_osem_;
+        }
     };
 
+	/*!
+	\ingroup PET
+	\brief Single scatter simulation with the attenuation part cached across calls.
+
+	Computes the single scatter estimate of Watson's model for the detector
+	pairs of an acquisition data template (normally of low resolution, e.g.
+	obtained with PETAcquisitionData::single_slice_rebinned_data()).
+
+	The scatter points are the voxels of the attenuation image (in cm^-1, taking
+	every scatter_point_step-th voxel in each direction) whose value is at least
+	the attenuation threshold. The detectors are the end points of the LORs of
+	the template bins. The scatter points, the detectors and the attenuation
+	line integrals between them are computed on the first forward() call, and
+	reused by the next calls until the attenuation image, the template or the
+	sampling parameters change. Each forward() call then only computes the line
+	integrals of the activity image, and sums the contributions of all scatter
+	points for each detector pair in parallel (if built with OpenMP).
+
+	The result is normalised by the unscattered detection sensitivity of the
+	pair, so that it is in the units of the attenuated forward projection of
+	the activity image. It does not include detection efficiencies other than
+	the energy window, and is normally scaled to the data by tail fitting.
+
+	Memory use is about 8 bytes per scatter point and detector.
+	*/
+	class PETSingleScatterEngine {
+	public:
+		PETSingleScatterEngine() :
+			attenuation_threshold_(0.01f), scatter_point_step_(4),
+			energy_resolution_(-1), low_energy_thres_(-1), high_energy_thres_(-1)
+		{}
+		//! sets the attenuation image (in cm^-1)
+		void set_attenuation_image_sptr(stir::shared_ptr<const STIRImageData> sptr)
+		{
+			sptr_att_image_ = sptr;
+			clear_cache_();
+		}
+		//! sets the smallest attenuation coefficient (in cm^-1) of a scatter point
+		void set_attenuation_threshold(float threshold)
+		{
+			attenuation_threshold_ = threshold;
+			clear_cache_();
+		}
+		//! sets the spacing of the scatter points in voxels of the attenuation image
+		void set_scatter_point_step(int step)
+		{
+			if (step < 1)
+				THROW("PETSingleScatterEngine::set_scatter_point_step: step must be positive");
+			scatter_point_step_ = step;
+			clear_cache_();
+		}
+		//! overrides the energy window thresholds (in keV) of the template exam info
+		void set_low_energy_threshold(float low)
+		{
+			low_energy_thres_ = low;
+		}
+		void set_high_energy_threshold(float high)
+		{
+			high_energy_thres_ = high;
+		}
+		//! overrides the energy resolution (FWHM relative to the reference energy) of the scanner
+		void set_energy_resolution(float resolution)
+		{
+			energy_resolution_ = resolution;
+		}
+		//! sets the acquisition data template defining the detector pairs
+		/*! The energy window and resolution are applied by set_up(). */
+		void set_up(stir::shared_ptr<const PETAcquisitionData> sptr_acq_template);
+
+		stir::shared_ptr<PETAcquisitionData> forward(const STIRImageData& activity);
+		void forward(PETAcquisitionData& ad, const STIRImageData& activity);
+		//! simulates the scatter of all frames, sharing the attenuation part
+		stir::shared_ptr<PETDynamicAcquisitionData>
+			forward(const STIRDynamicImageData& activity);
+		void forward(PETDynamicAcquisitionData& ad, const STIRDynamicImageData& activity);
+
+		//! number of scatter points (0 until the cache is computed)
+		size_t num_scatter_points() const
+		{
+			return points_.size();
+		}
+		//! number of detectors (0 until set_up)
+		size_t num_detectors() const
+		{
+			return detectors_.size();
+		}
+
+	protected:
+		// an image resampled on a dense array in the scanner frame (mm)
+		struct Volume {
+			std::vector<float> values;
+			int nx, ny, nz;
+			float x0, y0, z0; // centre of the first voxel
+			float dx, dy, dz;
+
+			void set(const STIRImageData& image);
+			float at(int ix, int iy, int iz) const
+			{
+				return values[(size_t(iz)*ny + iy)*nx + ix];
+			}
+			float centre_x(int ix) const { return x0 + ix*dx; }
+			float centre_y(int iy) const { return y0 + iy*dy; }
+			float centre_z(int iz) const { return z0 + iz*dz; }
+			//! integral (value times mm) of the nearest voxel values along a segment
+			float line_integral(const float* a, const float* b) const;
+		};
+		struct ScatterPoint {
+			float x, y, z;
+			float mu; // in mm^-1
+		};
+		struct Detector {
+			float x, y, z;
+			float nx, ny; // unit normal pointing to the scanner axis
+		};
+		// a (segment, view) of the template and the index of its first bin
+		struct ViewgramBins {
+			int segment, view;
+			size_t first_bin;
+		};
+
+		void clear_cache_()
+		{
+			points_.clear();
+			att_integrals_.clear();
+			att_version_ = 0;
+		}
+		void update_attenuation_cache_();
+		void compute_activity_integrals_(const STIRImageData& activity,
+			std::vector<float>& integrals) const;
+		void simulate_(PETAcquisitionData& ad, const std::vector<float>& act_integrals) const;
+
+		stir::shared_ptr<const PETAcquisitionData> sptr_acq_template_;
+		stir::shared_ptr<const STIRImageData> sptr_att_image_;
+		float attenuation_threshold_;
+		int scatter_point_step_;
+		float energy_resolution_;
+		float low_energy_thres_;
+		float high_energy_thres_;
+
+		// set up from the template
+		std::vector<Detector> detectors_;
+		std::vector<std::pair<uint32_t, uint32_t> > bin_detectors_;
+		std::vector<ViewgramBins> viewgrams_;
+		// Klein-Nishina differential cross section (relative to the total one
+		// at 511 keV) times the relative detection efficiency, and the total
+		// cross section relative to 511 keV, tabulated against cos(theta)
+		std::vector<float> kn_table_;
+		std::vector<float> sigma_table_;
+
+		// cached for the attenuation image version att_version_
+		std::vector<ScatterPoint> points_;
+		std::vector<float> att_integrals_; // [point][detector], dimensionless
+		float point_volume_; // mm^3
+		uint64_t att_version_;
+	};
+
+	/*!
+	\ingroup PET
+	\brief Ray tracing matrix with a persistent on-disk cache of its rows.
+
+	On set_up, the rows of all basic bins (i.e. those not related to others by
+	symmetries) are looked up in a file in the cache directory, whose name is
+	derived from the scanner, the acquisition data geometry, the image geometry
+	and the matrix parameters. If there is no such file, the rows are computed
+	by the wrapped ray tracing matrix and written to it (once, atomically).
+	The file is then memory-mapped read-only, so processes using the same
+	geometry share it and do not recompute the matrix.
+
+	The file stores the rows in compressed sparse row format: a sorted table of
+	basic bins, row offsets, voxel coordinates and values.
+	*/
+	class RayTracingMatrixWithPersistentCache : public stir::ProjMatrixByBin {
+	public:
+		RayTracingMatrixWithPersistentCache
+			(stir::shared_ptr<RayTracingMatrix> sptr_matrix, const std::string& cache_dir);
+		virtual void set_up(
+			const stir::shared_ptr<const stir::ProjDataInfo>& proj_data_info_sptr,
+			const stir::shared_ptr<const stir::DiscretisedDensity<3, float> >& density_info_sptr);
+		virtual RayTracingMatrixWithPersistentCache* clone() const
+		{
+			return new RayTracingMatrixWithPersistentCache(*this);
+		}
+		//! the ray tracing matrix used to compute the rows
+		stir::shared_ptr<RayTracingMatrix> matrix_sptr() const
+		{
+			return sptr_matrix_;
+		}
+		//! the cache file used (empty before set_up)
+		const std::string& cache_file() const
+		{
+			return filename_;
+		}
+	private:
+		class Store;
+		virtual void calculate_proj_matrix_elems_for_one_bin
+			(stir::ProjMatrixElemsForOneBin& elems) const;
+		std::string cache_key_(const stir::ProjDataInfo& proj_data_info,
+			const stir::DiscretisedDensity<3, float>& density_info) const;
+		void write_store_(const stir::ProjDataInfo& proj_data_info,
+			const std::string& key) const;
+
+		stir::shared_ptr<RayTracingMatrix> sptr_matrix_;
+		std::string cache_dir_;
+		std::string filename_;
+		// memory-mapped rows, shared by clones
+		std::shared_ptr<const Store> sptr_store_;
+	};
+
 	/*!
 	\ingroup PET
 	\brief Ray tracing matrix implementation of the PET acquisition model.
@@ -774,11 +1149,26 @@ The actual algorithm is described in
 			sptr_matrix_ = sptr_matrix;
 			((ProjectorPairUsingMatrix*)this->sptr_projectors_.get())->
 				set_proj_matrix_sptr(sptr_matrix);
+			invalidate_caches();
 		}
 		stir::shared_ptr<stir::ProjMatrixByBin> matrix_sptr()
 		{
-			return ((ProjectorPairUsingMatrix*)this->sptr_projectors_.get())->
-				get_proj_matrix_sptr();
+			return sptr_matrix_;
+		}
+		/*! \brief Sets the directory of the persistent ray tracing matrix cache.
+
+		If set (and the matrix is a ray tracing matrix), set_up uses the matrix
+		rows stored there, computing and storing them if not there yet
+		(see RayTracingMatrixWithPersistentCache). An empty string disables it.
+		*/
+		void set_matrix_cache_directory(const std::string& dir)
+		{
+			matrix_cache_dir_ = dir;
+			invalidate_caches();
+		}
+		const std::string& matrix_cache_directory() const
+		{
+			return matrix_cache_dir_;
 		}
 		virtual stir::Succeeded set_up(
 			stir::shared_ptr<PETAcquisitionData> sptr_acq,
@@ -786,11 +1176,28 @@ The actual algorithm is described in
 		{
 			if (!sptr_matrix_.get())
 				return stir::Succeeded::no;
+			stir::shared_ptr<stir::ProjMatrixByBin> sptr_proj_matrix = sptr_matrix_;
+			stir::shared_ptr<RayTracingMatrix> sptr_rtm =
+				std::dynamic_pointer_cast<RayTracingMatrix>(sptr_matrix_);
+			if (!matrix_cache_dir_.empty() && sptr_rtm.get())
+				sptr_proj_matrix.reset
+				(new RayTracingMatrixWithPersistentCache(sptr_rtm, matrix_cache_dir_));
+			((ProjectorPairUsingMatrix*)this->sptr_projectors_.get())->
+				set_proj_matrix_sptr(sptr_proj_matrix);
 			return PETAcquisitionModel::set_up(sptr_acq, sptr_image);
 		}
 
+	protected:
+		/* the frames are projected together, one view at a time: the matrix rows
+		of each view are computed once and applied to all frames */
+		virtual void forward_project_frames_(PETDynamicAcquisitionData& ad,
+			const STIRDynamicImageData& image) const;
+		virtual void back_project_frames_(STIRDynamicImageData& image,
+			const PETDynamicAcquisitionData& ad) const;
+
 	private:
 		stir::shared_ptr<stir::ProjMatrixByBin> sptr_matrix_;
+		std::string matrix_cache_dir_;
 	};
 
 	typedef PETAcquisitionModel AcqMod3DF;
@@ -819,6 +1226,7 @@ The actual algorithm is described in
         void set_use_truncation(const bool use_truncation) const
         {
             _NiftyPET_projector_pair_sptr->set_use_truncation(use_truncation);
+            invalidate_caches();
         }
     protected:
         stir::shared_ptr<ProjectorPairUsingNiftyPET> _NiftyPET_projector_pair_sptr;
@@ -846,17 +1254,43 @@ The actual algorithm is described in
 	\ingroup PET
 	\brief Attenuation model.
 
+	If created from a shared pointer to the attenuation image and memoisation
+	is switched on, the attenuation correction factors are computed once and
+	reused as long as the attenuation image is not modified (see
+	DataContainer::version()) and the acquisition data geometry is the same.
 	*/
 
 	class PETAttenuationModel : public PETAcquisitionSensitivityModel {
 	public:
 		PETAttenuationModel(STIRImageData& id, PETAcquisitionModel& am);
+		PETAttenuationModel(stir::shared_ptr<STIRImageData> sptr_id, PETAcquisitionModel& am);
+		using PETAcquisitionSensitivityModel::unnormalise;
 		// multiply by bin efficiencies
 		virtual void unnormalise(PETAcquisitionData& ad) const;
 		// divide by bin efficiencies
 		virtual void normalise(PETAcquisitionData& ad) const;
+		// switches the reuse of attenuation correction factors on or off (off by default)
+		void set_memoisation(bool memoise)
+		{
+			acf_memo_.set_enabled(memoise);
+		}
+		bool memoisation() const
+		{
+			return acf_memo_.enabled();
+		}
+		// the version of the attenuation image (if created from a shared pointer to it)
+		virtual uint64_t data_version() const
+		{
+			return sptr_mu_.get() ? sptr_mu_->version() : 0;
+		}
 	protected:
 		stir::shared_ptr<stir::ForwardProjectorByBin> sptr_forw_projector_;
+		stir::shared_ptr<STIRImageData> sptr_mu_;
+		// attenuation correction factors for the last acquisition data geometry
+		mutable OperatorMemo<PETAcquisitionData> acf_memo_;
+		/* returns the attenuation correction factors for the geometry of ad if
+		memoisation is on, else an empty pointer */
+		stir::shared_ptr<const PETAcquisitionData> acfs_(const PETAcquisitionData& ad) const;
 	};
 
 	/*!
@@ -910,28 +1344,122 @@ The actual algorithm is described in
 			sptr_ad_ = sptr;
 			set_proj_data_sptr(sptr->data());
 		}
+		//! the additive term and normalisation of the model are read by set_up()
 		void set_acquisition_model(stir::shared_ptr<AcqMod3DF> sptr)
 		{
 			sptr_am_ = sptr;
-			AcqMod3DF& am = *sptr;
-			set_projector_pair_sptr(am.projectors_sptr());
-			if (am.additive_term_sptr().get())
-				set_additive_proj_data_sptr(am.additive_term_sptr()->data());
-			if (am.normalisation_sptr().get())
-				set_normalisation_sptr(am.normalisation_sptr());
+			set_projector_pair_sptr(sptr->projectors_sptr());
 		}
 		stir::shared_ptr<AcqMod3DF> acquisition_model_sptr()
 		{
 			return sptr_am_;
 		}
+		virtual stir::Succeeded set_up(stir::shared_ptr<Image3DF> const& sptr_image)
+		{
+			if (sptr_am_.get())
+				set_acquisition_model_terms_(*sptr_am_);
+			return stir::PoissonLogLikelihoodWithLinearModelForMeanAndProjData
+				< Image3DF >::set_up(sptr_image);
+		}
 	private:
 		stir::shared_ptr<PETAcquisitionData> sptr_ad_;
 		stir::shared_ptr<AcqMod3DF> sptr_am_;
+		void set_acquisition_model_terms_(const AcqMod3DF& am)
+		{
+			if (am.additive_term_sptr().get())
+				set_additive_proj_data_sptr(am.additive_term_sptr()->data());
+			else
+				set_additive_proj_data_sptr(stir::shared_ptr<stir::ProjData>());
+			if (am.normalisation_sptr().get())
+				set_normalisation_sptr(am.normalisation_sptr());
+			else
+				set_normalisation_sptr(stir::shared_ptr<stir::BinNormalisation>
+					(new stir::TrivialBinNormalisation));
+		}
 	};
 
 	typedef xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjData3DF
 		PoissonLogLhLinModMeanProjData3DF;
 
+	/*!
+	\ingroup PET
+	\brief Poisson log-likelihood of listmode data.
+
+	The value and the (subset) gradients are computed from the recorded
+	events, each projected with the matrix of the acquisition model, so their
+	cost is proportional to the number of counts rather than to the size of
+	the sinograms. Only the sensitivity image needs a full back projection,
+	which set_up computes once (or reads, see set_sensitivity_filename()).
+
+	With STIR 5 or later the events are read from the listmode file once and
+	cached as (bin, value) pairs, i.e. with the event-to-LOR mapping done,
+	in batches of at most cache_max_size events (stored in files in the cache
+	directory if there are more). The gradient is computed by OpenMP threads
+	over the cached events.
+
+	The acquisition model must use a matrix. Its additive term and
+	normalisation, as they are when set_up is called, are used and must have
+	the geometry of the listmode data (usually span 1 without view mashing);
+	background terms are not supported.
+	*/
+	class xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeData3DF :
+		public stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin < Image3DF > {
+	public:
+		void set_input_file(const std::string& filename)
+		{
+			list_mode_filename = filename;
+			stir::shared_ptr<stir::ListModeData>
+				sptr_lm(stir::read_from_file<stir::ListModeData>(filename));
+			set_input_data(sptr_lm);
+		}
+		//! events with a larger ring difference are ignored (-1: none)
+		void set_max_ring_difference(int max_ring_diff)
+		{
+			max_ring_difference_num_to_process = max_ring_diff;
+		}
+		int get_max_ring_difference() const
+		{
+			return max_ring_difference_num_to_process;
+		}
+		void set_acquisition_model(stir::shared_ptr<AcqModUsingMatrix3DF> sptr)
+		{
+			if (!sptr->matrix_sptr().get())
+				THROW("listmode objective function: the acquisition model has no matrix");
+			sptr_am_ = sptr;
+			set_proj_matrix(sptr->matrix_sptr());
+		}
+		stir::shared_ptr<AcqModUsingMatrix3DF> acquisition_model_sptr()
+		{
+			return sptr_am_;
+		}
+		virtual stir::Succeeded set_up(stir::shared_ptr<Image3DF> const& sptr_image)
+		{
+			if (sptr_am_.get())
+				set_acquisition_model_terms_(*sptr_am_);
+			return stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin
+				< Image3DF >::set_up(sptr_image);
+		}
+	private:
+		stir::shared_ptr<AcqModUsingMatrix3DF> sptr_am_;
+		void set_acquisition_model_terms_(const AcqModUsingMatrix3DF& am)
+		{
+			if (am.background_term_sptr().get())
+				THROW("listmode objective function: background term not supported");
+			if (am.additive_term_sptr().get())
+				set_additive_proj_data_sptr(am.additive_term_sptr()->data());
+			else
+				set_additive_proj_data_sptr(stir::shared_ptr<stir::ProjData>());
+			if (am.normalisation_sptr().get())
+				set_normalisation_sptr(am.normalisation_sptr());
+			else
+				set_normalisation_sptr(stir::shared_ptr<stir::BinNormalisation>
+					(new stir::TrivialBinNormalisation));
+		}
+	};
+
+	typedef xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeData3DF
+		PoissonLogLhLinModMeanListData3DF;
+
 	class xSTIR_IterativeReconstruction3DF :
 		public stir::IterativeReconstruction < Image3DF > {
 	public:
@@ -1039,9 +1567,27 @@ The actual algorithm is described in
 		{
 			return _sptr_image_data;
 		}
+		/*!
+		\brief Reconstructs all frames (or gates) of dynamic data.
+
+		The frames are shared out among OpenMP threads, each reconstructing with
+		its own copy of this reconstructor (with all its settings and the image
+		template, see set_up()) and its own back projector. The frames must have
+		the same acquisition geometry.
+		The images are returned by get_dynamic_output().
+		*/
+		stir::Succeeded process(const PETDynamicAcquisitionData& ad);
+		stir::shared_ptr<STIRDynamicImageData> get_dynamic_output()
+		{
+			return _sptr_dyn_image_data;
+		}
 	protected:
 		bool _is_set_up;
 		stir::shared_ptr<STIRImageData> _sptr_image_data;
+		stir::shared_ptr<STIRDynamicImageData> _sptr_dyn_image_data;
+
+		// replaces the (shared) back projector by a copy
+		void own_back_projector_();
 	};
 
 	class xSTIR_SeparableGaussianImageFilter : 
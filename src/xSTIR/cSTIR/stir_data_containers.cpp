@@ -22,7 +22,9 @@ limitations under the License.
 #include "sirf/STIR/stir_data_containers.h"
 #include "stir/KeyParser.h"
 #include "stir/is_null_ptr.h"
+#include "stir/utilities.h"
 #include "stir/zoom.h"
+#include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
 
 using namespace stir;
 using namespace sirf;
@@ -33,6 +35,129 @@ using namespace sirf;
 std::string PETAcquisitionData::_storage_scheme;
 shared_ptr<PETAcquisitionData> PETAcquisitionData::_template;
 
+ProjDataInHalfPrecision::ProjDataInHalfPrecision(
+	shared_ptr<const ExamInfo> sptr_exam_info,
+	shared_ptr<const ProjDataInfo> sptr_proj_data_info,
+	StoragePrecision precision) :
+	ProjData(SPTR_WRAP(sptr_exam_info), SPTR_WRAP(sptr_proj_data_info)),
+	precision_(precision)
+{
+	if (precision_ == StoragePrecision::single)
+		THROW("ProjDataInHalfPrecision: use ProjDataInMemory for single precision");
+#if STIR_VERSION >= 060000
+	if (sptr_proj_data_info->get_num_tof_poss() > 1)
+		THROW("ProjDataInHalfPrecision: TOF data not supported");
+#endif
+	const ProjDataInfo& pdi = *sptr_proj_data_info;
+	size_t size = 0;
+	for (int seg = pdi.get_min_segment_num(); seg <= pdi.get_max_segment_num(); seg++) {
+		segment_offsets_.push_back(size);
+		size += size_t(pdi.get_num_axial_poss(seg))*
+			pdi.get_num_views()*pdi.get_num_tangential_poss();
+	}
+	// zero bits are 0.0 in both formats
+	values_.assign(size, 0);
+}
+
+Viewgram<float>
+ProjDataInHalfPrecision::get_viewgram_(int view_num, int segment_num,
+	bool make_num_tangential_poss_odd) const
+{
+	const ProjDataInfo& pdi = *get_proj_data_info_sptr();
+	if (segment_num < pdi.get_min_segment_num() || segment_num > pdi.get_max_segment_num() ||
+		view_num < pdi.get_min_view_num() || view_num > pdi.get_max_view_num())
+		THROW("ProjDataInHalfPrecision: view or segment number out of range");
+	Viewgram<float> viewgram =
+		get_empty_viewgram(view_num, segment_num, make_num_tangential_poss_odd);
+	const int min_tang = pdi.get_min_tangential_pos_num();
+	const int nt = pdi.get_num_tangential_poss();
+	std::vector<float> row(nt);
+	for (int ax = pdi.get_min_axial_pos_num(segment_num);
+		ax <= pdi.get_max_axial_pos_num(segment_num); ax++) {
+		unpack_16bit(precision_, &values_[offset_(segment_num, ax, view_num, min_tang)],
+			&row[0], nt);
+		for (int t = 0; t < nt; t++)
+			viewgram[ax][min_tang + t] = row[t];
+	}
+	return viewgram;
+}
+
+Sinogram<float>
+ProjDataInHalfPrecision::get_sinogram_(int ax_pos_num, int segment_num,
+	bool make_num_tangential_poss_odd) const
+{
+	const ProjDataInfo& pdi = *get_proj_data_info_sptr();
+	if (segment_num < pdi.get_min_segment_num() || segment_num > pdi.get_max_segment_num() ||
+		ax_pos_num < pdi.get_min_axial_pos_num(segment_num) ||
+		ax_pos_num > pdi.get_max_axial_pos_num(segment_num))
+		THROW("ProjDataInHalfPrecision: axial position or segment number out of range");
+	Sinogram<float> sinogram =
+		get_empty_sinogram(ax_pos_num, segment_num, make_num_tangential_poss_odd);
+	const int min_view = pdi.get_min_view_num();
+	const int min_tang = pdi.get_min_tangential_pos_num();
+	const int nv = pdi.get_num_views();
+	const int nt = pdi.get_num_tangential_poss();
+	// the views of a sinogram are stored contiguously
+	std::vector<float> values(size_t(nv)*nt);
+	unpack_16bit(precision_, &values_[offset_(segment_num, ax_pos_num, min_view, min_tang)],
+		&values[0], values.size());
+	for (int v = 0; v < nv; v++)
+		for (int t = 0; t < nt; t++)
+			sinogram[min_view + v][min_tang + t] = values[size_t(v)*nt + t];
+	return sinogram;
+}
+
+Succeeded
+ProjDataInHalfPrecision::set_viewgram(const Viewgram<float>& viewgram)
+{
+	const ProjDataInfo& pdi = *get_proj_data_info_sptr();
+	const int seg = viewgram.get_segment_num();
+	const int view = viewgram.get_view_num();
+	if (seg < pdi.get_min_segment_num() || seg > pdi.get_max_segment_num() ||
+		view < pdi.get_min_view_num() || view > pdi.get_max_view_num() ||
+		viewgram.get_min_axial_pos_num() != pdi.get_min_axial_pos_num(seg) ||
+		viewgram.get_max_axial_pos_num() != pdi.get_max_axial_pos_num(seg) ||
+		viewgram.get_min_tangential_pos_num() != pdi.get_min_tangential_pos_num() ||
+		viewgram.get_max_tangential_pos_num() != pdi.get_max_tangential_pos_num())
+		return Succeeded::no;
+	const int min_tang = pdi.get_min_tangential_pos_num();
+	const int nt = pdi.get_num_tangential_poss();
+	std::vector<float> row(nt);
+	for (int ax = viewgram.get_min_axial_pos_num();
+		ax <= viewgram.get_max_axial_pos_num(); ax++) {
+		for (int t = 0; t < nt; t++)
+			row[t] = viewgram[ax][min_tang + t];
+		pack_16bit(precision_, &row[0], &values_[offset_(seg, ax, view, min_tang)], nt);
+	}
+	return Succeeded::yes;
+}
+
+Succeeded
+ProjDataInHalfPrecision::set_sinogram(const Sinogram<float>& sinogram)
+{
+	const ProjDataInfo& pdi = *get_proj_data_info_sptr();
+	const int seg = sinogram.get_segment_num();
+	const int ax = sinogram.get_axial_pos_num();
+	if (seg < pdi.get_min_segment_num() || seg > pdi.get_max_segment_num() ||
+		ax < pdi.get_min_axial_pos_num(seg) || ax > pdi.get_max_axial_pos_num(seg) ||
+		sinogram.get_min_view_num() != pdi.get_min_view_num() ||
+		sinogram.get_max_view_num() != pdi.get_max_view_num() ||
+		sinogram.get_min_tangential_pos_num() != pdi.get_min_tangential_pos_num() ||
+		sinogram.get_max_tangential_pos_num() != pdi.get_max_tangential_pos_num())
+		return Succeeded::no;
+	const int min_view = pdi.get_min_view_num();
+	const int min_tang = pdi.get_min_tangential_pos_num();
+	const int nv = pdi.get_num_views();
+	const int nt = pdi.get_num_tangential_poss();
+	std::vector<float> values(size_t(nv)*nt);
+	for (int v = 0; v < nv; v++)
+		for (int t = 0; t < nt; t++)
+			values[size_t(v)*nt + t] = sinogram[min_view + v][min_tang + t];
+	pack_16bit(precision_, &values[0],
+		&values_[offset_(seg, ax, min_view, min_tang)], values.size());
+	return Succeeded::yes;
+}
+
 float
 PETAcquisitionData::norm() const
 {
@@ -104,6 +229,7 @@ const DataContainer& a_x, const void* ptr_a,
 const DataContainer& a_y, const void* ptr_b
 )
 {
+	mark_modified();
     // Cast to correct types
     float a = *(float*)ptr_a;
     float b = *(float*)ptr_b;
@@ -125,6 +251,7 @@ const DataContainer& a_x, const DataContainer& a_a,
 const DataContainer& a_y, const DataContainer& a_b
 )
 {
+	mark_modified();
     // Cast to correct types
     auto a = dynamic_cast<const PETAcquisitionData*>(&a_a);
     auto b = dynamic_cast<const PETAcquisitionData*>(&a_b);
@@ -145,6 +272,7 @@ const DataContainer& a_y, const DataContainer& a_b
 void
 PETAcquisitionData::inv(float amin, const DataContainer& a_x)
 {
+	mark_modified();
 	//PETAcquisitionData& x = (PETAcquisitionData&)a_x;
 	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
 	int n = get_max_segment_num();
@@ -182,6 +310,7 @@ PETAcquisitionData::binary_op_(
 	int job
 )
 {
+	mark_modified();
 	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
 	DYNAMIC_CAST(const PETAcquisitionData, y, a_y);
 	int n = get_max_segment_num();
@@ -245,6 +374,259 @@ PETAcquisitionData::binary_op_(
 	}
 }
 
+PETSubsetAcquisitionData::PETSubsetAcquisitionData(
+	shared_ptr<const ExamInfo> sptr_exam_info,
+	shared_ptr<const ProjDataInfo> sptr_proj_data_info,
+	shared_ptr<DataSymmetriesForViewSegmentNumbers> sptr_symmetries,
+	int subset_num, int num_subsets) :
+	sptr_exam_info_(sptr_exam_info),
+	sptr_proj_data_info_(sptr_proj_data_info),
+	sptr_symmetries_(sptr_symmetries),
+	subset_num_(subset_num), num_subsets_(num_subsets)
+{
+	if (is_null_ptr(sptr_proj_data_info_) || is_null_ptr(sptr_symmetries_))
+		THROW("PETSubsetAcquisitionData: acquisition data info or symmetries not set");
+	if (num_subsets_ < 1 || subset_num_ < 0 || subset_num_ >= num_subsets_)
+		THROW("PETSubsetAcquisitionData: wrong subset number");
+#if STIR_VERSION >= 060000
+	if (sptr_proj_data_info_->get_num_tof_poss() > 1)
+		THROW("PETSubsetAcquisitionData: TOF data not supported");
+#endif
+	const ProjDataInfo& pdi = *sptr_proj_data_info_;
+	basic_vs_ = detail::find_basic_vs_nums_in_subset(pdi, *sptr_symmetries_,
+		pdi.get_min_segment_num(), pdi.get_max_segment_num(),
+		subset_num_, num_subsets_);
+	related_vs_.resize(basic_vs_.size());
+	offsets_.assign(1, 0);
+	for (size_t i = 0; i < basic_vs_.size(); i++) {
+		RelatedViewgrams<float> viewgrams =
+			pdi.get_empty_related_viewgrams(basic_vs_[i], sptr_symmetries_);
+		size_t size = 0;
+		for (RelatedViewgrams<float>::const_iterator it = viewgrams.begin();
+			it != viewgrams.end(); ++it) {
+			related_vs_[i].push_back
+				(ViewSegmentNumbers(it->get_view_num(), it->get_segment_num()));
+			size += it->size_all();
+		}
+		offsets_.push_back(offsets_.back() + size);
+	}
+	data_.assign(offsets_.back(), 0.0f);
+}
+
+RelatedViewgrams<float>
+PETSubsetAcquisitionData::get_related_viewgrams(int i) const
+{
+	RelatedViewgrams<float> viewgrams = sptr_proj_data_info_->
+		get_empty_related_viewgrams(basic_vs_[i], sptr_symmetries_);
+	const float* ptr = data_.data() + offsets_[i];
+	for (RelatedViewgrams<float>::iterator it = viewgrams.begin();
+		it != viewgrams.end(); ++it)
+		for (Viewgram<float>::full_iterator v = it->begin_all(); v != it->end_all(); ++v)
+			*v = *ptr++;
+	return viewgrams;
+}
+
+void
+PETSubsetAcquisitionData::set_related_viewgrams(int i,
+	const RelatedViewgrams<float>& viewgrams)
+{
+	mark_modified();
+	if (viewgrams.get_basic_view_segment_num() != basic_vs_[i])
+		THROW("PETSubsetAcquisitionData::set_related_viewgrams: wrong viewgrams");
+	float* ptr = data_.data() + offsets_[i];
+	for (RelatedViewgrams<float>::const_iterator it = viewgrams.begin();
+		it != viewgrams.end(); ++it)
+		for (Viewgram<float>::const_full_iterator v = it->begin_all(); v != it->end_all(); ++v)
+			*ptr++ = *v;
+}
+
+void
+PETSubsetAcquisitionData::fill(const PETAcquisitionData& ad)
+{
+	if (ad.is_empty())
+		THROW("The source of PETSubsetAcquisitionData::fill is empty");
+	const ProjData& pd = *ad.data();
+	if (*pd.get_proj_data_info_sptr() != *sptr_proj_data_info_)
+		THROW("PETSubsetAcquisitionData::fill: acquisition data info mismatch");
+	for (int i = 0; i < get_num_related_viewgrams(); i++)
+		set_related_viewgrams(i, pd.get_related_viewgrams(basic_vs_[i], sptr_symmetries_));
+}
+
+void
+PETSubsetAcquisitionData::copy_to(PETAcquisitionData& ad) const
+{
+	copy_to(*ad.data());
+}
+
+void
+PETSubsetAcquisitionData::copy_to(ProjData& pd) const
+{
+	if (*pd.get_proj_data_info_sptr() != *sptr_proj_data_info_)
+		THROW("PETSubsetAcquisitionData::copy_to: acquisition data info mismatch");
+	for (int i = 0; i < get_num_related_viewgrams(); i++)
+		if (pd.set_related_viewgrams(get_related_viewgrams(i)) != Succeeded::yes)
+			THROW("PETSubsetAcquisitionData::copy_to: failed to set viewgrams");
+}
+
+void
+PETSubsetAcquisitionData::write(const std::string &filename) const
+{
+	PETAcquisitionDataInMemory ad(sptr_exam_info_, sptr_proj_data_info_);
+	ad.fill(0.0f);
+	copy_to(ad);
+	ad.write(filename);
+}
+
+const PETSubsetAcquisitionData&
+PETSubsetAcquisitionData::same_layout_(const DataContainer& a_x) const
+{
+	DYNAMIC_CAST(const PETSubsetAcquisitionData, x, a_x);
+	if (x.subset_num_ != subset_num_ || x.num_subsets_ != num_subsets_ ||
+		x.offsets_ != offsets_ || x.basic_vs_ != basic_vs_)
+		THROW("PETSubsetAcquisitionData: subsets mismatch");
+	return x;
+}
+
+float
+PETSubsetAcquisitionData::norm() const
+{
+	double t = 0.0;
+	for (size_t i = 0; i < data_.size(); i++)
+		t += double(data_[i])*data_[i];
+	return (float)std::sqrt(t);
+}
+
+void
+PETSubsetAcquisitionData::dot(const DataContainer& a_x, void* ptr) const
+{
+	const PETSubsetAcquisitionData& x = same_layout_(a_x);
+	double t = 0.0;
+	for (size_t i = 0; i < data_.size(); i++)
+		t += double(data_[i])*x.data_[i];
+	float* ptr_t = (float*)ptr;
+	*ptr_t = (float)t;
+}
+
+void
+PETSubsetAcquisitionData::xapyb(
+	const DataContainer& a_x, const void* ptr_a,
+	const DataContainer& a_y, const void* ptr_b)
+{
+	mark_modified();
+	float a = *(float*)ptr_a;
+	float b = *(float*)ptr_b;
+	const PETSubsetAcquisitionData& x = same_layout_(a_x);
+	const PETSubsetAcquisitionData& y = same_layout_(a_y);
+	for (size_t i = 0; i < data_.size(); i++)
+		data_[i] = a*x.data_[i] + b*y.data_[i];
+}
+
+void
+PETSubsetAcquisitionData::xapyb(
+	const DataContainer& a_x, const DataContainer& a_a,
+	const DataContainer& a_y, const DataContainer& a_b)
+{
+	mark_modified();
+	const PETSubsetAcquisitionData& x = same_layout_(a_x);
+	const PETSubsetAcquisitionData& a = same_layout_(a_a);
+	const PETSubsetAcquisitionData& y = same_layout_(a_y);
+	const PETSubsetAcquisitionData& b = same_layout_(a_b);
+	for (size_t i = 0; i < data_.size(); i++)
+		data_[i] = a.data_[i]*x.data_[i] + b.data_[i]*y.data_[i];
+}
+
+void
+PETSubsetAcquisitionData::binary_op_(
+	const DataContainer& a_x,
+	const DataContainer& a_y,
+	int job
+)
+{
+	mark_modified();
+	const PETSubsetAcquisitionData& x = same_layout_(a_x);
+	const PETSubsetAcquisitionData& y = same_layout_(a_y);
+	for (size_t i = 0; i < data_.size(); i++) {
+		switch (job) {
+		case 1:
+			data_[i] = x.data_[i] * y.data_[i];
+			break;
+		case 2:
+			data_[i] = x.data_[i] / y.data_[i];
+			break;
+		case 3:
+			data_[i] = std::max(x.data_[i], y.data_[i]);
+			break;
+		case 4:
+			data_[i] = std::min(x.data_[i], y.data_[i]);
+			break;
+		}
+	}
+}
+
+#ifdef SIRF_WITH_MPI
+float
+PETDistributedAcquisitionData::norm() const
+{
+	const float* ptr = data();
+	double t = 0.0;
+	for (size_t i = 0; i < size(); i++)
+		t += double(ptr[i])*ptr[i];
+	double s;
+	MPI_Allreduce(&t, &s, 1, MPI_DOUBLE, MPI_SUM, comm_);
+	return (float)std::sqrt(s);
+}
+
+void
+PETDistributedAcquisitionData::dot(const DataContainer& a_x, void* ptr) const
+{
+	const PETSubsetAcquisitionData& x = same_layout_(a_x);
+	const float* ptr_y = data();
+	const float* ptr_x = x.data();
+	double t = 0.0;
+	for (size_t i = 0; i < size(); i++)
+		t += double(ptr_y[i])*ptr_x[i];
+	double s;
+	MPI_Allreduce(&t, &s, 1, MPI_DOUBLE, MPI_SUM, comm_);
+	float* ptr_t = (float*)ptr;
+	*ptr_t = (float)s;
+}
+
+void
+PETDistributedAcquisitionData::write(const std::string &filename) const
+{
+	// The processes write their viewgrams into the file in turn: the process
+	// of rank 0 creates it, and the others open it and write at the offsets
+	// of their viewgrams, so that no process needs more memory than its part.
+	int failed = 0;
+	for (int r = 0; r < num_subsets(); r++) {
+		if (r == subset_num() && !failed) {
+			try {
+				if (r == 0) {
+					ProjDataInterfile pd(get_exam_info_sptr(),
+						get_proj_data_info_sptr()->create_shared_clone(), filename,
+						std::ios::in | std::ios::out | std::ios::trunc);
+					copy_to(pd);
+				}
+				else {
+					std::string header = filename;
+					replace_extension(header, ".hs");
+					shared_ptr<ProjData> sptr_pd =
+						ProjData::read_from_file(header, std::ios::in | std::ios::out);
+					copy_to(*sptr_pd);
+				}
+			}
+			catch (...) {
+				failed = 1;
+			}
+		}
+		// also makes the next process wait until the file is written
+		MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm_);
+	}
+	if (failed)
+		THROW("PETDistributedAcquisitionData::write: failed to write " + filename);
+}
+#endif
+
 STIRImageData::STIRImageData(const ImageData& id)
 {
     throw std::runtime_error("TODO - create STIRImageData from general SIRFImageData.");
@@ -336,6 +718,7 @@ STIRImageData::xapyb(
 const DataContainer& a_x, const void* ptr_a,
 const DataContainer& a_y, const void* ptr_b)
 {
+	mark_modified();
 	float a = *(float*)ptr_a;
 	float b = *(float*)ptr_b;
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
@@ -363,6 +746,7 @@ STIRImageData::xapyb(
 const DataContainer& a_x, const DataContainer& a_a,
 const DataContainer& a_y, const DataContainer& a_b)
 {
+	mark_modified();
 	DYNAMIC_CAST(const STIRImageData, a, a_a);
 	DYNAMIC_CAST(const STIRImageData, b, a_b);	
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
@@ -411,9 +795,28 @@ STIRImageData::norm() const
 	return (float)sqrt(s);
 }
 
+const float*
+STIRImageData::contiguous_float_data() const
+{
+	const Image3DF& image = *_data;
+	const int min_z = image.get_min_index();
+	const int min_y = image[min_z].get_min_index();
+	const int min_x = image[min_z][min_y].get_min_index();
+	const float* ptr = &image[min_z][min_y][min_x];
+	size_t offset = 0;
+	for (int z = min_z; z <= image.get_max_index(); z++)
+		for (int y = image[z].get_min_index(); y <= image[z].get_max_index(); y++) {
+			if (image[z][y].get_min_index() != min_x || &image[z][y][min_x] != ptr + offset)
+				return 0;
+			offset += image[z][y].size();
+		}
+	return ptr;
+}
+
 void
 STIRImageData::scale(float s)
 {
+	mark_modified();
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	Image3DF::full_iterator iter;
 #else
@@ -429,6 +832,7 @@ STIRImageData::binary_op_(
 	const DataContainer& a_y, 
 	int job
 ){
+	mark_modified();
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
 	DYNAMIC_CAST(const STIRImageData, y, a_y);
 #if defined(_MSC_VER) && _MSC_VER < 1900
@@ -518,6 +922,7 @@ STIRImageData::get_data(float* data) const
 void
 STIRImageData::set_data(const float* data)
 {
+	mark_modified();
 	Image3DF& image = *_data;
 	Coordinate3D<int> min_indices;
 	Coordinate3D<int> max_indices;
@@ -600,6 +1005,7 @@ move_to_scanner_centre(const PETAcquisitionData &)
 void
 STIRImageData::set_up_geom_info()
 {
+	mark_modified();
     const Voxels3DF* const vox_image = dynamic_cast<const Voxels3DF*>(&data());
 
     // If cast failed, throw error
@@ -25,15 +25,52 @@ limitations under the License.
 #include "stir/error.h"
 #include "stir/IO/stir_ecat_common.h"
 #include "stir/is_null_ptr.h"
+#include "stir/LORCoordinates.h"
 #include "stir/multiply_crystal_factors.h"
 #include "stir/Verbosity.h"
 
+#include "stir/recon_buildblock/DataSymmetriesForBins.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/stream.h"
+#include "stir/Viewgram.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
 #include "sirf/STIR/stir_x.h"
+#include "sirf/common/Profiler.h"
+
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 
 using namespace stir;
 using namespace ecat;
 using namespace sirf;
 
+static uint64_t
+bytes_(const PETAcquisitionData& ad)
+{
+	return uint64_t(ad.get_num_sinograms())*ad.get_num_views()*
+		ad.get_num_tangential_poss()*sizeof(float);
+}
+
+static uint64_t
+bytes_(const STIRImageData& id)
+{
+	return uint64_t(id.data().size_all())*sizeof(float);
+}
+
 #if defined(HAVE_HDF5)
 #include "stir/IO/GEHDF5Wrapper.h"
 #include "stir/data/SinglesRatesFromGEHDF5.h"
@@ -98,6 +135,7 @@ float ListmodeToSinograms::get_time_at_which_num_prompts_exceeds_threshold(const
 void
 ListmodeToSinograms::compute_fan_sums_(bool prompt_fansum)
 {
+	ScopedTimer profiler_timer("ListmodeToSinograms::compute_fan_sums");
 	//*********** get Scanner details
 	const int num_rings =
 		lm_data_ptr->get_scanner_ptr()->get_num_rings();
@@ -254,6 +292,7 @@ const int max_ring_diff, const int half_fan_size)
 int
 ListmodeToSinograms::compute_singles_()
 {
+	ScopedTimer profiler_timer("ListmodeToSinograms::compute_singles");
 	const int do_display_interval = display_interval;
 	const int do_KL_interval = KL_interval;
 	const int do_save_interval =
@@ -328,6 +367,7 @@ ListmodeToSinograms::compute_singles_()
 int 
 ListmodeToSinograms::estimate_randoms()
 {
+	ScopedTimer timer("ListmodeToSinograms::estimate_randoms");
 #if defined(HAVE_HDF5)
 	std::cout << "estimate_randoms: trying GEHDF5...\n";
 	try {
@@ -411,6 +451,17 @@ PETAcquisitionSensitivityModel::unnormalise(PETAcquisitionData& ad) const
 	norm->undo(*ad.data(), 0, 1);
 }
 
+void
+PETAcquisitionSensitivityModel::unnormalise(PETSubsetAcquisitionData& ad) const
+{
+	BinNormalisation* norm = norm_.get();
+	for (int i = 0; i < ad.get_num_related_viewgrams(); i++) {
+		RelatedViewgrams<float> viewgrams = ad.get_related_viewgrams(i);
+		norm->undo(viewgrams, 0, 1);
+		ad.set_related_viewgrams(i, viewgrams);
+	}
+}
+
 void
 PETAcquisitionSensitivityModel::normalise(PETAcquisitionData& ad) const
 {
@@ -434,10 +485,40 @@ PETAttenuationModel::PETAttenuationModel
 	norm_ = sptr_n;
 }
 
+PETAttenuationModel::PETAttenuationModel
+(shared_ptr<STIRImageData> sptr_id, PETAcquisitionModel& am) :
+	PETAttenuationModel(*sptr_id, am)
+{
+	sptr_mu_ = sptr_id;
+}
+
+shared_ptr<const PETAcquisitionData>
+PETAttenuationModel::acfs_(const PETAcquisitionData& ad) const
+{
+	if (!acf_memo_.enabled() || !sptr_mu_.get())
+		return shared_ptr<const PETAcquisitionData>();
+	shared_ptr<const PETAcquisitionData> sptr_acf = acf_memo_.find(*sptr_mu_);
+	if (sptr_acf.get() &&
+		*sptr_acf->get_proj_data_info_sptr() == *ad.get_proj_data_info_sptr())
+		return sptr_acf;
+	shared_ptr<PETAcquisitionData> sptr_new = ad.new_acquisition_data();
+	sptr_new->fill(1.0f);
+	shared_ptr<DataSymmetriesForViewSegmentNumbers>
+		symmetries_sptr(sptr_forw_projector_->get_symmetries_used()->clone());
+	norm_->undo(*sptr_new->data(), 0, 1, symmetries_sptr);
+	acf_memo_.store(*sptr_mu_, sptr_new);
+	return sptr_new;
+}
+
 void
 PETAttenuationModel::unnormalise(PETAcquisitionData& ad) const
 {
 	//std::cout << "in PETAttenuationModel::unnormalise\n";
+	shared_ptr<const PETAcquisitionData> sptr_acf = acfs_(ad);
+	if (sptr_acf.get()) {
+		ad.multiply(ad, *sptr_acf);
+		return;
+	}
 	BinNormalisation* norm = norm_.get();
 	shared_ptr<DataSymmetriesForViewSegmentNumbers>
 		symmetries_sptr(sptr_forw_projector_->get_symmetries_used()->clone());
@@ -447,6 +528,11 @@ PETAttenuationModel::unnormalise(PETAcquisitionData& ad) const
 void
 PETAttenuationModel::normalise(PETAcquisitionData& ad) const
 {
+	shared_ptr<const PETAcquisitionData> sptr_acf = acfs_(ad);
+	if (sptr_acf.get()) {
+		ad.divide(ad, *sptr_acf);
+		return;
+	}
 	BinNormalisation* norm = norm_.get();
 	shared_ptr<DataSymmetriesForViewSegmentNumbers>
 		symmetries_sptr(sptr_forw_projector_->get_symmetries_used()->clone());
@@ -487,6 +573,7 @@ PETAcquisitionModel::set_up(
 			s = sptr_asm_->set_up(sptr_acq->get_exam_info_sptr(),
 				sptr_acq->get_proj_data_info_sptr()->create_shared_clone());
 	}
+	invalidate_caches();
 	return s;
 }
 
@@ -498,16 +585,135 @@ PETAcquisitionModel::set_image_data_processor(stir::shared_ptr<ImageDataProcesso
 
 	sptr_projectors_->get_forward_projector_sptr()->set_pre_data_processor(sptr_processor);
 	sptr_projectors_->get_back_projector_sptr()->set_post_data_processor(sptr_processor);
+	sptr_image_processor_ = sptr_processor;
+	invalidate_caches();
+}
+
+shared_ptr<STIRImageData>
+PETAcquisitionModel::norm_initial_guess_(const NormCacheEntry& entry) const
+{
+	if (!sptr_image_template_.get())
+		THROW("PETAcquisitionModel::norm: model not set up");
+	if (entry.sptr_eigenvector.get()) {
+		int dim[3];
+		int dim_eig[3];
+		sptr_image_template_->get_dimensions(dim);
+		entry.sptr_eigenvector->get_dimensions(dim_eig);
+		if (dim[0] == dim_eig[0] && dim[1] == dim_eig[1] && dim[2] == dim_eig[2])
+			return entry.sptr_eigenvector;
+	}
+	shared_ptr<STIRImageData> sptr_x(sptr_image_template_->clone());
+	sptr_x->fill(1.0);
+	return sptr_x;
+}
+
+std::vector<uint64_t>
+PETAcquisitionModel::norm_versions_() const
+{
+	return std::vector<uint64_t>{
+		sptr_acq_template_.get() ? sptr_acq_template_->version() : 0,
+		sptr_image_template_.get() ? sptr_image_template_->version() : 0,
+		sptr_asm_.get() ? sptr_asm_->data_version() : 0 };
+}
+
+float
+PETAcquisitionModel::norm(int subset_num, int num_subsets) const
+{
+	NormCacheEntry& entry = norm_cache_[std::make_pair(subset_num, num_subsets)];
+	if (norm_cached_(entry))
+		return entry.norm;
+
+	BFOperator bf(*this);
+	bf.set_subset(subset_num);
+	bf.set_num_subsets(num_subsets);
+	JacobiCG<float> jcg;
+	jcg.set_num_iterations(2);
+	// on return, x is the eigenvector estimate, kept as the initial guess for next time
+	shared_ptr<STIRImageData> sptr_x = norm_initial_guess_(entry);
+	float lmd = jcg.largest(bf, *sptr_x);
+	entry.sptr_eigenvector = sptr_x;
+	entry.norm = std::sqrt(lmd);
+	entry.valid = true;
+	entry.versions = norm_versions_();
+	return entry.norm;
+}
+
+std::vector<float>
+PETAcquisitionModel::subset_norms(int num_subsets) const
+{
+	std::vector<float> norms(num_subsets);
+	std::vector<int> todo;
+	for (int i = 0; i < num_subsets; i++) {
+		const NormCacheEntry& entry = norm_cache_[std::make_pair(i, num_subsets)];
+		if (norm_cached_(entry))
+			norms[i] = entry.norm;
+		else
+			todo.push_back(i);
+	}
+	if (todo.empty())
+		return norms;
+
+	std::vector<std::unique_ptr<BFOperator> > bfs;
+	std::vector<Operator<STIRImageData>*> ops;
+	std::vector<shared_ptr<STIRImageData> > xs;
+	std::vector<STIRImageData*> x_ptrs;
+	for (int i : todo) {
+		bfs.emplace_back(new BFOperator(*this));
+		bfs.back()->set_subset(i);
+		bfs.back()->set_num_subsets(num_subsets);
+		ops.push_back(bfs.back().get());
+		xs.push_back(norm_initial_guess_(norm_cache_[std::make_pair(i, num_subsets)]));
+		x_ptrs.push_back(xs.back().get());
+	}
+	JacobiCG<float> jcg;
+	jcg.set_num_iterations(2);
+	std::vector<float> lmd = jcg.largest(ops, x_ptrs);
+	const std::vector<uint64_t> versions = norm_versions_();
+	for (size_t j = 0; j < todo.size(); j++) {
+		NormCacheEntry& entry = norm_cache_[std::make_pair(todo[j], num_subsets)];
+		entry.sptr_eigenvector = xs[j];
+		entry.norm = std::sqrt(lmd[j]);
+		entry.valid = true;
+		entry.versions = versions;
+		norms[todo[j]] = entry.norm;
+	}
+	return norms;
 }
 
 void 
 PETAcquisitionModel::forward(PETAcquisitionData& ad, const STIRImageData& image,
 	int subset_num, int num_subsets, bool zero, bool do_linear_only) const
 {
+	ScopedTimer timer("PETAcquisitionModel::forward");
+	Profiler::count_bytes("PETAcquisitionModel::forward", bytes_(image) + bytes_(ad));
+	ad.mark_modified();
+	// only results overwriting all of ad can be reused
+	const bool memoise = fwd_memo_.enabled() && (zero || num_subsets == 1);
+	OperatorMemo<PETAcquisitionData>::Arguments args;
+	if (memoise) {
+		args = { uint64_t(subset_num), uint64_t(num_subsets), uint64_t(do_linear_only),
+			sptr_add_.get() ? sptr_add_->version() : 0,
+			sptr_background_.get() ? sptr_background_->version() : 0,
+			sptr_asm_.get() ? sptr_asm_->data_version() : 0 };
+		shared_ptr<const PETAcquisitionData> sptr_memo = fwd_memo_.find(image, args);
+		if (sptr_memo.get() && *sptr_memo->get_proj_data_info_sptr() ==
+			*ad.get_proj_data_info_sptr()) {
+			if (stir::Verbosity::get() > 1) std::cout << "reusing forward projection\n";
+			ad.fill(*sptr_memo);
+			return;
+		}
+	}
 	shared_ptr<ProjData> sptr_fd = ad.data();
 	sptr_projectors_->get_forward_projector_sptr()->forward_project
 		(*sptr_fd, image.data(), subset_num, num_subsets, zero);
+	apply_constant_terms_(ad, do_linear_only);
+	if (memoise)
+		fwd_memo_.store(image, shared_ptr<const PETAcquisitionData>(ad.clone()), args);
+}
 
+void
+PETAcquisitionModel::apply_constant_terms_(PETAcquisitionData& ad, bool do_linear_only) const
+{
 	float one = 1.0;
 
 	if (sptr_add_.get() && !do_linear_only) {
@@ -538,6 +744,196 @@ PETAcquisitionModel::forward(PETAcquisitionData& ad, const STIRImageData& image,
 		if (stir::Verbosity::get() > 1) std::cout << "no background term added\n";
 }
 
+shared_ptr<PETDynamicAcquisitionData>
+PETAcquisitionModel::forward(const STIRDynamicImageData& image, bool do_linear_only) const
+{
+	if (!sptr_acq_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::forward: acquisition template not set");
+	shared_ptr<PETDynamicAcquisitionData> sptr_ad(new PETDynamicAcquisitionData
+		(*sptr_acq_template_, image.get_num_frames()));
+	forward(*sptr_ad, image, do_linear_only);
+	return sptr_ad;
+}
+
+void
+PETAcquisitionModel::forward(PETDynamicAcquisitionData& ad, const STIRDynamicImageData& image,
+	bool do_linear_only) const
+{
+	if (ad.get_num_frames() != image.get_num_frames())
+		THROW("PETAcquisitionModel::forward: numbers of frames differ");
+	forward_project_frames_(ad, image);
+	// the frames are written through their ProjData, so they are marked here
+	for (int f = 0; f < ad.get_num_frames(); f++) {
+		apply_constant_terms_(ad.frame(f), do_linear_only);
+		ad.frame(f).mark_modified();
+	}
+	ad.mark_modified();
+}
+
+shared_ptr<STIRDynamicImageData>
+PETAcquisitionModel::backward(const PETDynamicAcquisitionData& ad) const
+{
+	if (!sptr_image_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::backward: image template not set");
+	shared_ptr<STIRDynamicImageData> sptr_id(new STIRDynamicImageData
+		(*sptr_image_template_, ad.get_num_frames()));
+	backward(*sptr_id, ad);
+	return sptr_id;
+}
+
+void
+PETAcquisitionModel::backward(STIRDynamicImageData& image, const PETDynamicAcquisitionData& ad) const
+{
+	if (ad.get_num_frames() != image.get_num_frames())
+		THROW("PETAcquisitionModel::backward: numbers of frames differ");
+	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
+	if (sm && sm->data() && !sm->data()->is_trivial()) {
+		if (stir::Verbosity::get() > 1) std::cout << "applying unnormalisation...";
+		std::unique_ptr<PETDynamicAcquisitionData> uptr_ad = ad.clone();
+		for (int f = 0; f < uptr_ad->get_num_frames(); f++)
+			sptr_asm_->unnormalise(uptr_ad->frame(f));
+		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+		back_project_frames_(image, *uptr_ad);
+	}
+	else
+		back_project_frames_(image, ad);
+	for (int f = 0; f < image.get_num_frames(); f++)
+		image.frame(f).mark_modified();
+	image.mark_modified();
+}
+
+void
+PETAcquisitionModel::forward_project_frames_(PETDynamicAcquisitionData& ad,
+	const STIRDynamicImageData& image) const
+{
+	ForwardProjectorByBin& projector = *sptr_projectors_->get_forward_projector_sptr();
+	for (int f = 0; f < ad.get_num_frames(); f++)
+		projector.forward_project(*ad.frame(f).data(), image.frame(f).data());
+}
+
+void
+PETAcquisitionModel::back_project_frames_(STIRDynamicImageData& image,
+	const PETDynamicAcquisitionData& ad) const
+{
+	BackProjectorByBin& projector = *sptr_projectors_->get_back_projector_sptr();
+	for (int f = 0; f < ad.get_num_frames(); f++)
+		projector.back_project(image.frame(f).data(), *ad.frame(f).data());
+}
+
+static void
+check_frames_geometry(const ProjDataInfo& pdi, const PETDynamicAcquisitionData& ad)
+{
+#if STIR_VERSION >= 060000
+	if (pdi.get_num_tof_poss() > 1)
+		THROW("PETAcquisitionModelUsingMatrix: TOF dynamic data not supported");
+#endif
+	for (int f = 0; f < ad.get_num_frames(); f++)
+		if (*ad.frame(f).get_proj_data_info_sptr() != pdi)
+			THROW("PETAcquisitionModelUsingMatrix: frame acquisition geometry differs from the template");
+}
+
+void
+PETAcquisitionModelUsingMatrix::forward_project_frames_(PETDynamicAcquisitionData& ad,
+	const STIRDynamicImageData& image) const
+{
+	const ProjDataInfo& pdi = *sptr_acq_template_->get_proj_data_info_sptr();
+	check_frames_geometry(pdi, ad);
+	const ProjMatrixByBin& matrix = *((ProjectorPairUsingMatrix*)sptr_projectors_.get())->
+		get_proj_matrix_sptr();
+	const int nf = image.get_num_frames();
+
+	// the image data processor is applied to copies of the frames
+	std::vector<shared_ptr<Image3DF> > processed(nf);
+	std::vector<const Image3DF*> frames(nf);
+	for (int f = 0; f < nf; f++) {
+		frames[f] = &image.frame(f).data();
+		if (sptr_image_processor_.get()) {
+			processed[f].reset(frames[f]->clone());
+			sptr_image_processor_->apply(*processed[f]);
+			frames[f] = processed[f].get();
+		}
+	}
+
+	for (int seg = pdi.get_min_segment_num(); seg <= pdi.get_max_segment_num(); seg++) {
+		const int min_ax = pdi.get_min_axial_pos_num(seg);
+		const int num_ax = pdi.get_num_axial_poss(seg);
+		const int min_tang = pdi.get_min_tangential_pos_num();
+		const int num_tang = pdi.get_num_tangential_poss();
+		for (int view = pdi.get_min_view_num(); view <= pdi.get_max_view_num(); view++) {
+			// matrix rows of this view
+			std::vector<ProjMatrixElemsForOneBin> rows(num_ax*num_tang);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int i = 0; i < num_ax*num_tang; i++) {
+				Bin bin(seg, view, min_ax + i / num_tang, min_tang + i % num_tang);
+				matrix.get_proj_matrix_elems_for_one_bin(rows[i], bin);
+			}
+			// applied to all frames
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int f = 0; f < nf; f++) {
+				Viewgram<float> viewgram = pdi.get_empty_viewgram(view, seg);
+				for (int i = 0; i < num_ax*num_tang; i++) {
+					Bin bin = rows[i].get_bin();
+					bin.set_bin_value(0);
+					rows[i].forward_project(bin, *frames[f]);
+					viewgram[bin.axial_pos_num()][bin.tangential_pos_num()] = bin.get_bin_value();
+				}
+				ad.frame(f).data()->set_viewgram(viewgram);
+			}
+		}
+	}
+}
+
+void
+PETAcquisitionModelUsingMatrix::back_project_frames_(STIRDynamicImageData& image,
+	const PETDynamicAcquisitionData& ad) const
+{
+	const ProjDataInfo& pdi = *sptr_acq_template_->get_proj_data_info_sptr();
+	check_frames_geometry(pdi, ad);
+	const ProjMatrixByBin& matrix = *((ProjectorPairUsingMatrix*)sptr_projectors_.get())->
+		get_proj_matrix_sptr();
+	const int nf = ad.get_num_frames();
+	for (int f = 0; f < nf; f++)
+		image.frame(f).fill(0.0f);
+
+	for (int seg = pdi.get_min_segment_num(); seg <= pdi.get_max_segment_num(); seg++) {
+		const int min_ax = pdi.get_min_axial_pos_num(seg);
+		const int num_ax = pdi.get_num_axial_poss(seg);
+		const int min_tang = pdi.get_min_tangential_pos_num();
+		const int num_tang = pdi.get_num_tangential_poss();
+		for (int view = pdi.get_min_view_num(); view <= pdi.get_max_view_num(); view++) {
+			std::vector<ProjMatrixElemsForOneBin> rows(num_ax*num_tang);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int i = 0; i < num_ax*num_tang; i++) {
+				Bin bin(seg, view, min_ax + i / num_tang, min_tang + i % num_tang);
+				matrix.get_proj_matrix_elems_for_one_bin(rows[i], bin);
+			}
+			// each thread back projects into its own frames
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int f = 0; f < nf; f++) {
+				const Viewgram<float> viewgram = ad.frame(f).data()->get_viewgram(view, seg);
+				Image3DF& frame = image.frame(f).data();
+				for (int i = 0; i < num_ax*num_tang; i++) {
+					Bin bin = rows[i].get_bin();
+					bin.set_bin_value(viewgram[bin.axial_pos_num()][bin.tangential_pos_num()]);
+					rows[i].back_project(frame, bin);
+				}
+			}
+		}
+	}
+
+	if (sptr_image_processor_.get())
+		for (int f = 0; f < nf; f++)
+			sptr_image_processor_->apply(image.frame(f).data());
+}
+
 shared_ptr<PETAcquisitionData>
 PETAcquisitionModel::forward(const STIRImageData& image, 
 	int subset_num, int num_subsets, bool do_linear_only) const
@@ -546,6 +942,7 @@ PETAcquisitionModel::forward(const STIRImageData& image,
 		THROW("Fatal error in PETAcquisitionModel::forward: acquisition template not set");
 	shared_ptr<PETAcquisitionData> sptr_ad;
 	sptr_ad = sptr_acq_template_->new_acquisition_data();
+	Profiler::count_allocation("PETAcquisitionModel::forward", bytes_(*sptr_ad));
 	shared_ptr<ProjData> sptr_fd = sptr_ad->data();
 	forward(*sptr_ad, image, subset_num, num_subsets, num_subsets > 1, do_linear_only);
 	return sptr_ad;
@@ -559,6 +956,7 @@ PETAcquisitionModel::backward(PETAcquisitionData& ad,
 		THROW("Fatal error in PETAcquisitionModel::backward: image template not set");
 	shared_ptr<STIRImageData> sptr_id;
 	sptr_id = sptr_image_template_->new_image_data();
+	Profiler::count_allocation("PETAcquisitionModel::backward", bytes_(*sptr_id));
 	backward(*sptr_id, ad, subset_num, num_subsets);
 	return sptr_id;
 }
@@ -567,6 +965,20 @@ void
 PETAcquisitionModel::backward(STIRImageData& id, PETAcquisitionData& ad,
 	int subset_num, int num_subsets) const
 {
+	ScopedTimer timer("PETAcquisitionModel::backward");
+	Profiler::count_bytes("PETAcquisitionModel::backward", bytes_(id) + bytes_(ad));
+	id.mark_modified();
+	const OperatorMemo<STIRImageData>::Arguments args =
+		{ uint64_t(subset_num), uint64_t(num_subsets),
+		sptr_asm_.get() ? sptr_asm_->data_version() : 0 };
+	shared_ptr<const STIRImageData> sptr_memo = bwd_memo_.find(ad, args);
+	if (sptr_memo.get() && id.data().has_same_characteristics(sptr_memo->data())) {
+		if (stir::Verbosity::get() > 1) std::cout << "reusing backprojection\n";
+		std::copy(sptr_memo->data().begin_all_const(), sptr_memo->data().end_all_const(),
+			id.data().begin_all());
+		return;
+	}
+
 	shared_ptr<Image3DF> sptr_im = id.data_sptr();
 
 	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
@@ -589,4 +1001,868 @@ PETAcquisitionModel::backward(STIRImageData& id, PETAcquisitionData& ad,
 		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
 	}
 
+	if (bwd_memo_.enabled())
+		bwd_memo_.store(ad, shared_ptr<const STIRImageData>(id.clone()), args);
+}
+
+shared_ptr<PETSubsetAcquisitionData>
+PETAcquisitionModel::new_subset_acquisition_data(int subset_num, int num_subsets) const
+{
+	if (!sptr_acq_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::new_subset_acquisition_data: acquisition template not set");
+	shared_ptr<DataSymmetriesForViewSegmentNumbers> sptr_symmetries
+		(sptr_projectors_->get_symmetries_used()->clone());
+	return shared_ptr<PETSubsetAcquisitionData>(new PETSubsetAcquisitionData
+		(sptr_acq_template_->get_exam_info_sptr(),
+		sptr_acq_template_->get_proj_data_info_sptr(),
+		sptr_symmetries, subset_num, num_subsets));
+}
+
+shared_ptr<PETSubsetAcquisitionData>
+PETAcquisitionModel::forward_subset(const STIRImageData& image,
+	int subset_num, int num_subsets, bool do_linear_only) const
+{
+	shared_ptr<PETSubsetAcquisitionData> sptr_ad =
+		new_subset_acquisition_data(subset_num, num_subsets);
+	forward(*sptr_ad, image, do_linear_only);
+	return sptr_ad;
+}
+
+void
+PETAcquisitionModel::forward(PETSubsetAcquisitionData& ad, const STIRImageData& image,
+	bool do_linear_only) const
+{
+	ScopedTimer timer("PETAcquisitionModel::forward_subset");
+	ForwardProjectorByBin& projector = *sptr_projectors_->get_forward_projector_sptr();
+	const int n = ad.get_num_related_viewgrams();
+#if STIR_VERSION < 050000
+	for (int i = 0; i < n; i++) {
+		RelatedViewgrams<float> viewgrams = ad.get_related_viewgrams(i);
+		viewgrams.fill(0.0f);
+		projector.forward_project(viewgrams, image.data());
+		ad.set_related_viewgrams(i, viewgrams);
+	}
+#else
+	projector.set_input(image.data());
+	// each group of related viewgrams occupies its own part of ad
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i = 0; i < n; i++) {
+		RelatedViewgrams<float> viewgrams = ad.get_related_viewgrams(i);
+		viewgrams.fill(0.0f);
+		projector.forward_project(viewgrams);
+		ad.set_related_viewgrams(i, viewgrams);
+	}
+#endif
+
+	float one = 1.0;
+
+	if (sptr_add_.get() && !do_linear_only) {
+		if (stir::Verbosity::get() > 1) std::cout << "additive term added...";
+		shared_ptr<PETSubsetAcquisitionData> sptr_add = ad.new_subset_acquisition_data();
+		sptr_add->fill(*sptr_add_);
+		ad.axpby(&one, ad, &one, *sptr_add);
+		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+	}
+	else
+		if (stir::Verbosity::get() > 1) std::cout << "no additive term added\n";
+
+	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
+	if (sm && sm->data() && !sm->data()->is_trivial()) {
+		if (stir::Verbosity::get() > 1) std::cout << "applying unnormalisation...";
+		sptr_asm_->unnormalise(ad);
+		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+	}
+	else
+		if (stir::Verbosity::get() > 1) std::cout << "no unnormalisation applied\n";
+
+	if (sptr_background_.get() && !do_linear_only) {
+		if (stir::Verbosity::get() > 1) std::cout << "background term added...";
+		shared_ptr<PETSubsetAcquisitionData> sptr_bck = ad.new_subset_acquisition_data();
+		sptr_bck->fill(*sptr_background_);
+		ad.axpby(&one, ad, &one, *sptr_bck);
+		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+	}
+	else
+		if (stir::Verbosity::get() > 1) std::cout << "no background term added\n";
+}
+
+shared_ptr<STIRImageData>
+PETAcquisitionModel::backward(const PETSubsetAcquisitionData& ad) const
+{
+	if (!sptr_image_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::backward: image template not set");
+	shared_ptr<STIRImageData> sptr_id;
+	sptr_id = sptr_image_template_->new_image_data();
+	backward(*sptr_id, ad);
+	return sptr_id;
+}
+
+void
+PETAcquisitionModel::backward(STIRImageData& id, const PETSubsetAcquisitionData& ad) const
+{
+	ScopedTimer timer("PETAcquisitionModel::backward_subset");
+	const PETSubsetAcquisitionData* ptr_ad = &ad;
+	std::unique_ptr<PETSubsetAcquisitionData> uptr_ad;
+	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
+	if (sm && sm->data() && !sm->data()->is_trivial()) {
+		if (stir::Verbosity::get() > 1) std::cout << "applying unnormalisation...";
+		uptr_ad = ad.clone();
+		sptr_asm_->unnormalise(*uptr_ad);
+		ptr_ad = uptr_ad.get();
+		if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+	}
+
+	if (stir::Verbosity::get() > 1) std::cout << "backprojecting...";
+	BackProjectorByBin& projector = *sptr_projectors_->get_back_projector_sptr();
+	const int n = ptr_ad->get_num_related_viewgrams();
+#if STIR_VERSION < 050000
+	id.data().fill(0.0f);
+	for (int i = 0; i < n; i++)
+		projector.back_project(id.data(), ptr_ad->get_related_viewgrams(i));
+#else
+	projector.start_accumulating_in_new_target();
+	// the back projector accumulates in a separate image for each thread
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i = 0; i < n; i++)
+		projector.back_project(ptr_ad->get_related_viewgrams(i));
+	projector.get_output(id.data());
+#endif
+	if (stir::Verbosity::get() > 1) std::cout << "ok\n";
+}
+
+#ifdef SIRF_WITH_MPI
+shared_ptr<PETDistributedAcquisitionData>
+PETAcquisitionModel::new_distributed_acquisition_data(MPI_Comm comm) const
+{
+	if (!sptr_acq_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::new_distributed_acquisition_data: acquisition template not set");
+	shared_ptr<DataSymmetriesForViewSegmentNumbers> sptr_symmetries
+		(sptr_projectors_->get_symmetries_used()->clone());
+	return shared_ptr<PETDistributedAcquisitionData>(new PETDistributedAcquisitionData
+		(sptr_acq_template_->get_exam_info_sptr(),
+		sptr_acq_template_->get_proj_data_info_sptr(),
+		sptr_symmetries, comm));
+}
+
+shared_ptr<PETDistributedAcquisitionData>
+PETAcquisitionModel::forward_distributed(const STIRImageData& image,
+	MPI_Comm comm, bool do_linear_only) const
+{
+	shared_ptr<PETDistributedAcquisitionData> sptr_ad =
+		new_distributed_acquisition_data(comm);
+	forward(*sptr_ad, image, do_linear_only);
+	return sptr_ad;
+}
+
+shared_ptr<STIRImageData>
+PETAcquisitionModel::backward(const PETDistributedAcquisitionData& ad) const
+{
+	if (!sptr_image_template_.get())
+		THROW("Fatal error in PETAcquisitionModel::backward: image template not set");
+	shared_ptr<STIRImageData> sptr_id;
+	sptr_id = sptr_image_template_->new_image_data();
+	backward(*sptr_id, ad);
+	return sptr_id;
+}
+
+void
+PETAcquisitionModel::backward(STIRImageData& id, const PETDistributedAcquisitionData& ad) const
+{
+	backward(id, static_cast<const PETSubsetAcquisitionData&>(ad));
+	ScopedTimer timer("PETAcquisitionModel::backward_distributed_reduce");
+	std::vector<float> local(id.data().size_all());
+	std::vector<float> total(local.size());
+	id.get_data(local.data());
+	if (local.size() > (size_t)std::numeric_limits<int>::max())
+		THROW("PETAcquisitionModel::backward: image too large for MPI_Allreduce");
+	MPI_Allreduce(local.data(), total.data(), (int)local.size(), MPI_FLOAT, MPI_SUM,
+		ad.communicator());
+	id.set_data(total.data());
+}
+#endif
+
+/*
+Layout of the persistent ray tracing matrix cache file (native byte order):
+	char magic[8]
+	uint64 key_size, char key[key_size] (padded to a multiple of 8 bytes)
+	uint64 num_bins, uint64 num_elems
+	int32 bins[num_bins][4] (segment, view, axial and tangential positions, sorted)
+	uint64 row_start[num_bins + 1]
+	int32 coords[num_elems][3]
+	float values[num_elems]
+*/
+static const char MATRIX_CACHE_MAGIC[8] = { 'S', 'I', 'R', 'F', 'P', 'M', 'C', '1' };
+
+static size_t
+padded_to_8(size_t size)
+{
+	return (size + 7) / 8 * 8;
+}
+
+class RayTracingMatrixWithPersistentCache::Store {
+public:
+	// maps the file, returns an empty pointer if it does not exist or does not match the key
+	static std::shared_ptr<const Store> open(const std::string& filename, const std::string& key)
+	{
+		if (!boost::filesystem::exists(filename))
+			return std::shared_ptr<const Store>();
+		std::shared_ptr<Store> sptr_store(new Store);
+		Store& store = *sptr_store;
+		try {
+			store.mapping_ = boost::interprocess::file_mapping
+				(filename.c_str(), boost::interprocess::read_only);
+			store.region_ = boost::interprocess::mapped_region
+				(store.mapping_, boost::interprocess::read_only);
+		}
+		catch (const boost::interprocess::interprocess_exception&) {
+			return std::shared_ptr<const Store>();
+		}
+		const char* ptr = static_cast<const char*>(store.region_.get_address());
+		const size_t size = store.region_.get_size();
+		size_t offset = 0;
+		uint64_t key_size;
+		if (size < sizeof(MATRIX_CACHE_MAGIC) + sizeof(key_size)
+			|| std::memcmp(ptr, MATRIX_CACHE_MAGIC, sizeof(MATRIX_CACHE_MAGIC)) != 0)
+			return std::shared_ptr<const Store>();
+		offset += sizeof(MATRIX_CACHE_MAGIC);
+		std::memcpy(&key_size, ptr + offset, sizeof(key_size));
+		offset += sizeof(key_size);
+		if (key_size != key.size() || size < offset + padded_to_8(key_size) + 2 * sizeof(uint64_t)
+			|| key.compare(0, key.size(), ptr + offset, key_size) != 0)
+			return std::shared_ptr<const Store>();
+		offset += padded_to_8(key_size);
+		std::memcpy(&store.num_bins_, ptr + offset, sizeof(uint64_t));
+		offset += sizeof(uint64_t);
+		std::memcpy(&store.num_elems_, ptr + offset, sizeof(uint64_t));
+		offset += sizeof(uint64_t);
+		const size_t expected_size = offset + store.num_bins_ * 4 * sizeof(int32_t)
+			+ (store.num_bins_ + 1) * sizeof(uint64_t)
+			+ store.num_elems_ * (3 * sizeof(int32_t) + sizeof(float));
+		if (size != expected_size)
+			return std::shared_ptr<const Store>();
+		store.bins_ = reinterpret_cast<const int32_t*>(ptr + offset);
+		offset += store.num_bins_ * 4 * sizeof(int32_t);
+		store.row_start_ = reinterpret_cast<const uint64_t*>(ptr + offset);
+		offset += (store.num_bins_ + 1) * sizeof(uint64_t);
+		store.coords_ = reinterpret_cast<const int32_t*>(ptr + offset);
+		offset += store.num_elems_ * 3 * sizeof(int32_t);
+		store.values_ = reinterpret_cast<const float*>(ptr + offset);
+		return sptr_store;
+	}
+	// fills elems with the row of its bin, returns false if not stored
+	bool get_row(ProjMatrixElemsForOneBin& elems) const
+	{
+		const Bin& bin = elems.get_bin();
+		const int32_t b[4] = { int32_t(bin.segment_num()), int32_t(bin.view_num()),
+			int32_t(bin.axial_pos_num()), int32_t(bin.tangential_pos_num()) };
+		// binary search in the sorted table of bins
+		size_t lo = 0;
+		size_t hi = num_bins_;
+		while (lo < hi) {
+			const size_t mid = (lo + hi) / 2;
+			if (std::lexicographical_compare(bins_ + 4 * mid, bins_ + 4 * mid + 4, b, b + 4))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == num_bins_ || !std::equal(b, b + 4, bins_ + 4 * lo))
+			return false;
+		elems.erase();
+		elems.reserve(size_t(row_start_[lo + 1] - row_start_[lo]));
+		for (uint64_t i = row_start_[lo]; i < row_start_[lo + 1]; i++) {
+			const int32_t* c = coords_ + 3 * i;
+			elems.push_back(ProjMatrixElemsForOneBinValue
+				(Coordinate3D<int>(c[0], c[1], c[2]), values_[i]));
+		}
+		return true;
+	}
+private:
+	Store() {}
+	boost::interprocess::file_mapping mapping_;
+	boost::interprocess::mapped_region region_;
+	uint64_t num_bins_ = 0;
+	uint64_t num_elems_ = 0;
+	const int32_t* bins_ = 0;
+	const uint64_t* row_start_ = 0;
+	const int32_t* coords_ = 0;
+	const float* values_ = 0;
+};
+
+RayTracingMatrixWithPersistentCache::RayTracingMatrixWithPersistentCache
+(shared_ptr<RayTracingMatrix> sptr_matrix, const std::string& cache_dir) :
+	sptr_matrix_(sptr_matrix), cache_dir_(cache_dir)
+{
+	if (!sptr_matrix_.get())
+		THROW("RayTracingMatrixWithPersistentCache: ray tracing matrix not set");
+	// rows are in the memory-mapped file, no need to cache them again
+	this->enable_cache(false);
+}
+
+std::string
+RayTracingMatrixWithPersistentCache::cache_key_(const ProjDataInfo& proj_data_info,
+	const DiscretisedDensity<3, float>& density_info) const
+{
+	const VoxelsOnCartesianGrid<float>* vox_ptr =
+		dynamic_cast<const VoxelsOnCartesianGrid<float>*>(&density_info);
+	if (!vox_ptr)
+		THROW("RayTracingMatrixWithPersistentCache: only VoxelsOnCartesianGrid images are supported");
+	std::ostringstream key;
+	key << std::setprecision(9);
+	key << sptr_matrix_->parameter_info();
+	key << proj_data_info.parameter_info();
+	key << "image min indices " << vox_ptr->get_min_indices()
+		<< " max indices " << vox_ptr->get_max_indices()
+		<< " voxel size " << vox_ptr->get_voxel_size()
+		<< " origin " << vox_ptr->get_origin() << '\n';
+	return key.str();
+}
+
+void
+RayTracingMatrixWithPersistentCache::write_store_(const ProjDataInfo& proj_data_info,
+	const std::string& key) const
+{
+	// list the basic bins, sorted
+	const DataSymmetriesForBins& symmetries = *sptr_matrix_->get_symmetries_ptr();
+	std::vector<Bin> bins;
+	for (int seg = proj_data_info.get_min_segment_num(); seg <= proj_data_info.get_max_segment_num(); seg++)
+		for (int view = proj_data_info.get_min_view_num(); view <= proj_data_info.get_max_view_num(); view++)
+			for (int ax = proj_data_info.get_min_axial_pos_num(seg); ax <= proj_data_info.get_max_axial_pos_num(seg); ax++)
+				for (int tang = proj_data_info.get_min_tangential_pos_num(); tang <= proj_data_info.get_max_tangential_pos_num(); tang++) {
+					Bin bin(seg, view, ax, tang);
+					if (symmetries.is_basic(bin))
+						bins.push_back(bin);
+				}
+
+	// compute their rows
+	std::vector<std::vector<ProjMatrixElemsForOneBinValue> > rows(bins.size());
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long long i = 0; i < (long long)bins.size(); i++) {
+		ProjMatrixElemsForOneBin elems(bins[size_t(i)]);
+		sptr_matrix_->get_proj_matrix_elems_for_one_bin(elems, bins[size_t(i)]);
+		rows[size_t(i)].assign(elems.begin(), elems.end());
+	}
+
+	// write to a temporary file, then rename, so that other processes never see a partial file
+	const boost::filesystem::path tmp = boost::filesystem::unique_path(filename_ + ".%%%%-%%%%-%%%%.tmp");
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::binary);
+		if (!out)
+			THROW("RayTracingMatrixWithPersistentCache: could not write " + tmp.string());
+		const uint64_t key_size = key.size();
+		const std::vector<char> key_padding(padded_to_8(key.size()) - key.size(), 0);
+		uint64_t num_elems = 0;
+		for (size_t i = 0; i < rows.size(); i++)
+			num_elems += rows[i].size();
+		const uint64_t num_bins = bins.size();
+		out.write(MATRIX_CACHE_MAGIC, sizeof(MATRIX_CACHE_MAGIC));
+		out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+		out.write(key.data(), key.size());
+		out.write(key_padding.data(), key_padding.size());
+		out.write(reinterpret_cast<const char*>(&num_bins), sizeof(num_bins));
+		out.write(reinterpret_cast<const char*>(&num_elems), sizeof(num_elems));
+		for (size_t i = 0; i < bins.size(); i++) {
+			const int32_t b[4] = { int32_t(bins[i].segment_num()), int32_t(bins[i].view_num()),
+				int32_t(bins[i].axial_pos_num()), int32_t(bins[i].tangential_pos_num()) };
+			out.write(reinterpret_cast<const char*>(b), sizeof(b));
+		}
+		uint64_t row_start = 0;
+		out.write(reinterpret_cast<const char*>(&row_start), sizeof(row_start));
+		for (size_t i = 0; i < rows.size(); i++) {
+			row_start += rows[i].size();
+			out.write(reinterpret_cast<const char*>(&row_start), sizeof(row_start));
+		}
+		for (size_t i = 0; i < rows.size(); i++)
+			for (size_t j = 0; j < rows[i].size(); j++) {
+				const int32_t c[3] = { int32_t(rows[i][j].coord1()),
+					int32_t(rows[i][j].coord2()), int32_t(rows[i][j].coord3()) };
+				out.write(reinterpret_cast<const char*>(c), sizeof(c));
+			}
+		for (size_t i = 0; i < rows.size(); i++)
+			for (size_t j = 0; j < rows[i].size(); j++) {
+				const float v = rows[i][j].get_value();
+				out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+			}
+		if (!out)
+			THROW("RayTracingMatrixWithPersistentCache: could not write " + tmp.string());
+	}
+	boost::filesystem::rename(tmp, filename_);
+}
+
+void
+RayTracingMatrixWithPersistentCache::set_up(
+	const shared_ptr<const ProjDataInfo>& proj_data_info_sptr,
+	const shared_ptr<const DiscretisedDensity<3, float> >& density_info_sptr)
+{
+	sptr_matrix_->set_up(proj_data_info_sptr, density_info_sptr);
+	this->symmetries_sptr.reset(sptr_matrix_->get_symmetries_ptr()->clone());
+	ProjMatrixByBin::set_up(proj_data_info_sptr, density_info_sptr);
+
+	sptr_store_.reset();
+	filename_.clear();
+#if STIR_VERSION >= 060000
+	// time-of-flight bins are not stored
+	if (proj_data_info_sptr->get_num_tof_poss() > 1)
+		return;
+#endif
+
+	// the file name is derived from a (FNV-1a) hash of the key, the key itself is stored in the file
+	const std::string key = cache_key_(*proj_data_info_sptr, *density_info_sptr);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < key.size(); i++) {
+		hash ^= uint64_t((unsigned char)key[i]);
+		hash *= 1099511628211ULL;
+	}
+	std::ostringstream name;
+	name << "ray_tracing_matrix_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+	boost::filesystem::create_directories(cache_dir_);
+	filename_ = (boost::filesystem::path(cache_dir_) / name.str()).string();
+
+	sptr_store_ = Store::open(filename_, key);
+	if (!sptr_store_.get()) {
+		write_store_(*proj_data_info_sptr, key);
+		sptr_store_ = Store::open(filename_, key);
+		if (!sptr_store_.get())
+			THROW("RayTracingMatrixWithPersistentCache: could not read " + filename_);
+	}
+}
+
+void
+RayTracingMatrixWithPersistentCache::calculate_proj_matrix_elems_for_one_bin
+(ProjMatrixElemsForOneBin& elems) const
+{
+	if (sptr_store_.get() && sptr_store_->get_row(elems))
+		return;
+	const Bin bin = elems.get_bin();
+	sptr_matrix_->get_proj_matrix_elems_for_one_bin(elems, bin);
+}
+
+Succeeded
+xSTIR_FBP2DReconstruction::process(const PETDynamicAcquisitionData& ad)
+{
+	const int nf = ad.get_num_frames();
+	if (nf < 1)
+		THROW("xSTIR_FBP2DReconstruction::process: no frames to reconstruct");
+	shared_ptr<STIRImageData> sptr_templ = _sptr_image_data;
+	if (!_is_set_up) {
+		set_input_data(ad.frame(0).data());
+		shared_ptr<Image3DF> sptr_image(construct_target_image_ptr());
+		sptr_templ.reset(new STIRImageData(sptr_image));
+	}
+	_sptr_dyn_image_data.reset(new STIRDynamicImageData(*sptr_templ, nf));
+
+	// one copy of this reconstructor per thread, set up before the frames are shared out
+	int num_workers = 1;
+#ifdef STIR_OPENMP
+	num_workers = std::min(nf, omp_get_max_threads());
+#endif
+	std::vector<std::unique_ptr<xSTIR_FBP2DReconstruction> > workers;
+	for (int w = 0; w < num_workers; w++) {
+		workers.emplace_back(new xSTIR_FBP2DReconstruction(*this));
+		xSTIR_FBP2DReconstruction& worker = *workers.back();
+		worker.own_back_projector_();
+		worker.set_input_data(ad.frame(0).data());
+		if (worker.Reconstruction<Image3DF>::set_up
+			(_sptr_dyn_image_data->frame(0).data_sptr()) != Succeeded::yes)
+			return Succeeded::no;
+	}
+
+	std::vector<int> done(nf, 0);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(num_workers)
+#endif
+	for (int f = 0; f < nf; f++) {
+		int w = 0;
+#ifdef STIR_OPENMP
+		w = omp_get_thread_num();
+#endif
+		xSTIR_FBP2DReconstruction& worker = *workers[w];
+		STIRImageData& frame = _sptr_dyn_image_data->frame(f);
+		try {
+			worker.set_input_data(ad.frame(f).data());
+			done[f] = (worker.reconstruct(frame.data_sptr()) == Succeeded::yes);
+		}
+		catch (...) {
+		}
+		frame.mark_modified();
+	}
+	_sptr_dyn_image_data->mark_modified();
+	for (int f = 0; f < nf; f++)
+		if (!done[f])
+			return Succeeded::no;
+	return Succeeded::yes;
+}
+
+void
+xSTIR_FBP2DReconstruction::own_back_projector_()
+{
+	// the back projector accumulates the back projection, so it cannot be shared
+	// by concurrent reconstructions; it is recreated from its parameters
+	std::istringstream parameters(back_projector_sptr->parameter_info());
+	back_projector_sptr.reset(BackProjectorByBin::read_registered_object
+		(&parameters, back_projector_sptr->get_registered_name()));
+	if (is_null_ptr(back_projector_sptr))
+		THROW("xSTIR_FBP2DReconstruction: could not copy the back projector");
+}
+
+// Klein-Nishina total cross section (in units of the classical electron
+// radius squared) of photons of the given energy in keV
+static double
+total_Compton_cross_section_(double energy)
+{
+	const double a = energy / 511.0;
+	const double l = std::log(1 + 2 * a);
+	return 2 * _PI*((1 + a) / (a*a)*(2 * (1 + a) / (1 + 2 * a) - l / a)
+		+ l / (2 * a) - (1 + 3 * a) / ((1 + 2 * a)*(1 + 2 * a)));
+}
+
+void
+PETSingleScatterEngine::Volume::set(const STIRImageData& image)
+{
+	const Voxels3DF& voxels = dynamic_cast<const Voxels3DF&>(image.data());
+	const int min_z = voxels.get_min_index();
+	const int max_z = voxels.get_max_index();
+	const int min_y = voxels[min_z].get_min_index();
+	const int max_y = voxels[min_z].get_max_index();
+	const int min_x = voxels[min_z][min_y].get_min_index();
+	const int max_x = voxels[min_z][min_y].get_max_index();
+	nx = max_x - min_x + 1;
+	ny = max_y - min_y + 1;
+	nz = max_z - min_z + 1;
+	const CartesianCoordinate3D<float>& size = voxels.get_voxel_size();
+	const CartesianCoordinate3D<float>& origin = voxels.get_origin();
+	dx = size.x();
+	dy = size.y();
+	dz = size.z();
+	x0 = origin.x() + min_x*dx;
+	y0 = origin.y() + min_y*dy;
+	// the centre of the scanner is in the middle of the image planes
+	// (shifted by the z-origin), as for the STIR projectors
+	z0 = origin.z() - 0.5f*(max_z - min_z)*dz;
+	values.resize(size_t(nx)*ny*nz);
+	size_t i = 0;
+	for (int z = min_z; z <= max_z; z++)
+		for (int y = min_y; y <= max_y; y++)
+			for (int x = min_x; x <= max_x; x++)
+				values[i++] = voxels[z][y][x];
+}
+
+float
+PETSingleScatterEngine::Volume::line_integral(const float* a, const float* b) const
+{
+	// clip the segment to the image box
+	const float first[3] = { x0, y0, z0 };
+	const float step[3] = { dx, dy, dz };
+	const int n[3] = { nx, ny, nz };
+	double t0 = 0;
+	double t1 = 1;
+	for (int i = 0; i < 3; i++) {
+		const double lo = first[i] - 0.5*step[i];
+		const double hi = first[i] + (n[i] - 0.5)*step[i];
+		const double d = b[i] - a[i];
+		if (std::abs(d) < 1e-9) {
+			if (a[i] < lo || a[i] > hi)
+				return 0;
+			continue;
+		}
+		double ta = (lo - a[i]) / d;
+		double tb = (hi - a[i]) / d;
+		if (ta > tb)
+			std::swap(ta, tb);
+		t0 = std::max(t0, ta);
+		t1 = std::min(t1, tb);
+	}
+	if (t1 <= t0)
+		return 0;
+
+	// sample the nearest voxels at half the smallest voxel size
+	const double d[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	const double length = (t1 - t0)*std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	const int num_samples = std::max(1, int(std::ceil(2 * length / std::min(dx, std::min(dy, dz)))));
+	double sum = 0;
+	for (int k = 0; k < num_samples; k++) {
+		const double t = t0 + (k + 0.5)*(t1 - t0) / num_samples;
+		int j[3];
+		for (int i = 0; i < 3; i++) {
+			j[i] = int(std::lround((a[i] + t*d[i] - first[i]) / step[i]));
+			j[i] = std::min(std::max(j[i], 0), n[i] - 1);
+		}
+		sum += at(j[0], j[1], j[2]);
+	}
+	return float(sum*length / num_samples);
+}
+
+void
+PETSingleScatterEngine::set_up(shared_ptr<const PETAcquisitionData> sptr_acq_template)
+{
+	sptr_acq_template_ = sptr_acq_template;
+	clear_cache_();
+
+	const ProjDataInfo& pdi = *sptr_acq_template->get_proj_data_info_sptr();
+	const Scanner& scanner = *pdi.get_scanner_ptr();
+	const float radius = scanner.get_effective_ring_radius();
+	const int num_dets = scanner.get_num_detectors_per_ring();
+	const float ring_spacing = scanner.get_ring_spacing();
+
+	// energy window and resolution
+	float low = low_energy_thres_;
+	float high = high_energy_thres_;
+	if (low < 0 || high <= low) {
+		low = sptr_acq_template->get_exam_info_sptr()->get_low_energy_thres();
+		high = sptr_acq_template->get_exam_info_sptr()->get_high_energy_thres();
+	}
+	if (low < 0 || high <= low)
+		THROW("PETSingleScatterEngine::set_up: energy window not set");
+	const float resolution = energy_resolution_ > 0 ?
+		energy_resolution_ : scanner.get_energy_resolution();
+	if (resolution <= 0)
+		THROW("PETSingleScatterEngine::set_up: energy resolution not set");
+	const double ref_energy = scanner.get_reference_energy() > 0 ?
+		scanner.get_reference_energy() : 511.0;
+	auto efficiency = [&](double energy) {
+		const double sigma_times_sqrt2 =
+			std::sqrt(2 * energy*ref_energy)*resolution / 2.35482;
+		return 0.5*(std::erf((high - energy) / sigma_times_sqrt2)
+			- std::erf((low - energy) / sigma_times_sqrt2));
+	};
+	const double efficiency_511 = efficiency(511.0);
+	if (efficiency_511 <= 0)
+		THROW("PETSingleScatterEngine::set_up: 511 keV is outside the energy window");
+
+	const int table_size = 2001;
+	const double sigma_511 = total_Compton_cross_section_(511.0);
+	kn_table_.resize(table_size);
+	sigma_table_.resize(table_size);
+	for (int i = 0; i < table_size; i++) {
+		const double cos_theta = -1 + 2.0*i / (table_size - 1);
+		const double p = 1 / (2 - cos_theta); // scattered to initial energy
+		const double energy = 511.0*p;
+		const double dif_cross_section =
+			0.5*p*p*(p + 1 / p - 1 + cos_theta*cos_theta);
+		kn_table_[i] = float(dif_cross_section / sigma_511
+			* efficiency(energy) / efficiency_511);
+		sigma_table_[i] = float(total_Compton_cross_section_(energy) / sigma_511);
+	}
+
+	// the detectors are the LOR end points, merged on a grid of one detector
+	// by half a ring
+	detectors_.clear();
+	bin_detectors_.clear();
+	viewgrams_.clear();
+	std::map<std::pair<int, int>, uint32_t> detector_index;
+	auto detector = [&](const CartesianCoordinate3D<float>& c) {
+		int a = int(std::lround(std::atan2(c.y(), c.x())*num_dets / (2 * _PI)));
+		a = (a % num_dets + num_dets) % num_dets;
+		const std::pair<int, int> key(int(std::lround(2 * c.z() / ring_spacing)), a);
+		std::map<std::pair<int, int>, uint32_t>::const_iterator it =
+			detector_index.find(key);
+		if (it != detector_index.end())
+			return it->second;
+		const float r = std::sqrt(c.x()*c.x() + c.y()*c.y());
+		Detector d = { c.x(), c.y(), c.z(), -c.x() / r, -c.y() / r };
+		detectors_.push_back(d);
+		const uint32_t i = uint32_t(detectors_.size() - 1);
+		detector_index[key] = i;
+		return i;
+	};
+	LORInAxialAndNoArcCorrSinogramCoordinates<float> lor;
+	LORAs2Points<float> end_points;
+	for (int seg = pdi.get_min_segment_num(); seg <= pdi.get_max_segment_num(); seg++) {
+		for (int view = pdi.get_min_view_num(); view <= pdi.get_max_view_num(); view++) {
+			ViewgramBins vb = { seg, view, bin_detectors_.size() };
+			viewgrams_.push_back(vb);
+			for (int ax = pdi.get_min_axial_pos_num(seg); ax <= pdi.get_max_axial_pos_num(seg); ax++) {
+				for (int tang = pdi.get_min_tangential_pos_num();
+					tang <= pdi.get_max_tangential_pos_num(); tang++) {
+					pdi.get_LOR(lor, Bin(seg, view, ax, tang));
+					if (lor.get_intersections_with_cylinder(end_points, radius) == Succeeded::no)
+						THROW("PETSingleScatterEngine::set_up: LOR outside the scanner");
+					const uint32_t a = detector(end_points.p1());
+					bin_detectors_.push_back(std::make_pair(a, detector(end_points.p2())));
+				}
+			}
+		}
+	}
+}
+
+void
+PETSingleScatterEngine::update_attenuation_cache_()
+{
+	if (!sptr_acq_template_.get())
+		THROW("PETSingleScatterEngine: set_up() must be called first");
+	if (!sptr_att_image_.get())
+		THROW("PETSingleScatterEngine: attenuation image not set");
+	if (att_version_ != 0 && att_version_ == sptr_att_image_->version())
+		return;
+
+	ScopedTimer timer("PETSingleScatterEngine::update_attenuation_cache");
+	Volume mu;
+	mu.set(*sptr_att_image_);
+	const int step = scatter_point_step_;
+	points_.clear();
+	for (int z = step / 2; z < mu.nz; z += step)
+		for (int y = step / 2; y < mu.ny; y += step)
+			for (int x = step / 2; x < mu.nx; x += step) {
+				const float v = mu.at(x, y, z);
+				if (v < attenuation_threshold_ || v <= 0)
+					continue;
+				// cm^-1 to mm^-1
+				ScatterPoint p = { mu.centre_x(x), mu.centre_y(y), mu.centre_z(z), 0.1f*v };
+				points_.push_back(p);
+			}
+	point_volume_ = step*step*step*mu.dx*mu.dy*mu.dz;
+
+	const long long num_points = (long long)points_.size();
+	const size_t num_dets = detectors_.size();
+	att_integrals_.assign(num_points*num_dets, 0.0f);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long long p = 0; p < num_points; p++) {
+		const float s[3] = { points_[p].x, points_[p].y, points_[p].z };
+		float* att = &att_integrals_[p*num_dets];
+		for (size_t d = 0; d < num_dets; d++) {
+			const float t[3] = { detectors_[d].x, detectors_[d].y, detectors_[d].z };
+			att[d] = 0.1f*mu.line_integral(s, t);
+		}
+	}
+	att_version_ = sptr_att_image_->version();
+	Profiler::count_allocation("PETSingleScatterEngine::update_attenuation_cache",
+		att_integrals_.size()*sizeof(float));
+}
+
+void
+PETSingleScatterEngine::compute_activity_integrals_(const STIRImageData& activity,
+	std::vector<float>& integrals) const
+{
+	Volume act;
+	act.set(activity);
+	const long long num_points = (long long)points_.size();
+	const size_t num_dets = detectors_.size();
+	integrals.assign(num_points*num_dets, 0.0f);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long long p = 0; p < num_points; p++) {
+		const float s[3] = { points_[p].x, points_[p].y, points_[p].z };
+		float* emis = &integrals[p*num_dets];
+		for (size_t d = 0; d < num_dets; d++) {
+			const float t[3] = { detectors_[d].x, detectors_[d].y, detectors_[d].z };
+			emis[d] = act.line_integral(s, t);
+		}
+	}
+}
+
+void
+PETSingleScatterEngine::simulate_(PETAcquisitionData& ad,
+	const std::vector<float>& act_integrals) const
+{
+	const ProjDataInfo& pdi = *sptr_acq_template_->get_proj_data_info_sptr();
+	if (*ad.get_proj_data_info_sptr() != pdi)
+		THROW("PETSingleScatterEngine::forward: acquisition data do not match the template");
+	shared_ptr<ProjData> sptr_pd = ad.data();
+	const size_t num_points = points_.size();
+	const size_t num_dets = detectors_.size();
+	const int table_max = int(kn_table_.size()) - 1;
+	const int num_viewgrams = int(viewgrams_.size());
+	bool failed = false;
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(||:failed)
+#endif
+	for (int i = 0; i < num_viewgrams; i++) {
+		const ViewgramBins& vb = viewgrams_[i];
+		Viewgram<float> viewgram = sptr_pd->get_empty_viewgram(vb.view, vb.segment);
+		size_t bin = vb.first_bin;
+		for (int ax = viewgram.get_min_axial_pos_num(); ax <= viewgram.get_max_axial_pos_num(); ax++) {
+			for (int tang = viewgram.get_min_tangential_pos_num();
+				tang <= viewgram.get_max_tangential_pos_num(); tang++, bin++) {
+				const uint32_t ia = bin_detectors_[bin].first;
+				const uint32_t ib = bin_detectors_[bin].second;
+				const Detector& a = detectors_[ia];
+				const Detector& b = detectors_[ib];
+				double sum = 0;
+				for (size_t p = 0; p < num_points; p++) {
+					const float* emis = &act_integrals[p*num_dets];
+					if (emis[ia] == 0 && emis[ib] == 0)
+						continue;
+					const ScatterPoint& s = points_[p];
+					// vectors from the detectors to the scatter point
+					const float xa = s.x - a.x, ya = s.y - a.y, za = s.z - a.z;
+					const float xb = s.x - b.x, yb = s.y - b.y, zb = s.z - b.z;
+					const float ra2 = xa*xa + ya*ya + za*za;
+					const float rb2 = xb*xb + yb*yb + zb*zb;
+					const float ra = std::sqrt(ra2);
+					const float rb = std::sqrt(rb2);
+					const float cos_a = (xa*a.nx + ya*a.ny) / ra;
+					const float cos_b = (xb*b.nx + yb*b.ny) / rb;
+					if (cos_a <= 0 || cos_b <= 0)
+						continue;
+					const float cos_theta = -(xa*xb + ya*yb + za*zb) / (ra*rb);
+					const int k = std::min(std::max(
+						int(std::lround((cos_theta + 1)*0.5f*table_max)), 0), table_max);
+					const float* att = &att_integrals_[p*num_dets];
+					const float sigma = sigma_table_[k];
+					sum += s.mu*kn_table_[k] * cos_a*cos_b / (ra2*rb2)*
+						(emis[ia] * std::exp(-att[ia] - sigma*att[ib]) +
+						emis[ib] * std::exp(-att[ib] - sigma*att[ia]));
+				}
+				const float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+				viewgram[ax][tang] = float(sum*point_volume_*(dx*dx + dy*dy + dz*dz));
+			}
+		}
+#ifdef STIR_OPENMP
+#pragma omp critical(PETSingleScatterEngine_set_viewgram)
+#endif
+		if (sptr_pd->set_viewgram(viewgram) != Succeeded::yes)
+			failed = true;
+	}
+	if (failed)
+		THROW("PETSingleScatterEngine::forward: failed to write the scatter estimate");
+}
+
+shared_ptr<PETAcquisitionData>
+PETSingleScatterEngine::forward(const STIRImageData& activity)
+{
+	if (!sptr_acq_template_.get())
+		THROW("PETSingleScatterEngine: set_up() must be called first");
+	shared_ptr<PETAcquisitionData> sptr_ad = sptr_acq_template_->new_acquisition_data();
+	forward(*sptr_ad, activity);
+	return sptr_ad;
+}
+
+void
+PETSingleScatterEngine::forward(PETAcquisitionData& ad, const STIRImageData& activity)
+{
+	ScopedTimer timer("PETSingleScatterEngine::forward");
+	update_attenuation_cache_();
+	std::vector<float> act_integrals;
+	compute_activity_integrals_(activity, act_integrals);
+	simulate_(ad, act_integrals);
+	ad.mark_modified();
+}
+
+shared_ptr<PETDynamicAcquisitionData>
+PETSingleScatterEngine::forward(const STIRDynamicImageData& activity)
+{
+	if (!sptr_acq_template_.get())
+		THROW("PETSingleScatterEngine: set_up() must be called first");
+	shared_ptr<PETDynamicAcquisitionData> sptr_ad(new PETDynamicAcquisitionData
+		(*sptr_acq_template_, activity.get_num_frames()));
+	forward(*sptr_ad, activity);
+	return sptr_ad;
+}
+
+void
+PETSingleScatterEngine::forward(PETDynamicAcquisitionData& ad, const STIRDynamicImageData& activity)
+{
+	if (ad.get_num_frames() != activity.get_num_frames())
+		THROW("PETSingleScatterEngine::forward: numbers of frames differ");
+	for (int f = 0; f < ad.get_num_frames(); f++)
+		forward(ad.frame(f), activity.frame(f));
+	ad.mark_modified();
 }
@@ -31,10 +31,15 @@ limitations under the License.
 #include <fstream>
 #include <string>
 
+#include <boost/filesystem.hpp>
+
 #include "stir/common.h"
 #include "stir/IO/stir_ecat_common.h"
 
 #include "sirf/STIR/stir_x.h"
+#include "sirf/common/ImagePrior.h"
+#include "sirf/common/Profiler.h"
+#include "sirf/common/SnapshotWriter.h"
 
 #include "getenv.h"
 #include "object.h"
@@ -248,6 +253,295 @@ int test1()
 			std::cout << sim_norm << " > " << bound << " failure!\n";
 		fail = fail || !ok;
 
+		// the norm is cached, and subset norms computed together are cached as well
+		std::cout << "checking the cached acquisition model norms: ";
+		std::vector<float> subset_norms = am.subset_norms(2);
+		ok = (am.norm() == am_norm && subset_norms.size() == 2 &&
+			subset_norms[0] > 0 && subset_norms[0] == am.norm(0, 2) &&
+			subset_norms[1] > 0 && subset_norms[1] == am.norm(1, 2));
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the cached norm is recomputed if the model is modified in place
+		std::cout << "checking that the cached norm follows in-place changes of the attenuation image: ";
+		{
+			CREATE_OBJECT(PETAcquisitionModel, PETAcquisitionModelUsingMatrix,
+				am_att, sptr_am_att,);
+			am_att.set_matrix(sptr_matrix);
+			shared_ptr<STIRImageData> sptr_mu(image_data.new_image_data());
+			sptr_mu->fill(0.0f);
+			shared_ptr<PETAttenuationModel> sptr_att(new PETAttenuationModel(sptr_mu, am));
+			am_att.set_asm(sptr_att);
+			am_att.set_up(sptr_ad, sptr_id);
+			float att_norm = am_att.norm();
+			ok = (am_att.norm() == att_norm);
+			sptr_mu->fill(0.01f);
+			float att_norm_mod = am_att.norm();
+			ok = ok && (att_norm_mod < att_norm);
+			std::cout << att_norm << " -> " << att_norm_mod << (ok ? " ok!\n" : " failure!\n");
+		}
+		fail = fail || !ok;
+
+		// the ray tracing matrix stored in the persistent cache gives the same projection
+		std::cout << "checking the persistent ray tracing matrix cache: ";
+		CREATE_OBJECT(PETAcquisitionModel, PETAcquisitionModelUsingMatrix,
+			am_plain, sptr_am_plain,);
+		am_plain.set_matrix(sptr_matrix);
+		am_plain.set_up(sptr_ad, sptr_id);
+		CREATE_OBJECT(PETAcquisitionModel, PETAcquisitionModelUsingMatrix,
+			am_cached, sptr_am_cached,);
+		am_cached.set_matrix(sptr_matrix);
+		const boost::filesystem::path matrix_cache_dir =
+			boost::filesystem::temp_directory_path() /
+			boost::filesystem::unique_path("sirf_matrix_cache_%%%%-%%%%-%%%%");
+		am_cached.set_matrix_cache_directory(matrix_cache_dir.string());
+		am_cached.set_up(sptr_ad, sptr_id);
+		am_cached.set_up(sptr_ad, sptr_id); // second time the cache file is used
+		shared_ptr<PETAcquisitionData> sptr_cd = am_cached.forward(image_data);
+		alpha = 1.0;
+		beta = -1.0;
+		acq_diff.axpby(&alpha, *sptr_cd, &beta, *am_plain.forward(image_data));
+		ok = (acq_diff.norm() <= 1e-5*sptr_cd->norm());
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+		// release the memory-mapped cache file before removing it
+		sptr_am_cached.reset();
+		boost::filesystem::remove_all(matrix_cache_dir);
+
+		// projecting onto subset-compact data gives the same result as projecting a subset
+		std::cout << "checking the subset acquisition data: ";
+		shared_ptr<PETAcquisitionData> sptr_fs = am.forward(image_data, 1, 4, true);
+		shared_ptr<PETSubsetAcquisitionData> sptr_subset = am.forward_subset(image_data, 1, 4, true);
+		shared_ptr<PETAcquisitionData> sptr_full = acq_data.new_acquisition_data();
+		sptr_full->fill(0.0f);
+		sptr_subset->copy_to(*sptr_full);
+		acq_diff.axpby(&alpha, *sptr_full, &beta, *sptr_fs);
+		ok = (sptr_subset->size() < sinos*views*tangs &&
+			acq_diff.norm() <= 1e-5*sptr_fs->norm());
+		shared_ptr<STIRImageData> sptr_bs = am.backward(*sptr_fs, 1, 4);
+		shared_ptr<STIRImageData> sptr_bsd = am.backward(*sptr_subset);
+		img_diff.axpby(&alpha, *sptr_bsd, &beta, *sptr_bs);
+		ok = ok && (img_diff.norm() <= 1e-5*sptr_bs->norm());
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the frames of dynamic data are projected together as they would be one by one
+		std::cout << "checking the dynamic data projection: ";
+		STIRDynamicImageData dyn_image(image_data, 3);
+		for (int f = 0; f < 3; f++) {
+			float scale = f + 1.0f;
+			float zero = 0.0f;
+			dyn_image.frame(f).axpby(&scale, image_data, &zero, image_data);
+		}
+		shared_ptr<PETDynamicAcquisitionData> sptr_dyn_ad = am.forward(dyn_image, true);
+		shared_ptr<STIRDynamicImageData> sptr_dyn_bd = am.backward(*sptr_dyn_ad);
+		ok = (sptr_dyn_ad->get_num_frames() == 3 && sptr_dyn_bd->get_num_frames() == 3);
+		// projecting into existing frames marks them as modified
+		const uint64_t ad_frame_version = sptr_dyn_ad->frame(1).version();
+		const uint64_t bd_frame_version = sptr_dyn_bd->frame(1).version();
+		am.forward(*sptr_dyn_ad, dyn_image, true);
+		am.backward(*sptr_dyn_bd, *sptr_dyn_ad);
+		ok = ok && (sptr_dyn_ad->frame(1).version() != ad_frame_version &&
+			sptr_dyn_bd->frame(1).version() != bd_frame_version);
+		for (int f = 0; ok && f < 3; f++) {
+			shared_ptr<PETAcquisitionData> sptr_fd = am.forward(dyn_image.frame(f), 0, 1, true);
+			acq_diff.axpby(&alpha, sptr_dyn_ad->frame(f), &beta, *sptr_fd);
+			ok = (acq_diff.norm() <= 1e-4*sptr_fd->norm());
+			shared_ptr<STIRImageData> sptr_fb = am.backward(*sptr_fd);
+			img_diff.axpby(&alpha, sptr_dyn_bd->frame(f), &beta, *sptr_fb);
+			ok = ok && (img_diff.norm() <= 1e-4*sptr_fb->norm());
+		}
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the frames reconstructed together by FBP2D are those reconstructed one by one
+		std::cout << "checking the FBP2D reconstruction of dynamic data: ";
+		xSTIR_FBP2DReconstruction fbp;
+		fbp.set_input(sptr_dyn_ad->frame(0));
+		fbp.set_up(sptr_id);
+		ok = (fbp.process(*sptr_dyn_ad) == Succeeded::yes &&
+			fbp.get_dynamic_output()->get_num_frames() == 3);
+		for (int f = 0; ok && f < 3; f++) {
+			fbp.set_input(sptr_dyn_ad->frame(f));
+			ok = (fbp.process() == Succeeded::yes);
+			img_diff.axpby(&alpha, fbp.get_dynamic_output()->frame(f), &beta, *fbp.get_output());
+			ok = ok && (img_diff.norm() <= 1e-4*fbp.get_output()->norm());
+		}
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// memoised projections are reused only while the projected data are unchanged
+		std::cout << "checking the memoisation of projections: ";
+		shared_ptr<STIRImageData> sptr_mi(image_data.clone());
+		uint64_t version = sptr_mi->version();
+		am.set_memoisation(true);
+		shared_ptr<PETAcquisitionData> sptr_m1 = am.forward(*sptr_mi);
+		shared_ptr<PETAcquisitionData> sptr_m2 = am.forward(*sptr_mi);
+		acq_diff.axpby(&alpha, *sptr_m2, &beta, *sptr_m1);
+		ok = (acq_diff.norm() == 0);
+		sptr_mi->scale(0.5f);
+		ok = ok && (sptr_mi->version() != version);
+		sptr_m2 = am.forward(*sptr_mi);
+		am.set_memoisation(false);
+		shared_ptr<PETAcquisitionData> sptr_m3 = am.forward(*sptr_mi);
+		acq_diff.axpby(&alpha, *sptr_m2, &beta, *sptr_m3);
+		ok = ok && (acq_diff.norm() <= 1e-5*sptr_m3->norm());
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// memoised projections are not reused once the attenuation image is changed in place
+		std::cout << "checking the memoisation of projections with attenuation: ";
+		{
+			CREATE_OBJECT(PETAcquisitionModel, PETAcquisitionModelUsingMatrix,
+				am_mem, sptr_am_mem,);
+			am_mem.set_matrix(sptr_matrix);
+			shared_ptr<STIRImageData> sptr_mu(image_data.new_image_data());
+			sptr_mu->fill(0.0f);
+			am_mem.set_asm(shared_ptr<PETAttenuationModel>
+				(new PETAttenuationModel(sptr_mu, am_mem)));
+			am_mem.set_up(sptr_ad, sptr_id);
+			am_mem.set_memoisation(true);
+			shared_ptr<PETAcquisitionData> sptr_f1 = am_mem.forward(image_data);
+			shared_ptr<STIRImageData> sptr_b1 = am_mem.backward(*sptr_f1);
+			sptr_mu->fill(0.01f);
+			shared_ptr<PETAcquisitionData> sptr_f2 = am_mem.forward(image_data);
+			shared_ptr<STIRImageData> sptr_b2 = am_mem.backward(*sptr_f1);
+			ok = (sptr_f2->norm() < sptr_f1->norm() && sptr_b2->norm() < sptr_b1->norm());
+		}
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the quadratic image prior vanishes on constant images, and <R'(x), x> = 2R(x)
+		std::cout << "checking the quadratic image prior: ";
+		QuadraticImagePrior quad_prior;
+		shared_ptr<STIRImageData> sptr_pi(image_data.clone());
+		shared_ptr<STIRImageData> sptr_pg(image_data.clone());
+		sptr_pi->fill(2.0f);
+		quad_prior.gradient(*sptr_pg, *sptr_pi);
+		ok = (quad_prior.value(*sptr_pi) == 0 && sptr_pg->norm() == 0);
+		quad_prior.gradient(*sptr_pg, image_data);
+		float pg_dot_x;
+		sptr_pg->dot(image_data, &pg_dot_x);
+		const float prior_value = float(quad_prior.value(image_data));
+		ok = ok && (prior_value > 0 &&
+			std::abs(pg_dot_x - 2 * prior_value) <= 1e-4*prior_value);
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the profiler records the projections while it is on
+		std::cout << "checking the profiler: ";
+		const bool profiling = Profiler::enabled();
+		Profiler::instance().set_enabled(true);
+		Profiler::instance().reset();
+		am.forward(image_data);
+		Profiler::Record record = Profiler::instance().records()["PETAcquisitionModel::forward"];
+		ok = (record.calls == 1 && record.bytes > 0 && record.allocations == 1);
+		Profiler::instance().set_enabled(false);
+		am.forward(image_data);
+		record = Profiler::instance().records()["PETAcquisitionModel::forward"];
+		ok = ok && (record.calls == 1);
+		Profiler::instance().set_enabled(profiling);
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the single scatter estimate is linear in the activity, reuses the
+		// cached attenuation integrals and is the same for dynamic frames
+		std::cout << "checking the single scatter engine: ";
+		{
+			shared_ptr<PETAcquisitionData> sptr_sst =
+				acq_data.single_slice_rebinned_data(1, 4, 0, false);
+			shared_ptr<STIRImageData> sptr_mu(image_data.clone());
+			sptr_mu->fill(0.096f);
+			PETSingleScatterEngine sse;
+			sse.set_attenuation_image_sptr(sptr_mu);
+			sse.set_scatter_point_step(8);
+			sse.set_low_energy_threshold(425.0f);
+			sse.set_high_energy_threshold(650.0f);
+			sse.set_energy_resolution(0.25f);
+			sse.set_up(sptr_sst);
+			const bool profiling_sse = Profiler::enabled();
+			Profiler::instance().set_enabled(true);
+			Profiler::instance().reset();
+			shared_ptr<PETAcquisitionData> sptr_s1 = sse.forward(image_data);
+			const int num_scatter_points = sse.num_scatter_points();
+			shared_ptr<STIRImageData> sptr_a2(image_data.clone());
+			sptr_a2->scale(2.0f); // scale() divides
+			shared_ptr<PETAcquisitionData> sptr_s2 = sse.forward(*sptr_a2);
+			// a new activity does not recompute the attenuation integrals
+			Profiler::Record att_record = Profiler::instance().records()
+				["PETSingleScatterEngine::update_attenuation_cache"];
+			Profiler::instance().set_enabled(profiling_sse);
+			shared_ptr<PETAcquisitionData> sptr_sdiff = sptr_s1->new_acquisition_data();
+			float half = 0.5f;
+			float minus_one = -1.0f;
+			sptr_sdiff->axpby(&half, *sptr_s1, &minus_one, *sptr_s2);
+			ok = (num_scatter_points > 0 && sse.num_scatter_points() == num_scatter_points &&
+				sptr_s1->norm() > 0 && sptr_sdiff->norm() <= 1e-5*sptr_s1->norm());
+			ok = ok && (att_record.calls == 1 && att_record.allocations == 1);
+			STIRDynamicImageData dyn_activity(image_data, 2);
+			float zero = 0.0f;
+			dyn_activity.frame(1).axpby(&half, image_data, &zero, image_data);
+			shared_ptr<PETDynamicAcquisitionData> sptr_ds = sse.forward(dyn_activity);
+			sptr_sdiff->axpby(&alpha, sptr_ds->frame(1), &beta, *sptr_s2);
+			ok = ok && (sptr_sdiff->norm() <= 1e-5*sptr_s2->norm());
+			sptr_mu->fill(0.0f);
+			ok = ok && (sse.forward(image_data)->norm() == 0);
+		}
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the snapshot is taken when write() is called, so later changes
+		// to the image do not get to the file
+		std::cout << "checking the snapshot writer: ";
+		const boost::filesystem::path snapshot_dir =
+			boost::filesystem::temp_directory_path() /
+			boost::filesystem::unique_path("sirf_snapshot_test_%%%%-%%%%-%%%%");
+		boost::filesystem::create_directories(snapshot_dir);
+		const std::string snapshot_1 = (snapshot_dir / "snapshot_test_1.hv").string();
+		const std::string snapshot_2 = (snapshot_dir / "snapshot_test_2.hv").string();
+		shared_ptr<STIRImageData> sptr_si(image_data.clone());
+		const float si_norm = sptr_si->norm();
+		SnapshotWriter snapshot_writer(1);
+		SnapshotWriter::Completion c1 =
+			snapshot_writer.write(*sptr_si, snapshot_1);
+		sptr_si->scale(0.5f); // scale() divides
+		snapshot_writer.write(*sptr_si, snapshot_2);
+		sptr_si->fill(0.0f);
+		c1.get();
+		snapshot_writer.wait_all();
+		ok = (snapshot_writer.in_flight() == 0);
+		ok = ok && (std::abs(STIRImageData(snapshot_1).norm() - si_norm) <= 1e-5*si_norm);
+		ok = ok && (std::abs(STIRImageData(snapshot_2).norm() - 2*si_norm) <= 2e-5*si_norm);
+		boost::filesystem::remove_all(snapshot_dir);
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// 16-bit storage rounds the stored projections to 11 (half) or
+		// 8 (bfloat16) significant bits, the projector still works in float
+		std::cout << "checking the 16-bit storage: ";
+		shared_ptr<PETAcquisitionData> sptr_f32 = am.forward(image_data);
+		const float f32_norm = sptr_f32->norm();
+		// keep the projections within the range of half
+		shared_ptr<STIRImageData> sptr_hi(image_data.clone());
+		sptr_hi->scale(f32_norm);
+		PETAcquisitionDataInMemory::set_as_template(StoragePrecision::half);
+		shared_ptr<PETAcquisitionData> sptr_f16 = am.forward(*sptr_hi);
+		PETAcquisitionDataInMemory::set_as_template(StoragePrecision::bfloat16);
+		shared_ptr<PETAcquisitionData> sptr_b16 = am.forward(*sptr_hi);
+		ok = (PETAcquisitionData::storage_scheme() == "memory_bf16");
+		PETAcquisitionDataInMemory::set_as_template();
+		ok = ok && dynamic_cast<const ProjDataInHalfPrecision*>(sptr_f16->data().get()) &&
+			dynamic_cast<const ProjDataInHalfPrecision*>(sptr_b16->data().get());
+		shared_ptr<PETAcquisitionData> sptr_d16 = sptr_f32->new_acquisition_data();
+		float one = 1.0f;
+		float minus_scale = -1.0f / f32_norm;
+		sptr_d16->axpby(&one, *sptr_f16, &minus_scale, *sptr_f32);
+		ok = ok && (sptr_d16->norm() <= 1e-3f);
+		sptr_d16->axpby(&one, *sptr_b16, &minus_scale, *sptr_f32);
+		ok = ok && (sptr_d16->norm() <= 1e-2f);
+		std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
 		// restore the default storage scheme
 		PETAcquisitionDataInFile::set_as_template();
 
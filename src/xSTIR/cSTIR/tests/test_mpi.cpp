@@ -0,0 +1,147 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2021 University College London
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup PET
+\brief Tests of the distributed acquisition data, run with mpirun -np <n>.
+
+\author SyneRBI
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <mpi.h>
+
+#include "stir/common.h"
+
+#include "sirf/STIR/stir_x.h"
+#include "sirf/common/getenv.h"
+
+using namespace stir;
+using namespace sirf;
+
+static int test_mpi(int rank)
+{
+	try {
+		std::string SIRF_path = sirf::getenv("SIRF_PATH");
+		if (SIRF_path.length() < 1) {
+			std::cout << "SIRF_PATH not defined, cannot find data" << std::endl;
+			return 1;
+		}
+
+		TextWriter w; // create writer with no output
+		TextWriterHandle h;
+		h.set_information_channel(&w); // suppress STIR info output
+
+		bool ok;
+		bool fail = false;
+
+		std::string filename = SIRF_path + "/data/examples/PET/my_forward_projection.hs";
+		shared_ptr<PETAcquisitionData> sptr_ad(new PETAcquisitionDataInFile(filename.c_str()));
+		PETAcquisitionDataInMemory::set_as_template();
+
+		shared_ptr<STIRImageData> sptr_id(new STIRImageData(*sptr_ad));
+		STIRImageData& image_data = *sptr_id;
+		image_data.fill(1.0f);
+
+		shared_ptr<RayTracingMatrix> sptr_matrix(new RayTracingMatrix);
+		sptr_matrix->set_num_tangential_LORs(2);
+		PETAcquisitionModelUsingMatrix am;
+		am.set_matrix(sptr_matrix);
+		am.set_up(sptr_ad, sptr_id);
+
+		float alpha = 1.0f;
+		float beta = -1.0f;
+
+		// every process holds its part of the projection, the norm is that of the whole
+		if (rank == 0)
+			std::cout << "checking the distributed forward projection: ";
+		shared_ptr<PETAcquisitionData> sptr_fd = am.forward(image_data, 0, 1, true);
+		shared_ptr<PETDistributedAcquisitionData> sptr_dd =
+			am.forward_distributed(image_data, MPI_COMM_WORLD, true);
+		float fd_norm = sptr_fd->norm();
+		ok = (std::abs(sptr_dd->norm() - fd_norm) <= 1e-5*fd_norm);
+		shared_ptr<PETAcquisitionData> sptr_part = sptr_ad->new_acquisition_data();
+		sptr_part->fill(0.0f);
+		sptr_dd->copy_to(*sptr_part);
+		shared_ptr<PETDistributedAcquisitionData> sptr_dx = sptr_dd->new_distributed_acquisition_data();
+		sptr_dx->fill(*sptr_part);
+		float dot;
+		sptr_dd->dot(*sptr_dx, &dot);
+		ok = ok && (std::abs(dot - fd_norm*fd_norm) <= 1e-4*fd_norm*fd_norm);
+		if (rank == 0)
+			std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the back projections of the parts add up to the back projection of the whole
+		if (rank == 0)
+			std::cout << "checking the distributed back projection: ";
+		shared_ptr<STIRImageData> sptr_bd = am.backward(*sptr_fd);
+		shared_ptr<STIRImageData> sptr_bdd = am.backward(*sptr_dd);
+		shared_ptr<STIRImageData> sptr_diff = sptr_bd->new_image_data();
+		sptr_diff->axpby(&alpha, *sptr_bdd, &beta, *sptr_bd);
+		ok = (sptr_diff->norm() <= 1e-5*sptr_bd->norm());
+		if (rank == 0)
+			std::cout << (ok ? "ok!\n" : "failure!\n");
+		fail = fail || !ok;
+
+		// the processes write their parts into one file
+		if (rank == 0)
+			std::cout << "checking the distributed write: ";
+		const std::string written = "test_mpi_distributed_write";
+		sptr_dd->write(written + ".hs");
+		{
+			PETAcquisitionDataInFile ad_written((written + ".hs").c_str());
+			sptr_part->axpby(&alpha, ad_written, &beta, *sptr_fd);
+			ok = (sptr_part->norm() <= 1e-5*fd_norm);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+		if (rank == 0) {
+			std::remove((written + ".hs").c_str());
+			std::remove((written + ".s").c_str());
+			std::cout << (ok ? "ok!\n" : "failure!\n");
+		}
+		fail = fail || !ok;
+
+		return fail;
+	}
+	catch (...)
+	{
+		std::cout << "exception thrown\n";
+		return 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	MPI_Init(&argc, &argv);
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	int failed = test_mpi(rank);
+	int failed_anywhere;
+	MPI_Allreduce(&failed, &failed_anywhere, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	if (rank == 0)
+		std::cout << (failed_anywhere ? "some" : "no") << " tests failed\n";
+	MPI_Finalize();
+	return failed_anywhere == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -804,6 +804,12 @@ class AcquisitionData(DataContainer):
         scheme = 'memory':
             all acquisition data generated from now on will be kept in RAM
             (avoid if data is very large)
+        scheme = 'memory_fp16' or 'memory_bf16':
+            as 'memory', but the data are stored as 16-bit floating point
+            numbers (IEEE half or bfloat16), taking half the RAM; suitable
+            for data that do not need full float precision (e.g. additive
+            terms, attenuation and normalisation factors); TOF data are not
+            supported
         """
         try_calling(pystir.cSTIR_setAcquisitionDataStorageScheme(scheme))
 
@@ -1053,6 +1059,51 @@ class AcquisitionData(DataContainer):
 DataContainer.register(AcquisitionData)
 
 
+class SubsetAcquisitionData(DataContainer):
+    """Class for PET acquisition data restricted to the views of one subset.
+
+    Only the views forward-projected by AcquisitionModel.forward with the same
+    subset are stored (in memory), so that subset-based algorithms use memory
+    proportional to the subset size. Objects of this class are created by
+    AcquisitionModel methods get_subset_data and forward_subset.
+    """
+
+    def __init__(self):
+        """init."""
+        self.handle = None
+        self.name = 'SubsetAcquisitionData'
+
+    def __del__(self):
+        """del."""
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def same_object(self):
+        """See DataContainer method."""
+        return SubsetAcquisitionData()
+
+    def copy_to(self, ad):
+        """Copies the subset views into AcquisitionData ad.
+
+        The other views of ad are not changed.
+        """
+        assert_validity(ad, AcquisitionData)
+        try_calling(pystir.cSTIR_subsetAcquisitionDataCopyTo(
+            self.handle, ad.handle))
+
+    def as_acquisition_data(self, template):
+        """Returns AcquisitionData with zeros outside the subset views.
+
+        template: AcquisitionData with the same geometry.
+        """
+        ad = template.get_uniform_copy(0)
+        self.copy_to(ad)
+        return ad
+
+
+DataContainer.register(SubsetAcquisitionData)
+
+
 class ListmodeToSinograms(object):
     """
     Class for listmode-to-sinogram converter.
@@ -1440,6 +1491,17 @@ class AcquisitionModel(object):
             self.handle, 'AcquisitionModel', 'image_data_processor',
             processor.handle)
 
+    def set_memoisation(self, memoise=True):
+        """
+        Switches memoisation of forward and back projections on or off.
+
+        If on, the last forward projection of full data and the last back
+        projection are reused if called again for the same unmodified image
+        or acquisition data and the same subset. Off by default.
+        """
+        parms.set_int_par(
+            self.handle, 'AcquisitionModel', 'memoisation', int(memoise))
+
     def get_background_term(self):
         """Returns the background term b of the AcquisitionModel (F).
         """
@@ -1547,6 +1609,44 @@ class AcquisitionModel(object):
         try_calling(pystir.cSTIR_acquisitionModelBwdReplace(
                 self.handle, ad.handle, subset_num, num_subsets, out.handle))
 
+    def get_subset_data(self, ad, subset_num, num_subsets):
+        """Returns the views of ad in a subset as SubsetAcquisitionData.
+
+        The views are those computed by forward with the same subset.
+        ad: AcquisitionData or None (zero data returned).
+        """
+        sd = SubsetAcquisitionData()
+        if ad is None:
+            sd.handle = pystir.cSTIR_acquisitionModelSubsetData(
+                self.handle, None, subset_num, num_subsets)
+        else:
+            assert_validity(ad, AcquisitionData)
+            sd.handle = pystir.cSTIR_acquisitionModelSubsetData(
+                self.handle, ad.handle, subset_num, num_subsets)
+        check_status(sd.handle)
+        return sd
+
+    def forward_subset(self, image, subset_num, num_subsets):
+        """Returns the forward projection of image onto a subset of views.
+
+        Unlike forward, only the subset views are stored.
+        """
+        assert_validity(image, ImageData)
+        sd = SubsetAcquisitionData()
+        sd.handle = pystir.cSTIR_acquisitionModelFwdSubset(
+            self.handle, image.handle, subset_num, num_subsets)
+        check_status(sd.handle)
+        return sd
+
+    def backward_subset(self, sd):
+        """Returns the backward projection of SubsetAcquisitionData sd."""
+        assert_validity(sd, SubsetAcquisitionData)
+        image = ImageData()
+        image.handle = pystir.cSTIR_acquisitionModelBwdSubset(
+            self.handle, sd.handle)
+        check_status(image.handle)
+        return image
+
     def get_linear_acquisition_model(self):
         """Returns the linear part L = S G P of self.
         """
@@ -1719,6 +1819,16 @@ class AcquisitionModelUsingMatrix(AcquisitionModel):
         """
         parms.set_parameter(self.handle, self.name, 'matrix', matrix.handle)
 
+    def set_matrix_cache_directory(self, directory):
+        """Sets the directory of the persistent ray tracing matrix cache.
+
+        On set_up, the ray tracing matrix is read from (memory-mapped) files
+        in this directory, and computed and stored there if not found.
+        An empty string disables the cache.
+        """
+        parms.set_char_par(
+            self.handle, self.name, 'matrix_cache_directory', directory)
+
 
 class AcquisitionModelUsingRayTracingMatrix(AcquisitionModelUsingMatrix):
     """PET acquisition model with RayTracingMatrix.
@@ -2235,7 +2345,10 @@ class PoissonLogLikelihoodWithLinearModelForMeanAndProjData(
 #           self.handle, self.name, 'max_segment_num_to_process', n)
 
     def set_acquisition_model(self, am):
-        """Sets the acquisition model to be used by this objective function."""
+        """Sets the acquisition model to be used by this objective function.
+
+        Its additive term and normalisation are read by set_up.
+        """
         assert_validity(am, AcquisitionModel)
         parms.set_parameter(
             self.handle, self.name, 'acquisition_model', am.handle)
@@ -2258,6 +2371,74 @@ class PoissonLogLikelihoodWithLinearModelForMeanAndProjData(
             self.handle, self.name, 'acquisition_data', ad.handle)
 
 
+class PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin(
+        PoissonLogLikelihoodWithLinearModelForMean):
+    """Class for the Poisson loglikelihood of listmode data.
+
+    The value and gradients are computed from the recorded events rather
+    than from sinograms, so their cost is proportional to the number of
+    counts, which suits short (or low-count) time frames. The acquisition
+    model must use a matrix, and its additive term and normalisation must
+    have the geometry of the listmode data (usually span 1). See:
+    http://stir.sourceforge.net/documentation/doxy/html/classstir_1_1PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin.html
+    """
+
+    def __init__(self):
+        """init."""
+        self.handle = None
+        self.name = \
+            'PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin'
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+
+    def __del__(self):
+        """del."""
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def set_input_filename(self, name):
+        """Sets the name of the listmode file (e.g. its Interfile header)."""
+        parms.set_char_par(
+            self.handle, self.name, 'input_filename', name)
+
+    def set_acquisition_model(self, am):
+        """Sets the acquisition model, which must use a matrix.
+
+        Its additive term and normalisation are read by set_up.
+        """
+        assert_validity(am, AcquisitionModelUsingMatrix)
+        parms.set_parameter(
+            self.handle, self.name, 'acquisition_model', am.handle)
+
+    def set_max_ring_difference(self, n):
+        """Sets the largest ring difference of the events used (-1: all).
+
+        The acquisition data geometry is that of the listmode data with the
+        segments restricted accordingly.
+        """
+        parms.set_int_par(self.handle, self.name, 'max_ring_difference', n)
+
+    def get_max_ring_difference(self):
+        """Returns the largest ring difference of the events used."""
+        return parms.int_par(self.handle, self.name, 'max_ring_difference')
+
+    def set_cache_max_size(self, n):
+        """Sets the maximal number of events cached in memory (needs STIR 5)."""
+        parms.set_int_par(self.handle, self.name, 'cache_max_size', n)
+
+    def get_cache_max_size(self):
+        """Returns the maximal number of events cached in memory."""
+        return parms.int_par(self.handle, self.name, 'cache_max_size')
+
+    def set_cache_path(self, path):
+        """Sets the directory for the event cache files (needs STIR 5)."""
+        parms.set_char_par(self.handle, self.name, 'cache_path', path)
+
+    def get_cache_path(self):
+        """Returns the directory for the event cache files."""
+        return parms.char_par(self.handle, self.name, 'cache_path')
+
+
 class Reconstructor(object):
     """Base class for a generic PET reconstructor."""
 
@@ -2369,6 +2550,28 @@ class FBP2DReconstructor(object):
         """Performs reconstruction."""
         try_calling(pystir.cSTIR_runFBP2DReconstruction(self.handle))
 
+    def reconstruct_frames(self, frames):
+        """Reconstructs the frames (or gates) of dynamic data.
+
+        frames: list of AcquisitionData of the same geometry.
+        The frames are reconstructed in parallel with the settings of this
+        reconstructor and the image template given to set_up (if called).
+        Returns the list of the reconstructed images.
+        """
+        vec = SIRF.DataHandleVector()
+        for frame in frames:
+            assert_validity(frame, AcquisitionData)
+            vec.push_back(frame.handle)
+        try_calling(pystir.cSTIR_runFBP2DReconstructionOfFrames(
+            self.handle, vec.handle))
+        images = []
+        for f in range(len(frames)):
+            image = ImageData()
+            image.handle = pystir.cSTIR_FBP2DReconstructionFrame(self.handle, f)
+            check_status(image.handle)
+            images.append(image)
+        return images
+
     def get_output(self):
         """Returns the reconstructed image."""
         image = ImageData()
@@ -2855,6 +3058,92 @@ class ScatterEstimator():
         """
         parms.set_char_par(self.handle, 'PETScatterEstimator', 'set_output_prefix', v)
 
+    def set_activity_image_zoom(self, v):
+        """Set the zoom of the activity image reconstructed at each iteration (default 0.2)."""
+        parms.set_float_par(self.handle, 'PETScatterEstimator', 'set_activity_image_zoom', v)
+
+    def get_activity_image_zoom(self):
+        """Get the zoom of the activity image reconstructed at each iteration."""
+        return parms.float_par(self.handle, 'PETScatterEstimator', 'activity_image_zoom')
+
+    def set_OSEM_num_subsets(self, v):
+        """Set the number of subsets of the default OSEM reconstruction."""
+        parms.set_int_par(self.handle, 'PETScatterEstimator', 'set_OSEM_num_subsets', v)
+
+    def set_OSEM_num_subiterations(self, v):
+        """Set the number of subiterations of the default OSEM reconstruction."""
+        parms.set_int_par(self.handle, 'PETScatterEstimator', 'set_OSEM_num_subiterations', v)
+
+
+class SingleScatterEngine():
+    '''
+    Class for simulating the single scatter contribution to PET data.
+
+    Unlike SingleScatterSimulator, this class caches the scatter points,
+    the detectors and the attenuation line integrals between them, so that
+    calls of forward() for several activity images (e.g. the frames of a
+    dynamic study) only recompute the activity part. The cache is renewed
+    when the attenuation image (in cm^-1) is modified or replaced.
+    The contributions of the scatter points to the detector pairs are
+    summed in parallel (if built with OpenMP).
+
+    The acquisition data template should be of low resolution, e.g. obtained
+    with AcquisitionData.rebin(). The result is in the units of the attenuated
+    forward projection of the activity image and does not include
+    normalisation.
+    '''
+    def __init__(self):
+        self.handle = None
+        self.name = 'PETSingleScatterEngine'
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+
+    def set_attenuation_image(self, image):
+        assert_validity(image, ImageData)
+        parms.set_parameter(self.handle, self.name, 'setAttenuationImage', image.handle)
+
+    def set_attenuation_threshold(self, v):
+        """Set the smallest attenuation coefficient (in cm^-1) of a scatter point."""
+        parms.set_float_par(self.handle, self.name, 'attenuation_threshold', v)
+
+    def set_scatter_point_step(self, v):
+        """Set the spacing of the scatter points in voxels of the attenuation image."""
+        parms.set_int_par(self.handle, self.name, 'scatter_point_step', v)
+
+    def set_energy_window(self, low, high):
+        """Override the energy window (in keV) of the acquisition data template."""
+        parms.set_float_par(self.handle, self.name, 'low_energy_threshold', low)
+        parms.set_float_par(self.handle, self.name, 'high_energy_threshold', high)
+
+    def set_energy_resolution(self, v):
+        """Override the energy resolution (relative FWHM) of the scanner."""
+        parms.set_float_par(self.handle, self.name, 'energy_resolution', v)
+
+    def set_up(self, acq_templ):
+        """Set up for the detector pairs of the acquisition data template."""
+        assert_validity(acq_templ, AcquisitionData)
+        try_calling(pystir.cSTIR_setupScatterEngine(self.handle, acq_templ.handle))
+
+    def forward(self, image, out=None):
+        """Return the scatter estimate for the activity image."""
+        assert_validity(image, ImageData)
+        if out is None:
+            ad = AcquisitionData()
+            ad.handle = pystir.cSTIR_scatterEngineFwd(self.handle, image.handle)
+            check_status(ad.handle)
+            return ad
+        assert_validity(out, AcquisitionData)
+        try_calling(pystir.cSTIR_scatterEngineFwdReplace(
+            self.handle, image.handle, out.handle))
+
+    def get_num_scatter_points(self):
+        """Number of scatter points (0 until the first forward())."""
+        return parms.int_par(self.handle, self.name, 'num_scatter_points')
+
 class OSSPSReconstructor(IterativeReconstructor):
     """OSSPS reconstructor class.
 
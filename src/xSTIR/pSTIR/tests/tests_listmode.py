@@ -37,7 +37,48 @@ def test_main(rec=False, verb=False, throw=True):
     if abs(time_at_which_num_prompts_exceeds_threshold-known_time) > 1.e-4:
         raise AssertionError("ListmodeToSinograms::get_time_at_which_num_prompts_exceeds_threshold failed")
 
-    return 0, 1
+    obj_fun = pet.PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin()
+    obj_fun.set_input_filename(raw_data_file)
+    obj_fun.set_acquisition_model(pet.AcquisitionModelUsingRayTracingMatrix())
+    obj_fun.set_cache_max_size(100000)
+    if obj_fun.get_cache_max_size() != 100000:
+        raise AssertionError("listmode objective function cache size not set")
+
+    # the listmode objective function agrees with the one of the sinograms
+    # of the same events in the same (segment 0) geometry
+    max_ring_diff = 0
+    acq_template = pet.AcquisitionData('Siemens_mMR', span=1,
+                                       max_ring_diff=max_ring_diff)
+    lm2sino = pet.ListmodeToSinograms()
+    lm2sino.set_input(raw_data_file)
+    lm2sino.set_output_prefix(os.path.join(os.getcwd(), 'tests_listmode_sinograms'))
+    lm2sino.set_template(acq_template)
+    lm2sino.set_time_interval(0, 1e6)
+    lm2sino.set_up()
+    lm2sino.process()
+    acq_data = lm2sino.get_output()
+
+    image = acq_template.create_uniform_image(1.0, xy=72)
+    sino_obj_fun = pet.make_Poisson_loglikelihood(acq_data)
+    sino_obj_fun.set_acquisition_model(pet.AcquisitionModelUsingRayTracingMatrix())
+    sino_obj_fun.set_up(image)
+    obj_fun.set_max_ring_difference(max_ring_diff)
+    obj_fun.set_up(image)
+
+    sino_value = sino_obj_fun.get_value(image)
+    value = obj_fun.get_value(image)
+    if abs(value - sino_value) > 1e-3*abs(sino_value):
+        raise AssertionError("listmode objective function value %f differs from %f"
+                             % (value, sino_value))
+    sino_gradient = sino_obj_fun.get_gradient(image)
+    diff = obj_fun.get_gradient(image) - sino_gradient
+    if diff.norm() > 1e-3*sino_gradient.norm():
+        raise AssertionError("listmode objective function gradient differs")
+    for f in os.listdir(os.getcwd()):
+        if f.startswith('tests_listmode_sinograms'):
+            os.remove(f)
+
+    return 0, 3
 
 
 if __name__ == "__main__":